@@ -0,0 +1,102 @@
+#ifndef CUTERF_BENCH_H
+#define CUTERF_BENCH_H
+
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace bench {
+
+struct result
+{
+    std::string name;
+    size_t iterations;
+    double seconds;
+    std::vector<std::pair<std::string, double>> counters;
+
+    double ns_per_op() const { return 1e9 * seconds / iterations; }
+
+    result &counter(const std::string &name, double value)
+    {
+        counters.emplace_back(name, value);
+        return *this;
+    }
+};
+
+class context
+{
+public:
+    double min_time; // seconds per measurement
+    std::deque<result> results; // a deque, so that results measured earlier stay where they are
+
+    context() : min_time(0.5) 
+    {}
+
+    // Runs `body` repeatedly for at least `min_time` seconds and records its timing.
+    result &measure(const std::string &name, const std::function<void()> &body)
+    {
+        typedef std::chrono::steady_clock clock;
+        body(); // warm-up
+        size_t iterations = 0;
+        clock::time_point start = clock::now(), now;
+        do {
+            body();
+            iterations++;
+            now = clock::now();
+        } while (std::chrono::duration<double>(now - start).count() < min_time);
+
+        result r;
+        r.name = name;
+        r.iterations = iterations;
+        r.seconds = std::chrono::duration<double>(now - start).count();
+        results.push_back(r);
+        return results.back();
+    }
+};
+
+typedef void (*case_fn)(context &);
+
+struct registered_case
+{
+    const char *name;
+    case_fn fn;
+};
+
+inline std::vector<registered_case> &registry()
+{
+    static std::vector<registered_case> cases;
+    return cases;
+}
+
+struct registrar
+{
+    registrar(const char *name, case_fn fn) 
+    {
+        registry().push_back({ name, fn });
+    }
+};
+
+// Keeps the optimizer from discarding a computed value.
+template<class T>
+inline void do_not_optimize(const T &value)
+{
+#if defined(__GNUC__)
+    asm volatile("" : : "g"(&value) : "memory");
+#else
+    static volatile const void *sink;
+    sink = &value;
+#endif
+}
+
+}
+
+#define BENCH_CASE(name) \
+    static void name(bench::context &); \
+    static bench::registrar name##_registrar(#name, name); \
+    static void name(bench::context &ctx)
+
+#endif // CUTERF_BENCH_H
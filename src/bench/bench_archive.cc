@@ -0,0 +1,93 @@
+#include <cmath>
+#include <filesystem>
+#include <random>
+#include <stdexcept>
+#include <cuterf.h>
+#include "bench.h"
+
+using namespace cuterf;
+
+static std::vector<nanovna::point> sweep_points(unsigned count, unsigned seed)
+{
+    std::vector<nanovna::point> data(count);
+    for (unsigned idx = 0; idx < count; idx++) {
+        float phase = 0.01f * idx + seed;
+        data[idx].freq = 50000 + idx * 2249875;
+        data[idx].s11 = std::complex<float>(0.9f * std::cos(phase), -0.9f * std::sin(phase));
+        data[idx].s21 = std::complex<float>(0.1f * std::sin(phase), 0.2f * std::cos(phase));
+    }
+    return data;
+}
+
+static std::wstring temporary_path(const char *name)
+{
+    return (std::filesystem::temp_directory_path() / name).wstring();
+}
+
+BENCH_CASE(archive_sweeps)
+{
+    const unsigned points = 401, sweeps = 4000;
+    const std::vector<std::string> header = { "Board: NanoVNA-H 4", "Firmware: 1.2.3" };
+    const auto timestamp = std::chrono::system_clock::now();
+    std::wstring path = temporary_path("cuterf_bench.cra");
+    std::filesystem::remove(path);
+
+    auto data = sweep_points(points, 0);
+    const unsigned batch = 100;
+    auto &append = ctx.measure("archive/append/" + std::to_string(batch) + "x" + std::to_string(points), [&] {
+        std::filesystem::remove(path);
+        archive::writer writer;
+        if (!writer.open(path))
+            throw std::runtime_error("cannot create archive");
+        for (unsigned idx = 0; idx < batch; idx++)
+            writer.append(timestamp, header, 2, data);
+        writer.close();
+    });
+    append.counter("MB/s", (batch * points * 20.0) / append.ns_per_op() * 1e3);
+
+    std::filesystem::remove(path);
+    {
+        archive::writer writer;
+        if (!writer.open(path))
+            throw std::runtime_error("cannot create archive");
+        for (unsigned seed = 0; seed < sweeps; seed++)
+            writer.append(timestamp, header, 2, sweep_points(points, seed));
+        writer.close();
+    }
+
+    archive::reader reader;
+    auto &open = ctx.measure("archive/open/" + std::to_string(sweeps) + "x" + std::to_string(points), [&] {
+        if (!reader.open(path))
+            throw std::runtime_error("cannot open archive");
+    });
+    open.counter("sweeps", (double)reader.size());
+
+    if (reader.size() != sweeps || reader.sweep(123).to_points()[7].s11 != sweep_points(points, 123)[7].s11)
+        throw std::runtime_error("archive returned wrong data");
+
+    std::mt19937 random(1);
+    auto &seek = ctx.measure("archive/random_sweep/" + std::to_string(points), [&] {
+        archive::sweep_view sweep = reader.sweep(random() % sweeps);
+        bench::do_not_optimize(sweep.s11[random() % points]);
+    });
+    seek.counter("sweeps/s", 1e9 / seek.ns_per_op());
+
+    // the text that archiving replaces: formatting a sweep and parsing it back
+    std::string text;
+    touchstone::string_sink output(text);
+    touchstone::writer writer(output, 2);
+    writer.header(header);
+    writer.points(data);
+    writer.flush();
+    auto &parse = ctx.measure("archive/touchstone_parse/" + std::to_string(points), [&] {
+        bench::do_not_optimize(touchstone::parse(text));
+    });
+    parse.counter("MB/s", text.size() / parse.ns_per_op() * 1e3);
+    auto &load = ctx.measure("archive/load_sweep/" + std::to_string(points), [&] {
+        bench::do_not_optimize(reader.sweep(random() % sweeps).to_points());
+    });
+    load.counter("sweeps/s", 1e9 / load.ns_per_op());
+
+    reader.close();
+    std::filesystem::remove(path);
+}
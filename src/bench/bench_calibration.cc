@@ -0,0 +1,184 @@
+#include <cmath>
+#include <filesystem>
+#include <stdexcept>
+#include <cuterf.h>
+#include "bench.h"
+
+using namespace cuterf;
+
+static const double PI = 3.14159265358979323846;
+
+typedef std::complex<double> complex;
+
+// Forward error terms of a fixture with a few centimetres of cable on each port.
+struct fixture
+{
+    complex e00, e11, e10e01, e30, e22, e10e32;
+
+    explicit fixture(double freq)
+    {
+        double omega = 2 * PI * freq;
+        e00 = std::polar(0.05, -omega * 0.3e-9);
+        e11 = std::polar(0.1, -omega * 0.5e-9);
+        e10e01 = std::polar(0.9, -omega * 2e-9);
+        e30 = std::polar(1e-3, -omega * 1e-9);
+        e22 = std::polar(0.08, -omega * 0.4e-9);
+        e10e32 = std::polar(0.8, -omega * 1.5e-9);
+    }
+
+    // What the device reads for a two-port with S-parameters `s` (S11, S21, S12, S22).
+    nanovna::point measure(unsigned freq, const complex s[4]) const
+    {
+        complex input = s[0] + s[1] * s[2] * e22 / (1.0 - s[3] * e22);
+        nanovna::point reading;
+        reading.freq = freq;
+        reading.s11 = std::complex<float>(e00 + e10e01 * input / (1.0 - e11 * input));
+        reading.s21 = std::complex<float>(e30 + e10e32 * s[1] / ((1.0 - e11 * s[0]) * (1.0 - e22 * s[3]) - e11 * e22 * s[1] * s[2]));
+        return reading;
+    }
+};
+
+static std::vector<unsigned> sweep_grid(unsigned points)
+{
+    std::vector<unsigned> grid(points);
+    for (unsigned idx = 0; idx < points; idx++)
+        grid[idx] = 50000 + (unsigned)((900000000ull - 50000) * idx / (points - 1));
+    return grid;
+}
+
+// A matched 6 dB attenuator behind a short line, as the device under test.
+static void attenuator(double freq, complex s[4])
+{
+    s[0] = std::polar(0.2, -2 * PI * freq * 0.2e-9);
+    s[1] = s[2] = std::polar(0.5, -2 * PI * freq * 0.7e-9);
+    s[3] = 0;
+}
+
+static calibration::standards measure_standards(const std::vector<unsigned> &grid)
+{
+    calibration::standards measured;
+    for (unsigned freq : grid) {
+        fixture errors(freq);
+        const complex open[4] = { 1.0, 0.0, 0.0, 0.0 }, short_circuit[4] = { -1.0, 0.0, 0.0, 0.0 };
+        const complex load[4] = { 0.0, 0.0, 0.0, 0.0 }, thru[4] = { 0.0, 1.0, 1.0, 0.0 };
+        measured.open.push_back(errors.measure(freq, open));
+        measured.short_circuit.push_back(errors.measure(freq, short_circuit));
+        measured.load.push_back(errors.measure(freq, load));
+        measured.thru.push_back(errors.measure(freq, thru));
+        measured.isolation.push_back(errors.measure(freq, load));
+    }
+    return measured;
+}
+
+static std::vector<nanovna::point> measure_attenuator(const std::vector<unsigned> &grid)
+{
+    std::vector<nanovna::point> sweep;
+    for (unsigned freq : grid) {
+        complex s[4];
+        attenuator(freq, s);
+        sweep.push_back(fixture(freq).measure(freq, s));
+    }
+    return sweep;
+}
+
+// Largest difference from the attenuator, whose input reflection includes the load match.
+static double correction_error(const std::vector<nanovna::point> &corrected)
+{
+    double error = 0;
+    for (auto &point : corrected) {
+        complex s[4];
+        attenuator(point.freq, s);
+        complex input = s[0] + s[1] * s[2] * fixture(point.freq).e22;
+        error = std::max(error, std::abs(complex(point.s11) - input));
+        error = std::max(error, std::abs(complex(point.s21) - s[1]));
+    }
+    return error;
+}
+
+// Correction one point at a time with std::complex, as a reference.
+static void correct_directly(const std::vector<calibration::terms> &terms, std::vector<nanovna::point> &sweep)
+{
+    for (size_t idx = 0; idx < sweep.size(); idx++) {
+        const calibration::terms &at = terms[idx];
+        std::complex<float> reflected = sweep[idx].s11 - at.e00;
+        std::complex<float> input = reflected / (at.e10e01 + at.e11 * reflected);
+        sweep[idx].s11 = input;
+        sweep[idx].s21 = (sweep[idx].s21 - at.e30) / at.e10e32 * (1.0f - at.e11 * input);
+    }
+}
+
+BENCH_CASE(calibration_correct)
+{
+    // a continuous capture delivers about 10 sweeps/s at 101 points and 2 sweeps/s at 401;
+    // 20001 points is a segmented sweep
+    for (unsigned points : { 101, 401, 1601, 20001 }) {
+        std::string suffix = "/" + std::to_string(points);
+        std::vector<unsigned> grid = sweep_grid(points);
+        calibration::standards standards = measure_standards(grid);
+        calibration::model model;
+        auto &solving = ctx.measure("calibration/solve" + suffix, [&] {
+            model.solve(standards);
+        });
+        solving.counter("points/s", points * 1e9 / solving.ns_per_op());
+
+        std::vector<nanovna::point> measured = measure_attenuator(grid), sweep = measured;
+        model.apply(sweep);
+        double error = correction_error(sweep);
+        if (error > 1e-4)
+            throw std::runtime_error("calibration does not recover the device under test");
+
+        auto &direct = ctx.measure("calibration/direct" + suffix, [&] {
+            sweep = measured;
+            correct_directly(model.error_terms(), sweep);
+        });
+        direct.counter("points/s", points * 1e9 / direct.ns_per_op());
+        auto &applied = ctx.measure("calibration/apply" + suffix, [&] {
+            sweep = measured;
+            model.apply(sweep);
+        });
+        applied.counter("points/s", points * 1e9 / applied.ns_per_op()).counter("max_error", error)
+            .counter("speedup", direct.ns_per_op() / applied.ns_per_op());
+    }
+
+    // terms solved at 401 points and interpolated to sweeps of other spans and densities
+    calibration::model model;
+    model.solve(measure_standards(sweep_grid(401)));
+    std::vector<unsigned> fine = sweep_grid(1601), narrow(1601);
+    for (unsigned idx = 0; idx < narrow.size(); idx++)
+        narrow[idx] = 100000000 + idx * 62500;
+    std::vector<nanovna::point> sweeps[2] = { measure_attenuator(fine), measure_attenuator(narrow) }, sweep;
+    double error = 0;
+    for (auto &measured : sweeps) {
+        sweep = measured;
+        model.apply(sweep);
+        error = std::max(error, correction_error(sweep));
+    }
+    if (error > 1e-2)
+        throw std::runtime_error("interpolated calibration does not recover the device under test");
+    size_t flip = 0;
+    auto &interpolated = ctx.measure("calibration/interpolate/401_to_1601", [&] {
+        sweep = sweeps[flip++ % 2];
+        model.apply(sweep);
+    });
+    interpolated.counter("points/s", 1601 * 1e9 / interpolated.ns_per_op()).counter("max_error", error);
+
+    std::wstring path = (std::filesystem::temp_directory_path() / "cuterf_bench.cal").wstring();
+    calibration::model loaded;
+    if (!model.save(path) || !loaded.load(path))
+        throw std::runtime_error("cannot write calibration");
+    std::filesystem::remove(path);
+    sweep = sweeps[0];
+    loaded.apply(sweep);
+    if (correction_error(sweep) != correction_error([&] { auto again = sweeps[0]; model.apply(again); return again; }()))
+        throw std::runtime_error("loaded calibration differs from the saved one");
+
+    std::vector<nanovna::point> outside = measure_attenuator(sweep_grid(11));
+    outside.back().freq = 1000000000;
+    try {
+        model.apply(outside);
+        throw std::runtime_error("sweep beyond the calibrated span was corrected");
+    } catch (const std::runtime_error &e) {
+        if (std::string(e.what()) != "sweep extends beyond the calibrated span!")
+            throw;
+    }
+}
@@ -0,0 +1,106 @@
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <cuterf.h>
+#include "bench.h"
+
+using namespace cuterf;
+
+// Writes `count` Touchstone files as nanovna_data does, one per day from 2024-01-01 on, with
+// the start frequency stepping through ten bands.
+static void write_sweep_files(const std::filesystem::path &directory, unsigned count)
+{
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directories(directory);
+    for (unsigned idx = 0; idx < count; idx++) {
+        std::vector<nanovna::point> points(101);
+        for (unsigned pt = 0; pt < points.size(); pt++) {
+            points[pt].freq = 1000000 * (1 + idx % 10) * (1 + pt);
+            points[pt].s11 = std::complex<float>(0.5f, -0.5f);
+            points[pt].s21 = std::complex<float>(0.1f, 0.2f);
+        }
+        char timestamp[64];
+        snprintf(timestamp, sizeof(timestamp), "Timestamp: 2024-%02u-%02u 12:00:00", 1 + idx / 28 % 12, 1 + idx % 28);
+        std::string text;
+        touchstone::string_sink sink(text);
+        touchstone::writer writer(sink, 2);
+        writer.header({ "Board: NanoVNA-H 4", "Firmware: 1.2.3", timestamp });
+        writer.points(points);
+        writer.flush();
+        std::ofstream(directory / (std::to_string(idx) + ".s2p"), std::ios::binary) << text;
+    }
+}
+
+BENCH_CASE(catalog_index)
+{
+    const unsigned file_count = 2000;
+    std::filesystem::path directory = std::filesystem::temp_directory_path() / "cuterf_bench_catalog";
+    write_sweep_files(directory, file_count);
+    std::vector<std::wstring> roots = { directory.wstring() };
+    std::wstring catalog_path = (std::filesystem::temp_directory_path() / "cuterf_bench.cat").wstring();
+
+    auto &full = ctx.measure("catalog/index/" + std::to_string(file_count), [&] {
+        catalog::database database;
+        if (database.update(roots).indexed != file_count)
+            throw std::runtime_error("cannot index files");
+    });
+    full.counter("files/s", file_count * 1e9 / full.ns_per_op());
+
+    {
+        catalog::database database;
+        database.update(roots);
+        if (!database.save(catalog_path))
+            throw std::runtime_error("cannot write catalog");
+    }
+    auto &incremental = ctx.measure("catalog/reindex_unchanged/" + std::to_string(file_count), [&] {
+        catalog::database database;
+        database.load(catalog_path);
+        if (database.update(roots).indexed != 0)
+            throw std::runtime_error("unchanged files were indexed");
+    });
+    incremental.counter("files/s", file_count * 1e9 / incremental.ns_per_op());
+
+    // "every sweep of the 10 MHz band in March", first by reading every file as before
+    catalog::database database;
+    database.load(catalog_path);
+    catalog::query criteria;
+    struct tm from = {}, to = {};
+    from.tm_year = to.tm_year = 124;
+    from.tm_mon = to.tm_mon = 2;
+    from.tm_mday = 1;
+    to.tm_mday = 31;
+    from.tm_isdst = to.tm_isdst = -1;
+    criteria.from = std::chrono::system_clock::from_time_t(mktime(&from));
+    criteria.to = std::chrono::system_clock::from_time_t(mktime(&to));
+    criteria.min_freq = criteria.max_freq = 10000000;
+    size_t expected = database.find(criteria).size();
+
+    auto &scan = ctx.measure("catalog/query/reopen_files", [&] {
+        size_t found = 0;
+        for (auto &file : std::filesystem::directory_iterator(directory)) {
+            std::ifstream stream(file.path(), std::ios::binary);
+            std::stringstream text;
+            text << stream.rdbuf();
+            touchstone::document parsed = touchstone::parse(text.str());
+            std::string timestamp;
+            for (auto &line : parsed.comments)
+                if (line.compare(0, 11, "Timestamp: ") == 0)
+                    timestamp = line.substr(11);
+            if (timestamp.compare(0, 8, "2024-03-") == 0 && parsed.points.front().freq <= 10000000 &&
+                    parsed.points.back().freq >= 10000000)
+                found++;
+        }
+        if (found != expected)
+            throw std::runtime_error("catalog query differs from a scan");
+    });
+    scan.counter("matches", (double)expected);
+    auto &query = ctx.measure("catalog/query/index", [&] {
+        bench::do_not_optimize(database.find(criteria));
+    });
+    query.counter("speedup", scan.ns_per_op() / query.ns_per_op());
+
+    std::filesystem::remove(catalog_path);
+    std::filesystem::remove_all(directory);
+}
@@ -0,0 +1,843 @@
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <cuterf.h>
+#include "bench.h"
+#include "pixmap.h"
+#include "pty_device.h"
+#include "serial.h"
+
+using namespace cuterf;
+
+BENCH_CASE(nanovna_open)
+{
+    pty_device stand_in([](const std::string &command) { return fake_nanovna(command, 101); }, USB_FULL_SPEED);
+    auto &result = ctx.measure("nanovna_open/usb_fs", [&] {
+        nanovna::device device;
+        if (!device.open(stand_in.path()))
+            throw std::runtime_error("cannot open stand-in device");
+    });
+    result.counter("round_trips/op", (double)stand_in.round_trips() / (result.iterations + 1));
+}
+
+// Opening a device found through discovery, identified every time, against one that the
+// registry remembers, which is not asked again; `#sync#` then waits for the first command,
+// so opening followed by a command is measured too. CUTERF_PORTS gives the stand-in a USB
+// serial number, which is what identities are remembered by.
+BENCH_CASE(nanovna_open_registry)
+{
+    pty_device stand_in([](const std::string &command) { return fake_nanovna(command, 101); }, USB_FULL_SPEED);
+    std::wstring wide_path = stand_in.path();
+    std::string path(wide_path.begin(), wide_path.end());
+    const struct {
+        const char *name;
+        std::string ports;
+    } cases[] = {
+        { "identified", path },
+        { "remembered", path + "=BENCH0001" },
+    };
+    double open_ns = 0, command_ns = 0, identify_ns = 0;
+    for (auto &variant : cases) {
+        setenv("CUTERF_PORTS", variant.ports.c_str(), 1);
+        auto open = [&](nanovna::device &device) {
+            if (!device.open())
+                throw std::runtime_error("cannot open stand-in device");
+        };
+        std::string prefix = std::string("nanovna_open_registry/usb_fs/") + variant.name;
+        uint64_t round_trips = stand_in.round_trips();
+        auto &opened = ctx.measure(prefix + "/open", [&] {
+            nanovna::device device;
+            open(device);
+        });
+        opened.counter("round_trips/op", (double)(stand_in.round_trips() - round_trips) / (opened.iterations + 1));
+        auto &commanded = ctx.measure(prefix + "/open_edelay", [&] {
+            nanovna::device device;
+            open(device);
+            bench::do_not_optimize(device.edelay());
+        });
+        auto &identified = ctx.measure(prefix + "/identify_device", [&] {
+            device_info info = identify_device(wide_path);
+            if (!info.is_nanovna())
+                throw std::runtime_error("stand-in device was not identified");
+        });
+        if (open_ns != 0) {
+            opened.counter("speedup", open_ns / opened.ns_per_op());
+            commanded.counter("speedup", command_ns / commanded.ns_per_op());
+            identified.counter("speedup", identify_ns / identified.ns_per_op());
+        }
+        open_ns = opened.ns_per_op();
+        command_ns = commanded.ns_per_op();
+        identify_ns = identified.ns_per_op();
+    }
+    unsetenv("CUTERF_PORTS");
+}
+
+BENCH_CASE(nanovna_run)
+{
+    const struct {
+        const char *name;
+        pty_device::link timing;
+    } links[] = {
+        { "pty", { std::chrono::microseconds(0), 0 } },
+        { "usb_fs", USB_FULL_SPEED },
+    };
+    for (auto &link : links) {
+        pty_device stand_in([](const std::string &command) { return fake_nanovna(command, 101); }, link.timing);
+        nanovna::device device;
+        if (!device.open(stand_in.path()))
+            throw std::runtime_error("cannot open stand-in device");
+        auto &result = ctx.measure(std::string("nanovna_run/") + link.name + "/edelay", [&] {
+            bench::do_not_optimize(device.edelay());
+        });
+        result.counter("us/round_trip", result.ns_per_op() / 1e3);
+    }
+}
+
+// The cost of enable_stats on the shortest command, where it matters most, and a check that
+// what it collects adds up.
+BENCH_CASE(nanovna_stats)
+{
+    pty_device stand_in([](const std::string &command) { return fake_nanovna(command, 101); });
+    nanovna::device device;
+    if (!device.open(stand_in.path()))
+        throw std::runtime_error("cannot open stand-in device");
+    double disabled_ns = 0;
+    for (bool enable : { false, true }) {
+        device.enable_stats(enable);
+        auto &result = ctx.measure(std::string("nanovna_stats/pty/edelay/") + (enable ? "enabled" : "disabled"), [&] {
+            bench::do_not_optimize(device.edelay());
+        });
+        if (enable)
+            result.counter("overhead_ns", result.ns_per_op() - disabled_ns);
+        else
+            disabled_ns = result.ns_per_op();
+    }
+
+    device.capture_data(2, nanovna::transfer::text);
+    device.capture_data(2, nanovna::transfer::binary);
+    std::vector<command_stats> stats = device.stats();
+    auto find = [&](const char *command) -> const command_stats & {
+        for (auto &entry : stats)
+            if (entry.command == command)
+                return entry;
+        throw std::runtime_error(std::string("no statistics for ") + command);
+    };
+    const command_stats &edelay = find("edelay");
+    if (edelay.bytes_written != edelay.calls * 8 || edelay.echo.count() != edelay.calls ||
+            edelay.parse.count() != edelay.calls || edelay.echo.max() > edelay.prompt.max())
+        throw std::runtime_error("edelay statistics do not add up");
+    const command_stats &data = find("data");
+    // both outputs of the batch may arrive in a single read
+    if (data.calls != 2 || data.bytes_read < 2 * 101 * 20 || data.syscalls == 0)
+        throw std::runtime_error("data statistics do not add up");
+    const command_stats &scan = find("scan_bin");
+    if (scan.calls != 1 || scan.bytes_read < 101 * 20 || scan.parse.count() != 1)
+        throw std::runtime_error("scan_bin statistics do not add up");
+
+    histogram latency;
+    uint64_t value = 1;
+    auto &record = ctx.measure("nanovna_stats/histogram_record", [&] {
+        latency.record(value);
+        value = value * 6364136223846793005ULL + 1442695040888963407ULL;
+        value >>= 40;
+    });
+    record.counter("p99_error", std::abs((double)latency.percentile(99) / (0.99 * (1 << 24)) - 1));
+}
+
+// serial_port::read_until on a real pseudo-terminal, as opposed to the scripted stream of
+// serial_read_until, so that the system calls of the port are part of the measurement.
+BENCH_CASE(serial_read_until_pty)
+{
+    for (unsigned points : { 101, 401, 1601 }) {
+        pty_device stand_in([=](const std::string &command) { return fake_nanovna(command, points); });
+        serial_port port;
+        if (!port.open(stand_in.path()))
+            throw std::runtime_error("cannot open stand-in device");
+        std::string response;
+        auto &result = ctx.measure("serial_read_until_pty/data_" + std::to_string(points), [&] {
+            port.write("data 0\r\n");
+            port.read_until("data 0\r\n");
+            port.read_until("ch> ", &response);
+        });
+        result.counter("MB/s", response.size() / result.ns_per_op() * 1e3);
+    }
+}
+
+// Checks a capture against the values the stand-in reports: exactly for binary transfers,
+// and to the precision of the text format otherwise.
+static void verify_capture(const std::vector<nanovna::point> &data, unsigned points, nanovna::transfer mode)
+{
+    auto reference = fake_nanovna("scan_bin 50000 900000000 " + std::to_string(points) + " 7", points);
+    if (data.size() != points)
+        throw std::runtime_error("capture returned wrong number of points");
+    for (unsigned idx = 0; idx < points; idx++) {
+        uint32_t freq;
+        memcpy(&freq, &reference[4 + 20 * idx], sizeof(freq));
+        if (data[idx].freq != freq)
+            throw std::runtime_error("capture returned wrong frequency");
+        for (unsigned port = 0; port < 2; port++) {
+            std::complex<float> actual = port == 0 ? data[idx].s11 : data[idx].s21;
+            std::complex<float> expected(fake_nanovna_value(port, idx, false), fake_nanovna_value(port, idx, true));
+            float tolerance = mode == nanovna::transfer::binary ? 0.0f : 1e-8f;
+            if (std::abs(actual.real() - expected.real()) > tolerance || std::abs(actual.imag() - expected.imag()) > tolerance)
+                throw std::runtime_error("capture returned wrong S-parameter");
+        }
+    }
+}
+
+BENCH_CASE(nanovna_capture_data)
+{
+    const unsigned point_counts[] = { 101, 401 };
+    const struct {
+        const char *name;
+        nanovna::transfer mode;
+    } modes[] = {
+        { "text", nanovna::transfer::text },
+        { "binary", nanovna::transfer::binary },
+    };
+    const struct {
+        const char *name;
+        pty_device::link timing;
+    } links[] = {
+        { "pty", { std::chrono::microseconds(0), 0 } },
+        { "usb_fs", USB_FULL_SPEED },
+    };
+    for (auto &link : links) {
+        for (unsigned points : point_counts) {
+            pty_device stand_in([=](const std::string &command) { return fake_nanovna(command, points); }, link.timing);
+            nanovna::device device;
+            if (!device.open(stand_in.path()))
+                throw std::runtime_error("cannot open stand-in device");
+            for (auto &mode : modes) {
+                verify_capture(device.capture_data(2, mode.mode), points, mode.mode);
+                size_t commands = stand_in.commands(), round_trips = stand_in.round_trips();
+                auto &result = ctx.measure(std::string("nanovna_capture_data/") + link.name + "/" + mode.name + "/" + std::to_string(points), [&] {
+                    auto data = device.capture_data(2, mode.mode);
+                    bench::do_not_optimize(data);
+                });
+                result.counter("commands/op", (double)(stand_in.commands() - commands) / (result.iterations + 1));
+                result.counter("round_trips/op", (double)(stand_in.round_trips() - round_trips) / (result.iterations + 1));
+            }
+        }
+    }
+}
+
+// What nanovna_screenshot does: header, sweep data, and optionally the screen.
+BENCH_CASE(nanovna_capture_touchstone)
+{
+    const struct {
+        const char *name;
+        nanovna::transfer mode;
+    } modes[] = {
+        { "text", nanovna::transfer::text },
+        { "binary", nanovna::transfer::binary },
+    };
+    pty_device stand_in([](const std::string &command) { return fake_nanovna(command, 101); }, USB_FULL_SPEED);
+    nanovna::device device;
+    if (!device.open(stand_in.path()))
+        throw std::runtime_error("cannot open stand-in device");
+    for (auto &mode : modes) {
+        for (bool with_screen : { false, true }) {
+            size_t round_trips = stand_in.round_trips();
+            std::string name = std::string("nanovna_capture_touchstone/usb_fs/") + mode.name + (with_screen ? "/screen" : "");
+            auto &result = ctx.measure(name, [&] {
+                if (with_screen) {
+                    screenshot screen;
+                    bench::do_not_optimize(device.capture_touchstone(2, mode.mode, screen));
+                    bench::do_not_optimize(screen);
+                } else {
+                    bench::do_not_optimize(device.capture_touchstone(2, mode.mode));
+                }
+            });
+            result.counter("round_trips/op", (double)(stand_in.round_trips() - round_trips) / (result.iterations + 1));
+        }
+    }
+}
+
+// A 20001-point sweep in segments of 101 and 401 points. The scanned points are the same, so
+// the difference in time is the cost of the extra segments.
+BENCH_CASE(nanovna_capture_segmented)
+{
+    const unsigned start = 50000, stop = 900000000, points = 20001;
+    const struct {
+        const char *name;
+        pty_device::link timing;
+    } links[] = {
+        { "pty", { std::chrono::microseconds(0), 0 } },
+        { "usb_fs", USB_FULL_SPEED },
+    };
+    for (auto &link : links) {
+        pty_device stand_in([](const std::string &command) { return fake_nanovna(command, 101); }, link.timing);
+        nanovna::device device;
+        if (!device.open(stand_in.path()))
+            throw std::runtime_error("cannot open stand-in device");
+
+        double ns_per_op[2];
+        size_t segment_counts[2];
+        const unsigned segment_sizes[2] = { 101, 401 };
+        for (unsigned size_idx = 0; size_idx < 2; size_idx++) {
+            nanovna::segment_stats stats;
+            auto data = device.capture_segmented(start, stop, points, 2, segment_sizes[size_idx], 0, &stats);
+            if (data.size() != points || data.front().freq != start || data.back().freq != stop)
+                throw std::runtime_error("segmented sweep has the wrong span");
+            for (size_t idx = 1; idx < data.size(); idx++)
+                if (data[idx].freq <= data[idx - 1].freq)
+                    throw std::runtime_error("segmented sweep is not monotonic");
+
+            size_t round_trips = stand_in.round_trips();
+            auto &result = ctx.measure(std::string("nanovna_capture_segmented/") + link.name + "/" +
+                    std::to_string(points) + "x" + std::to_string(segment_sizes[size_idx]), [&] {
+                bench::do_not_optimize(device.capture_segmented(start, stop, points, 2, segment_sizes[size_idx], 0, &stats));
+            });
+            result.counter("points/s", points * 1e9 / result.ns_per_op());
+            result.counter("segments", (double)stats.segments);
+            result.counter("round_trips/op", (double)(stand_in.round_trips() - round_trips) / (result.iterations + 1));
+            ns_per_op[size_idx] = result.ns_per_op();
+            segment_counts[size_idx] = stats.segments;
+        }
+        ctx.results.back().counter("us/segment",
+            (ns_per_op[0] - ns_per_op[1]) / (segment_counts[0] - segment_counts[1]) / 1e3);
+    }
+
+    // a segment cut short mid-sweep, with the next `scan_bin` already written, fails the
+    // capture but leaves the device resynchronized and on the span it had
+    std::mutex state;
+    std::string last_span;
+    unsigned scans = 0;
+    pty_device stand_in([&](const std::string &command) {
+        std::string response = fake_nanovna(command, 101);
+        std::lock_guard<std::mutex> lock(state);
+        if (command.compare(0, 6, "sweep ") == 0)
+            last_span = command;
+        if (command.compare(0, 9, "scan_bin ") == 0 && ++scans == 2)
+            response.resize(response.size() / 2);
+        return response;
+    });
+    nanovna::device device;
+    if (!device.open(stand_in.path()))
+        throw std::runtime_error("cannot open stand-in device");
+    device.set_timeout(100);
+    try {
+        device.capture_segmented(start, stop, points, 2, 401);
+        throw std::logic_error("segmented sweep with a short segment succeeded");
+    } catch (const std::runtime_error &) {
+    }
+    {
+        std::lock_guard<std::mutex> lock(state);
+        if (last_span != "sweep 50000 900000000 101")
+            throw std::runtime_error("failed segmented sweep did not restore the span");
+    }
+    verify_capture(device.capture_data(2), 101, nanovna::transfer::binary);
+}
+
+BENCH_CASE(tinysa_capture_screenshot)
+{
+    pty_device stand_in([](const std::string &command) { return fake_tinysa(command); });
+    tinysa::device device;
+    if (!device.open(stand_in.path()))
+        throw std::runtime_error("cannot open stand-in device");
+    ctx.measure("tinysa_capture_screenshot", [&] {
+        size_t width, height;
+        auto data = device.capture_screenshot(width, height);
+        bench::do_not_optimize(data);
+    });
+}
+
+// Checks a trace against the levels the stand-in reports: exactly for binary transfers, and to
+// the precision of `%e` otherwise.
+static void verify_trace(const tinysa::trace &data, unsigned points, tinysa::transfer mode)
+{
+    if (data.freq.size() != points || data.level.size() != points)
+        throw std::runtime_error("trace has wrong number of points");
+    if (data.freq.front() != 100000 || data.freq.back() != 5300000000)
+        throw std::runtime_error("trace has wrong span");
+    for (unsigned idx = 0; idx < points; idx++) {
+        float expected = fake_tinysa_level(idx) / 32.0f - 174;
+        float tolerance = mode == tinysa::transfer::binary ? 0.0f : 1e-3f;
+        if (std::abs(data.level[idx] - expected) > tolerance)
+            throw std::runtime_error("trace has wrong level");
+    }
+}
+
+// 290 and 450 points are what TinySA and TinySA Ultra display; 10000 is a custom scan.
+BENCH_CASE(tinysa_capture_trace)
+{
+    const struct {
+        const char *name;
+        tinysa::transfer mode;
+    } modes[] = {
+        { "text", tinysa::transfer::text },
+        { "binary", tinysa::transfer::binary },
+    };
+    const struct {
+        const char *name;
+        pty_device::link timing;
+    } links[] = {
+        { "pty", { std::chrono::microseconds(0), 0 } },
+        { "usb_fs", USB_FULL_SPEED },
+    };
+    for (auto &link : links) {
+        for (unsigned points : { 290, 450, 10000 }) {
+            pty_device stand_in([=](const std::string &command) { return fake_tinysa(command, points); }, link.timing);
+            tinysa::device device;
+            if (!device.open(stand_in.path()))
+                throw std::runtime_error("cannot open stand-in device");
+            for (auto &mode : modes) {
+                verify_trace(device.capture_trace(mode.mode), points, mode.mode);
+                auto &result = ctx.measure(std::string("tinysa_capture_trace/") + link.name + "/" + mode.name + "/" + std::to_string(points), [&] {
+                    auto data = device.capture_trace(mode.mode);
+                    bench::do_not_optimize(data);
+                });
+                result.counter("points/s", points * 1e9 / result.ns_per_op());
+            }
+        }
+    }
+
+    // firmware without `scanraw` is read as text instead
+    pty_device stand_in([](const std::string &command) { return fake_tinysa(command, 450, false); });
+    tinysa::device device;
+    if (!device.open(stand_in.path()))
+        throw std::runtime_error("cannot open stand-in device");
+    verify_trace(device.capture_trace(tinysa::transfer::binary), 450, tinysa::transfer::text);
+    verify_trace(device.capture_trace(tinysa::transfer::binary), 450, tinysa::transfer::text);
+}
+
+// Sustained ingest: scanning traces from a TinySA Ultra into a waterfall file.
+BENCH_CASE(tinysa_waterfall_ingest)
+{
+    const unsigned points = 450;
+    std::wstring path = (std::filesystem::temp_directory_path() / "cuterf_bench_ingest.wf").wstring();
+    std::filesystem::remove(path);
+
+    pty_device stand_in([](const std::string &command) { return fake_tinysa(command, points); }, USB_FULL_SPEED);
+    tinysa::device device;
+    if (!device.open(stand_in.path()))
+        throw std::runtime_error("cannot open stand-in device");
+    tinysa::trace data = device.capture_trace();
+    waterfall::layout shape;
+    shape.points = points;
+    shape.start = data.freq.front();
+    shape.stop = data.freq.back();
+    waterfall::recorder recorder;
+    if (!recorder.open(path, shape))
+        throw std::runtime_error("cannot create waterfall");
+
+    auto &result = ctx.measure("tinysa_waterfall_ingest/usb_fs/" + std::to_string(points), [&] {
+        recorder.append(std::chrono::system_clock::now(), device.capture_trace());
+    });
+    result.counter("traces/s", 1e9 / result.ns_per_op());
+
+    recorder.close();
+    std::filesystem::remove(path);
+}
+
+BENCH_CASE(nanovna_stream)
+{
+    const unsigned points = 401;
+    pty_device stand_in([=](const std::string &command) { return fake_nanovna(command, points); }, USB_FULL_SPEED);
+    nanovna::device device;
+    if (!device.open(stand_in.path()))
+        throw std::runtime_error("cannot open stand-in device");
+
+    device.start_streaming(2, 16);
+    nanovna::sweep frame;
+    auto &result = ctx.measure("nanovna_stream/usb_fs/401", [&] {
+        while (!device.read_sweep(frame, 1000))
+            ;
+        bench::do_not_optimize(frame);
+    });
+    auto counters = device.stream_stats();
+    device.stop_streaming();
+    verify_capture(frame.points, points, nanovna::transfer::binary);
+    result.counter("sweeps/s", 1e9 / result.ns_per_op());
+    result.counter("overruns", (double)counters.overruns);
+}
+
+BENCH_CASE(fleet_capture_data)
+{
+    const unsigned points = 401, device_count = 8;
+    std::vector<std::unique_ptr<pty_device>> stand_ins;
+    std::vector<device_info> devices;
+    for (unsigned idx = 0; idx < device_count; idx++) {
+        stand_ins.emplace_back(new pty_device([=](const std::string &command) { return fake_nanovna(command, points); }, USB_FULL_SPEED));
+        devices.push_back(identify_device(stand_ins.back()->path()));
+        if (!devices.back().is_nanovna())
+            throw std::runtime_error("stand-in was not identified as a NanoVNA");
+    }
+
+    // each port is opened exclusively, so one fleet holds the devices at a time
+    std::string suffix = "/usb_fs/" + std::to_string(device_count) + "x" + std::to_string(points);
+    fleet sequential(devices, 1), parallel(devices);
+    if (sequential.open() != device_count)
+        throw std::runtime_error("cannot open stand-in devices");
+    ctx.measure("fleet_capture_data/1_worker" + suffix, [&] {
+        auto results = sequential.capture_data(2);
+        bench::do_not_optimize(results);
+    });
+    sequential.close();
+
+    if (parallel.open() != device_count)
+        throw std::runtime_error("cannot open stand-in devices");
+    if (sequential.open() != 0)
+        throw std::runtime_error("a port held by one fleet was opened by another");
+    ctx.measure("fleet_capture_data/" + std::to_string(device_count) + "_workers" + suffix, [&] {
+        auto results = parallel.capture_data(2);
+        for (auto &result : results) {
+            if (!result.ok())
+                throw std::runtime_error(result.error);
+            verify_capture(result.value, points, nanovna::transfer::binary);
+        }
+    });
+}
+
+static task capture_awaiting(io_loop &loop, nanovna::device &device, unsigned points, unsigned &captured)
+{
+    verify_capture(co_await device.capture_data(loop, 2), points, nanovna::transfer::binary);
+    captured++;
+}
+
+// The same devices captured by one thread: one after another, blocking, against all at once
+// on an io_loop.
+BENCH_CASE(io_loop_capture_data)
+{
+    const unsigned points = 401, device_count = 8;
+    std::vector<std::unique_ptr<pty_device>> stand_ins;
+    std::vector<std::unique_ptr<nanovna::device>> devices;
+    for (unsigned idx = 0; idx < device_count; idx++) {
+        stand_ins.emplace_back(new pty_device([=](const std::string &command) { return fake_nanovna(command, points); }, USB_FULL_SPEED));
+        devices.emplace_back(new nanovna::device);
+        if (!devices.back()->open(stand_ins.back()->path()))
+            throw std::runtime_error("cannot open stand-in device");
+    }
+
+    std::string suffix = "/usb_fs/" + std::to_string(device_count) + "x" + std::to_string(points);
+    auto &blocking = ctx.measure("io_loop_capture_data/blocking" + suffix, [&] {
+        for (auto &device : devices)
+            bench::do_not_optimize(device->capture_data(2));
+    });
+    io_loop loop;
+    for (auto &mode : { nanovna::transfer::text, nanovna::transfer::binary }) {
+        auto &result = ctx.measure(std::string("io_loop_capture_data/") + 
+                (mode == nanovna::transfer::text ? "text" : "binary") + suffix, [&] {
+            unsigned captured = 0;
+            for (auto &device : devices) {
+                device->capture_data_async(loop, 2, mode, [&](async_result<std::vector<nanovna::point>> &result) {
+                    verify_capture(result.get(), points, mode);
+                    captured++;
+                });
+            }
+            loop.run();
+            if (captured != device_count)
+                throw std::runtime_error("io_loop did not complete every capture");
+        });
+        if (mode == nanovna::transfer::binary)
+            result.counter("speedup", blocking.ns_per_op() / result.ns_per_op());
+    }
+    auto &awaiting = ctx.measure("io_loop_capture_data/coroutine" + suffix, [&] {
+        unsigned captured = 0;
+        std::vector<task> tasks;
+        for (auto &device : devices)
+            tasks.push_back(capture_awaiting(loop, *device, points, captured));
+        loop.run();
+        for (auto &awaited : tasks)
+            awaited.get();
+        if (captured != device_count)
+            throw std::runtime_error("io_loop did not resume every coroutine");
+    });
+    awaiting.counter("speedup", blocking.ns_per_op() / awaiting.ns_per_op());
+
+    // TinySA traces, falling back to text without `scanraw`
+    for (bool has_scanraw : { true, false }) {
+        pty_device stand_in([=](const std::string &command) { return fake_tinysa(command, 450, has_scanraw); });
+        tinysa::device device;
+        if (!device.open(stand_in.path()))
+            throw std::runtime_error("cannot open stand-in device");
+        for (int repeat = 0; repeat < 2; repeat++) {
+            device.capture_trace_async(loop, tinysa::transfer::binary, [&](async_result<tinysa::trace> &result) {
+                verify_trace(result.get(), 450, has_scanraw ? tinysa::transfer::binary : tinysa::transfer::text);
+            });
+            if (!loop.run_for(1000))
+                throw std::runtime_error("io_loop did not complete the trace");
+        }
+    }
+}
+
+// As the async case of nanovna_timeout, awaiting: co_await rethrows the timeout.
+static task time_out_awaiting(io_loop &loop, nanovna::device &device, unsigned short_timeout_ms,
+    unsigned resync_timeout_ms)
+{
+    device.set_timeout(short_timeout_ms);
+    try {
+        co_await device.run(loop, "s21offset");
+        throw std::runtime_error("slow command did not time out");
+    } catch (const timeout_error &) {}
+    device.set_timeout(resync_timeout_ms);
+    if (co_await device.run(loop, "edelay") != "0.000000\r\n")
+        throw std::runtime_error("device did not resynchronize after a timeout");
+}
+
+static task cancel_awaiting(io_loop &loop, nanovna::device &device)
+{
+    try {
+        co_await device.run(loop, "s21offset");
+        throw std::runtime_error("slow command was not cancelled");
+    } catch (const cancelled_error &) {}
+    if (co_await device.run(loop, "edelay") != "0.000000\r\n")
+        throw std::runtime_error("device did not resynchronize after cancellation");
+}
+
+// A command the device is slow to answer times out, or is cancelled, and the next command
+// resynchronizes: its reply waits for the late one, which is discarded.
+BENCH_CASE(nanovna_timeout)
+{
+    pty_device::script behaviour;
+    behaviour.delays["s21offset"] = std::chrono::milliseconds(20);
+    pty_device stand_in([](const std::string &command) { return fake_nanovna(command, 101); }, USB_FULL_SPEED, behaviour);
+    nanovna::device device;
+    if (!device.open(stand_in.path()))
+        throw std::runtime_error("cannot open stand-in device");
+    // the reply to the resynchronizing command comes after the late one, so it gets longer
+    const unsigned short_timeout_ms = 10, resync_timeout_ms = 1000;
+    auto &result = ctx.measure("nanovna_timeout/usb_fs/blocking", [&] {
+        device.set_timeout(short_timeout_ms);
+        try {
+            device.s21offset();
+            throw std::runtime_error("slow command did not time out");
+        } catch (const timeout_error &) {}
+        device.set_timeout(resync_timeout_ms);
+        if (device.run("edelay") != "0.000000\r\n")
+            throw std::runtime_error("device did not resynchronize after a timeout");
+    });
+    result.counter("round_trips/op", (double)stand_in.round_trips() / (result.iterations + 1));
+
+    io_loop loop;
+    ctx.measure("nanovna_timeout/usb_fs/async", [&] {
+        bool timed_out = false;
+        device.set_timeout(short_timeout_ms);
+        device.run_async(loop, "s21offset", [&](async_result<std::string> &result) {
+            try {
+                result.get();
+            } catch (const timeout_error &) {
+                timed_out = true;
+            }
+        });
+        loop.run();
+        if (!timed_out)
+            throw std::runtime_error("slow command did not time out");
+        device.set_timeout(resync_timeout_ms);
+        device.run_async(loop, "edelay", [&](async_result<std::string> &result) {
+            if (result.get() != "0.000000\r\n")
+                throw std::runtime_error("device did not resynchronize after a timeout");
+        });
+        loop.run();
+    });
+    ctx.measure("nanovna_timeout/usb_fs/coroutine", [&] {
+        task awaiting = time_out_awaiting(loop, device, short_timeout_ms, resync_timeout_ms);
+        loop.run();
+        awaiting.get();
+    });
+
+    device.set_timeout(0);
+    ctx.measure("nanovna_timeout/usb_fs/cancelled", [&] {
+        std::thread canceller([&] {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            device.cancel();
+        });
+        try {
+            device.s21offset();
+            throw std::runtime_error("slow command was not cancelled");
+        } catch (const cancelled_error &) {}
+        canceller.join();
+        if (device.run("edelay") != "0.000000\r\n")
+            throw std::runtime_error("device did not resynchronize after cancellation");
+    });
+    ctx.measure("nanovna_timeout/usb_fs/cancelled_coroutine", [&] {
+        task awaiting = cancel_awaiting(loop, device);
+        std::thread canceller([&] {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            device.cancel();
+        });
+        loop.run();
+        canceller.join();
+        awaiting.get();
+    });
+}
+
+// A link that drops the end of every 16th response: captures fail with an error instead of
+// taking the stand-in or the library down, commands without output (`sweep` with a span,
+// as segmented sweeps send) included, and the device recovers for the next attempt.
+BENCH_CASE(nanovna_truncated)
+{
+    pty_device::script behaviour;
+    behaviour.truncate_every = 16;
+    pty_device stand_in([](const std::string &command) { return fake_nanovna(command, 101); },
+        { std::chrono::microseconds(0), 0 }, behaviour);
+    nanovna::device device;
+    device.set_timeout(20);
+    size_t attempts = 0, failures = 0;
+    auto attempt = [&] {
+        attempts++;
+        try {
+            if (!device.is_open() && !device.open(stand_in.path()))
+                throw std::runtime_error("cannot open stand-in device");
+            bench::do_not_optimize(device.capture_data(2, nanovna::transfer::text));
+            bench::do_not_optimize(device.capture_segmented(50000, 900000000, 303, 2, 101));
+        } catch (const std::runtime_error &) {
+            failures++;
+        }
+    };
+    for (int repeat = 0; repeat < 12; repeat++)
+        attempt();
+    if (failures == 0 || stand_in.truncated() == 0)
+        throw std::runtime_error("truncated responses were not reported as errors");
+    if (failures == attempts)
+        throw std::runtime_error("device never recovered from a truncated response");
+
+    auto &result = ctx.measure("nanovna_truncated/pty/capture", attempt);
+    result.counter("failed", (double)failures / attempts).counter("truncated", (double)stand_in.truncated());
+}
+
+// A tool run against a device: open, identify, capture, close. Through a broker, the port is
+// already open and identified, and the capture comes back as a mapped buffer.
+BENCH_CASE(broker_tool_run)
+{
+    const unsigned points = 101;
+    pty_device stand_in([=](const std::string &command) { return fake_nanovna(command, points); }, USB_FULL_SPEED);
+    auto open = [&](nanovna::device &device, const std::wstring &path) {
+        if (!device.open(path))
+            throw std::runtime_error("cannot open stand-in device");
+    };
+    auto tool_run = [&](const std::wstring &path) {
+        nanovna::device device;
+        open(device, path);
+        auto data = device.capture_data(2);
+        verify_capture(data, points, nanovna::transfer::binary);
+    };
+    auto &direct_open = ctx.measure("broker_tool_run/usb_fs/direct_open", [&] {
+        nanovna::device device;
+        open(device, stand_in.path());
+    });
+    auto &direct = ctx.measure("broker_tool_run/usb_fs/direct", [&] { tool_run(stand_in.path()); });
+
+    std::string socket_path = (std::filesystem::temp_directory_path() / "cuterf_bench_broker.sock").string();
+    setenv("CUTERF_BROKER", socket_path.c_str(), 1);
+    broker::server server;
+    if (!server.open(stand_in.path(), broker::default_path()))
+        throw std::runtime_error("cannot open stand-in device");
+    std::thread serving([&] { server.serve(); });
+    auto &brokered_open = ctx.measure("broker_tool_run/usb_fs/brokered_open", [&] {
+        nanovna::device device;
+        open(device, L"");
+    });
+    brokered_open.counter("speedup", direct_open.ns_per_op() / brokered_open.ns_per_op());
+    auto &brokered = ctx.measure("broker_tool_run/usb_fs/brokered", [&] { tool_run(L""); });
+    brokered.counter("speedup", direct.ns_per_op() / brokered.ns_per_op());
+
+    // clients asking at once share captures
+    const unsigned clients = 8;
+    broker::server_counters before = server.counters();
+    auto &concurrent = ctx.measure("broker_tool_run/usb_fs/" + std::to_string(clients) + "_clients", [&] {
+        std::vector<std::thread> threads;
+        for (unsigned idx = 0; idx < clients; idx++)
+            threads.emplace_back([&] { tool_run(L""); });
+        for (auto &thread : threads)
+            thread.join();
+    });
+    broker::server_counters after = server.counters();
+    concurrent.counter("requests/capture",
+        (double)(after.requests - before.requests) / (after.transactions - before.transactions));
+
+    server.stop();
+    serving.join();
+    unsetenv("CUTERF_BROKER");
+}
+
+// What NanoVNA firmware redraws for one sweep: the 32x32 cells that the traces pass
+// through, two per column, and the marker readout, which is cleared with a fill.
+static std::vector<screen_region> fake_redraw(unsigned frame)
+{
+    const unsigned cell = 32;
+    std::vector<screen_region> regions;
+    for (unsigned column = 0; column < 480 / cell; column++) {
+        unsigned trace_row = (unsigned)(4.5 + 3.5 * std::sin(0.4 * column + 0.1 * frame));
+        for (unsigned row = trace_row; row < trace_row + 2; row++) {
+            screen_region region = { column * cell, row * cell, cell, cell, false, std::string(2 * cell * cell, '\0') };
+            for (size_t idx = 0; idx < region.data.size(); idx++)
+                region.data[idx] = (char)(idx * 7 + frame);
+            regions.push_back(region);
+        }
+    }
+    screen_region readout = { 0, 0, 240, 16, true, std::string("\x00\x00", 2) };
+    regions.push_back(readout);
+    return regions;
+}
+
+// A live view: a full screenshot per frame, against mirroring redrawn regions.
+BENCH_CASE(nanovna_mirror)
+{
+    pty_device stand_in([](const std::string &command) { return fake_nanovna(command, 101); }, USB_FULL_SPEED);
+    nanovna::device device;
+    if (!device.open(stand_in.path()))
+        throw std::runtime_error("cannot open stand-in device");
+
+    auto &screenshots = ctx.measure("nanovna_mirror/usb_fs/capture_screenshot", [&] {
+        size_t width, height;
+        bench::do_not_optimize(device.capture_screenshot(width, height));
+    });
+    screenshots.counter("frames/s", 1e9 / screenshots.ns_per_op());
+    screenshots.counter("KiB/frame", 2.0 * 480 * 320 / 1024);
+
+    // the stand-in redraws continuously, as a sweeping NanoVNA does
+    std::vector<std::string> frames;
+    size_t frame_bytes = 0;
+    for (unsigned frame = 0; frame < 16; frame++) {
+        std::string data;
+        for (auto &region : fake_redraw(frame))
+            data += fake_screen_region(region);
+        frame_bytes += data.size();
+        frames.push_back(data);
+    }
+    const size_t regions_per_frame = fake_redraw(0).size();
+
+    device.start_mirroring();
+    std::atomic<bool> stop(false), stopped(false);
+    std::thread redraw([&] {
+        for (unsigned frame = 0; !stop; frame++)
+            stand_in.push(frames[frame % frames.size()]);
+        stopped = true;
+    });
+
+    rgb565_pixmap pixmap(480, 320);
+    screen_region region;
+    for (auto &expected : fake_redraw(0)) {
+        if (!device.read_screen_region(region, 1000))
+            throw std::runtime_error("stand-in sent no screen region");
+        if (region.x != expected.x || region.y != expected.y || region.width != expected.width ||
+                region.height != expected.height || region.fill != expected.fill || region.data != expected.data)
+            throw std::runtime_error("mirroring returned wrong screen region");
+        pixmap.apply_region(region);
+    }
+
+    auto &mirrored = ctx.measure("nanovna_mirror/usb_fs/regions", [&] {
+        for (size_t idx = 0; idx < regions_per_frame; idx++) {
+            if (!device.read_screen_region(region, 1000))
+                throw std::runtime_error("stand-in sent no screen region");
+            pixmap.apply_region(region);
+        }
+    });
+    mirrored.counter("frames/s", 1e9 / mirrored.ns_per_op());
+    mirrored.counter("KiB/frame", frame_bytes / 1024.0 / frames.size());
+
+    // the stand-in may be blocked writing a frame that has to be read first
+    stop = true;
+    while (!stopped)
+        device.read_screen_region(region, 10);
+    redraw.join();
+    device.stop_mirroring();
+    bench::do_not_optimize(device.edelay());
+}
@@ -0,0 +1,136 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <stdexcept>
+#include "bench.h"
+
+static void write_json_string(FILE *out, const std::string &text)
+{
+    fputc('"', out);
+    for (char c : text) {
+        if (c == '"' || c == '\\')
+            fprintf(out, "\\%c", c);
+        else if ((unsigned char)c < 0x20)
+            fprintf(out, "\\u%04x", c);
+        else
+            fputc(c, out);
+    }
+    fputc('"', out);
+}
+
+static void write_json_number(FILE *out, double value)
+{
+    if (std::isfinite(value))
+        fprintf(out, "%.9g", value);
+    else
+        fprintf(out, "null");
+}
+
+// Results in the layout of Google Benchmark's JSON output, with each counter as a field of
+// its benchmark, so that existing tools for comparing runs can read them. Only wall-clock
+// time is measured, so it is reported as the CPU time too.
+static bool write_json(const std::string &path, const bench::context &ctx)
+{
+    FILE *out = path == "-" ? stdout : fopen(path.c_str(), "w");
+    if (out == NULL)
+        return false;
+
+    char date[32];
+    time_t now = time(NULL);
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+    fprintf(out, "{\n  \"context\": {\n    \"date\": ");
+    write_json_string(out, date);
+    fprintf(out, ",\n    \"executable\": \"cuterf_bench\",\n    \"min_time\": ");
+    write_json_number(out, ctx.min_time);
+#if defined(__VERSION__)
+    fprintf(out, ",\n    \"compiler\": ");
+    write_json_string(out, __VERSION__);
+#elif defined(_MSC_VER)
+    fprintf(out, ",\n    \"compiler\": \"MSVC %d\"", _MSC_VER);
+#endif
+#if defined(__AVX2__)
+    fprintf(out, ",\n    \"simd\": \"avx2\"");
+#elif defined(__SSE2__) || defined(_M_X64)
+    fprintf(out, ",\n    \"simd\": \"sse2\"");
+#else
+    fprintf(out, ",\n    \"simd\": \"none\"");
+#endif
+#ifdef NDEBUG
+    fprintf(out, ",\n    \"build_type\": \"release\"");
+#else
+    fprintf(out, ",\n    \"build_type\": \"debug\"");
+#endif
+    fprintf(out, "\n  },\n  \"benchmarks\": [");
+    for (size_t idx = 0; idx < ctx.results.size(); idx++) {
+        const bench::result &r = ctx.results[idx];
+        fprintf(out, "%s\n    {\n      \"name\": ", idx == 0 ? "" : ",");
+        write_json_string(out, r.name);
+        fprintf(out, ",\n      \"run_type\": \"iteration\",\n      \"iterations\": %zu,\n      \"real_time\": ", r.iterations);
+        write_json_number(out, r.ns_per_op());
+        fprintf(out, ",\n      \"cpu_time\": ");
+        write_json_number(out, r.ns_per_op());
+        fprintf(out, ",\n      \"time_unit\": \"ns\"");
+        for (auto &counter : r.counters) {
+            fprintf(out, ",\n      ");
+            write_json_string(out, counter.first);
+            fprintf(out, ": ");
+            write_json_number(out, counter.second);
+        }
+        fprintf(out, "\n    }");
+    }
+    fprintf(out, "\n  ]\n}\n");
+    if (out == stdout)
+        return fflush(out) == 0;
+    return fclose(out) == 0;
+}
+
+int main(int argc, char **argv)
+{
+    bench::context ctx;
+    std::string filter, json_path;
+    for (int argn = 1; argn < argc; argn++) {
+        if (!strncmp(argv[argn], "--min-time=", 11)) {
+            ctx.min_time = atof(&argv[argn][11]);
+        } else if (!strncmp(argv[argn], "--json=", 7)) {
+            json_path = &argv[argn][7];
+        } else if (argv[argn][0] != '-' && filter.empty()) {
+            filter = argv[argn];
+        } else {
+            std::cerr << "Usage: cuterf_bench [--min-time=SECONDS] [--json=FILE] [filter]" << std::endl;
+            std::cerr << std::endl;
+            std::cerr << "Runs the benchmarks whose names contain `filter`, printing a line per result." << std::endl;
+            std::cerr << "With --json, the results are also written to FILE (- for standard output," << std::endl;
+            std::cerr << "in which case the lines go to standard error)." << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    FILE *text_out = json_path == "-" ? stderr : stdout;
+
+    for (auto &c : bench::registry()) {
+        if (!filter.empty() && std::string(c.name).find(filter) == std::string::npos)
+            continue;
+        size_t first = ctx.results.size();
+        try {
+            c.fn(ctx);
+        } catch (const std::exception &e) {
+            std::cerr << c.name << ": " << e.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+        for (size_t idx = first; idx < ctx.results.size(); idx++) {
+            auto &r = ctx.results[idx];
+            fprintf(text_out, "%-48s %10zu iter %14.1f ns/op", r.name.c_str(), r.iterations, r.ns_per_op());
+            for (auto &counter : r.counters)
+                fprintf(text_out, "  %s=%.6g", counter.first.c_str(), counter.second);
+            fprintf(text_out, "\n");
+        }
+    }
+
+    if (!json_path.empty() && !write_json(json_path, ctx)) {
+        std::cerr << "cannot write results to " << json_path << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
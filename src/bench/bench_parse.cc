@@ -0,0 +1,72 @@
+#include <complex>
+#include <cstdio>
+#include <stdexcept>
+#include <vector>
+#include "bench.h"
+#include "parser.h"
+
+using namespace cuterf;
+
+static std::string data_response(unsigned points)
+{
+    std::string response;
+    char line[64];
+    for (unsigned idx = 0; idx < points; idx++) {
+        snprintf(line, sizeof(line), "%.9f %.9f\r\n", 0.5f - idx * 1e-4f, -0.25f + idx * 1e-4f);
+        response += line;
+    }
+    return response;
+}
+
+// The substr/stof implementation that device::capture_data used to have.
+static void legacy_parse(std::string buf, std::vector<std::complex<float>> &data)
+{
+    size_t pos;
+    for (size_t idx = 0; idx < data.size(); idx++) {
+        float re = std::stof(buf, &pos);
+        if (pos == 0 || buf[pos] != ' ')
+            throw std::runtime_error("failed to parse response to data!");
+        buf = buf.substr(pos);
+        float im = std::stof(buf, &pos);
+        if (pos == 0 || buf.substr(pos, 2) != "\r\n")
+            throw std::runtime_error("failed to parse response to data!");
+        data[idx] = std::complex<float>(re, im);
+        buf = buf.substr(pos);
+    }
+}
+
+static void cursor_parse(const std::string &buf, std::vector<std::complex<float>> &data)
+{
+    response_parser parser("data", buf);
+    for (size_t idx = 0; idx < data.size(); idx++) {
+        float re = parser.parse_float();
+        parser.expect(' ');
+        float im = parser.parse_float();
+        parser.expect("\r\n");
+        data[idx] = std::complex<float>(re, im);
+    }
+    parser.expect_end();
+}
+
+BENCH_CASE(parse_data)
+{
+    const unsigned line_counts[] = { 101, 401, 10000 };
+    for (unsigned lines : line_counts) {
+        std::string response = data_response(lines);
+        std::vector<std::complex<float>> legacy(lines), cursor(lines);
+        legacy_parse(response, legacy);
+        cursor_parse(response, cursor);
+        if (legacy != cursor)
+            throw std::runtime_error("parsers disagree");
+
+        std::string suffix = "/" + std::to_string(lines);
+        auto &before = ctx.measure("parse_data/legacy" + suffix, [&] {
+            legacy_parse(response, legacy);
+        });
+        before.counter("MB/s", response.size() / before.ns_per_op() * 1e3);
+        auto &after = ctx.measure("parse_data/cursor" + suffix, [&] {
+            cursor_parse(response, cursor);
+        });
+        after.counter("MB/s", response.size() / after.ns_per_op() * 1e3);
+    }
+}
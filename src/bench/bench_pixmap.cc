@@ -0,0 +1,307 @@
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <thread>
+#include <cuterf.h>
+#include <stdexcept>
+#include "bench.h"
+#include "pixmap.h"
+
+// The conversion that rgb565_pixmap used to have.
+static std::vector<uint8_t> legacy_to_rgb24(const rgb565_pixmap &pixmap, unsigned scale)
+{
+    static const uint8_t lut6to8[] = {
+        0,   4,   8,   12,  16,  20,  24,  28,  32,  36,  40,  45,  49,  53,  57,  61,
+        65,  69,  73,  77,  81,  85,  89,  93,  97,  101, 105, 109, 113, 117, 121, 125,
+        130, 134, 138, 142, 146, 150, 154, 158, 162, 166, 170, 174, 178, 182, 186, 190,
+        194, 198, 202, 206, 210, 215, 219, 223, 227, 231, 235, 239, 243, 247, 251, 255
+    };
+    std::vector<uint8_t> rgb24_data;
+    for (size_t row = 0; row < pixmap.height; row++) {
+        for (unsigned yrepeat = 0; yrepeat < scale; yrepeat++) {
+            for (size_t column = 0; column < pixmap.width; column++) {
+                uint16_t pixel = pixmap.data[column + pixmap.width * row];
+                for (unsigned xrepeat = 0; xrepeat < scale; xrepeat++) {
+                    rgb24_data.push_back(lut6to8[(pixel & 0xf800) >> 10]);
+                    rgb24_data.push_back(lut6to8[(pixel & 0x07e0) >> 5]);
+                    rgb24_data.push_back(lut6to8[(pixel & 0x001f) << 1]);
+                }
+            }
+        }
+    }
+    return rgb24_data;
+}
+
+static void legacy_read_from_capture(rgb565_pixmap &pixmap, const std::string &raw_data)
+{
+    for (size_t i = 0; i < raw_data.length(); i += 2)
+        pixmap.data[i / 2] = (raw_data[i] << 8) | (raw_data[i + 1] & 0xff);
+}
+
+// The whole-image encode that save_to_png_file used to do.
+static bool legacy_save_to_png_file(const rgb565_pixmap &pixmap, const std::string &path, unsigned scale)
+{
+    FILE *file = fopen(path.c_str(), "wb");
+    if (file == NULL)
+        return false;
+    png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    png_infop info = png_create_info_struct(png);
+    std::vector<uint8_t> rgb24_data = legacy_to_rgb24(pixmap, scale);
+    std::vector<png_bytep> rows;
+    if (setjmp(png_jmpbuf(png))) {
+        png_destroy_write_struct(&png, &info);
+        fclose(file);
+        return false;
+    }
+    png_set_IHDR(png, info, pixmap.width * scale, pixmap.height * scale, 8, PNG_COLOR_TYPE_RGB,
+        PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+    for (size_t row = 0; row < pixmap.height * scale; row++)
+        rows.push_back(&rgb24_data[3 * pixmap.width * scale * row]);
+    png_set_rows(png, info, &rows[0]);
+    png_init_io(png, file);
+    png_write_png(png, info, PNG_TRANSFORM_IDENTITY, 0);
+    png_destroy_write_struct(&png, &info);
+    fclose(file);
+    return true;
+}
+
+// Something like a NanoVNA screen: a dark background with a grid, traces and text.
+static std::string synthetic_capture(size_t width, size_t height)
+{
+    std::string raw(2 * width * height, '\0');
+    for (size_t y = 0; y < height; y++) {
+        for (size_t x = 0; x < width; x++) {
+            uint16_t pixel = 0x0000;
+            if (x % 40 == 0 || y % 32 == 0)
+                pixel = 0x4208; // grid
+            if ((size_t)(160 + 100 * std::sin(x * 0.05)) == y)
+                pixel = 0xffe0; // trace
+            if (y < 16 && (x * 7 + y * 3) % 11 < 4)
+                pixel = 0xffff; // text
+            raw[2 * (x + width * y)] = (char)(pixel >> 8);
+            raw[2 * (x + width * y) + 1] = (char)(pixel & 0xff);
+        }
+    }
+    return raw;
+}
+
+BENCH_CASE(pixmap_convert)
+{
+    // every pixel value must convert exactly as the lookup table does
+    rgb565_pixmap all_values(256, 256);
+    for (size_t idx = 0; idx < 65536; idx++)
+        all_values.data[idx] = (uint16_t)idx;
+    for (unsigned scale = 1; scale <= 2; scale++) {
+        if (all_values.to_rgb24(scale) != legacy_to_rgb24(all_values, scale))
+            throw std::runtime_error("RGB565 conversion differs from lookup table");
+    }
+
+    const size_t width = 480, height = 320;
+    std::string raw = synthetic_capture(width, height);
+    rgb565_pixmap legacy(width, height), pixmap(width, height);
+    legacy_read_from_capture(legacy, raw);
+    pixmap.read_from_capture(raw);
+    if (memcmp(&legacy.data[0], &pixmap.data[0], 2 * width * height))
+        throw std::runtime_error("byte swap differs");
+
+    auto &swap_before = ctx.measure("pixmap_convert/read_from_capture/legacy", [&] {
+        legacy_read_from_capture(legacy, raw);
+    });
+    swap_before.counter("Mpx/s", width * height / swap_before.ns_per_op() * 1e3);
+    auto &swap_after = ctx.measure("pixmap_convert/read_from_capture/simd", [&] {
+        pixmap.read_from_capture(raw);
+    });
+    swap_after.counter("Mpx/s", width * height / swap_after.ns_per_op() * 1e3);
+
+    for (unsigned scale = 1; scale <= 4; scale++) {
+        double pixels = (double)width * height * scale * scale;
+        auto &before = ctx.measure("pixmap_convert/to_rgb24/legacy/x" + std::to_string(scale), [&] {
+            bench::do_not_optimize(legacy_to_rgb24(legacy, scale));
+        });
+        before.counter("Mpx/s", pixels / before.ns_per_op() * 1e3);
+        auto &after = ctx.measure("pixmap_convert/to_rgb24/simd/x" + std::to_string(scale), [&] {
+            bench::do_not_optimize(pixmap.to_rgb24(scale));
+        });
+        after.counter("Mpx/s", pixels / after.ns_per_op() * 1e3);
+    }
+}
+
+// Decodes a PNG file to RGB24, whatever its color type.
+static std::vector<uint8_t> decode_png_file(const std::string &path)
+{
+    png_image image;
+    memset(&image, 0, sizeof(image));
+    image.version = PNG_IMAGE_VERSION;
+    if (!png_image_begin_read_from_file(&image, path.c_str()))
+        throw std::runtime_error("cannot read PNG");
+    image.format = PNG_FORMAT_RGB;
+    std::vector<uint8_t> rgb24_data(PNG_IMAGE_SIZE(image));
+    if (!png_image_finish_read(&image, NULL, &rgb24_data[0], 0, NULL))
+        throw std::runtime_error("cannot decode PNG");
+    return rgb24_data;
+}
+
+BENCH_CASE(pixmap_save_png)
+{
+    const size_t width = 480, height = 320;
+    rgb565_pixmap pixmap(width, height);
+    pixmap.read_from_capture(synthetic_capture(width, height));
+    std::filesystem::path path = std::filesystem::temp_directory_path() / "cuterf_bench.png";
+
+    // indexed output and RGB output of images with too many colors must decode exactly
+    rgb565_pixmap all_values(256, 256);
+    for (size_t idx = 0; idx < 65536; idx++)
+        all_values.data[idx] = (uint16_t)idx;
+    for (const rgb565_pixmap *image : { &pixmap, &all_values }) {
+        for (unsigned scale = 1; scale <= 4; scale++) {
+            if (!image->save_to_png_file(path.wstring(), scale, "", ""))
+                throw std::runtime_error("cannot write PNG");
+            if (decode_png_file(path.string()) != image->to_rgb24(scale))
+                throw std::runtime_error("PNG decodes to different pixels");
+        }
+    }
+
+    static const std::pair<const char *, png_speed> speeds[] = {
+        { "fast", png_speed::fast },
+        { "balanced", png_speed::balanced },
+        { "small", png_speed::small },
+    };
+    for (unsigned scale = 1; scale <= 4; scale++) {
+        std::string suffix = "/x" + std::to_string(scale);
+        auto &before = ctx.measure("pixmap_save_png/legacy" + suffix, [&] {
+            if (!legacy_save_to_png_file(pixmap, path.string(), scale))
+                throw std::runtime_error("cannot write PNG");
+        });
+        before.counter("bytes", (double)std::filesystem::file_size(path));
+        before.counter("ms", before.ns_per_op() / 1e6);
+        for (auto &speed : speeds) {
+            auto &after = ctx.measure("pixmap_save_png/" + std::string(speed.first) + suffix, [&] {
+                if (!pixmap.save_to_png_file(path.wstring(), scale, "", "", NULL, speed.second))
+                    throw std::runtime_error("cannot write PNG");
+            });
+            after.counter("bytes", (double)std::filesystem::file_size(path));
+            after.counter("ms", after.ns_per_op() / 1e6);
+        }
+    }
+    std::filesystem::remove(path);
+}
+
+// The extraction that nanovna_extract used to do, decoding the whole image to reach the text.
+static bool legacy_extract_touchstone(const std::string &path, std::string &touchstone)
+{
+    FILE *file = fopen(path.c_str(), "rb");
+    if (file == NULL)
+        return false;
+    png_structp png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    png_infop info = png_create_info_struct(png);
+    bool result = false;
+    if (setjmp(png_jmpbuf(png)) == 0) {
+        png_textp texts;
+        png_init_io(png, file);
+        png_read_png(png, info, PNG_TRANSFORM_IDENTITY, 0);
+        int text_count = png_get_text(png, info, &texts, NULL);
+        for (int idx = 0; idx < text_count; idx++) {
+            if (!strcmp(texts[idx].key, "Touchstone")) {
+                touchstone = std::string(texts[idx].text, texts[idx].text_length);
+                result = true;
+            }
+        }
+    }
+    png_destroy_read_struct(&png, &info, NULL);
+    fclose(file);
+    return result;
+}
+
+// Writes a screenshot as nanovna_screenshot does, with a 401-point sweep embedded.
+static void save_screenshot_with_touchstone(const rgb565_pixmap &pixmap, const std::filesystem::path &path,
+    unsigned scale, std::string *touchstone_text)
+{
+    std::vector<cuterf::nanovna::point> points(401);
+    for (unsigned idx = 0; idx < points.size(); idx++) {
+        points[idx].freq = 50000 + idx * 2249875;
+        points[idx].s11 = std::complex<float>(0.9f * std::cos(0.01f * idx), -0.9f * std::sin(0.01f * idx));
+        points[idx].s21 = std::complex<float>(0.1f * std::sin(0.01f * idx), 0.2f * std::cos(0.01f * idx));
+    }
+    png_ztxt_sink touchstone("Touchstone");
+    cuterf::touchstone::writer writer(touchstone, 2);
+    writer.header({ "Board: NanoVNA-H 4" });
+    writer.points(points);
+    writer.flush();
+    if (touchstone_text != NULL) {
+        cuterf::touchstone::string_sink text(*touchstone_text);
+        cuterf::touchstone::writer text_writer(text, 2);
+        text_writer.header({ "Board: NanoVNA-H 4" });
+        text_writer.points(points);
+        text_writer.flush();
+    }
+    if (!pixmap.save_to_png_file(path.wstring(), scale, "", "", &touchstone))
+        throw std::runtime_error("cannot write PNG");
+}
+
+BENCH_CASE(png_text_extract)
+{
+    const size_t width = 480, height = 320;
+    rgb565_pixmap pixmap(width, height);
+    pixmap.read_from_capture(synthetic_capture(width, height));
+    std::filesystem::path path = std::filesystem::temp_directory_path() / "cuterf_bench.png";
+
+    for (unsigned scale : { 1, 4 }) {
+        std::string expected, legacy, scanned;
+        save_screenshot_with_touchstone(pixmap, path, scale, &expected);
+        if (!legacy_extract_touchstone(path.string(), legacy) || !cuterf::read_png_text(path.wstring(), "Touchstone", scanned) ||
+                legacy != expected || scanned != expected)
+            throw std::runtime_error("extracted Touchstone data differs");
+
+        std::string suffix = "/x" + std::to_string(scale);
+        auto &before = ctx.measure("png_text_extract/png_read_png" + suffix, [&] {
+            if (!legacy_extract_touchstone(path.string(), legacy))
+                throw std::runtime_error("cannot extract Touchstone data");
+        });
+        before.counter("files/s", 1e9 / before.ns_per_op());
+        auto &after = ctx.measure("png_text_extract/chunk_scan" + suffix, [&] {
+            if (!cuterf::read_png_text(path.wstring(), "Touchstone", scanned))
+                throw std::runtime_error("cannot extract Touchstone data");
+        });
+        after.counter("files/s", 1e9 / after.ns_per_op());
+    }
+    std::filesystem::remove(path);
+
+    // a directory of screenshots, as nanovna_extract processes it in batch mode
+    const size_t file_count = 1000;
+    std::filesystem::path directory = std::filesystem::temp_directory_path() / "cuterf_bench_png";
+    std::filesystem::create_directories(directory);
+    std::vector<std::wstring> paths;
+    for (size_t idx = 0; idx < file_count; idx++) {
+        paths.push_back((directory / (std::to_string(idx) + ".png")).wstring());
+        if (idx == 0)
+            save_screenshot_with_touchstone(pixmap, paths[0], 1, NULL);
+        else
+            std::filesystem::copy_file(paths[0], paths[idx], std::filesystem::copy_options::overwrite_existing);
+    }
+    unsigned cpus = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<unsigned> thread_counts = { 1u };
+    if (cpus > 1)
+        thread_counts.push_back(cpus);
+    for (unsigned threads : thread_counts) {
+        auto &batch = ctx.measure("png_text_extract/batch/" + std::to_string(file_count) + "x" + std::to_string(threads) + "_threads", [&] {
+            std::atomic<size_t> next(0);
+            auto work = [&] {
+                std::string text;
+                size_t index;
+                while ((index = next++) < paths.size()) {
+                    if (!cuterf::read_png_text(paths[index], "Touchstone", text))
+                        throw std::runtime_error("cannot extract Touchstone data");
+                }
+            };
+            std::vector<std::thread> workers;
+            for (unsigned idx = 1; idx < threads; idx++)
+                workers.emplace_back(work);
+            work();
+            for (auto &worker : workers)
+                worker.join();
+        });
+        batch.counter("files/s", file_count / batch.ns_per_op() * 1e9);
+    }
+    std::filesystem::remove_all(directory);
+}
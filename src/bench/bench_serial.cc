@@ -0,0 +1,92 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include "bench.h"
+#include "reader.h"
+
+using namespace cuterf;
+
+// Stand-in for a serial port that replays a canned device transcript. Every call to
+// read_some() corresponds to one ReadFile()/read() system call on a real port, and returns
+// at most one full-speed USB CDC packet.
+class scripted_stream : public buffered_reader
+{
+public:
+    std::string script;
+    size_t position, syscalls, packet_size;
+
+    scripted_stream(const std::string &script, size_t packet_size = 64) :
+        script(script), position(0), syscalls(0), packet_size(packet_size)
+    {}
+
+    void rewind()
+    {
+        position = 0;
+        discard_buffered();
+    }
+
+    size_t read_some(char *data, size_t size) override
+    {
+        syscalls++;
+        size_t count = std::min(std::min(size, packet_size), script.size() - position);
+        if (count == 0)
+            throw std::runtime_error("transcript exhausted");
+        memcpy(data, &script[position], count);
+        position += count;
+        return count;
+    }
+};
+
+// The byte-at-a-time implementation that serial_port::read_until used to have.
+static void legacy_read_until(scripted_stream &stream, std::string expected, std::string *data = nullptr)
+{
+    std::string buffer(1, '\0');
+    while (stream.read_some(&buffer[buffer.length() - 1], 1) == 1) {
+        if (buffer.size() >= expected.size() && buffer.substr(buffer.size() - expected.size(), expected.size()) == expected) {
+            if (data != nullptr)
+                *data = buffer.substr(0, buffer.size() - expected.size());
+            return;
+        }
+        buffer += '\0';
+    }
+}
+
+static std::string data_transcript(const std::string &command, unsigned points)
+{
+    std::string script = command + "\r\n";
+    char line[64];
+    for (unsigned idx = 0; idx < points; idx++) {
+        snprintf(line, sizeof(line), "%.9f %.9f\r\n", 0.5f - idx * 1e-3f, -0.25f + idx * 1e-3f);
+        script += line;
+    }
+    return script + "ch> ";
+}
+
+BENCH_CASE(serial_read_until)
+{
+    const unsigned point_counts[] = { 101, 401 };
+    for (unsigned points : point_counts) {
+        std::string command = "data 0";
+        scripted_stream stream(data_transcript(command, points));
+        std::string suffix = "/data_" + std::to_string(points);
+
+        std::string result;
+        stream.syscalls = 0;
+        auto &legacy = ctx.measure("serial_read_until/legacy" + suffix, [&] {
+            stream.rewind();
+            legacy_read_until(stream, command + "\r\n");
+            legacy_read_until(stream, "ch> ", &result);
+        });
+        legacy.counter("syscalls/op", (double)stream.syscalls / (legacy.iterations + 1));
+
+        stream.syscalls = 0;
+        auto &buffered = ctx.measure("serial_read_until/buffered" + suffix, [&] {
+            stream.rewind();
+            stream.read_until(command + "\r\n");
+            stream.read_until("ch> ", &result);
+        });
+        buffered.counter("syscalls/op", (double)stream.syscalls / (buffered.iterations + 1));
+        bench::do_not_optimize(result);
+    }
+}
@@ -0,0 +1,118 @@
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <cuterf.h>
+#include "bench.h"
+
+using namespace cuterf;
+
+static const double PI = 3.14159265358979323846;
+
+// A harmonic sweep of an open at the end of a line with a delay of 10 ns each way.
+static std::vector<nanovna::point> line_sweep(unsigned count)
+{
+    std::vector<nanovna::point> data(count);
+    for (unsigned idx = 0; idx < count; idx++) {
+        double freq = 1e6 * (idx + 1);
+        data[idx].freq = (unsigned)freq;
+        data[idx].s11 = std::complex<float>(std::polar(0.5, -2 * PI * freq * 20e-9));
+        data[idx].s21 = std::complex<float>(std::polar(1.0, -2 * PI * freq * 10e-9));
+    }
+    return data;
+}
+
+// The DC value tdr::plan extrapolates from the first two points of a sweep that starts at its
+// frequency step.
+static double extrapolated_dc(const std::vector<nanovna::point> &sweep)
+{
+    return 2.0 * sweep[0].s11.real() - sweep[1].s11.real();
+}
+
+// The lowpass impulse response as a direct inverse DFT of the two-sided spectrum, scaled by
+// the sum of a rectangular window over it.
+static void direct_impulse(const std::vector<nanovna::point> &sweep, size_t length, std::vector<float> &values)
+{
+    values.resize(length / 2);
+    for (size_t time = 0; time < length / 2; time++) {
+        double sum = extrapolated_dc(sweep);
+        for (size_t idx = 0; idx < sweep.size(); idx++)
+            sum += 2 * (std::complex<double>(sweep[idx].s11) * std::polar(1.0, 2 * PI * (idx + 1) * time / length)).real();
+        values[time] = (float)(sum / (2 * sweep.size() + 1));
+    }
+}
+
+BENCH_CASE(tdr_transform)
+{
+    // a continuous capture delivers about 10 sweeps/s at 101 points and 2 sweeps/s at 401
+    for (unsigned points : { 101, 201, 401, 801, 1601 }) {
+        auto sweep = line_sweep(points);
+        std::string suffix = "/" + std::to_string(points);
+
+        tdr::options opts;
+        opts.mode = tdr::mode::lowpass_impulse;
+        tdr::plan impulse(points, opts);
+        tdr::response response;
+        impulse.transform(sweep, tdr::parameter::s11, response);
+        size_t peak = 0;
+        for (size_t idx = 0; idx < response.values.size(); idx++)
+            if (response.values[idx] > response.values[peak])
+                peak = idx;
+        if (std::fabs(tdr::distance(peak * response.time_step, 1, tdr::parameter::s11) - 3) > 0.2)
+            throw std::runtime_error("open is not at 3 m");
+
+        if (points <= 401) {
+            // the FFT, the split of the real inverse and the scaling against the direct sum
+            tdr::options rectangular;
+            rectangular.mode = tdr::mode::lowpass_impulse;
+            rectangular.window = tdr::window::rectangular;
+            tdr::plan unwindowed(points, rectangular);
+            std::vector<float> direct;
+            direct_impulse(sweep, unwindowed.size() * 2, direct);
+            unwindowed.transform(sweep, tdr::parameter::s11, response);
+            if (response.values.size() != direct.size())
+                throw std::runtime_error("impulse response has the wrong length");
+            float error = 0, peak_value = 0;
+            for (size_t idx = 0; idx < direct.size(); idx++) {
+                error = std::max(error, std::fabs(response.values[idx] - direct[idx]));
+                peak_value = std::max(peak_value, std::fabs(direct[idx]));
+            }
+            if (error > 1e-5f * peak_value * std::log2((float)direct.size()))
+                throw std::runtime_error("impulse response differs from the direct DFT");
+
+            auto &dft = ctx.measure("tdr/direct_dft" + suffix, [&] {
+                direct_impulse(sweep, impulse.size() * 2, direct);
+            });
+            dft.counter("sweeps/s", 1e9 / dft.ns_per_op()).counter("max_error", error / peak_value);
+        }
+        auto &lowpass = ctx.measure("tdr/lowpass_impulse" + suffix, [&] {
+            impulse.transform(sweep, tdr::parameter::s11, response);
+        });
+        lowpass.counter("sweeps/s", 1e9 / lowpass.ns_per_op()).counter("samples", (double)impulse.size());
+
+        opts.mode = tdr::mode::lowpass_step;
+        tdr::plan step(points, opts);
+        step.transform(sweep, tdr::parameter::s11, response);
+        // past the reflection at 20 ns, and the ringing of the window after it
+        double dc = extrapolated_dc(sweep);
+        for (size_t idx = (size_t)(40e-9 / response.time_step); idx < response.values.size(); idx++)
+            if (std::fabs(response.values[idx] - dc) > 0.01 * dc)
+                throw std::runtime_error("step response does not settle at the DC value");
+        auto &integrated = ctx.measure("tdr/lowpass_step" + suffix, [&] {
+            step.transform(sweep, tdr::parameter::s11, response);
+        });
+        integrated.counter("sweeps/s", 1e9 / integrated.ns_per_op());
+
+        opts.mode = tdr::mode::bandpass;
+        tdr::plan bandpass(points, opts);
+        auto &complex = ctx.measure("tdr/bandpass" + suffix, [&] {
+            bandpass.transform(sweep, tdr::parameter::s21, response);
+        });
+        complex.counter("sweeps/s", 1e9 / complex.ns_per_op());
+
+        auto &planning = ctx.measure("tdr/plan" + suffix, [&] {
+            tdr::plan fresh(points, opts);
+            bench::do_not_optimize(fresh);
+        });
+        planning.counter("transforms", planning.ns_per_op() / complex.ns_per_op());
+    }
+}
@@ -0,0 +1,111 @@
+#include <cmath>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <cuterf.h>
+#include "bench.h"
+
+using namespace cuterf;
+
+// The stringstream formatter that device::capture_touchstone used to have.
+static std::string legacy_format(const std::vector<std::string> &header, const std::vector<nanovna::point> &data, unsigned ports)
+{
+    std::stringstream ss;
+    for (auto &line : header)
+        ss << "! " << line << '\n';
+    ss << "# HZ S RI R 50\n";
+    for (auto &point : data) {
+        std::vector<float> sxy;
+        if (ports == 1 || ports == 2) {
+            sxy.push_back(point.s11.real());
+            sxy.push_back(point.s11.imag());
+        }
+        if (ports == 2) {
+            sxy.push_back(point.s21.real());
+            sxy.push_back(point.s21.imag());
+            sxy.push_back(0.0f); // s12.re
+            sxy.push_back(0.0f); // s12.im
+            sxy.push_back(0.0f); // s22.re
+            sxy.push_back(0.0f); // s22.im
+        }
+        ss << std::setw(10) << point.freq;
+        for (auto s : sxy)
+            ss << ' ' << std::fixed << std::setw(12) << std::showpos << std::setprecision(9) << s;
+        ss << '\n';
+    }
+    return ss.str();
+}
+
+static std::string writer_format(const std::vector<std::string> &header, const std::vector<nanovna::point> &data, unsigned ports)
+{
+    std::string result;
+    touchstone::string_sink output(result);
+    touchstone::writer writer(output, ports);
+    writer.header(header);
+    writer.points(data);
+    writer.flush();
+    return result;
+}
+
+static std::vector<nanovna::point> sweep_points(unsigned count)
+{
+    std::vector<nanovna::point> data(count);
+    for (unsigned idx = 0; idx < count; idx++) {
+        float phase = 0.001f * idx;
+        data[idx].freq = 50000 + idx * 8999;
+        data[idx].s11 = std::complex<float>(0.9f * std::cos(phase), -0.9f * std::sin(phase));
+        data[idx].s21 = std::complex<float>(1e-3f * std::sin(3 * phase), 2.5f * std::cos(7 * phase));
+    }
+    return data;
+}
+
+// Values where rounding or sign handling could plausibly diverge from iostreams.
+static std::vector<nanovna::point> edge_points()
+{
+    const float values[] = {
+        0.0f, -0.0f, 1.0f, -1.0f, 0.5e-9f, -0.5e-9f, 1.5e-9f, 0.1234567895f, 99999.9f, -123456.789f,
+        3.0e38f, -3.0e38f, std::numeric_limits<float>::denorm_min(), std::numeric_limits<float>::infinity(),
+        -std::numeric_limits<float>::infinity(), std::numeric_limits<float>::quiet_NaN(),
+    };
+    std::vector<nanovna::point> data;
+    unsigned freq = 0;
+    for (float re : values) {
+        for (float im : values) {
+            nanovna::point point;
+            point.freq = freq;
+            point.s11 = std::complex<float>(re, im);
+            point.s21 = std::complex<float>(im, re);
+            data.push_back(point);
+            freq = freq * 10 + 7;
+        }
+    }
+    return data;
+}
+
+BENCH_CASE(touchstone_write)
+{
+    const std::vector<std::string> header = { "Board: NanoVNA-H 4", "Timestamp: 2024-01-01 00:00:00" };
+    for (unsigned ports : { 1, 2 }) {
+        if (legacy_format(header, edge_points(), ports) != writer_format(header, edge_points(), ports))
+            throw std::runtime_error("Touchstone writer output differs from iostreams");
+    }
+
+    const unsigned point_counts[] = { 101, 401, 100000 };
+    for (unsigned points : point_counts) {
+        auto data = sweep_points(points);
+        std::string expected = legacy_format(header, data, 2);
+        if (writer_format(header, data, 2) != expected)
+            throw std::runtime_error("Touchstone writer output differs from iostreams");
+
+        std::string suffix = "/" + std::to_string(points);
+        auto &before = ctx.measure("touchstone_write/stringstream" + suffix, [&] {
+            bench::do_not_optimize(legacy_format(header, data, 2));
+        });
+        before.counter("MB/s", expected.size() / before.ns_per_op() * 1e3);
+        auto &after = ctx.measure("touchstone_write/writer" + suffix, [&] {
+            bench::do_not_optimize(writer_format(header, data, 2));
+        });
+        after.counter("MB/s", expected.size() / after.ns_per_op() * 1e3);
+    }
+}
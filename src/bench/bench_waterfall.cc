@@ -0,0 +1,98 @@
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <stdexcept>
+#include <cuterf.h>
+#include "bench.h"
+
+using namespace cuterf;
+
+static tinysa::trace noise_trace(unsigned points, unsigned seed)
+{
+    tinysa::trace data;
+    for (unsigned idx = 0; idx < points; idx++) {
+        data.freq.push_back(100000 + (uint64_t)idx * 11557328);
+        data.level.push_back(-100.0f + 8.0f * std::sin(0.37f * idx + 0.11f * seed) + (idx == seed % points ? 60.0f : 0.0f));
+    }
+    return data;
+}
+
+static std::wstring temporary_path(const char *name)
+{
+    return (std::filesystem::temp_directory_path() / name).wstring();
+}
+
+// Resident set size of the process in MiB, or 0 where it cannot be read.
+static double resident_mib()
+{
+#ifdef __linux__
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (statm == NULL)
+        return 0;
+    unsigned long size = 0, resident = 0;
+    if (fscanf(statm, "%lu %lu", &size, &resident) != 2)
+        resident = 0;
+    fclose(statm);
+    return resident * 4096.0 / 1048576;
+#else
+    return 0;
+#endif
+}
+
+BENCH_CASE(waterfall_record)
+{
+    const unsigned points = 450;
+    std::wstring path = temporary_path("cuterf_bench.wf");
+    std::filesystem::remove(path);
+
+    std::vector<tinysa::trace> traces;
+    for (unsigned seed = 0; seed < 64; seed++)
+        traces.push_back(noise_trace(points, seed));
+
+    waterfall::layout shape;
+    shape.points = points;
+    shape.start = traces[0].freq.front();
+    shape.stop = traces[0].freq.back();
+    double rss_before = resident_mib();
+    waterfall::recorder recorder;
+    if (!recorder.open(path, shape))
+        throw std::runtime_error("cannot create waterfall");
+
+    // a day and a half at 4 traces/s wraps tier 0 and 1 many times over
+    auto timestamp = std::chrono::system_clock::now() - std::chrono::hours(36);
+    size_t appended = 0;
+    auto &append = ctx.measure("waterfall/append/" + std::to_string(points), [&] {
+        recorder.append(timestamp, traces[appended++ % traces.size()]);
+        timestamp += std::chrono::milliseconds(250);
+    });
+    append.counter("traces/s", 1e9 / append.ns_per_op());
+    append.counter("file_MiB", shape.file_size() / 1048576.0);
+    append.counter("rss_growth_MiB", resident_mib() - rss_before);
+    for (; appended < 500000; appended++) {
+        recorder.append(timestamp, traces[appended % traces.size()]);
+        timestamp += std::chrono::milliseconds(250);
+    }
+    recorder.close();
+
+    waterfall::reader reader;
+    if (!reader.open(path))
+        throw std::runtime_error("cannot open waterfall");
+    if (reader.rows(0) != shape.rows - 1 || reader.row(1, 0).traces != shape.factor)
+        throw std::runtime_error("waterfall has wrong rows");
+
+    std::vector<uint8_t> rgb24(3 * points);
+    auto newest = reader.row(0, reader.rows(0) - 1).last;
+    for (auto window : { std::chrono::hours(1), std::chrono::hours(24) }) {
+        auto &render = ctx.measure("waterfall/render/" + std::to_string(window.count()) + "h", [&] {
+            waterfall::selection rows = waterfall::select(reader, newest - window, newest, 1024);
+            for (size_t row = rows.first; row < rows.first + rows.count; row++)
+                waterfall::render_row(reader.row(rows.tier, row), points, waterfall::statistic::max, -110, -20, &rgb24[0]);
+            bench::do_not_optimize(rgb24);
+        });
+        waterfall::selection rows = waterfall::select(reader, newest - window, newest, 1024);
+        render.counter("tier", rows.tier).counter("rows", (double)rows.count);
+    }
+
+    reader.close();
+    std::filesystem::remove(path);
+}
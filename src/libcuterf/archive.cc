@@ -0,0 +1,371 @@
+#include <cstring>
+#include <stdexcept>
+#include <cuterf.h>
+#include "file.h"
+
+namespace cuterf {
+
+namespace archive {
+
+// On-disk layout. Every field is little-endian, as on every host we run on, and chunks and
+// columns are 8-byte aligned, so that a mapped archive can be used in place:
+//
+//   file_header
+//   chunk_header, header lines, frequency column, S11 column, [S21 column]   (per sweep)
+//   uint64_t chunk offsets[sweep_count]                                      (the index)
+//
+// While a writer has the archive open, `index_offset` is 0 and readers find the chunks by
+// walking them instead.
+
+static const char FILE_MAGIC[8] = { 'C', 'U', 'T', 'E', 'R', 'F', 'S', 'A' };
+static const uint32_t FILE_VERSION = 1;
+static const uint32_t CHUNK_MAGIC = 0x50575301; // "\x01SWP"
+
+struct file_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t index_offset;
+    uint64_t sweep_count;
+};
+
+struct chunk_header
+{
+    uint32_t magic;
+    uint32_t ports;
+    uint32_t points;
+    uint32_t header_size;
+    int64_t timestamp; // microseconds since the epoch
+    uint64_t size;     // of the whole chunk, including padding
+};
+
+static_assert(sizeof(file_header) == 32 && sizeof(chunk_header) == 32, "archive headers must be packed");
+
+static uint64_t align8(uint64_t offset)
+{
+    return (offset + 7) & ~(uint64_t)7;
+}
+
+// Offsets of each part of a chunk, relative to its start.
+struct chunk_layout
+{
+    uint64_t header, freq, s11, s21, size;
+
+    chunk_layout(uint32_t ports, uint32_t points, uint32_t header_size)
+    {
+        header = sizeof(chunk_header);
+        freq = align8(header + header_size);
+        s11 = align8(freq + sizeof(uint32_t) * (uint64_t)points);
+        s21 = s11 + sizeof(std::complex<float>) * (uint64_t)points;
+        size = s21 + (ports == 2 ? sizeof(std::complex<float>) * (uint64_t)points : 0);
+    }
+};
+
+// Returns the header of the chunk at `offset` if it is well-formed and fits in the file.
+static const chunk_header *find_chunk(const char *data, uint64_t size, uint64_t offset)
+{
+    if (offset % 8 != 0 || offset < sizeof(file_header) || offset > size || size - offset < sizeof(chunk_header))
+        return nullptr;
+    const chunk_header *chunk = (const chunk_header *)&data[offset];
+    if (chunk->magic != CHUNK_MAGIC || !(chunk->ports == 1 || chunk->ports == 2))
+        return nullptr;
+    if (chunk->size != chunk_layout(chunk->ports, chunk->points, chunk->header_size).size || chunk->size > size - offset)
+        return nullptr;
+    return chunk;
+}
+
+// Locates every chunk of a mapped archive, either through its index, or, if it was not
+// closed, by walking the chunks. `end` is set to where the next chunk would be appended.
+static void load_index(const char *data, uint64_t size, const uint64_t *&offsets, uint64_t &count,
+    std::vector<uint64_t> &walked, uint64_t &end)
+{
+    if (size < sizeof(file_header) || memcmp(data, FILE_MAGIC, sizeof(FILE_MAGIC)))
+        throw std::runtime_error("file is not a sweep archive!");
+    const file_header *header = (const file_header *)data;
+    if (header->version != FILE_VERSION)
+        throw std::runtime_error("unsupported sweep archive version!");
+
+    walked.clear();
+    if (header->index_offset != 0) {
+        if (header->index_offset < sizeof(file_header) || header->index_offset % 8 != 0 ||
+                header->index_offset > size || header->sweep_count > (size - header->index_offset) / sizeof(uint64_t))
+            throw std::runtime_error("sweep archive index is corrupt!");
+        offsets = (const uint64_t *)&data[header->index_offset];
+        count = header->sweep_count;
+        end = header->index_offset;
+        return;
+    }
+
+    uint64_t offset = sizeof(file_header);
+    while (const chunk_header *chunk = find_chunk(data, size, offset)) {
+        walked.push_back(offset);
+        offset += chunk->size;
+    }
+    offsets = walked.data();
+    count = walked.size();
+    end = offset;
+}
+
+// --- sweep_view ------------------------------------------------------------
+
+std::vector<std::string> sweep_view::header_lines() const
+{
+    std::vector<std::string> lines;
+    size_t start = 0;
+    while (start < header.size()) {
+        size_t end = header.find('\n', start);
+        if (end == std::string_view::npos)
+            end = header.size();
+        lines.emplace_back(header.substr(start, end - start));
+        start = end + 1;
+    }
+    return lines;
+}
+
+nanovna::point sweep_view::point(size_t index) const
+{
+    nanovna::point point;
+    point.freq = freq[index];
+    point.s11 = s11[index];
+    if (s21 != nullptr)
+        point.s21 = s21[index];
+    return point;
+}
+
+std::vector<nanovna::point> sweep_view::to_points() const
+{
+    std::vector<nanovna::point> result(points);
+    for (size_t index = 0; index < points; index++)
+        result[index] = point(index);
+    return result;
+}
+
+// --- writer ----------------------------------------------------------------
+
+class writer_impl
+{
+public:
+    FILE *m_file;
+    std::vector<uint64_t> m_index;
+    uint64_t m_end;
+    std::vector<char> m_chunk;
+
+    writer_impl() : m_file(NULL), m_end(0)
+    {}
+
+    void write_at(uint64_t offset, const void *data, size_t size);
+};
+
+void writer_impl::write_at(uint64_t offset, const void *data, size_t size)
+{
+    // 64-bit seeks are spelled differently on every platform
+#ifdef _WIN32
+    bool seeked = _fseeki64(m_file, (long long)offset, SEEK_SET) == 0;
+#else
+    bool seeked = fseeko(m_file, (off_t)offset, SEEK_SET) == 0;
+#endif
+    if (!seeked || fwrite(data, 1, size, m_file) != size)
+        throw std::runtime_error("failed to write sweep archive!");
+}
+
+writer::writer() : m_i(new writer_impl)
+{}
+
+writer::~writer()
+{
+    try {
+        close();
+    } catch (const std::runtime_error &) {
+        // the chunks that were written can still be recovered by walking the archive
+    }
+    delete m_i;
+}
+
+bool writer::open(const std::wstring &path)
+{
+    close();
+
+    m_i->m_index.clear();
+    m_i->m_end = sizeof(file_header);
+    bool exists = false;
+    {
+        mapped_file existing;
+        if (existing.open(path) && existing.size != 0) {
+            exists = true;
+            const uint64_t *offsets;
+            uint64_t count;
+            std::vector<uint64_t> walked;
+            load_index(existing.data, existing.size, offsets, count, walked, m_i->m_end);
+            m_i->m_index.assign(offsets, offsets + count);
+        }
+    }
+
+    m_i->m_file = open_file(path, exists ? "r+b" : "w+b");
+    if (m_i->m_file == NULL)
+        return false;
+
+    // mark the archive as unindexed until close(), as new chunks overwrite the old index
+    file_header header = {};
+    memcpy(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC));
+    header.version = FILE_VERSION;
+    m_i->write_at(0, &header, sizeof(header));
+    return true;
+}
+
+void writer::close()
+{
+    if (m_i->m_file == NULL)
+        return;
+
+    FILE *file = m_i->m_file;
+    try {
+        file_header header = {};
+        memcpy(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC));
+        header.version = FILE_VERSION;
+        header.index_offset = m_i->m_end;
+        header.sweep_count = m_i->m_index.size();
+        if (!m_i->m_index.empty())
+            m_i->write_at(m_i->m_end, m_i->m_index.data(), m_i->m_index.size() * sizeof(uint64_t));
+        if (fflush(file) != 0)
+            throw std::runtime_error("failed to write sweep archive!");
+        // the header goes last, so that it never points to an index that was not written
+        m_i->write_at(0, &header, sizeof(header));
+    } catch (...) {
+        m_i->m_file = NULL;
+        fclose(file);
+        throw;
+    }
+    m_i->m_file = NULL;
+    if (fclose(file) != 0)
+        throw std::runtime_error("failed to write sweep archive!");
+}
+
+size_t writer::size() const
+{
+    return m_i->m_index.size();
+}
+
+void writer::append(std::chrono::system_clock::time_point timestamp, const std::vector<std::string> &header,
+    unsigned ports, const std::vector<nanovna::point> &points)
+{
+    if (m_i->m_file == NULL)
+        throw std::logic_error("cannot append to an archive that is not open!");
+    if (!(ports == 1 || ports == 2))
+        throw std::logic_error("can only archive data for 1 or 2 ports!");
+
+    std::string header_text;
+    for (auto &line : header) {
+        if (!header_text.empty())
+            header_text += '\n';
+        header_text += line;
+    }
+
+    chunk_layout layout(ports, (uint32_t)points.size(), (uint32_t)header_text.size());
+    chunk_header chunk = {};
+    chunk.magic = CHUNK_MAGIC;
+    chunk.ports = ports;
+    chunk.points = (uint32_t)points.size();
+    chunk.header_size = (uint32_t)header_text.size();
+    chunk.timestamp = std::chrono::duration_cast<std::chrono::microseconds>(timestamp.time_since_epoch()).count();
+    chunk.size = layout.size;
+
+    // assembled in memory, so that each sweep takes a single write
+    m_i->m_chunk.assign(layout.size, '\0');
+    char *data = m_i->m_chunk.data();
+    memcpy(data, &chunk, sizeof(chunk));
+    memcpy(&data[layout.header], header_text.data(), header_text.size());
+    uint32_t *freq = (uint32_t *)&data[layout.freq];
+    std::complex<float> *s11 = (std::complex<float> *)&data[layout.s11];
+    std::complex<float> *s21 = (std::complex<float> *)&data[layout.s21];
+    for (size_t index = 0; index < points.size(); index++) {
+        freq[index] = points[index].freq;
+        s11[index] = points[index].s11;
+        if (ports == 2)
+            s21[index] = points[index].s21;
+    }
+
+    m_i->write_at(m_i->m_end, data, layout.size);
+    m_i->m_index.push_back(m_i->m_end);
+    m_i->m_end += layout.size;
+}
+
+// --- reader ----------------------------------------------------------------
+
+class reader_impl
+{
+public:
+    mapped_file m_file;
+    const uint64_t *m_offsets;
+    uint64_t m_count;
+    std::vector<uint64_t> m_walked;
+
+    reader_impl() : m_offsets(nullptr), m_count(0)
+    {}
+};
+
+reader::reader() : m_i(new reader_impl)
+{}
+
+reader::~reader()
+{
+    delete m_i;
+}
+
+bool reader::open(const std::wstring &path)
+{
+    close();
+    if (!m_i->m_file.open(path))
+        return false;
+
+    try {
+        uint64_t end;
+        load_index(m_i->m_file.data, m_i->m_file.size, m_i->m_offsets, m_i->m_count, m_i->m_walked, end);
+    } catch (...) {
+        close();
+        throw;
+    }
+    return true;
+}
+
+void reader::close()
+{
+    m_i->m_file.close();
+    m_i->m_offsets = nullptr;
+    m_i->m_count = 0;
+    m_i->m_walked.clear();
+}
+
+size_t reader::size() const
+{
+    return (size_t)m_i->m_count;
+}
+
+sweep_view reader::sweep(size_t index) const
+{
+    if (index >= m_i->m_count)
+        throw std::logic_error("sweep index is out of range!");
+
+    const char *data = m_i->m_file.data;
+    uint64_t offset = m_i->m_offsets[index];
+    const chunk_header *chunk = find_chunk(data, m_i->m_file.size, offset);
+    if (chunk == nullptr)
+        throw std::runtime_error("sweep archive is corrupt!");
+
+    chunk_layout layout(chunk->ports, chunk->points, chunk->header_size);
+    const char *base = &data[offset];
+    sweep_view view;
+    view.timestamp = std::chrono::system_clock::time_point(std::chrono::duration_cast<std::chrono::system_clock::duration>(
+        std::chrono::microseconds(chunk->timestamp)));
+    view.ports = chunk->ports;
+    view.points = chunk->points;
+    view.header = std::string_view(&base[layout.header], chunk->header_size);
+    view.freq = (const uint32_t *)&base[layout.freq];
+    view.s11 = (const std::complex<float> *)&base[layout.s11];
+    view.s21 = chunk->ports == 2 ? (const std::complex<float> *)&base[layout.s21] : nullptr;
+    return view;
+}
+
+}
+
+}
@@ -0,0 +1,121 @@
+#ifndef LIBCUTERF_BROKER_H
+#define LIBCUTERF_BROKER_H
+
+#include <chrono>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "cuterf.h"
+
+namespace cuterf {
+
+namespace broker {
+
+// Clients and the broker exchange messages over a SOCK_SEQPACKET socket. A client sends a
+// request; the broker answers with a status and text (an error, or fields separated by
+// NULs), and the result of a capture as a sealed memory file passed with SCM_RIGHTS.
+
+constexpr uint32_t PROTOCOL = 1;
+
+enum operation : uint32_t
+{
+    HELLO = 1,         // answered with the kind of device, its path, and its identity
+    LEASE,             // answered with the path of the device, once the broker has closed it
+    NANOVNA_CAPTURE,   // nanovna::device::capture()
+    TINYSA_SCREENSHOT, // tinysa::device::capture_screenshot()
+    TINYSA_TRACE,      // tinysa::device::capture_trace(mode)
+    TINYSA_SCAN,       // tinysa::device::capture_trace(start, stop, points)
+};
+
+// parts of NANOVNA_CAPTURE
+constexpr uint32_t PART_SCREEN    = 0x01;
+constexpr uint32_t PART_EDELAY    = 0x02;
+constexpr uint32_t PART_S21OFFSET = 0x04;
+
+// Requests are compared bytewise to find identical ones, so unused fields must be zero.
+struct request
+{
+    uint32_t protocol, op;
+    uint32_t ports, mode, parts, points;
+    uint64_t start, stop;
+};
+
+// A NANOVNA_CAPTURE result is this, then `points` nanovna::point, then the screen.
+struct nanovna_result
+{
+    uint32_t point_size; // sizeof(nanovna::point) in the broker
+    uint32_t points, screen_width, screen_height;
+    float edelay, s21offset;
+};
+
+// A TINYSA_* result is this, then `points` frequencies (uint64_t) and levels (float), then
+// the screen.
+struct tinysa_result
+{
+    uint32_t points, screen_width, screen_height, reserved;
+};
+
+// A read-only mapping of a result.
+class result
+{
+public:
+    const char *data;
+    size_t size;
+
+    result() : data(nullptr), size(0) {}
+    result(result &&other) : data(other.data), size(other.size) { other.data = nullptr; }
+    ~result();
+    result(const result &) = delete;
+    result &operator=(const result &) = delete;
+};
+
+// Thrown when the broker goes away or does not answer in time. The connection is closed by
+// then, and the device may be opened directly.
+class unavailable : public std::runtime_error
+{
+public:
+    using std::runtime_error::runtime_error;
+};
+
+// The connection of a nanovna::device or tinysa::device to a broker.
+class connection
+{
+public:
+    connection();
+    ~connection();
+    bool is_open() const;
+
+    // Connects to the broker at default_path() if one is listening and serves a device of
+    // `kind` ("nanovna" or "tinysa"); `identity` receives the path of the device and then
+    // the fields of its kind.
+    bool open(const char *kind, std::vector<std::string> &identity);
+    // Leasing ends when the connection is closed.
+    void close();
+
+    // Each waits up to `timeout` for the broker to answer, or forever if it is zero, and
+    // throws unavailable if it does not.
+    result call(const request &req, std::chrono::steady_clock::duration timeout);
+    std::wstring lease(std::chrono::steady_clock::duration timeout);
+
+private:
+#ifndef _WIN32
+    int m_socket;
+
+    std::vector<std::string> transact(const request &req, int *fd, std::chrono::steady_clock::duration timeout);
+#endif
+};
+
+inline request make_request(operation op)
+{
+    request req = {};
+    req.protocol = PROTOCOL;
+    req.op = op;
+    return req;
+}
+
+}
+
+}
+
+#endif // LIBCUTERF_BROKER_H
@@ -0,0 +1,692 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <stdexcept>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "broker.h"
+#include "file.h"
+#include "serial.h"
+
+namespace cuterf {
+
+namespace broker {
+
+static const size_t MAX_MESSAGE = 4096;
+// The broker answers HELLO between captures, so a longer wait means it is stuck.
+static const std::chrono::seconds HELLO_TIMEOUT(5);
+
+static std::wstring widen(const std::string &narrow)
+{
+    return std::wstring(narrow.begin(), narrow.end());
+}
+
+// Returns whether `path` is a directory of ours that no one else may enter.
+static bool is_private_directory(const std::string &path)
+{
+    struct stat info;
+    return lstat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode) && info.st_uid == getuid() &&
+        (info.st_mode & 077) == 0;
+}
+
+std::wstring default_path()
+{
+    if (const char *path = getenv("CUTERF_BROKER"))
+        return widen(path);
+    if (const char *runtime = getenv("XDG_RUNTIME_DIR"))
+        return widen(std::string(runtime) + "/cuterf-broker.sock");
+
+    // anyone can create files in /tmp, so the socket goes in a directory only we can enter;
+    // if someone else made it first, there is no broker
+    std::string directory = "/tmp/cuterf-" + std::to_string(getuid());
+    if (mkdir(directory.c_str(), 0700) != 0 && errno != EEXIST)
+        return std::wstring();
+    if (!is_private_directory(directory))
+        return std::wstring();
+    return widen(directory + "/broker.sock");
+}
+
+// Returns whether the process at the other end of `socket` runs as our user.
+static bool peer_is_us(int socket)
+{
+#ifdef __linux__
+    ucred credentials;
+    socklen_t size = sizeof(credentials);
+    return getsockopt(socket, SOL_SOCKET, SO_PEERCRED, &credentials, &size) == 0 &&
+        credentials.uid == getuid();
+#else
+    uid_t uid;
+    gid_t gid;
+    return getpeereid(socket, &uid, &gid) == 0 && uid == getuid();
+#endif
+}
+
+static bool socket_address(const std::wstring &path, sockaddr_un &address)
+{
+    std::string narrow = narrow_path(path);
+    if (narrow.empty() || narrow.size() >= sizeof(address.sun_path))
+        return false;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    memcpy(address.sun_path, narrow.c_str(), narrow.size() + 1);
+    return true;
+}
+
+static int connect_to(const sockaddr_un &address)
+{
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+        return -1;
+    if (connect(fd, (const sockaddr *)&address, sizeof(address)) != 0) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static std::string join_fields(const std::vector<std::string> &fields)
+{
+    std::string text;
+    for (auto &field : fields) {
+        if (!text.empty())
+            text += '\0';
+        text += field;
+    }
+    return text;
+}
+
+// Sends a status and text, with `fd` attached unless it is -1. Never blocks: a client that
+// does not read its replies is dropped.
+static bool send_reply(int socket, uint32_t status, const std::string &text, int fd)
+{
+    std::string message((const char *)&status, sizeof(status));
+    message += text.substr(0, MAX_MESSAGE - sizeof(status));
+    iovec iov = { &message[0], message.size() };
+    msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+    if (fd != -1) {
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        cmsghdr *header = CMSG_FIRSTHDR(&msg);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_RIGHTS;
+        header->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(header), &fd, sizeof(int));
+    }
+    ssize_t sent;
+    do {
+        sent = sendmsg(socket, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+    } while (sent == -1 && errno == EINTR);
+    return sent == (ssize_t)message.size();
+}
+
+// Waits up to `timeout` (forever if zero) for `socket` to become readable.
+static void wait_for_reply(int socket, std::chrono::steady_clock::duration timeout)
+{
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    pollfd pfd = { socket, POLLIN, 0 };
+    while (true) {
+        int timeout_ms = -1;
+        if (timeout != std::chrono::steady_clock::duration::zero()) {
+            auto left = deadline - std::chrono::steady_clock::now();
+            if (left <= std::chrono::steady_clock::duration::zero())
+                throw unavailable("broker did not answer in time!");
+            timeout_ms = (int)std::min<int64_t>(std::chrono::ceil<std::chrono::milliseconds>(left).count(), INT_MAX);
+        }
+        int ready = poll(&pfd, 1, timeout_ms);
+        if (ready > 0)
+            return;
+        if (ready == -1 && errno != EINTR)
+            throw unavailable("poll() failed");
+    }
+}
+
+// Receives a reply within `timeout` and returns its fields, or throws the error it carries.
+// An attached file descriptor is stored in `fd`, or closed if `fd` is null.
+static std::vector<std::string> receive_reply(int socket, int *fd, std::chrono::steady_clock::duration timeout)
+{
+    wait_for_reply(socket, timeout);
+    char message[MAX_MESSAGE];
+    iovec iov = { message, sizeof(message) };
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+    msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    ssize_t count;
+    do {
+        count = recvmsg(socket, &msg, MSG_CMSG_CLOEXEC | MSG_DONTWAIT);
+    } while (count == -1 && errno == EINTR);
+    if (count < (ssize_t)sizeof(uint32_t))
+        throw unavailable("broker closed the connection!");
+
+    int received = -1;
+    for (cmsghdr *header = CMSG_FIRSTHDR(&msg); header != nullptr; header = CMSG_NXTHDR(&msg, header)) {
+        if (header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS)
+            memcpy(&received, CMSG_DATA(header), sizeof(int));
+    }
+    uint32_t status;
+    memcpy(&status, message, sizeof(status));
+    std::string text(message + sizeof(status), count - sizeof(status));
+    if (status != 0 || fd == nullptr) {
+        if (received != -1)
+            ::close(received);
+        if (status != 0)
+            throw std::runtime_error(text);
+    } else {
+        *fd = received;
+    }
+
+    std::vector<std::string> fields;
+    for (size_t begin = 0, end; begin <= text.size(); begin = end + 1) {
+        end = std::min(text.find('\0', begin), text.size());
+        fields.push_back(text.substr(begin, end - begin));
+    }
+    return fields;
+}
+
+// --- Client ----------------------------------------------------------------
+
+result::~result()
+{
+    if (data != nullptr)
+        munmap((void *)data, size);
+}
+
+connection::connection() : m_socket(-1)
+{}
+
+connection::~connection()
+{
+    close();
+}
+
+bool connection::is_open() const
+{
+    return m_socket != -1;
+}
+
+bool connection::open(const char *kind, std::vector<std::string> &identity)
+{
+    close();
+    sockaddr_un address;
+    if (!socket_address(default_path(), address))
+        return false;
+    m_socket = connect_to(address);
+    if (m_socket == -1)
+        return false;
+    // its captures and the device path it leases are trusted
+    if (!peer_is_us(m_socket)) {
+        close();
+        return false;
+    }
+
+    std::vector<std::string> fields;
+    try {
+        request req = make_request(HELLO);
+        if (send(m_socket, &req, sizeof(req), MSG_NOSIGNAL) != sizeof(req))
+            throw std::runtime_error("cannot write to broker!");
+        fields = receive_reply(m_socket, nullptr, HELLO_TIMEOUT);
+    } catch (const std::runtime_error &) {
+        fields.clear();
+    }
+    if (fields.size() < 2 || fields[0] != kind) {
+        close();
+        return false;
+    }
+    identity.assign(fields.begin() + 1, fields.end());
+    return true;
+}
+
+void connection::close()
+{
+    if (m_socket != -1)
+        ::close(m_socket);
+    m_socket = -1;
+}
+
+// Sends `req` and receives the reply. A late reply would be taken for the answer to the next
+// request, so the connection is closed if the broker is unavailable.
+std::vector<std::string> connection::transact(const request &req, int *fd, std::chrono::steady_clock::duration timeout)
+{
+    try {
+        if (send(m_socket, &req, sizeof(req), MSG_NOSIGNAL) != sizeof(req))
+            throw unavailable("cannot write to broker!");
+        return receive_reply(m_socket, fd, timeout);
+    } catch (const unavailable &) {
+        close();
+        throw;
+    }
+}
+
+result connection::call(const request &req, std::chrono::steady_clock::duration timeout)
+{
+    int fd = -1;
+    transact(req, &fd, timeout);
+    if (fd == -1)
+        throw std::runtime_error("broker returned no capture!");
+
+    result mapped;
+    struct stat info;
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+        void *data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (data != MAP_FAILED) {
+            mapped.data = (const char *)data;
+            mapped.size = (size_t)info.st_size;
+        }
+    }
+    ::close(fd);
+    if (mapped.data == nullptr)
+        throw std::runtime_error("cannot map capture from broker!");
+    return mapped;
+}
+
+std::wstring connection::lease(std::chrono::steady_clock::duration timeout)
+{
+    return widen(transact(make_request(LEASE), nullptr, timeout)[0]);
+}
+
+// --- Server ----------------------------------------------------------------
+
+// Copies `data` into a memory file that cannot be changed any more, so that every client
+// it is sent to may map it.
+static int seal_buffer(const std::string &data)
+{
+#ifdef __linux__
+    int fd = memfd_create("cuterf-broker", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+#else
+    char path[] = "/tmp/cuterf-broker-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd != -1)
+        unlink(path);
+#endif
+    if (fd == -1)
+        throw std::runtime_error("cannot create capture buffer!");
+    size_t done = 0;
+    while (done < data.size()) {
+        ssize_t count = write(fd, &data[done], data.size() - done);
+        if (count > 0) {
+            done += count;
+        } else if (!(count == -1 && errno == EINTR)) {
+            ::close(fd);
+            throw std::runtime_error("cannot write capture buffer!");
+        }
+    }
+#ifdef __linux__
+    fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+#endif
+    return fd;
+}
+
+template<class T>
+static void append_raw(std::string &buffer, const T *values, size_t count)
+{
+    buffer.append((const char *)values, sizeof(T) * count);
+}
+
+class server_impl
+{
+public:
+    device_info m_info;
+    std::vector<std::string> m_identity; // the reply to HELLO
+    std::unique_ptr<nanovna::device> m_nanovna;
+    std::unique_ptr<tinysa::device> m_tinysa;
+    std::wstring m_socket_path;
+    int m_listener, m_wake[2];
+    std::atomic<bool> m_stop;
+    std::atomic<uint64_t> m_requests, m_transactions, m_leases;
+
+    struct waiting
+    {
+        int client;
+        request req;
+    };
+    std::vector<int> m_clients;
+    std::deque<waiting> m_queue; // requests waiting for the device, oldest first
+    int m_lessee;                // the client holding the lease, or -1
+
+    server_impl();
+    ~server_impl();
+
+    bool device_is_open() const;
+    bool open_device();
+    void close_device();
+
+    void receive(int client);
+    void drop(int client);
+    void dispatch();
+    std::string transact(const request &req);
+};
+
+server_impl::server_impl() :
+    m_listener(-1), m_stop(false), m_requests(0), m_transactions(0), m_leases(0), m_lessee(-1)
+{
+    if (pipe(m_wake) != 0)
+        throw std::runtime_error("cannot create pipe!");
+    fcntl(m_wake[0], F_SETFL, O_NONBLOCK);
+    fcntl(m_wake[1], F_SETFL, O_NONBLOCK);
+}
+
+server_impl::~server_impl()
+{
+    for (int client : m_clients)
+        ::close(client);
+    if (m_listener != -1) {
+        ::close(m_listener);
+        unlink(narrow_path(m_socket_path).c_str());
+    }
+    ::close(m_wake[0]);
+    ::close(m_wake[1]);
+}
+
+bool server_impl::device_is_open() const
+{
+    return m_nanovna ? m_nanovna->is_open() : m_tinysa->is_open();
+}
+
+bool server_impl::open_device()
+{
+    try {
+        return m_nanovna ? m_nanovna->open(m_info.path) : m_tinysa->open(m_info.path);
+    } catch (const std::runtime_error &) {
+        close_device();
+        return false;
+    }
+}
+
+void server_impl::close_device()
+{
+    if (m_nanovna)
+        m_nanovna->close();
+    else
+        m_tinysa->close();
+}
+
+void server_impl::receive(int client)
+{
+    request req;
+    ssize_t count = recv(client, &req, sizeof(req), MSG_DONTWAIT);
+    if (count == -1 && (errno == EAGAIN || errno == EINTR))
+        return;
+    if (count != sizeof(req) || req.protocol != PROTOCOL) {
+        drop(client);
+        return;
+    }
+
+    switch (req.op) {
+    case HELLO:
+        if (!send_reply(client, 0, join_fields(m_identity), -1))
+            drop(client);
+        break;
+    case NANOVNA_CAPTURE:
+    case TINYSA_SCREENSHOT:
+    case TINYSA_TRACE:
+    case TINYSA_SCAN:
+        m_requests++;
+        // fall through
+    case LEASE:
+        m_queue.push_back({ client, req });
+        break;
+    default:
+        if (!send_reply(client, 1, "unknown broker request!", -1))
+            drop(client);
+    }
+}
+
+void server_impl::drop(int client)
+{
+    ::close(client);
+    m_clients.erase(std::remove(m_clients.begin(), m_clients.end(), client), m_clients.end());
+    m_queue.erase(std::remove_if(m_queue.begin(), m_queue.end(), [=](const waiting &entry) {
+        return entry.client == client;
+    }), m_queue.end());
+    if (client == m_lessee) {
+        m_lessee = -1;
+        open_device(); // or again for the next request, if the device is gone for now
+    }
+}
+
+std::string server_impl::transact(const request &req)
+{
+    std::string buffer;
+    if (req.op == NANOVNA_CAPTURE && m_nanovna && req.ports <= 2 && req.mode <= 1) {
+        screenshot screen = { std::string(), 0, 0 };
+        float edelay = 0.0f, s21offset = 0.0f;
+        std::vector<nanovna::point> data = m_nanovna->capture(req.ports, (nanovna::transfer)req.mode,
+            (req.parts & PART_SCREEN) ? &screen : nullptr, (req.parts & PART_EDELAY) ? &edelay : nullptr,
+            (req.parts & PART_S21OFFSET) ? &s21offset : nullptr);
+        nanovna_result header = { sizeof(nanovna::point), (uint32_t)data.size(), (uint32_t)screen.width,
+            (uint32_t)screen.height, edelay, s21offset };
+        append_raw(buffer, &header, 1);
+        append_raw(buffer, data.data(), data.size());
+        buffer += screen.data;
+        return buffer;
+    }
+
+    if (m_tinysa && (req.op == TINYSA_SCREENSHOT || req.op == TINYSA_TRACE || req.op == TINYSA_SCAN)) {
+        tinysa_result header = { 0, 0, 0, 0 };
+        tinysa::trace data;
+        std::string screen;
+        if (req.op == TINYSA_SCREENSHOT) {
+            size_t width, height;
+            screen = m_tinysa->capture_screenshot(width, height);
+            header.screen_width = (uint32_t)width;
+            header.screen_height = (uint32_t)height;
+        } else if (req.op == TINYSA_TRACE && req.mode <= 1) {
+            data = m_tinysa->capture_trace((tinysa::transfer)req.mode);
+        } else if (req.op == TINYSA_SCAN) {
+            data = m_tinysa->capture_trace(req.start, req.stop, req.points);
+        } else {
+            throw std::runtime_error("request does not match the device!");
+        }
+        header.points = (uint32_t)data.freq.size();
+        append_raw(buffer, &header, 1);
+        append_raw(buffer, data.freq.data(), data.freq.size());
+        append_raw(buffer, data.level.data(), data.level.size());
+        buffer += screen;
+        return buffer;
+    }
+
+    throw std::runtime_error("request does not match the device!");
+}
+
+void server_impl::dispatch()
+{
+    waiting first = m_queue.front();
+    m_queue.pop_front();
+    if (first.req.op == LEASE) {
+        close_device();
+        m_lessee = first.client;
+        m_leases++;
+        if (!send_reply(first.client, 0, narrow_path(m_info.path), -1))
+            drop(first.client);
+        return;
+    }
+
+    // every identical request that is waiting gets the same capture
+    std::vector<int> clients = { first.client };
+    for (auto entry = m_queue.begin(); entry != m_queue.end();) {
+        if (memcmp(&entry->req, &first.req, sizeof(request)) == 0) {
+            clients.push_back(entry->client);
+            entry = m_queue.erase(entry);
+        } else {
+            ++entry;
+        }
+    }
+
+    m_transactions++;
+    int fd = -1;
+    std::string error;
+    try {
+        if (!device_is_open() && !open_device())
+            throw std::runtime_error("cannot reopen the device!");
+        fd = seal_buffer(transact(first.req));
+    } catch (const std::exception &e) {
+        error = e.what();
+        // reopening synchronizes with the shell again, whatever state the failure left it in
+        close_device();
+    }
+    for (int client : clients) {
+        if (!send_reply(client, error.empty() ? 0 : 1, error, fd))
+            drop(client);
+    }
+    if (fd != -1)
+        ::close(fd);
+}
+
+server::server() : m_i(new server_impl)
+{}
+
+server::~server()
+{
+    delete m_i;
+}
+
+bool server::open(const std::wstring &device_path, const std::wstring &socket_path)
+{
+    if (m_i->m_listener != -1)
+        throw std::logic_error("broker is already open!");
+
+    std::wstring path = device_path;
+    if (path.empty() && !FindUSBSerialPortByVIDPID(nanovna::VID, nanovna::PID, path))
+        return false;
+    m_i->m_info = identify_device(path);
+    if (m_i->m_info.is_nanovna())
+        m_i->m_nanovna.reset(new nanovna::device);
+    else if (m_i->m_info.is_tinysa())
+        m_i->m_tinysa.reset(new tinysa::device);
+    else
+        return false;
+    if (!m_i->open_device())
+        return false;
+    if (m_i->m_nanovna)
+        m_i->m_identity = { "nanovna", narrow_path(path), m_i->m_nanovna->board_name(),
+            m_i->m_nanovna->firmware_info() };
+    else
+        m_i->m_identity = { "tinysa", narrow_path(path), m_i->m_tinysa->is_ultra() ? "1" : "0",
+            m_i->m_tinysa->hardware_version(), m_i->m_tinysa->firmware_version() };
+
+    sockaddr_un address;
+    if (!socket_address(socket_path, address))
+        throw std::logic_error("broker socket path is empty or too long!");
+    int existing = connect_to(address);
+    if (existing != -1) {
+        ::close(existing);
+        throw std::runtime_error("another broker is listening on the socket!");
+    }
+    // only a socket of ours is left behind by a broker that did not exit cleanly
+    struct stat info;
+    if (lstat(address.sun_path, &info) == 0) {
+        if (!S_ISSOCK(info.st_mode) || info.st_uid != getuid())
+            throw std::runtime_error("broker socket path is taken by something else!");
+        unlink(address.sun_path);
+    }
+
+    int listener = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (listener == -1)
+        throw std::runtime_error("cannot create broker socket!");
+    // the socket is created accessible to us alone, rather than changed once others could
+    // have connected
+    mode_t mask = umask(077);
+    int bound = bind(listener, (const sockaddr *)&address, sizeof(address));
+    umask(mask);
+    if (bound != 0 || listen(listener, 64) != 0) {
+        ::close(listener);
+        throw std::runtime_error("cannot listen on broker socket!");
+    }
+    m_i->m_listener = listener;
+    m_i->m_socket_path = socket_path;
+    return true;
+}
+
+const device_info &server::device() const
+{
+    return m_i->m_info;
+}
+
+void server::serve()
+{
+    if (m_i->m_listener == -1)
+        throw std::logic_error("broker is not open!");
+
+    std::vector<pollfd> fds;
+    while (!m_i->m_stop) {
+        fds.clear();
+        fds.push_back({ m_i->m_wake[0], POLLIN, 0 });
+        fds.push_back({ m_i->m_listener, POLLIN, 0 });
+        for (int client : m_i->m_clients)
+            fds.push_back({ client, POLLIN, 0 });
+
+        // with work to do, only collect what has arrived meanwhile, to coalesce it
+        bool ready = !m_i->m_queue.empty() && m_i->m_lessee == -1;
+        if (poll(&fds[0], fds.size(), ready ? 0 : -1) == -1) {
+            if (errno == EINTR)
+                continue;
+            throw std::runtime_error("poll() failed");
+        }
+
+        if (fds[0].revents & POLLIN) {
+            char drained[64];
+            while (read(m_i->m_wake[0], drained, sizeof(drained)) > 0)
+                ;
+        }
+        for (size_t idx = 2; idx < fds.size(); idx++) {
+            int client = fds[idx].fd;
+            if (fds[idx].revents == 0 ||
+                    std::find(m_i->m_clients.begin(), m_i->m_clients.end(), client) == m_i->m_clients.end())
+                continue;
+            if (fds[idx].revents & POLLIN)
+                m_i->receive(client);
+            else
+                m_i->drop(client);
+        }
+        if (fds[1].revents & POLLIN) {
+            int client;
+            while ((client = accept(m_i->m_listener, NULL, NULL)) != -1) {
+                fcntl(client, F_SETFD, FD_CLOEXEC);
+                if (peer_is_us(client))
+                    m_i->m_clients.push_back(client);
+                else
+                    ::close(client);
+            }
+        }
+
+        if (!m_i->m_queue.empty() && m_i->m_lessee == -1 && !m_i->m_stop)
+            m_i->dispatch();
+    }
+}
+
+void server::stop()
+{
+    // only async-signal-safe calls here
+    m_i->m_stop = true;
+    ssize_t ignored = write(m_i->m_wake[1], "", 1);
+    (void)ignored;
+}
+
+server_counters server::counters() const
+{
+    server_counters counters;
+    counters.requests = m_i->m_requests;
+    counters.transactions = m_i->m_transactions;
+    counters.leases = m_i->m_leases;
+    return counters;
+}
+
+}
+
+}
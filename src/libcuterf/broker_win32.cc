@@ -0,0 +1,84 @@
+#include <stdexcept>
+#include "broker.h"
+
+namespace cuterf {
+
+namespace broker {
+
+// The broker passes file descriptors over Unix-domain sockets, which Windows lacks; devices
+// are always opened directly.
+
+std::wstring default_path()
+{
+    return std::wstring();
+}
+
+result::~result()
+{}
+
+connection::connection()
+{}
+
+connection::~connection()
+{}
+
+bool connection::is_open() const
+{
+    return false;
+}
+
+bool connection::open(const char *, std::vector<std::string> &)
+{
+    return false;
+}
+
+void connection::close()
+{}
+
+result connection::call(const request &, std::chrono::steady_clock::duration)
+{
+    throw std::logic_error("broker is not available on Windows!");
+}
+
+std::wstring connection::lease(std::chrono::steady_clock::duration)
+{
+    throw std::logic_error("broker is not available on Windows!");
+}
+
+class server_impl
+{};
+
+server::server() : m_i(new server_impl)
+{}
+
+server::~server()
+{
+    delete m_i;
+}
+
+bool server::open(const std::wstring &, const std::wstring &)
+{
+    throw std::runtime_error("broker is not available on Windows!");
+}
+
+const device_info &server::device() const
+{
+    throw std::logic_error("broker is not open!");
+}
+
+void server::serve()
+{
+    throw std::logic_error("broker is not open!");
+}
+
+void server::stop()
+{}
+
+server_counters server::counters() const
+{
+    return server_counters();
+}
+
+}
+
+}
@@ -0,0 +1,419 @@
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <cuterf.h>
+#include "file.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define CALIBRATION_AVX2
+#define CALIBRATION_SSE2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CALIBRATION_SSE2
+#endif
+
+namespace cuterf {
+
+namespace calibration {
+
+static const double PI = 3.14159265358979323846;
+static const double Z0 = 50;
+
+// On-disk layout, little-endian: file_header, then a file_record per frequency, holding the
+// real and imaginary parts of e00, e11, e10e01, e30, e22 and e10e32.
+static const char FILE_MAGIC[8] = { 'C', 'U', 'T', 'E', 'R', 'F', 'C', 'L' };
+static const uint32_t FILE_VERSION = 1;
+
+struct file_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t points;
+};
+
+struct file_record
+{
+    uint32_t freq;
+    float terms[12];
+};
+
+static_assert(sizeof(file_header) == 16 && sizeof(file_record) == 52, "calibration records must be packed");
+
+static std::complex<float> terms::*const TERMS[6] = {
+    &terms::e00, &terms::e11, &terms::e10e01, &terms::e30, &terms::e22, &terms::e10e32,
+};
+
+kit::kit() :
+    open_capacitance(0), open_delay(0), short_inductance(0), short_delay(0), load_resistance(Z0), thru_delay(0)
+{}
+
+// The terms interpolated to a sweep are kept as columns of real or imaginary parts, so that
+// the kernels load a part of a term for consecutive points at once. K is e10e01 / e10e32.
+enum column
+{
+    E00_RE, E00_IM, E11_RE, E11_IM, E10E01_RE, E10E01_IM, E30_RE, E30_IM, K_RE, K_IM, COLUMNS
+};
+
+// The sweep being corrected, likewise.
+enum measurement
+{
+    S11_RE, S11_IM, S21_RE, S21_IM, MEASUREMENTS
+};
+
+class model_impl
+{
+public:
+    std::vector<terms> m_terms;
+
+    // terms interpolated to the frequencies of the last sweep corrected, in COLUMNS columns
+    // of m_grid.size() floats, and that sweep in MEASUREMENTS columns
+    std::vector<unsigned> m_grid;
+    std::vector<float> m_columns, m_work;
+
+    void prepare(const nanovna::point *sweep, size_t points);
+};
+
+model::model() : m_i(new model_impl)
+{}
+
+model::~model()
+{
+    delete m_i;
+}
+
+const std::vector<terms> &model::error_terms() const
+{
+    return m_i->m_terms;
+}
+
+static std::complex<double> reflection(std::complex<double> impedance)
+{
+    return (impedance - Z0) / (impedance + Z0);
+}
+
+// Reflection of an ideal termination behind a lossless offset of `delay` each way.
+static std::complex<double> offset(std::complex<double> gamma, double omega, double delay)
+{
+    return gamma * std::polar(1.0, -2 * omega * delay);
+}
+
+static std::complex<double> determinant(const std::complex<double> m[3][3])
+{
+    return m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1]) -
+        m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0]) +
+        m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+}
+
+static void check_grid(const std::vector<nanovna::point> &sweep, const std::vector<nanovna::point> &grid)
+{
+    if (sweep.size() != grid.size())
+        throw std::logic_error("calibration standards must be swept over the same frequencies!");
+    for (size_t idx = 0; idx < grid.size(); idx++) {
+        if (sweep[idx].freq != grid[idx].freq)
+            throw std::logic_error("calibration standards must be swept over the same frequencies!");
+    }
+}
+
+void model::solve(const standards &measured, const kit &standard)
+{
+    const std::vector<nanovna::point> &grid = measured.open;
+    if (grid.size() < 2)
+        throw std::logic_error("calibration needs at least 2 points!");
+    check_grid(measured.short_circuit, grid);
+    check_grid(measured.load, grid);
+    check_grid(measured.thru, grid);
+    if (!measured.isolation.empty())
+        check_grid(measured.isolation, grid);
+    for (size_t idx = 1; idx < grid.size(); idx++) {
+        if (grid[idx].freq <= grid[idx - 1].freq)
+            throw std::runtime_error("sweep frequencies are not increasing!");
+    }
+
+    std::vector<terms> solved(grid.size());
+    for (size_t idx = 0; idx < grid.size(); idx++) {
+        double omega = 2 * PI * grid[idx].freq;
+        std::complex<double> j(0, 1);
+        std::complex<double> actual[3] = {
+            standard.open_capacitance == 0 ? 1.0 :
+                reflection(1.0 / (j * omega * standard.open_capacitance)),
+            reflection(j * omega * standard.short_inductance),
+            reflection(standard.load_resistance),
+        };
+        actual[0] = offset(actual[0], omega, standard.open_delay);
+        actual[1] = offset(actual[1], omega, standard.short_delay);
+        std::complex<double> reading[3] = {
+            measured.open[idx].s11, measured.short_circuit[idx].s11, measured.load[idx].s11,
+        };
+
+        // M = e00 + G M e11 + G (e10e01 - e00 e11) is linear in e00, e11 and the last
+        // factor, so the three standards give three equations, solved by Cramer's rule
+        std::complex<double> system[3][3], unknowns[3];
+        for (int row = 0; row < 3; row++) {
+            system[row][0] = 1;
+            system[row][1] = actual[row] * reading[row];
+            system[row][2] = actual[row];
+        }
+        std::complex<double> det = determinant(system);
+        if (std::abs(det) == 0)
+            throw std::runtime_error("calibration standards cannot be told apart!");
+        for (int col = 0; col < 3; col++) {
+            std::complex<double> replaced[3][3];
+            for (int row = 0; row < 3; row++) {
+                for (int other = 0; other < 3; other++)
+                    replaced[row][other] = other == col ? reading[row] : system[row][other];
+            }
+            unknowns[col] = determinant(replaced) / det;
+        }
+        std::complex<double> e00 = unknowns[0], e11 = unknowns[1], e10e01 = unknowns[2] + e00 * e11;
+
+        // the thru reflects the load match of port 2 back through itself
+        std::complex<double> e30 = measured.isolation.empty() ? 0.0 : std::complex<double>(measured.isolation[idx].s21);
+        std::complex<double> thru = std::polar(1.0, -omega * standard.thru_delay);
+        std::complex<double> reflected = std::complex<double>(measured.thru[idx].s11) - e00;
+        std::complex<double> e22 = reflected / (e10e01 + e11 * reflected) / (thru * thru);
+        std::complex<double> e10e32 = (std::complex<double>(measured.thru[idx].s21) - e30) *
+            (1.0 - e11 * e22 * thru * thru) / thru;
+        if (std::abs(e10e32) == 0)
+            throw std::runtime_error("thru standard shows no transmission!");
+
+        solved[idx].freq = grid[idx].freq;
+        solved[idx].e00 = std::complex<float>(e00);
+        solved[idx].e11 = std::complex<float>(e11);
+        solved[idx].e10e01 = std::complex<float>(e10e01);
+        solved[idx].e30 = std::complex<float>(e30);
+        solved[idx].e22 = std::complex<float>(e22);
+        solved[idx].e10e32 = std::complex<float>(e10e32);
+    }
+    m_i->m_terms = std::move(solved);
+    m_i->m_grid.clear();
+}
+
+bool model::load(const std::wstring &path)
+{
+    mapped_file file;
+    if (!file.open(path))
+        return false;
+
+    file_header header;
+    if (file.size < sizeof(header) || memcmp(file.data, FILE_MAGIC, sizeof(FILE_MAGIC)))
+        throw std::runtime_error("file is not a calibration!");
+    memcpy(&header, file.data, sizeof(header));
+    if (header.version != FILE_VERSION)
+        throw std::runtime_error("unsupported calibration version!");
+    if (header.points < 2 || file.size != sizeof(header) + (size_t)header.points * sizeof(file_record))
+        throw std::runtime_error("calibration is corrupt!");
+
+    std::vector<terms> loaded(header.points);
+    for (size_t idx = 0; idx < loaded.size(); idx++) {
+        file_record record;
+        memcpy(&record, file.data + sizeof(header) + idx * sizeof(record), sizeof(record));
+        if (idx != 0 && record.freq <= loaded[idx - 1].freq)
+            throw std::runtime_error("calibration is corrupt!");
+        loaded[idx].freq = record.freq;
+        for (int term = 0; term < 6; term++)
+            loaded[idx].*TERMS[term] = std::complex<float>(record.terms[2 * term], record.terms[2 * term + 1]);
+    }
+    m_i->m_terms = std::move(loaded);
+    m_i->m_grid.clear();
+    return true;
+}
+
+bool model::save(const std::wstring &path) const
+{
+    if (m_i->m_terms.empty())
+        throw std::logic_error("calibration has no error terms!");
+
+    FILE *file = open_file(path, "wb");
+    if (file == nullptr)
+        return false;
+    file_header header = {};
+    memcpy(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC));
+    header.version = FILE_VERSION;
+    header.points = (uint32_t)m_i->m_terms.size();
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+    for (const terms &point : m_i->m_terms) {
+        file_record record;
+        record.freq = point.freq;
+        for (int term = 0; term < 6; term++) {
+            record.terms[2 * term] = (point.*TERMS[term]).real();
+            record.terms[2 * term + 1] = (point.*TERMS[term]).imag();
+        }
+        written = written && fwrite(&record, sizeof(record), 1, file) == 1;
+    }
+    if (fclose(file) != 0 || !written)
+        throw std::runtime_error("failed to write calibration!");
+    return true;
+}
+
+// Interpolates the terms to the frequencies of `sweep`, unless they are those of the last one.
+void model_impl::prepare(const nanovna::point *sweep, size_t points)
+{
+    if (m_terms.empty())
+        throw std::logic_error("calibration has no error terms!");
+    bool same = m_grid.size() == points;
+    for (size_t idx = 0; same && idx < points; idx++)
+        same = m_grid[idx] == sweep[idx].freq;
+    if (same)
+        return;
+
+    for (size_t idx = 1; idx < points; idx++) {
+        if (sweep[idx].freq < sweep[idx - 1].freq)
+            throw std::runtime_error("sweep frequencies are not increasing!");
+    }
+    if (sweep[0].freq < m_terms.front().freq || sweep[points - 1].freq > m_terms.back().freq)
+        throw std::runtime_error("sweep extends beyond the calibrated span!");
+
+    m_grid.resize(points);
+    m_columns.resize(COLUMNS * points);
+    m_work.resize(MEASUREMENTS * points);
+    size_t segment = 0;
+    for (size_t idx = 0; idx < points; idx++) {
+        unsigned freq = sweep[idx].freq;
+        while (segment + 2 < m_terms.size() && m_terms[segment + 1].freq < freq)
+            segment++;
+        const terms &below = m_terms[segment], &above = m_terms[segment + 1];
+        double weight = (double)(freq - below.freq) / (above.freq - below.freq);
+        auto interpolate = [&](std::complex<float> terms::*term) {
+            std::complex<double> low(below.*term), high(above.*term);
+            return low + weight * (high - low);
+        };
+        std::complex<double> e10e01 = interpolate(&terms::e10e01);
+        const std::complex<double> values[COLUMNS / 2] = {
+            interpolate(&terms::e00), interpolate(&terms::e11), e10e01, interpolate(&terms::e30),
+            e10e01 / interpolate(&terms::e10e32),
+        };
+        for (int value = 0; value < COLUMNS / 2; value++) {
+            m_columns[(2 * value) * points + idx] = (float)values[value].real();
+            m_columns[(2 * value + 1) * points + idx] = (float)values[value].imag();
+        }
+        m_grid[idx] = freq;
+    }
+}
+
+// The kernel is written once over these, for plain floats and for each vector width; all of
+// them compute the same operations in the same order, so their results are identical.
+struct scalar_ops
+{
+    typedef float vector;
+    static const size_t width = 1;
+
+    static vector splat(float value) { return value; }
+    static vector load(const float *data) { return *data; }
+    static void store(float *data, vector value) { *data = value; }
+    static vector add(vector a, vector b) { return a + b; }
+    static vector sub(vector a, vector b) { return a - b; }
+    static vector mul(vector a, vector b) { return a * b; }
+    static vector div(vector a, vector b) { return a / b; }
+};
+
+#if defined(CALIBRATION_SSE2)
+struct sse2_ops
+{
+    typedef __m128 vector;
+    static const size_t width = 4;
+
+    static vector splat(float value) { return _mm_set1_ps(value); }
+    static vector load(const float *data) { return _mm_loadu_ps(data); }
+    static void store(float *data, vector value) { _mm_storeu_ps(data, value); }
+    static vector add(vector a, vector b) { return _mm_add_ps(a, b); }
+    static vector sub(vector a, vector b) { return _mm_sub_ps(a, b); }
+    static vector mul(vector a, vector b) { return _mm_mul_ps(a, b); }
+    static vector div(vector a, vector b) { return _mm_div_ps(a, b); }
+};
+#endif
+
+#if defined(CALIBRATION_AVX2)
+struct avx2_ops
+{
+    typedef __m256 vector;
+    static const size_t width = 8;
+
+    static vector splat(float value) { return _mm256_set1_ps(value); }
+    static vector load(const float *data) { return _mm256_loadu_ps(data); }
+    static void store(float *data, vector value) { _mm256_storeu_ps(data, value); }
+    static vector add(vector a, vector b) { return _mm256_add_ps(a, b); }
+    static vector sub(vector a, vector b) { return _mm256_sub_ps(a, b); }
+    static vector mul(vector a, vector b) { return _mm256_mul_ps(a, b); }
+    static vector div(vector a, vector b) { return _mm256_div_ps(a, b); }
+};
+#endif
+
+// Corrects points from `begin` in groups of ops::width, for as long as a whole group is left;
+// returns the first point not corrected. With d = S11 - e00 and r = 1 / (e10e01 + e11 d):
+//
+//   S11' = d r                 S21' = (S21 - e30) K r
+//
+// where K = e10e01 / e10e32 folds the source match of port 1 into the transmission.
+template<class ops>
+static size_t correct(float *work, const float *columns, size_t begin, size_t points)
+{
+    typedef typename ops::vector vector;
+    auto column = [&](int index, size_t idx) { return ops::load(&columns[index * points + idx]); };
+    const vector one = ops::splat(1.0f);
+    size_t idx = begin;
+    for (; idx + ops::width <= points; idx += ops::width) {
+        float *s11_re = &work[S11_RE * points + idx], *s11_im = &work[S11_IM * points + idx];
+        float *s21_re = &work[S21_RE * points + idx], *s21_im = &work[S21_IM * points + idx];
+        vector e11_re = column(E11_RE, idx), e11_im = column(E11_IM, idx);
+
+        vector d_re = ops::sub(ops::load(s11_re), column(E00_RE, idx));
+        vector d_im = ops::sub(ops::load(s11_im), column(E00_IM, idx));
+        vector den_re = ops::add(column(E10E01_RE, idx), ops::sub(ops::mul(e11_re, d_re), ops::mul(e11_im, d_im)));
+        vector den_im = ops::add(column(E10E01_IM, idx), ops::add(ops::mul(e11_re, d_im), ops::mul(e11_im, d_re)));
+        // r = (r_re, -q)
+        vector scale = ops::div(one, ops::add(ops::mul(den_re, den_re), ops::mul(den_im, den_im)));
+        vector r_re = ops::mul(den_re, scale), q = ops::mul(den_im, scale);
+
+        vector u_re = ops::sub(ops::load(s21_re), column(E30_RE, idx));
+        vector u_im = ops::sub(ops::load(s21_im), column(E30_IM, idx));
+        vector k_re = column(K_RE, idx), k_im = column(K_IM, idx);
+        vector t_re = ops::sub(ops::mul(u_re, k_re), ops::mul(u_im, k_im));
+        vector t_im = ops::add(ops::mul(u_re, k_im), ops::mul(u_im, k_re));
+
+        ops::store(s11_re, ops::add(ops::mul(d_re, r_re), ops::mul(d_im, q)));
+        ops::store(s11_im, ops::sub(ops::mul(d_im, r_re), ops::mul(d_re, q)));
+        ops::store(s21_re, ops::add(ops::mul(t_re, r_re), ops::mul(t_im, q)));
+        ops::store(s21_im, ops::sub(ops::mul(t_im, r_re), ops::mul(t_re, q)));
+    }
+    return idx;
+}
+
+void model::apply(std::vector<nanovna::point> &sweep)
+{
+    apply(sweep.data(), sweep.size());
+}
+
+void model::apply(nanovna::point *sweep, size_t points)
+{
+    if (points == 0)
+        return;
+    m_i->prepare(sweep, points);
+
+    float *work = &m_i->m_work[0];
+    for (size_t idx = 0; idx < points; idx++) {
+        work[S11_RE * points + idx] = sweep[idx].s11.real();
+        work[S11_IM * points + idx] = sweep[idx].s11.imag();
+        work[S21_RE * points + idx] = sweep[idx].s21.real();
+        work[S21_IM * points + idx] = sweep[idx].s21.imag();
+    }
+
+    const float *columns = &m_i->m_columns[0];
+    size_t idx = 0;
+#if defined(CALIBRATION_AVX2)
+    idx = correct<avx2_ops>(work, columns, idx, points);
+#endif
+#if defined(CALIBRATION_SSE2)
+    idx = correct<sse2_ops>(work, columns, idx, points);
+#endif
+    correct<scalar_ops>(work, columns, idx, points);
+
+    for (size_t pt = 0; pt < points; pt++) {
+        sweep[pt].s11 = std::complex<float>(work[S11_RE * points + pt], work[S11_IM * points + pt]);
+        sweep[pt].s21 = std::complex<float>(work[S21_RE * points + pt], work[S21_IM * points + pt]);
+    }
+}
+
+}
+
+}
@@ -0,0 +1,457 @@
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <limits>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <cuterf.h>
+#include "file.h"
+#include "pool.h"
+
+namespace cuterf {
+
+namespace catalog {
+
+// On-disk layout, little-endian like the archive:
+//
+//   file_header
+//   record, path, device, firmware   (per entry, in creation time order)
+//
+// Strings are UTF-8 and not terminated; their lengths are in the record.
+
+static const char FILE_MAGIC[8] = { 'C', 'U', 'T', 'E', 'R', 'F', 'C', 'T' };
+static const uint32_t FILE_VERSION = 1;
+
+struct file_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t entry_count;
+};
+
+struct record
+{
+    uint64_t file_size;
+    int64_t file_time;
+    int64_t created; // microseconds since the epoch
+    float edelay;
+    float s21offset;
+    uint32_t ports;
+    uint32_t start;
+    uint32_t stop;
+    uint32_t points;
+    uint32_t path_size;
+    uint16_t device_size;
+    uint16_t firmware_size;
+};
+
+static_assert(sizeof(file_header) == 24 && sizeof(record) == 56, "catalog records must be packed");
+
+query::query() :
+    from(std::chrono::system_clock::time_point::min()), to(std::chrono::system_clock::time_point::max()),
+    min_freq(0), max_freq(std::numeric_limits<uint32_t>::max())
+{}
+
+class database_impl
+{
+public:
+    std::vector<entry> m_entries;
+};
+
+database::database() : m_i(new database_impl)
+{}
+
+database::~database()
+{
+    delete m_i;
+}
+
+size_t database::size() const
+{
+    return m_i->m_entries.size();
+}
+
+const entry &database::at(size_t index) const
+{
+    return m_i->m_entries.at(index);
+}
+
+static std::chrono::system_clock::time_point from_microseconds(int64_t microseconds)
+{
+    return std::chrono::system_clock::time_point(std::chrono::duration_cast<std::chrono::system_clock::duration>(
+        std::chrono::microseconds(microseconds)));
+}
+
+static int64_t to_microseconds(std::chrono::system_clock::time_point timestamp)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(timestamp.time_since_epoch()).count();
+}
+
+bool database::load(const std::wstring &path)
+{
+    mapped_file file;
+    if (!file.open(path))
+        return false;
+
+    file_header header;
+    if (file.size < sizeof(header))
+        throw std::runtime_error("file is not a catalog!");
+    memcpy(&header, file.data, sizeof(header));
+    if (memcmp(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC)) || header.version != FILE_VERSION)
+        throw std::runtime_error("file is not a catalog!");
+
+    std::vector<entry> entries;
+    size_t offset = sizeof(header);
+    for (uint64_t index = 0; index < header.entry_count; index++) {
+        record item;
+        if (file.size - offset < sizeof(item))
+            throw std::runtime_error("catalog is truncated!");
+        memcpy(&item, &file.data[offset], sizeof(item));
+        offset += sizeof(item);
+        size_t strings_size = (size_t)item.path_size + item.device_size + item.firmware_size;
+        if (file.size - offset < strings_size)
+            throw std::runtime_error("catalog is truncated!");
+
+        entry value;
+        const char *strings = &file.data[offset];
+        value.path = std::filesystem::path(std::u8string(strings, strings + item.path_size)).wstring();
+        value.device.assign(strings + item.path_size, item.device_size);
+        value.firmware.assign(strings + item.path_size + item.device_size, item.firmware_size);
+        offset += strings_size;
+        value.file_size = item.file_size;
+        value.file_time = item.file_time;
+        value.created = from_microseconds(item.created);
+        value.edelay = item.edelay;
+        value.s21offset = item.s21offset;
+        value.ports = item.ports;
+        value.start = item.start;
+        value.stop = item.stop;
+        value.points = item.points;
+        entries.push_back(std::move(value));
+    }
+    m_i->m_entries.swap(entries);
+    return true;
+}
+
+bool database::save(const std::wstring &path) const
+{
+    std::string data;
+    file_header header = {};
+    memcpy(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC));
+    header.version = FILE_VERSION;
+    header.entry_count = m_i->m_entries.size();
+    data.append((const char *)&header, sizeof(header));
+    for (auto &value : m_i->m_entries) {
+        std::u8string path_utf8 = std::filesystem::path(value.path).u8string();
+        record item = {};
+        item.file_size = value.file_size;
+        item.file_time = value.file_time;
+        item.created = to_microseconds(value.created);
+        item.edelay = value.edelay;
+        item.s21offset = value.s21offset;
+        item.ports = value.ports;
+        item.start = value.start;
+        item.stop = value.stop;
+        item.points = value.points;
+        item.path_size = (uint32_t)path_utf8.size();
+        item.device_size = (uint16_t)std::min<size_t>(value.device.size(), UINT16_MAX);
+        item.firmware_size = (uint16_t)std::min<size_t>(value.firmware.size(), UINT16_MAX);
+        data.append((const char *)&item, sizeof(item));
+        data.append((const char *)path_utf8.data(), path_utf8.size());
+        data.append(value.device, 0, item.device_size);
+        data.append(value.firmware, 0, item.firmware_size);
+    }
+
+    // written beside the catalog and renamed over it, so that a reader never sees half of it
+    std::wstring temporary_path = path + L".tmp";
+    FILE *f = open_file(temporary_path, "wb");
+    if (!f)
+        return false;
+    bool written = fwrite(data.data(), 1, data.size(), f) == data.size();
+    if (fclose(f) != 0 || !written) {
+        std::filesystem::remove(temporary_path);
+        return false;
+    }
+    std::error_code error;
+    std::filesystem::rename(temporary_path, path, error);
+    return !error;
+}
+
+// Accepts "YYYY-mm-dd HH:MM:SS", as in a Touchstone "Timestamp:" line, and "YYYY:mm:dd
+// HH:MM:SS", as in a PNG "Creation Time" chunk; both are in local time.
+static bool parse_local_time(const std::string &text, std::chrono::system_clock::time_point &timestamp)
+{
+    struct tm timeinfo = {};
+    char date_separator1, date_separator2;
+    if (sscanf(text.c_str(), "%d%c%d%c%d %d:%d:%d", &timeinfo.tm_year, &date_separator1, &timeinfo.tm_mon,
+            &date_separator2, &timeinfo.tm_mday, &timeinfo.tm_hour, &timeinfo.tm_min, &timeinfo.tm_sec) != 8)
+        return false;
+    timeinfo.tm_year -= 1900;
+    timeinfo.tm_mon -= 1;
+    timeinfo.tm_isdst = -1;
+    time_t seconds = mktime(&timeinfo);
+    if (seconds == (time_t)-1)
+        return false;
+    timestamp = std::chrono::system_clock::from_time_t(seconds);
+    return true;
+}
+
+static bool starts_with(const std::string &text, const char *prefix, std::string &rest)
+{
+    size_t length = strlen(prefix);
+    if (text.compare(0, length, prefix) != 0)
+        return false;
+    rest = text.substr(length);
+    return true;
+}
+
+// The header lines that nanovna_data and nanovna_screenshot write; see format_header().
+static void summarize_touchstone(const std::string &text, entry &value)
+{
+    touchstone::document document = touchstone::parse(text);
+    value.ports = document.ports;
+    value.points = (uint32_t)document.points.size();
+    if (!document.points.empty()) {
+        value.start = document.points.front().freq;
+        value.stop = document.points.back().freq;
+    }
+    for (auto &line : document.comments) {
+        std::string rest;
+        if (starts_with(line, "Board: ", rest))
+            value.device = rest;
+        else if (starts_with(line, "Firmware: ", rest))
+            value.firmware = rest;
+        else if (starts_with(line, "Timestamp: ", rest))
+            parse_local_time(rest, value.created);
+        else if (starts_with(line, "E-delay: ", rest))
+            value.edelay = strtof(rest.c_str(), nullptr);
+        else if (starts_with(line, "S21 offset: ", rest))
+            value.s21offset = strtof(rest.c_str(), nullptr);
+    }
+}
+
+// "NanoVNA-H 4 (firmware 1.2.20)" or "tinySA Ultra (hardware V0.4.5.1, firmware v1.4-143)".
+static void summarize_source(const std::string &source, entry &value)
+{
+    size_t open = source.find(" (");
+    value.device = source.substr(0, open);
+    if (open == std::string::npos)
+        return;
+    size_t firmware = source.find("firmware ", open);
+    size_t close = source.rfind(')');
+    if (firmware != std::string::npos && close != std::string::npos && close > firmware)
+        value.firmware = source.substr(firmware + 9, close - firmware - 9);
+}
+
+static bool read_file(const std::wstring &path, std::string &data)
+{
+    FILE *f = open_file(path, "rb");
+    if (!f)
+        return false;
+    data.clear();
+    char buffer[65536];
+    size_t count;
+    while ((count = fread(buffer, 1, sizeof(buffer), f)) != 0)
+        data.append(buffer, count);
+    bool result = !ferror(f);
+    fclose(f);
+    return result;
+}
+
+static std::wstring lowercase_extension(const std::filesystem::path &path)
+{
+    std::wstring extension = path.extension().wstring();
+    for (auto &c : extension)
+        c = towlower(c);
+    return extension;
+}
+
+// Fills in everything but the path, size and time of the file; returns false if it cannot
+// be read or parsed.
+static bool summarize(entry &value)
+{
+    value.device.clear();
+    value.firmware.clear();
+    value.edelay = value.s21offset = 0.0f;
+    value.ports = value.start = value.stop = value.points = 0;
+    value.created = std::chrono::system_clock::now() + std::chrono::duration_cast<std::chrono::system_clock::duration>(
+        std::filesystem::file_time_type(std::filesystem::file_time_type::duration(value.file_time)) -
+        std::filesystem::file_time_type::clock::now());
+
+    try {
+        if (lowercase_extension(value.path) == L".png") {
+            // the Touchstone header is the more precise, so it is applied last
+            std::vector<std::pair<std::string, std::string>> texts;
+            if (!read_png_texts(value.path, texts))
+                return false;
+            const std::string *touchstone = nullptr;
+            for (auto &text : texts) {
+                if (text.first == "Source")
+                    summarize_source(text.second, value);
+                else if (text.first == "Creation Time")
+                    parse_local_time(text.second, value.created);
+                else if (text.first == "Touchstone")
+                    touchstone = &text.second;
+            }
+            if (touchstone != nullptr)
+                summarize_touchstone(*touchstone, value);
+        } else {
+            std::string text;
+            if (!read_file(value.path, text))
+                return false;
+            summarize_touchstone(text, value);
+        }
+    } catch (const std::runtime_error &) {
+        return false;
+    }
+    return true;
+}
+
+// Finds the captures under `root`, which may also be a single file.
+static void collect_files(const std::filesystem::path &root, std::vector<entry> &files, size_t &failed)
+{
+    auto add = [&](const std::filesystem::path &path) {
+        std::error_code error;
+        entry value = {};
+        value.path = path.wstring();
+        value.file_size = std::filesystem::file_size(path, error);
+        if (!error)
+            value.file_time = std::filesystem::last_write_time(path, error).time_since_epoch().count();
+        if (error)
+            failed++;
+        else
+            files.push_back(std::move(value));
+    };
+    auto is_capture = [](const std::filesystem::path &path) {
+        std::wstring extension = lowercase_extension(path);
+        return extension == L".png" || extension == L".s1p" || extension == L".s2p";
+    };
+
+    std::error_code error;
+    if (!std::filesystem::is_directory(root, error)) {
+        add(root);
+        return;
+    }
+    std::filesystem::recursive_directory_iterator it(root, std::filesystem::directory_options::skip_permission_denied, error), end;
+    for (; !error && it != end; it.increment(error)) {
+        if (it->is_regular_file(error) && is_capture(it->path()))
+            add(it->path());
+    }
+    if (error)
+        failed++;
+}
+
+static bool is_under(const std::wstring &path, const std::wstring &root)
+{
+    if (path.compare(0, root.size(), root) != 0)
+        return false;
+    return path.size() == root.size() || path[root.size()] == std::filesystem::path::preferred_separator ||
+        root.back() == std::filesystem::path::preferred_separator;
+}
+
+update_stats database::update(const std::vector<std::wstring> &roots, unsigned threads)
+{
+    update_stats stats = {};
+    std::vector<std::wstring> absolute_roots;
+    std::vector<entry> files;
+    for (auto &root : roots) {
+        std::filesystem::path absolute_root = std::filesystem::absolute(root).lexically_normal();
+        if (!absolute_root.has_filename())
+            absolute_root = absolute_root.parent_path();
+        absolute_roots.push_back(absolute_root.wstring());
+        collect_files(absolute_root, files, stats.failed);
+    }
+    // a file may be under several of the roots
+    std::sort(files.begin(), files.end(), [](const entry &a, const entry &b) { return a.path < b.path; });
+    files.erase(std::unique(files.begin(), files.end(), [](const entry &a, const entry &b) {
+        return a.path == b.path;
+    }), files.end());
+    stats.files = files.size();
+
+    // unchanged files keep their entries; the rest are read in parallel
+    enum { UNSEEN, UNCHANGED, CHANGED };
+    std::vector<char> state(m_i->m_entries.size(), UNSEEN);
+    std::unordered_map<std::wstring, size_t> existing;
+    for (size_t index = 0; index < m_i->m_entries.size(); index++)
+        existing[m_i->m_entries[index].path] = index;
+    std::vector<entry> changed;
+    for (auto &file : files) {
+        auto it = existing.find(file.path);
+        if (it != existing.end()) {
+            const entry &previous = m_i->m_entries[it->second];
+            bool unchanged = previous.file_size == file.file_size && previous.file_time == file.file_time;
+            state[it->second] = unchanged ? UNCHANGED : CHANGED;
+            if (unchanged)
+                continue;
+        }
+        changed.push_back(std::move(file));
+    }
+    std::vector<char> summarized(changed.size());
+    worker_pool pool(threads != 0 ? threads : std::max(1u, std::thread::hardware_concurrency()));
+    pool.run(changed.size(), [&](size_t index) {
+        summarized[index] = summarize(changed[index]);
+    });
+
+    std::vector<entry> entries;
+    for (size_t index = 0; index < m_i->m_entries.size(); index++) {
+        entry &value = m_i->m_entries[index];
+        if (state[index] == UNSEEN && std::any_of(absolute_roots.begin(), absolute_roots.end(),
+                [&](const std::wstring &root) { return is_under(value.path, root); })) {
+            stats.removed++;
+            continue;
+        }
+        if (state[index] != CHANGED)
+            entries.push_back(std::move(value));
+    }
+    for (size_t index = 0; index < changed.size(); index++) {
+        if (!summarized[index]) {
+            stats.failed++;
+            continue;
+        }
+        stats.indexed++;
+        entries.push_back(std::move(changed[index]));
+    }
+
+    std::stable_sort(entries.begin(), entries.end(), [](const entry &a, const entry &b) {
+        return a.created < b.created;
+    });
+    m_i->m_entries.swap(entries);
+    return stats;
+}
+
+template<class String>
+static bool contains_ignoring_case(const String &text, const String &pattern)
+{
+    auto equal = [](typename String::value_type a, typename String::value_type b) {
+        return towlower(a) == towlower(b);
+    };
+    return std::search(text.begin(), text.end(), pattern.begin(), pattern.end(), equal) != text.end();
+}
+
+std::vector<const entry *> database::find(const query &criteria) const
+{
+    bool any_freq = criteria.min_freq == 0 && criteria.max_freq == std::numeric_limits<uint32_t>::max();
+    std::vector<const entry *> matches;
+    auto first = std::lower_bound(m_i->m_entries.begin(), m_i->m_entries.end(), criteria.from,
+        [](const entry &value, std::chrono::system_clock::time_point from) {
+            return value.created < from;
+        });
+    for (auto it = first; it != m_i->m_entries.end() && it->created <= criteria.to; ++it) {
+        if (!any_freq && (it->ports == 0 || it->start > criteria.max_freq || it->stop < criteria.min_freq))
+            continue;
+        if (!criteria.device.empty() && !contains_ignoring_case(it->device, criteria.device) &&
+                !contains_ignoring_case(it->firmware, criteria.device))
+            continue;
+        if (!criteria.path.empty() && !contains_ignoring_case(it->path, criteria.path))
+            continue;
+        matches.push_back(&*it);
+    }
+    return matches;
+}
+
+}
+
+}
@@ -0,0 +1,202 @@
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include "cuterf.h"
+#include "pool.h"
+#include "registry.h"
+#include "serial.h"
+
+namespace cuterf {
+
+device_info identify_device(const std::wstring &path)
+{
+    device_info info;
+    info.path = path;
+    device_identity identity;
+    if (device_registry::instance().recall(path, identity)) {
+        info.board = identity.board;
+        info.version = identity.version;
+        return info;
+    }
+
+    // a NanoVNA answers `version` with a bare version number, which tinysa::device rejects
+    try {
+        tinysa::device device;
+        if (!device.open(path)) {
+            info.error = "cannot open serial port";
+            return info;
+        }
+        info.board = device.is_ultra() ? "tinySA Ultra" : "tinySA";
+        info.version = device.firmware_version();
+        return info;
+    } catch (const std::runtime_error &) {
+    }
+
+    try {
+        nanovna::device device;
+        if (!device.open(path)) {
+            info.error = "cannot open serial port";
+            return info;
+        }
+        info.board = device.board_name();
+        info.version = device.firmware_info();
+    } catch (const std::runtime_error &e) {
+        info.error = e.what();
+    }
+    return info;
+}
+
+std::vector<device_info> enumerate_devices()
+{
+    std::vector<usb_serial_port> ports = device_registry::instance().ports();
+
+    std::vector<device_info> devices(ports.size());
+    if (ports.empty())
+        return devices;
+    worker_pool pool((unsigned)ports.size());
+    pool.run(ports.size(), [&](size_t index) {
+        devices[index] = identify_device(ports[index].path);
+        devices[index].serial_number = ports[index].serial_number;
+    });
+    return devices;
+}
+
+// --- Fleet -----------------------------------------------------------------
+
+class fleet_impl
+{
+public:
+    std::vector<device_info> m_devices;
+    std::vector<std::unique_ptr<nanovna::device>> m_nanovnas;
+    std::vector<std::unique_ptr<tinysa::device>> m_tinysas;
+    worker_pool m_pool;
+
+    fleet_impl(const std::vector<device_info> &devices, unsigned threads) :
+        m_devices(devices), m_nanovnas(devices.size()), m_tinysas(devices.size()), 
+        m_pool(threads != 0 ? threads : (unsigned)std::max<size_t>(devices.size(), 1))
+    {}
+
+    template<class T, class F>
+    std::vector<fleet_result<T>> collect(F capture)
+    {
+        std::vector<fleet_result<T>> results(m_devices.size());
+        m_pool.run(m_devices.size(), [&](size_t index) {
+            try {
+                results[index].value = capture(index);
+            } catch (const std::exception &e) {
+                results[index].error = e.what();
+            }
+        });
+        return results;
+    }
+};
+
+fleet::fleet(const std::vector<device_info> &devices, unsigned threads) : 
+    m_i(new fleet_impl(devices, threads))
+{}
+
+fleet::~fleet()
+{
+    delete m_i;
+}
+
+const std::vector<device_info> &fleet::devices() const
+{
+    return m_i->m_devices;
+}
+
+size_t fleet::open()
+{
+    std::vector<std::string> errors = for_each([this](size_t index) {
+        device_info &info = m_i->m_devices[index];
+        if (info.is_nanovna()) {
+            std::unique_ptr<nanovna::device> device(new nanovna::device);
+            if (!device->open(info.path))
+                throw std::runtime_error("cannot open serial port");
+            m_i->m_nanovnas[index] = std::move(device);
+        } else if (info.is_tinysa()) {
+            std::unique_ptr<tinysa::device> device(new tinysa::device);
+            if (!device->open(info.path))
+                throw std::runtime_error("cannot open serial port");
+            m_i->m_tinysas[index] = std::move(device);
+        } else if (info.error.empty()) {
+            throw std::runtime_error("device was not identified");
+        }
+    });
+
+    size_t opened = 0;
+    for (size_t index = 0; index < errors.size(); index++) {
+        if (!errors[index].empty())
+            m_i->m_devices[index].error = errors[index];
+        if (m_i->m_nanovnas[index] || m_i->m_tinysas[index])
+            opened++;
+    }
+    return opened;
+}
+
+void fleet::close()
+{
+    for (auto &device : m_i->m_nanovnas)
+        device.reset();
+    for (auto &device : m_i->m_tinysas)
+        device.reset();
+}
+
+nanovna::device *fleet::nanovna(size_t index)
+{
+    return m_i->m_nanovnas.at(index).get();
+}
+
+tinysa::device *fleet::tinysa(size_t index)
+{
+    return m_i->m_tinysas.at(index).get();
+}
+
+std::vector<std::string> fleet::for_each(const std::function<void(size_t index)> &job)
+{
+    std::vector<std::string> errors(m_i->m_devices.size());
+    m_i->m_pool.run(m_i->m_devices.size(), [&](size_t index) {
+        try {
+            job(index);
+        } catch (const std::exception &e) {
+            errors[index] = e.what();
+        }
+    });
+    return errors;
+}
+
+std::vector<fleet_result<std::vector<nanovna::point>>> fleet::capture_data(unsigned ports, nanovna::transfer mode)
+{
+    return m_i->collect<std::vector<nanovna::point>>([&](size_t index) {
+        nanovna::device *device = nanovna(index);
+        if (device == nullptr)
+            throw std::runtime_error("not an open NanoVNA");
+        return device->capture_data(ports, mode);
+    });
+}
+
+std::vector<fleet_result<std::string>> fleet::capture_touchstone(unsigned ports, nanovna::transfer mode)
+{
+    return m_i->collect<std::string>([&](size_t index) {
+        nanovna::device *device = nanovna(index);
+        if (device == nullptr)
+            throw std::runtime_error("not an open NanoVNA");
+        return device->capture_touchstone(ports, mode);
+    });
+}
+
+std::vector<fleet_result<screenshot>> fleet::capture_screenshot()
+{
+    return m_i->collect<screenshot>([&](size_t index) {
+        screenshot result;
+        if (nanovna::device *device = nanovna(index))
+            result.data = device->capture_screenshot(result.width, result.height);
+        else if (tinysa::device *device = tinysa(index))
+            result.data = device->capture_screenshot(result.width, result.height);
+        else
+            throw std::runtime_error("not an open device");
+        return result;
+    });
+}
+
+}
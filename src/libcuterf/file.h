@@ -0,0 +1,47 @@
+#ifndef LIBCUTERF_FILE_H
+#define LIBCUTERF_FILE_H
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+#include <cstdio>
+#include <string>
+
+namespace cuterf {
+
+#ifndef _WIN32
+// Paths are ASCII in practice, but anything else is round-tripped through UTF-8.
+std::string narrow_path(const std::wstring &wide);
+#endif
+
+// Opens a file by its wide-character path, like _wfopen().
+FILE *open_file(const std::wstring &path, const char *mode);
+
+// Read-only mapping of a whole file. Pages are loaded by the OS on first access, so only
+// the parts of a file that are actually read take up memory.
+struct mapped_file
+{
+#ifdef _WIN32
+    HANDLE hFile, hMapping;
+#else
+    int fd;
+#endif
+    const char *data;
+    size_t size;
+
+    mapped_file();
+    ~mapped_file();
+    bool is_open() const;
+
+    bool open(const std::wstring &path);
+    // Maps a file for reading and writing, creating it, or extending it to `initial_size`
+    // if it is empty. Changes reach the file when the OS writes the pages back.
+    bool open_writable(const std::wstring &path, size_t initial_size);
+    void close();
+
+    char *writable_data() const { return const_cast<char *>(data); }
+};
+
+}
+
+#endif // LIBCUTERF_FILE_H
@@ -0,0 +1,120 @@
+#include <cstdint>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "file.h"
+
+namespace cuterf {
+
+std::string narrow_path(const std::wstring &wide)
+{
+    std::string result;
+    for (wchar_t wc : wide) {
+        uint32_t c = (uint32_t)wc;
+        if (c < 0x80) {
+            result += (char)c;
+        } else if (c < 0x800) {
+            result += (char)(0xc0 | (c >> 6));
+            result += (char)(0x80 | (c & 0x3f));
+        } else if (c < 0x10000) {
+            result += (char)(0xe0 | (c >> 12));
+            result += (char)(0x80 | ((c >> 6) & 0x3f));
+            result += (char)(0x80 | (c & 0x3f));
+        } else {
+            result += (char)(0xf0 | (c >> 18));
+            result += (char)(0x80 | ((c >> 12) & 0x3f));
+            result += (char)(0x80 | ((c >> 6) & 0x3f));
+            result += (char)(0x80 | (c & 0x3f));
+        }
+    }
+    return result;
+}
+
+FILE *open_file(const std::wstring &path, const char *mode)
+{
+    return fopen(narrow_path(path).c_str(), mode);
+}
+
+mapped_file::mapped_file() : fd(-1), data(nullptr), size(0)
+{}
+
+mapped_file::~mapped_file()
+{
+    close();
+}
+
+bool mapped_file::is_open() const
+{
+    return fd != -1;
+}
+
+bool mapped_file::open(const std::wstring &path)
+{
+    close();
+    fd = ::open(narrow_path(path).c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close();
+        return false;
+    }
+    size = (size_t)st.st_size;
+    if (size == 0)
+        return true;
+
+    void *mapping = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED) {
+        close();
+        return false;
+    }
+    data = (const char *)mapping;
+    return true;
+}
+
+bool mapped_file::open_writable(const std::wstring &path, size_t initial_size)
+{
+    close();
+    fd = ::open(narrow_path(path).c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+    if (fd == -1)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close();
+        return false;
+    }
+    size = (size_t)st.st_size;
+    if (size == 0) {
+        if (ftruncate(fd, (off_t)initial_size) != 0) {
+            close();
+            return false;
+        }
+        size = initial_size;
+    }
+    if (size == 0)
+        return true;
+
+    void *mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED) {
+        close();
+        return false;
+    }
+    data = (const char *)mapping;
+    return true;
+}
+
+void mapped_file::close()
+{
+    if (data != nullptr)
+        munmap((void *)data, size);
+    if (fd != -1)
+        ::close(fd);
+    fd = -1;
+    data = nullptr;
+    size = 0;
+}
+
+}
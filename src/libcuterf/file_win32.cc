@@ -0,0 +1,107 @@
+#include <cstring>
+#include "file.h"
+
+namespace cuterf {
+
+FILE *open_file(const std::wstring &path, const char *mode)
+{
+    std::wstring wide_mode(mode, mode + strlen(mode));
+    return _wfopen(path.c_str(), wide_mode.c_str());
+}
+
+mapped_file::mapped_file() : hFile(INVALID_HANDLE_VALUE), hMapping(NULL), data(nullptr), size(0)
+{}
+
+mapped_file::~mapped_file()
+{
+    close();
+}
+
+bool mapped_file::is_open() const
+{
+    return hFile != INVALID_HANDLE_VALUE;
+}
+
+bool mapped_file::open(const std::wstring &path)
+{
+    close();
+    hFile = CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 
+        FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER liSize;
+    if (!GetFileSizeEx(hFile, &liSize)) {
+        close();
+        return false;
+    }
+    size = (size_t)liSize.QuadPart;
+    if (size == 0)
+        return true;
+
+    hMapping = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (hMapping == NULL) {
+        close();
+        return false;
+    }
+    data = (const char *)MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+    if (data == nullptr) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool mapped_file::open_writable(const std::wstring &path, size_t initial_size)
+{
+    close();
+    hFile = CreateFile(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_ALWAYS,
+        FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER liSize;
+    if (!GetFileSizeEx(hFile, &liSize)) {
+        close();
+        return false;
+    }
+    size = (size_t)liSize.QuadPart;
+    if (size == 0) {
+        liSize.QuadPart = (LONGLONG)initial_size;
+        if (!SetFilePointerEx(hFile, liSize, NULL, FILE_BEGIN) || !SetEndOfFile(hFile)) {
+            close();
+            return false;
+        }
+        size = initial_size;
+    }
+    if (size == 0)
+        return true;
+
+    hMapping = CreateFileMapping(hFile, NULL, PAGE_READWRITE, 0, 0, NULL);
+    if (hMapping == NULL) {
+        close();
+        return false;
+    }
+    data = (const char *)MapViewOfFile(hMapping, FILE_MAP_WRITE, 0, 0, 0);
+    if (data == nullptr) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void mapped_file::close()
+{
+    if (data != nullptr)
+        UnmapViewOfFile(data);
+    if (hMapping != NULL)
+        CloseHandle(hMapping);
+    if (hFile != INVALID_HANDLE_VALUE)
+        CloseHandle(hFile);
+    hFile = INVALID_HANDLE_VALUE;
+    hMapping = NULL;
+    data = nullptr;
+    size = 0;
+}
+
+}
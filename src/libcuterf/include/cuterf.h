@@ -1,12 +1,231 @@
 #ifndef LIBCUTERF_CUTERF_H
 #define LIBCUTERF_CUTERF_H
 
+#include <chrono>
 #include <complex>
+#include <coroutine>
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <functional>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
 
 namespace cuterf {
 
+struct screenshot
+{
+    std::string data; // RGB565, big-endian
+    size_t width, height;
+};
+
+// A rectangle of the screen that the device redrew, sent while mirroring.
+struct screen_region
+{
+    unsigned x, y, width, height;
+    bool fill;        // if true, the whole region is the single pixel in `data`
+    std::string data; // RGB565, big-endian
+};
+
+namespace touchstone {
+
+class sink;
+
+};
+
+namespace nanovna {
+
+class device;
+
+};
+
+namespace tinysa {
+
+class device;
+
+};
+
+// --- Errors ----------------------------------------------------------------
+
+// Thrown when a device does not answer a command in time (see set_timeout()). The device
+// stays open, and is resynchronized with before the next command.
+class timeout_error : public std::runtime_error
+{
+public:
+    using std::runtime_error::runtime_error;
+};
+
+// Thrown in place of the result of an operation that was cancelled (see cancel()).
+class cancelled_error : public std::runtime_error
+{
+public:
+    using std::runtime_error::runtime_error;
+};
+
+// --- Asynchronous I/O ------------------------------------------------------
+
+template<class T>
+struct async_result
+{
+    T value;
+    std::exception_ptr error; // null on success
+
+    bool ok() const { return !error; }
+    // Returns the value, or rethrows the error.
+    T &get()
+    {
+        if (error)
+            std::rethrow_exception(error);
+        return value;
+    }
+};
+
+template<class T>
+using async_handler = std::function<void(async_result<T> &result)>;
+
+// What the coroutine forms of the *_async() methods return. The operation starts when it is
+// awaited, the coroutine is resumed from io_loop::run() once it completes, and co_await
+// returns its value or rethrows its error, such as timeout_error or cancelled_error.
+template<class T>
+class awaitable
+{
+public:
+    explicit awaitable(std::function<void(async_handler<T> handler)> start) : m_start(std::move(start)) {}
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> waiting)
+    {
+        // the coroutine may finish, destroying this, before m_start() returns
+        m_start([this, waiting](async_result<T> &result) {
+            m_result = std::move(result);
+            waiting.resume();
+        });
+    }
+    T await_resume() { return std::move(m_result.get()); }
+
+private:
+    std::function<void(async_handler<T> handler)> m_start;
+    async_result<T> m_result;
+};
+
+// A coroutine that awaits devices on an io_loop. It runs from the call up to its first
+// co_await, and from then on within io_loop::run(); it must be kept until done().
+class task
+{
+public:
+    struct promise_type
+    {
+        std::exception_ptr error;
+
+        task get_return_object() { return task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { error = std::current_exception(); }
+    };
+
+    task(task &&other) noexcept : m_coroutine(std::exchange(other.m_coroutine, nullptr)) {}
+    task(const task &) = delete;
+    task &operator=(const task &) = delete;
+    ~task()
+    {
+        if (m_coroutine)
+            m_coroutine.destroy();
+    }
+
+    bool done() const { return m_coroutine.done(); }
+    // Rethrows the exception that ended the coroutine, if any.
+    void get() const
+    {
+        if (!done())
+            throw std::logic_error("task has not finished!");
+        if (m_coroutine.promise().error)
+            std::rethrow_exception(m_coroutine.promise().error);
+    }
+
+private:
+    std::coroutine_handle<promise_type> m_coroutine;
+
+    explicit task(std::coroutine_handle<promise_type> coroutine) : m_coroutine(coroutine) {}
+};
+
+class io_loop_impl;
+
+// Drives the asynchronous operations of any number of devices from the thread that calls
+// run(), waiting for all of their ports at once (with epoll on Linux). Operations are started
+// by the *_async() methods of nanovna::device and tinysa::device, and their handlers are
+// called from run(); a handler may start the next operation. A task awaiting the coroutine
+// forms of those methods is resumed from run() in the same way. A device has at most one
+// operation in progress, may not be used otherwise meanwhile, and must outlive it.
+class io_loop
+{
+private:
+    io_loop_impl *m_i;
+
+    friend class nanovna::device;
+    friend class tinysa::device;
+
+public:
+    io_loop();
+    ~io_loop();
+    io_loop(const io_loop &) = delete;
+    io_loop &operator=(const io_loop &) = delete;
+
+    // Runs until no operations are in progress, or until stop().
+    void run();
+    // As run(), but returns after at most `timeout_ms`; returns false if operations are still
+    // in progress.
+    bool run_for(unsigned timeout_ms);
+    // Makes run() return once the handlers being called have returned. May be called from
+    // any thread.
+    void stop();
+    size_t pending() const;
+};
+
+// --- Statistics ------------------------------------------------------------
+
+// Histogram of durations in nanoseconds, in the manner of HdrHistogram: each power of two is
+// split into 32 linear sub-buckets, so any value is kept to within 3% in a few KiB, and
+// recording a value takes a handful of instructions.
+class histogram
+{
+public:
+    histogram();
+
+    void record(uint64_t value);
+    void merge(const histogram &other);
+
+    uint64_t count() const { return m_count; }
+    uint64_t min() const { return m_count == 0 ? 0 : m_min; }
+    uint64_t max() const { return m_max; }
+    double mean() const { return m_count == 0 ? 0 : m_sum / m_count; }
+    // The value that `percent` of the recorded values are at most, to bucket precision.
+    uint64_t percentile(double percent) const;
+
+private:
+    std::vector<uint64_t> m_counts;
+    uint64_t m_count, m_min, m_max;
+    double m_sum;
+};
+
+// Measurements of every execution of a shell command, named by the first word of its line.
+struct command_stats
+{
+    std::string command;
+    uint64_t calls;
+    uint64_t bytes_written;
+    uint64_t bytes_read; // echo, output and prompt
+    uint64_t syscalls;   // reads and writes of the serial port
+    histogram echo;      // from writing the command until its echo was read
+    histogram prompt;    // from writing the command until the prompt after its output
+    histogram parse;     // decoding the output
+
+    command_stats() : calls(0), bytes_written(0), bytes_read(0), syscalls(0) {}
+};
+
 // --- NanoVNA ---------------------------------------------------------------
 
 namespace nanovna {
@@ -21,6 +240,37 @@ struct point
     std::complex<float> s21;
 };
 
+// A sweep acquired while streaming.
+struct sweep
+{
+    uint64_t sequence; // counts every sweep acquired, so gaps show dropped sweeps
+    std::chrono::system_clock::time_point timestamp;
+    std::vector<point> points;
+};
+
+struct stream_counters
+{
+    uint64_t acquired;  // sweeps read from the device
+    uint64_t delivered; // sweeps handed to the consumer
+    uint64_t overruns;  // sweeps dropped because the consumer fell behind
+};
+
+// Timing of a segmented sweep.
+struct segment_stats
+{
+    size_t segments;
+    size_t scanned;       // points scanned, counting overlaps
+    double seconds;       // from the first scan to the last
+    float max_seam_error; // largest difference between two scans of the same point
+};
+
+// How sweep data is transferred from the device.
+enum class transfer 
+{
+    binary, // one `scan_bin` transaction with packed little-endian values; performs a sweep
+    text,   // `data N` for each port; returns the data of the last sweep as displayed
+};
+
 class device_impl;
 
 class device 
@@ -45,11 +295,75 @@ public:
     float edelay(); // in ps
     float s21offset(); // in dB
 
+    // Each command must be answered within `timeout_ms` of being written, or of the command
+    // before it completing, or fails with timeout_error; 0 waits forever. 60 s by default.
+    void set_timeout(unsigned timeout_ms);
+    // Makes the operation waiting for the device, blocking or asynchronous, fail with
+    // cancelled_error; if none is, the next one that waits. May be called from any thread.
+    void cancel();
+
+    // Runs a shell command and returns its output.
+    std::string run(const std::string &command);
+
+    // Per-command statistics, collected only while enabled. Enabling before open() also
+    // measures the commands that identify the device. Asynchronous operations are not
+    // measured.
+    void enable_stats(bool enable = true);
+    std::vector<command_stats> stats() const;
+
     std::string capture_screenshot(size_t &width, size_t &height);
 
     std::vector<std::string> capture_header();
-    std::vector<point> capture_data(unsigned ports);
-    std::string capture_touchstone(unsigned ports);
+    std::vector<point> capture_data(unsigned ports, transfer mode = transfer::binary);
+    // Asynchronous forms of run() and capture_data(), completed by `loop`.
+    void run_async(io_loop &loop, const std::string &command, async_handler<std::string> handler);
+    void capture_data_async(io_loop &loop, unsigned ports, transfer mode, async_handler<std::vector<point>> handler);
+    // The same, for a coroutine to co_await.
+    awaitable<std::string> run(io_loop &loop, const std::string &command);
+    awaitable<std::vector<point>> capture_data(io_loop &loop, unsigned ports, transfer mode = transfer::binary);
+    // Captures the data of `ports` ports (none if 0) and, where not null, the screen, the
+    // e-delay and the S21 offset, in a single pipelined exchange. The other captures are made
+    // of this one.
+    std::vector<point> capture(unsigned ports, transfer mode, screenshot *screen, float *edelay, float *s21offset);
+    std::string capture_touchstone(unsigned ports, transfer mode = transfer::binary);
+    // Captures the screen, then the Touchstone data, in a single pipelined exchange.
+    std::string capture_touchstone(unsigned ports, transfer mode, screenshot &screen);
+    // As above, but formats straight into `output` instead of building the file in memory.
+    // Nothing is written until the capture has completed.
+    void capture_touchstone(touchstone::sink &output, unsigned ports, transfer mode = transfer::binary,
+        screenshot *screen = nullptr);
+
+    // Sweeps `points` points from `start` to `stop` Hz, beyond the 401 points of one sweep, as
+    // consecutive binary scans of at most `segment_points` points. Each scan after the first
+    // repeats the last `overlap` points of the one before, which are dropped, since the first
+    // points after retuning are the least settled. Scans are pipelined, so that the device
+    // finds the next command waiting, and the span shown on screen is restored afterwards.
+    std::vector<point> capture_segmented(unsigned start, unsigned stop, size_t points, unsigned ports,
+        unsigned segment_points = 401, unsigned overlap = 0, segment_stats *stats = nullptr);
+
+    // Starts sweeping the current span continuously on a background thread. Sweeps are
+    // transferred in binary and queued in a ring of `capacity` preallocated buffers; when
+    // the ring is full, new sweeps are dropped and counted as overruns. No other commands
+    // may be issued until stop_streaming().
+    void start_streaming(unsigned ports, size_t capacity = 64);
+    // As above, but `callback` is invoked for each sweep on a separate dispatch thread.
+    void start_streaming(unsigned ports, size_t capacity, std::function<void(const sweep &)> callback);
+    // Waits up to `timeout_ms` for the next sweep; returns false on timeout. The buffer of
+    // `frame` is swapped into the ring, so reusing a frame keeps streaming allocation-free.
+    bool read_sweep(sweep &frame, unsigned timeout_ms);
+    // Stops streaming, and rethrows an error that ended acquisition, if any.
+    void stop_streaming();
+    bool is_streaming() const;
+    stream_counters stream_stats() const;
+
+    // Turns on the remote desktop stream (`refresh on`), in which the firmware sends each
+    // region of the screen as it is redrawn, far less data per frame than a screenshot. No
+    // other commands may be issued until stop_mirroring().
+    void start_mirroring();
+    // Waits up to `timeout_ms` for the next redrawn region; returns false on timeout.
+    bool read_screen_region(screen_region &region, unsigned timeout_ms);
+    void stop_mirroring();
+    bool is_mirroring() const;
 };
 
 };
@@ -61,6 +375,20 @@ namespace tinysa {
 constexpr uint16_t VID = 0x0483;
 constexpr uint16_t PID = 0x5740;
 
+// A measured spectrum.
+struct trace
+{
+    std::vector<uint64_t> freq; // in Hz
+    std::vector<float> level;   // in dBm
+};
+
+// How trace data is transferred from the device.
+enum class transfer
+{
+    binary, // one `scanraw` transaction with three bytes per point; performs a sweep
+    text,   // `frequencies` and `data 2`; returns the measured trace as displayed
+};
+
 class device_impl;
 
 class device 
@@ -82,7 +410,611 @@ public:
     std::string hardware_version() const;
     std::string firmware_version() const;
 
+    // As nanovna::device.
+    void set_timeout(unsigned timeout_ms);
+    void cancel();
+    std::string run(const std::string &command);
+    void enable_stats(bool enable = true);
+    std::vector<command_stats> stats() const;
+
     std::string capture_screenshot(size_t &width, size_t &height);
+
+    // Captures the span displayed on screen. A binary capture falls back to text if the
+    // firmware lacks `scanraw`.
+    trace capture_trace(transfer mode = transfer::binary);
+    // Asynchronous forms of run() and capture_trace(), completed by `loop`.
+    void run_async(io_loop &loop, const std::string &command, async_handler<std::string> handler);
+    void capture_trace_async(io_loop &loop, transfer mode, async_handler<trace> handler);
+    // The same, for a coroutine to co_await.
+    awaitable<std::string> run(io_loop &loop, const std::string &command);
+    awaitable<trace> capture_trace(io_loop &loop, transfer mode = transfer::binary);
+    // Scans `points` points from `start` to `stop` Hz with `scanraw`, which is not limited to
+    // the points of a trace (290 on TinySA, 450 on TinySA Ultra).
+    trace capture_trace(uint64_t start, uint64_t stop, unsigned points);
+
+    // As nanovna::device.
+    void start_mirroring();
+    bool read_screen_region(screen_region &region, unsigned timeout_ms);
+    void stop_mirroring();
+    bool is_mirroring() const;
+};
+
+};
+
+// --- Touchstone -----------------------------------------------------------
+
+namespace touchstone {
+
+// Destination for formatted Touchstone data, which is written in chunks of a few KiB.
+class sink
+{
+public:
+    virtual ~sink() {}
+    virtual void write(const char *data, size_t size) = 0;
+};
+
+class string_sink : public sink
+{
+private:
+    std::string &m_target;
+
+public:
+    explicit string_sink(std::string &target) : m_target(target) {}
+
+    void write(const char *data, size_t size) override;
+};
+
+// Write errors are left for the caller to check with ferror().
+class file_sink : public sink
+{
+private:
+    FILE *m_file;
+
+public:
+    explicit file_sink(FILE *file) : m_file(file) {}
+
+    void write(const char *data, size_t size) override;
+};
+
+// Formats NanoVNA data as Touchstone v1 (Hz, RI, 50 Ohm) into a fixed buffer using
+// std::to_chars. The output is byte-for-byte what `%10u` and `%+12.9f` would produce.
+// Buffered output reaches the sink on flush(), which the destructor does not do.
+class writer
+{
+private:
+    static const size_t CAPACITY = 16384;
+
+    sink &m_output;
+    unsigned m_ports;
+    char m_buffer[CAPACITY];
+    size_t m_used;
+
+    void append(const char *data, size_t size);
+
+public:
+    writer(sink &output, unsigned ports);
+
+    void comment(const std::string &line); // "! line"
+    void header(const std::vector<std::string> &comments); // comments, then the option line
+    void point(const nanovna::point &point);
+    void points(const std::vector<nanovna::point> &points);
+    void flush();
+};
+
+struct document
+{
+    std::vector<std::string> comments; // without the leading "! "
+    unsigned ports;
+    std::vector<nanovna::point> points; // S12 and S22 are not kept
+};
+
+// Parses Touchstone v1 S-parameters for 1 or 2 ports, in any frequency unit and in RI, MA
+// or DB format; values are converted to Hz and RI. The number of ports is inferred from
+// the number of values per line.
+document parse(std::string_view text);
+
+};
+
+// --- Archive ---------------------------------------------------------------
+
+// Sweeps stored in a compact binary file. Each sweep is a chunk holding its timestamp and
+// header lines, followed by a frequency column and one complex column per parameter, and
+// an index at the end of the file locates every chunk. Archives are read through a memory
+// mapping, so opening one does not read it, and any sweep is found in constant time.
+namespace archive {
+
+// A sweep inside a mapped archive. The columns point into the mapping and are valid until
+// the reader is closed.
+struct sweep_view
+{
+    std::chrono::system_clock::time_point timestamp;
+    unsigned ports;
+    size_t points;
+    std::string_view header; // lines separated by '\n'
+    const uint32_t *freq;
+    const std::complex<float> *s11;
+    const std::complex<float> *s21; // null for 1-port sweeps
+
+    std::vector<std::string> header_lines() const;
+    nanovna::point point(size_t index) const;
+    std::vector<nanovna::point> to_points() const;
+};
+
+class writer_impl;
+
+class writer
+{
+private:
+    writer_impl *m_i;
+
+public:
+    writer();
+    ~writer();
+
+    // Creates the archive, or opens it for appending if it exists. Returns false if the
+    // file cannot be opened; throws if it is not an archive.
+    bool open(const std::wstring &path);
+    // Writes the index. A writer that is not closed leaves an unindexed archive, which can
+    // still be read, by walking its chunks.
+    void close();
+
+    size_t size() const;
+    void append(std::chrono::system_clock::time_point timestamp, const std::vector<std::string> &header,
+        unsigned ports, const std::vector<nanovna::point> &points);
+};
+
+class reader_impl;
+
+class reader
+{
+private:
+    reader_impl *m_i;
+
+public:
+    reader();
+    ~reader();
+
+    // Returns false if the file cannot be opened; throws if it is not an archive.
+    bool open(const std::wstring &path);
+    void close();
+
+    size_t size() const;
+    sweep_view sweep(size_t index) const;
+};
+
+};
+
+// --- Time domain -----------------------------------------------------------
+
+// Time-domain reflectometry (S11) and transmission (S21) from a sweep over a linear
+// frequency grid. A plan holds the window, FFT tables and buffers for one number of points,
+// so that transforming every sweep of a stream does not allocate.
+namespace tdr {
+
+enum class mode
+{
+    lowpass_impulse, // real response; the sweep should start at its frequency step
+    lowpass_step,    // integral of the lowpass impulse response; settles at the DC value
+    bandpass,        // magnitude of the complex response; any linear sweep
+};
+
+enum class window
+{
+    rectangular,
+    hann,
+    kaiser,
+};
+
+enum class parameter
+{
+    s11,
+    s21,
+};
+
+struct options
+{
+    tdr::mode mode;
+    tdr::window window;
+    float kaiser_beta;     // 0 is rectangular; 6 is the NanoVNA "normal" window
+    unsigned oversampling; // the FFT is at least this many times longer than the spectrum
+
+    options(); // lowpass_step, Kaiser, beta 6, oversampling 4
+};
+
+struct response
+{
+    double time_step;          // seconds between samples
+    std::vector<float> values; // from time 0, over half of the unambiguous range
+};
+
+class plan_impl;
+
+class plan
+{
+private:
+    plan_impl *m_i;
+
+public:
+    explicit plan(size_t points, const options &opts = options());
+    ~plan();
+
+    size_t points() const;
+    size_t size() const; // samples in each response
+
+    // Throws if the sweep does not have points() points or its frequencies are not increasing.
+    // `result` is resized, so reusing it keeps transforms allocation-free.
+    void transform(const std::vector<nanovna::point> &sweep, parameter which, response &result);
+    void transform(const archive::sweep_view &sweep, parameter which, response &result);
+};
+
+// One-way distance along a line to the feature seen at `time`; a reflection (S11) covers
+// the line twice.
+double distance(double time, double velocity_factor, parameter which);
+
+};
+
+// --- Calibration -----------------------------------------------------------
+
+// Host-side SOLT calibration, for fixtures that are swapped more often than the device can be
+// recalibrated, and for spans other than the one it was calibrated over. NanoVNA measures in
+// one direction only, so of the 12-term two-port error model the six forward terms apply;
+// the S22 of the device under test is taken to be 0. Standards and sweeps to be corrected
+// should be captured with the calibration on the device turned off.
+namespace calibration {
+
+// Models of the standards.
+struct kit
+{
+    double open_capacitance; // in F
+    double open_delay;       // in s, one way
+    double short_inductance; // in H
+    double short_delay;      // in s, one way
+    double load_resistance;  // in ohms
+    double thru_delay;       // in s
+
+    kit(); // ideal open and short, 50 ohm load, zero-length thru
+};
+
+// Sweeps of the standards, all over the same frequencies. The S11 of the thru gives the load
+// match of port 2; `isolation`, with loads on both ports, may be left empty.
+struct standards
+{
+    std::vector<nanovna::point> open, short_circuit, load, thru, isolation;
+};
+
+struct terms
+{
+    unsigned freq;
+    std::complex<float> e00, e11, e10e01; // directivity, source match, reflection tracking
+    std::complex<float> e30, e22, e10e32; // isolation, load match, transmission tracking
+};
+
+class model_impl;
+
+// Error terms at the frequencies of the standards, interpolated linearly to those of each
+// sweep corrected. Sweeps over the frequencies of the one before (as when streaming) reuse
+// the interpolated terms, and are corrected by SIMD kernels, so that correction does not
+// allocate and keeps up with any acquisition. Not thread-safe.
+class model
+{
+private:
+    model_impl *m_i;
+
+public:
+    model();
+    ~model();
+    model(const model &) = delete;
+    model &operator=(const model &) = delete;
+
+    // Throws if the sweeps have fewer than 2 points, or frequencies that differ or do not
+    // increase.
+    void solve(const standards &measured, const kit &standard = kit());
+    // Returns false if the file cannot be opened; throws if it is not a calibration.
+    bool load(const std::wstring &path);
+    // Writes the terms in 52 bytes per frequency. Returns false if the file cannot be created.
+    bool save(const std::wstring &path) const;
+
+    const std::vector<terms> &error_terms() const;
+
+    // Corrects S11 to the input reflection of the device under test, with port 2 connected,
+    // and S21 to its transmission. Throws if the sweep extends beyond the calibrated span.
+    void apply(std::vector<nanovna::point> &sweep);
+    void apply(nanovna::point *sweep, size_t points);
+};
+
+};
+
+// --- Waterfall -------------------------------------------------------------
+
+// Spectrogram of TinySA traces in a fixed-size, memory-mapped ring file. Tier 0 keeps the most
+// recent traces as they were captured; each further tier keeps rows that fold `factor` times
+// as many traces into their minimum, maximum and mean, so that a file of a few hundred MiB
+// covers days of scanning at full detail for the last minutes.
+namespace waterfall {
+
+struct layout
+{
+    unsigned points;
+    uint64_t start, stop; // in Hz
+    unsigned rows;        // per tier, including the one being folded
+    unsigned tiers;       // 1 to 8
+    unsigned factor;      // rows of a tier folded into each row of the next
+
+    layout(); // 450 points, 4096 rows, 4 tiers, factor 8
+    size_t file_size() const;
+};
+
+// A row inside a mapped waterfall, valid until the file is closed. In tier 0, `min`, `max`
+// and `mean` all point to the trace.
+struct row_view
+{
+    std::chrono::system_clock::time_point first, last;
+    unsigned traces;
+    const float *min, *max, *mean; // in dBm, `points` each
+};
+
+class recorder_impl;
+
+class recorder
+{
+private:
+    recorder_impl *m_i;
+
+public:
+    recorder();
+    ~recorder();
+
+    // Creates the file, or reopens it to continue recording if it has the same layout.
+    // Returns false if the file cannot be opened; throws if it has a different layout.
+    bool open(const std::wstring &path, const waterfall::layout &layout);
+    void close();
+
+    const waterfall::layout &layout() const;
+    size_t rows(unsigned tier) const;
+    // Throws if the trace does not match the points and span of the layout.
+    void append(std::chrono::system_clock::time_point timestamp, const tinysa::trace &data);
+};
+
+class reader_impl;
+
+class reader
+{
+private:
+    reader_impl *m_i;
+
+public:
+    reader();
+    ~reader();
+
+    // Returns false if the file cannot be opened; throws if it is not a waterfall.
+    bool open(const std::wstring &path);
+    void close();
+
+    const waterfall::layout &layout() const;
+    size_t rows(unsigned tier) const;      // complete rows, at most layout().rows - 1
+    row_view row(unsigned tier, size_t index) const; // 0 is the oldest
+    // Index of the first row that ends at or after `time`; rows(tier) if there is none.
+    size_t find(unsigned tier, std::chrono::system_clock::time_point time) const;
+};
+
+// Rows of one tier that show a time window.
+struct selection
+{
+    unsigned tier;
+    size_t first, count;
+};
+
+// Picks the finest tier that holds the whole window from `from` to `to` in at most `max_rows`
+// rows, or the most recent `max_rows` rows of the coarsest tier if none does.
+selection select(const reader &source, std::chrono::system_clock::time_point from,
+    std::chrono::system_clock::time_point to, size_t max_rows);
+
+enum class statistic
+{
+    min,
+    max,
+    mean,
+};
+
+// Colors a row, from black at `floor` dBm through blue, cyan, yellow and red to white at
+// `ceiling` dBm, as `points` RGB24 pixels.
+void render_row(const row_view &row, size_t points, statistic which, float floor, float ceiling, uint8_t *rgb24);
+
+};
+
+// --- PNG text --------------------------------------------------------------
+
+// Reads the text stored under `keyword` in a tEXt, zTXt or iTXt chunk of a PNG file, such
+// as the Touchstone data that nanovna_screenshot embeds. The file is memory-mapped and its
+// chunks are walked by length, so the image data is never read, and only the matching chunk
+// is inflated. Returns false if the file cannot be read, is not a PNG file, or has no such
+// text.
+bool read_png_text(const std::wstring &path, const std::string &keyword, std::string &text);
+// As above, but reads every text chunk, as (keyword, text) pairs in file order.
+bool read_png_texts(const std::wstring &path, std::vector<std::pair<std::string, std::string>> &texts);
+
+// --- Catalog ---------------------------------------------------------------
+
+// A searchable index of captures: PNG screenshots, with or without embedded Touchstone
+// data, and Touchstone files. Each file is summarized once, from its PNG text chunks and
+// Touchstone `!` header lines, and the summaries are kept in an index file. Updating the
+// index only reads files whose size or modification time changed.
+namespace catalog {
+
+struct entry
+{
+    std::wstring path;
+    uint64_t file_size;
+    int64_t file_time; // modification time, in ticks of std::filesystem::file_time_type
+    std::chrono::system_clock::time_point created; // as recorded, or else the modification time
+    std::string device;   // e.g. "NanoVNA-H 4" or "tinySA Ultra"; empty if unknown
+    std::string firmware;
+    float edelay;         // in ps; 0 if not recorded
+    float s21offset;      // in dB; 0 if not recorded
+    unsigned ports;       // 0 if the file holds no sweep, e.g. a TinySA screenshot
+    uint32_t start, stop; // in Hz
+    uint32_t points;
+};
+
+// Entries match if they satisfy every criterion.
+struct query
+{
+    std::chrono::system_clock::time_point from, to; // inclusive
+    uint32_t min_freq, max_freq; // the sweep must overlap this range
+    std::string device;          // substring of the device or firmware
+    std::wstring path;           // substring of the path
+
+    query(); // matches everything
+};
+
+struct update_stats
+{
+    size_t files;   // files found
+    size_t indexed; // files read because they were new or changed
+    size_t removed; // entries of files that no longer exist
+    size_t failed;  // files that could not be read
+};
+
+class database_impl;
+
+class database
+{
+private:
+    database_impl *m_i;
+
+public:
+    database();
+    ~database();
+
+    // Returns false if the file does not exist; throws if it is not a catalog.
+    bool load(const std::wstring &path);
+    // Replaces the file atomically. Returns false if it cannot be written.
+    bool save(const std::wstring &path) const;
+
+    // Scans files and directories, recursively, for .png, .s1p and .s2p files, on `threads`
+    // threads (0 for one per CPU).
+    update_stats update(const std::vector<std::wstring> &roots, unsigned threads = 0);
+
+    size_t size() const;
+    const entry &at(size_t index) const; // entries are ordered by creation time
+    std::vector<const entry *> find(const query &criteria) const;
+};
+
+};
+
+// --- Discovery -------------------------------------------------------------
+
+// Identity of a connected instrument. NanoVNA and TinySA share the same VID/PID, so each
+// port is opened briefly to tell them apart.
+struct device_info
+{
+    std::wstring path;
+    std::string serial_number; // USB serial number; empty if unknown
+    std::string board;         // "NanoVNA-H 4", "tinySA" or "tinySA Ultra"; empty if unidentified
+    std::string version;       // firmware version
+    std::string error;         // why identification failed, if it did
+
+    bool is_nanovna() const { return board == "NanoVNA-H 4"; }
+    bool is_tinysa() const { return board.compare(0, 6, "tinySA") == 0; }
+};
+
+device_info identify_device(const std::wstring &path);
+
+// Finds and identifies every connected NanoVNA and TinySA, in parallel. The result is
+// ordered by path.
+std::vector<device_info> enumerate_devices();
+
+// --- Fleet -----------------------------------------------------------------
+
+template<class T>
+struct fleet_result
+{
+    T value;
+    std::string error; // empty on success
+
+    bool ok() const { return error.empty(); }
+};
+
+class fleet_impl;
+
+// Drives several instruments concurrently on a pool of worker threads. Each device is used
+// by at most one worker at a time, and results are indexed like devices(), so they do not
+// depend on scheduling. Total capture time approaches that of the slowest device.
+class fleet
+{
+private:
+    fleet_impl *m_i;
+
+public:
+    // `threads` = 0 uses one worker per device.
+    explicit fleet(const std::vector<device_info> &devices, unsigned threads = 0);
+    ~fleet();
+
+    const std::vector<device_info> &devices() const;
+
+    // Opens every identified device; returns the number opened. Failures are reported
+    // through the `error` field of devices().
+    size_t open();
+    void close();
+
+    // Returns nullptr unless the device at `index` is open and of the requested family.
+    nanovna::device *nanovna(size_t index);
+    tinysa::device *tinysa(size_t index);
+
+    // Runs `job` once for every device index; an exception thrown for one device is
+    // recorded as that device's error and does not affect the others.
+    std::vector<std::string> for_each(const std::function<void(size_t index)> &job);
+
+    std::vector<fleet_result<std::vector<nanovna::point>>> capture_data(unsigned ports, 
+        nanovna::transfer mode = nanovna::transfer::binary);
+    std::vector<fleet_result<std::string>> capture_touchstone(unsigned ports, 
+        nanovna::transfer mode = nanovna::transfer::binary);
+    std::vector<fleet_result<screenshot>> capture_screenshot();
+};
+
+// --- Broker ----------------------------------------------------------------
+
+namespace broker {
+
+// The socket a broker listens on, which nanovna::device::open() and tinysa::device::open()
+// try before looking for a device: $CUTERF_BROKER if set, otherwise cuterf-broker.sock in
+// $XDG_RUNTIME_DIR, or broker.sock in /tmp/cuterf-UID, which is created with mode 0700. Empty
+// if that directory belongs to someone else or others may enter it. Either end of the socket
+// refuses a peer that runs as another user.
+std::wstring default_path();
+
+struct server_counters
+{
+    uint64_t requests;     // captures asked for
+    uint64_t transactions; // captures made; fewer than requests if identical ones coalesced
+    uint64_t leases;       // times a client took the device over
+};
+
+class server_impl;
+
+// Keeps one device open, identified once, and makes captures for clients of a Unix-domain
+// socket. Identical captures waiting for the device are made once, and every client that
+// asked is sent the same buffer, which it maps. A client that needs the device for anything
+// else (streaming, mirroring, segmented sweeps) leases it: the broker closes the port for
+// the client to open, and reopens it once the client disconnects. POSIX only.
+class server
+{
+private:
+    server_impl *m_i;
+
+public:
+    server();
+    ~server();
+
+    // Opens the device at `device_path`, or the first one found if empty, and listens on
+    // `socket_path`. Returns false if there is no device; throws if another broker is
+    // listening already.
+    bool open(const std::wstring &device_path = L"", const std::wstring &socket_path = default_path());
+    const device_info &device() const;
+    // Serves clients until stop() is called, from another thread or a signal handler.
+    void serve();
+    void stop();
+    server_counters counters() const;
 };
 
 };
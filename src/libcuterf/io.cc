@@ -0,0 +1,126 @@
+#include <algorithm>
+#include "io.h"
+
+namespace cuterf {
+
+io_loop::io_loop() : m_i(new io_loop_impl)
+{}
+
+io_loop::~io_loop()
+{
+    delete m_i;
+}
+
+void io_loop::run()
+{
+    m_i->run_until((io_loop_impl::clock::time_point::max)());
+}
+
+bool io_loop::run_for(unsigned timeout_ms)
+{
+    m_i->run_until(io_loop_impl::clock::now() + std::chrono::milliseconds(timeout_ms));
+    return m_i->pending() == 0;
+}
+
+void io_loop::stop()
+{
+    m_i->stop();
+}
+
+size_t io_loop::pending() const
+{
+    return m_i->pending();
+}
+
+void io_loop_impl::submit(std::unique_ptr<io_operation> operation)
+{
+    io_operation &submitted = *operation;
+    m_active.push_back(std::move(operation));
+    try {
+        submitted.port->arm();
+        submitted.port->write(submitted.exchange.request());
+        watch(submitted);
+    } catch (...) {
+        finish(submitted, std::current_exception());
+        return;
+    }
+    // bytes read ahead by the port earlier are never signalled
+    service(submitted);
+}
+
+// Takes whatever has arrived for `operation`, and finishes it if that completes it.
+void io_loop_impl::service(io_operation &operation)
+{
+    try {
+        if (operation.port->take_cancellation())
+            throw cancelled_error("operation was cancelled!");
+        char data[4096];
+        size_t completed = operation.exchange.completed();
+        while (size_t count = operation.port->read_available(data, sizeof(data))) {
+            operation.exchange.feed(data, count);
+            if (operation.check)
+                operation.check(operation.exchange);
+            if (operation.exchange.done())
+                break;
+        }
+        if (operation.exchange.done()) {
+            finish(operation, nullptr);
+            return;
+        }
+        if (operation.hangup)
+            throw std::runtime_error("serial port was disconnected");
+        if (operation.exchange.completed() != completed)
+            operation.port->arm();
+    } catch (...) {
+        finish(operation, std::current_exception());
+    }
+}
+
+void io_loop_impl::finish(io_operation &operation, std::exception_ptr error)
+{
+    auto it = std::find_if(m_active.begin(), m_active.end(), 
+        [&](const std::unique_ptr<io_operation> &active) { return active.get() == &operation; });
+    if (it == m_active.end())
+        return; // finished already in this round
+    unwatch(operation);
+    operation.error = error;
+    m_finished.push_back(std::move(*it));
+    m_active.erase(it);
+}
+
+void io_loop_impl::run_until(clock::time_point until)
+{
+    std::vector<io_operation *> ready;
+    while (!m_stopped) {
+        // handlers may start operations, or throw; an operation is gone from m_finished
+        // before its handler is called
+        while (!m_finished.empty() && !m_stopped) {
+            std::unique_ptr<io_operation> operation = std::move(m_finished.front());
+            m_finished.pop_front();
+            operation->finish(operation->exchange, operation->error);
+        }
+        clock::time_point now = clock::now();
+        if (m_active.empty() || m_stopped || now >= until)
+            break;
+
+        clock::time_point wake = until;
+        for (auto &operation : m_active)
+            wake = std::min(wake, operation->port->deadline);
+        ready.clear();
+        wait(wake > now ? wake - now : clock::duration::zero(), ready);
+        for (io_operation *operation : ready)
+            service(*operation);
+
+        now = clock::now();
+        std::vector<io_operation *> expired;
+        for (auto &operation : m_active) {
+            if (operation->port->deadline <= now)
+                expired.push_back(operation.get());
+        }
+        for (io_operation *operation : expired)
+            finish(*operation, std::make_exception_ptr(timeout_error("device did not answer in time!")));
+    }
+    m_stopped = false;
+}
+
+}
@@ -0,0 +1,81 @@
+#ifndef LIBCUTERF_IO_H
+#define LIBCUTERF_IO_H
+
+#include <atomic>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "cuterf.h"
+#include "serial.h"
+#include "shell.h"
+
+namespace cuterf {
+
+// An exchange with a device in progress on an io_loop.
+struct io_operation
+{
+    serial_port *port;
+    shell_exchange exchange;
+    // Called after each read, if set; throws to end the exchange early, when what has
+    // arrived shows that it cannot succeed.
+    std::function<void(const shell_exchange &exchange)> check;
+    // Called from run() once the exchange has completed, or has failed with `error`.
+    std::function<void(shell_exchange &exchange, std::exception_ptr error)> finish;
+
+    std::exception_ptr error;
+    bool hangup; // the port was closed at the other end
+
+    io_operation(serial_port &port, const shell_exchange &exchange) :
+        port(&port), exchange(exchange), hangup(false)
+    {}
+};
+
+// Returns a function reporting an error to `handler`.
+template<class T>
+std::function<void(std::exception_ptr)> async_failure(async_handler<T> handler)
+{
+    return [handler](std::exception_ptr error) {
+        async_result<T> result;
+        result.error = error;
+        handler(result);
+    };
+}
+
+class io_loop_impl
+{
+public:
+    typedef serial_port::clock clock;
+
+    io_loop_impl();
+    ~io_loop_impl();
+
+    // Writes the request of `operation`, whose reply is then awaited along with the others.
+    void submit(std::unique_ptr<io_operation> operation);
+    void run_until(clock::time_point until);
+    void stop();
+    size_t pending() const { return m_active.size() + m_finished.size(); }
+
+private:
+    std::vector<std::unique_ptr<io_operation>> m_active;
+    std::deque<std::unique_ptr<io_operation>> m_finished; // handlers not called yet
+    std::atomic<bool> m_stopped;
+#ifndef _WIN32
+    int m_poll;       // epoll instance; unused where there is no epoll
+    int m_wake_fds[2]; // a pipe, written to by stop()
+#endif
+
+    void service(io_operation &operation);
+    void finish(io_operation &operation, std::exception_ptr error);
+
+    // Platform-specific: watching ports, and waiting until one of them can be read, is
+    // cancelled, or stop() is called, or until `timeout`.
+    void watch(io_operation &operation);
+    void unwatch(io_operation &operation);
+    void wait(clock::duration timeout, std::vector<io_operation *> &ready);
+};
+
+}
+
+#endif // LIBCUTERF_IO_H
@@ -0,0 +1,148 @@
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <stdexcept>
+#include <fcntl.h>
+#include <poll.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+#include <unistd.h>
+#include "io.h"
+
+namespace cuterf {
+
+// On Linux the ports are watched with epoll, so that waiting costs the same however many
+// devices are in flight; elsewhere, a pollfd array is built for each wait.
+
+io_loop_impl::io_loop_impl() : m_stopped(false), m_poll(-1)
+{
+    if (pipe(m_wake_fds) == -1)
+        throw std::runtime_error("pipe() failed");
+    for (int wake_fd : m_wake_fds) {
+        fcntl(wake_fd, F_SETFL, fcntl(wake_fd, F_GETFL) | O_NONBLOCK);
+        fcntl(wake_fd, F_SETFD, FD_CLOEXEC);
+    }
+#ifdef __linux__
+    m_poll = epoll_create1(EPOLL_CLOEXEC);
+    if (m_poll == -1) {
+        ::close(m_wake_fds[0]);
+        ::close(m_wake_fds[1]);
+        throw std::runtime_error("epoll_create1() failed");
+    }
+    struct epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.u64 = 0;
+    epoll_ctl(m_poll, EPOLL_CTL_ADD, m_wake_fds[0], &event);
+#endif
+}
+
+io_loop_impl::~io_loop_impl()
+{
+    for (auto &operation : m_active)
+        unwatch(*operation);
+#ifdef __linux__
+    ::close(m_poll);
+#endif
+    ::close(m_wake_fds[0]);
+    ::close(m_wake_fds[1]);
+}
+
+void io_loop_impl::stop()
+{
+    m_stopped = true;
+    char signal = 0;
+    while (::write(m_wake_fds[1], &signal, 1) == -1 && errno == EINTR)
+        ;
+}
+
+// Epoll events carry the operation, with the low bit set for its cancellation pipe, and
+// zero for the wake pipe.
+static constexpr uint64_t CANCEL_TAG = 1;
+
+void io_loop_impl::watch(io_operation &operation)
+{
+#ifdef __linux__
+    struct epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.u64 = (uint64_t)(uintptr_t)&operation;
+    if (epoll_ctl(m_poll, EPOLL_CTL_ADD, operation.port->fd, &event) == -1)
+        throw std::runtime_error("epoll_ctl() failed");
+    event.data.u64 |= CANCEL_TAG;
+    if (epoll_ctl(m_poll, EPOLL_CTL_ADD, operation.port->cancel_fds[0], &event) == -1) {
+        epoll_ctl(m_poll, EPOLL_CTL_DEL, operation.port->fd, nullptr);
+        throw std::runtime_error("epoll_ctl() failed");
+    }
+#else
+    (void)operation;
+#endif
+}
+
+void io_loop_impl::unwatch(io_operation &operation)
+{
+#ifdef __linux__
+    // fails harmlessly for an operation whose request could not be written
+    epoll_ctl(m_poll, EPOLL_CTL_DEL, operation.port->fd, nullptr);
+    epoll_ctl(m_poll, EPOLL_CTL_DEL, operation.port->cancel_fds[0], nullptr);
+#else
+    (void)operation;
+#endif
+}
+
+static void drain(int fd)
+{
+    char data[64];
+    ssize_t count;
+    while ((count = ::read(fd, data, sizeof(data))) > 0 || (count == -1 && errno == EINTR))
+        ;
+}
+
+void io_loop_impl::wait(clock::duration timeout, std::vector<io_operation *> &ready)
+{
+    int timeout_ms = -1;
+    if (timeout != (clock::duration::max)())
+        timeout_ms = (int)std::min<int64_t>(std::chrono::ceil<std::chrono::milliseconds>(timeout).count(), INT_MAX);
+#ifdef __linux__
+    struct epoll_event events[64];
+    int count = epoll_wait(m_poll, events, 64, timeout_ms);
+    if (count == -1 && errno != EINTR)
+        throw std::runtime_error("epoll_wait() failed");
+    for (int index = 0; index < count; index++) {
+        if (events[index].data.u64 == 0) {
+            drain(m_wake_fds[0]);
+            continue;
+        }
+        io_operation *operation = (io_operation *)(uintptr_t)(events[index].data.u64 & ~CANCEL_TAG);
+        if (!(events[index].data.u64 & CANCEL_TAG) && (events[index].events & (EPOLLHUP | EPOLLERR)))
+            operation->hangup = true;
+        ready.push_back(operation);
+    }
+#else
+    std::vector<struct pollfd> pfds;
+    pfds.push_back({ m_wake_fds[0], POLLIN, 0 });
+    for (auto &operation : m_active) {
+        pfds.push_back({ operation->port->fd, POLLIN, 0 });
+        pfds.push_back({ operation->port->cancel_fds[0], POLLIN, 0 });
+    }
+    int count = poll(pfds.data(), pfds.size(), timeout_ms);
+    if (count == -1 && errno != EINTR)
+        throw std::runtime_error("poll() failed");
+    if (count <= 0)
+        return;
+    if (pfds[0].revents != 0)
+        drain(m_wake_fds[0]);
+    for (size_t index = 0; index < m_active.size(); index++) {
+        short port_events = pfds[1 + index * 2].revents, cancel_events = pfds[2 + index * 2].revents;
+        if (port_events & (POLLHUP | POLLERR))
+            m_active[index]->hangup = true;
+        if (port_events != 0 || cancel_events != 0)
+            ready.push_back(m_active[index].get());
+    }
+#endif
+    // the port and its cancellation pipe can be ready at once
+    std::sort(ready.begin(), ready.end());
+    ready.erase(std::unique(ready.begin(), ready.end()), ready.end());
+}
+
+}
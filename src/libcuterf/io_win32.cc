@@ -0,0 +1,35 @@
+#include <windows.h>
+#include "io.h"
+
+namespace cuterf {
+
+// Overlapped I/O would need the ports opened with FILE_FLAG_OVERLAPPED, which the blocking
+// reads do not use; instead every port is looked at each millisecond, which also notices
+// cancellation.
+
+io_loop_impl::io_loop_impl() : m_stopped(false)
+{}
+
+io_loop_impl::~io_loop_impl()
+{}
+
+void io_loop_impl::stop()
+{
+    m_stopped = true;
+}
+
+void io_loop_impl::watch(io_operation &)
+{}
+
+void io_loop_impl::unwatch(io_operation &)
+{}
+
+void io_loop_impl::wait(clock::duration timeout, std::vector<io_operation *> &ready)
+{
+    if (timeout > clock::duration::zero() && !m_stopped)
+        Sleep(1);
+    for (auto &operation : m_active)
+        ready.push_back(operation.get());
+}
+
+}
@@ -1,7 +1,26 @@
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <cstring>
+#include <ctime>
 #include <iostream>
 #include <iomanip>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include "broker.h"
 #include "cuterf.h"
+#include "io.h"
+#include "parser.h"
+#include "registry.h"
+#include "remote.h"
+#include "ring.h"
 #include "serial.h"
+#include "shell.h"
+#include "stats.h"
 
 namespace cuterf {
 
@@ -13,13 +32,82 @@ public:
     std::wstring m_path;
     serial_port m_port;
     std::string m_board, m_version;
+    std::string m_records; // reused for binary sweep transfers
+    bool m_mirroring;
+    bool m_synchronized;   // false until `#sync#` is sent, if the device was not identified,
+                           // and again after a command fails
+    bool m_async;          // an operation is in progress on an io_loop
+    shell_stats m_stats;
+    std::deque<shell_probe> m_scan_probes; // of `scan_bin` commands sent but not received yet
+    broker::connection m_broker; // if open, captures are made by the broker, which leases
+                                 // the port for anything else
+
+    // streaming state; m_ring is non-null while streaming
+    std::unique_ptr<spsc_ring<sweep>> m_ring;
+    std::thread m_acquire_thread, m_dispatch_thread;
+    std::atomic<bool> m_stream_stop, m_stream_done;
+    std::atomic<uint64_t> m_acquired, m_delivered, m_overruns;
+    std::mutex m_stream_mutex;
+    std::condition_variable m_stream_cv;
+    std::exception_ptr m_stream_error;
+
+    device_impl();
+    ~device_impl();
 
-    void synchronize();
     std::string run(const std::string &command);
+    std::vector<std::string> run_batch(const std::vector<shell_command> &commands);
+    std::vector<std::string> synchronize(const std::vector<shell_command> &commands);
+    void lease();
+    void bypass_broker();
+    void start(io_loop_impl &loop, const std::vector<shell_command> &commands,
+        std::function<void(std::vector<std::string> &outputs)> next, std::function<void(std::exception_ptr)> fail,
+        std::function<void(const shell_exchange &)> check = nullptr);
+
+    void detect_board(const std::string &info);
 
-    void detect_board();
+    void query_sweep(unsigned &start, unsigned &stop, unsigned &points);
+    std::string send_scan(unsigned start, unsigned stop, unsigned points, unsigned ports);
+    void receive_scan(const std::string &command, unsigned points, unsigned ports, point *data);
+    void scan_binary(unsigned start, unsigned stop, unsigned points, unsigned ports, point *data);
+    std::vector<point> capture(unsigned ports, transfer mode, screenshot *screen, float *edelay, float *s21offset);
+    std::vector<point> capture_brokered(unsigned ports, transfer mode, screenshot *screen, float *edelay,
+        float *s21offset);
+
+    void start_streaming(unsigned ports, size_t capacity);
+    void acquire(unsigned start, unsigned stop, unsigned points, unsigned ports);
+    bool read_sweep(sweep &frame, unsigned timeout_ms);
+    std::exception_ptr stop_streaming();
 };
 
+// see SCAN_MASK_* in firmware
+constexpr uint16_t SCAN_MASK_OUT_FREQ  = 0x01;
+constexpr uint16_t SCAN_MASK_OUT_DATA0 = 0x02;
+constexpr uint16_t SCAN_MASK_OUT_DATA1 = 0x04;
+constexpr uint16_t SCAN_MASK_BINARY    = 0x80;
+
+static uint32_t load_le32(const char *data)
+{
+    const uint8_t *bytes = (const uint8_t *)data;
+    return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+static float load_le_float(const char *data)
+{
+    uint32_t bits = load_le32(data);
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+device_impl::device_impl() : 
+    m_mirroring(false), m_synchronized(false), m_async(false), m_stream_stop(false), m_stream_done(false), m_acquired(0), m_delivered(0), m_overruns(0)
+{}
+
+device_impl::~device_impl()
+{
+    stop_streaming();
+}
+
 device::device() : m_i(new device_impl) 
 {}
 
@@ -30,8 +118,15 @@ device::~device()
 
 std::string device::timestamp()
 {
+    // fleet workers format timestamps concurrently, so not into localtime()'s shared buffer
     time_t now = time(NULL);
-    struct tm *timeinfo = localtime(&now);
+    struct tm local;
+#ifdef _WIN32
+    localtime_s(&local, &now);
+#else
+    localtime_r(&now, &local);
+#endif
+    const struct tm *timeinfo = &local;
 
     std::stringstream ss;
     ss << 1900 + timeinfo->tm_year;
@@ -45,7 +140,7 @@ std::string device::timestamp()
 
 bool device::is_open() const
 {
-    return m_i->m_port.is_open();
+    return m_i->m_port.is_open() || m_i->m_broker.is_open();
 }
 
 std::wstring device::path() const
@@ -56,58 +151,215 @@ std::wstring device::path() const
 bool device::open(const std::wstring &path)
 {
     m_i->m_path = path;
-    if (m_i->m_path.empty())
-        if (!FindUSBSerialPortByVIDPID(VID, PID, m_i->m_path))
+    if (m_i->m_path.empty()) {
+        // a broker that holds the device has identified it already
+        std::vector<std::string> identity;
+        if (m_i->m_broker.open("nanovna", identity) && identity.size() == 3) {
+            m_i->m_path.assign(identity[0].begin(), identity[0].end());
+            m_i->m_board = identity[1];
+            m_i->m_version = identity[2];
+            return true;
+        }
+        m_i->m_broker.close();
+        std::vector<usb_serial_port> ports = device_registry::instance().ports();
+        if (ports.empty())
             return false;
+        m_i->m_path = ports[0].path;
+    }
     if (!m_i->m_port.open(m_i->m_path))
         return false;
 
-    m_i->synchronize();
-    m_i->detect_board();
+    // a device identified since it was connected is not asked again, and `#sync#` waits for
+    // the first command
+    device_identity identity;
+    if (device_registry::instance().recall(m_i->m_path, identity) && identity.board == "NanoVNA-H 4") {
+        m_i->m_board = identity.board;
+        m_i->m_version = identity.version;
+        m_i->m_synchronized = false;
+        return true;
+    }
+
+    // `info` is pipelined behind `#sync#`, saving a round trip
+    std::vector<std::string> outputs = m_i->synchronize({ shell_command("info") });
+    {
+        parse_timer timer(m_i->m_port, "info");
+        m_i->detect_board(outputs[0]);
+    }
+    device_registry::instance().remember(m_i->m_path, { m_i->m_board, m_i->m_version, "" });
     return true;
 }
 
 void device::close()
 {
+    m_i->stop_streaming();
+    m_i->m_mirroring = false;
+    m_i->m_scan_probes.clear();
     m_i->m_port.close();
+    m_i->m_broker.close();
     m_i->m_board.clear();
     m_i->m_version.clear();
 }
 
-void device_impl::synchronize()
+std::string device_impl::run(const std::string &command)
 {
-    m_port.write("#sync#\r\n");
-    m_port.read_until("#sync#\r\n#sync#?\r\nch> ");
+    if (m_ring)
+        throw std::logic_error("cannot run commands while streaming!");
+    if (m_mirroring)
+        throw std::logic_error("cannot run commands while mirroring!");
+    if (m_async)
+        throw std::logic_error("cannot run commands during an asynchronous operation!");
+
+    lease();
+    if (!m_synchronized)
+        return synchronize({ shell_command(command) })[0];
+    try {
+        return shell_run(m_port, command);
+    } catch (...) {
+        // the rest of the output may still arrive
+        m_synchronized = false;
+        throw;
+    }
 }
 
-std::string device_impl::run(const std::string &command)
+std::vector<std::string> device_impl::run_batch(const std::vector<shell_command> &commands)
 {
-    std::string result;
-    m_port.write(command + "\r\n");
-    m_port.read_until(command + "\r\n");
-    m_port.read_until("ch> ", &result);
-    return result;
+    if (m_ring)
+        throw std::logic_error("cannot run commands while streaming!");
+    if (m_mirroring)
+        throw std::logic_error("cannot run commands while mirroring!");
+    if (m_async)
+        throw std::logic_error("cannot run commands during an asynchronous operation!");
+
+    lease();
+    if (!m_synchronized)
+        return synchronize(commands);
+    try {
+        return shell_run_batch(m_port, commands);
+    } catch (...) {
+        m_synchronized = false;
+        throw;
+    }
+}
+
+// Runs `commands` behind `#sync#`, which discards anything left over on the port.
+std::vector<std::string> device_impl::synchronize(const std::vector<shell_command> &commands)
+{
+    std::vector<std::string> outputs = shell_run_batch(m_port, commands, true);
+    m_synchronized = true;
+    return outputs;
 }
 
-void device_impl::detect_board()
+// Takes the device over from the broker, if it was opened through one; the broker gets it
+// back once the device is closed.
+void device_impl::lease()
+{
+    if (!m_broker.is_open() || m_port.is_open())
+        return;
+    std::wstring path;
+    try {
+        path = m_broker.lease(m_port.timeout);
+    } catch (const broker::unavailable &) {
+        bypass_broker();
+        return;
+    }
+    if (!m_port.open(path))
+        throw std::runtime_error("cannot open serial port leased from broker!");
+    m_synchronized = false;
+}
+
+// Opens the device directly once the broker has gone away or stopped answering. A broker
+// that is stuck still holds the port, which then fails as in use.
+void device_impl::bypass_broker()
+{
+    if (!m_port.open(m_path))
+        throw std::runtime_error("broker is unavailable and the device cannot be opened!");
+    m_synchronized = false;
+}
+
+// Writes `commands` for `loop` to complete, then calls `next` with their outputs, or `fail`
+// with the error. `check` looks at the outputs as they arrive.
+void device_impl::start(io_loop_impl &loop, const std::vector<shell_command> &commands,
+    std::function<void(std::vector<std::string> &outputs)> next, std::function<void(std::exception_ptr)> fail,
+    std::function<void(const shell_exchange &)> check)
+{
+    if (m_ring)
+        throw std::logic_error("cannot run commands while streaming!");
+    if (m_mirroring)
+        throw std::logic_error("cannot run commands while mirroring!");
+    if (m_async)
+        throw std::logic_error("device already has an asynchronous operation in progress!");
+
+    lease();
+    std::unique_ptr<io_operation> operation(new io_operation(m_port, shell_exchange(commands, !m_synchronized)));
+    operation->check = check;
+    operation->finish = [this, next, fail](shell_exchange &exchange, std::exception_ptr error) {
+        m_async = false;
+        m_synchronized = !error;
+        if (error)
+            fail(error);
+        else
+            next(exchange.outputs());
+    };
+    m_async = true;
+    loop.submit(std::move(operation));
+}
+
+static float parse_float_output(const char *command, const std::string &output)
+{
+    response_parser parser(command, output);
+    float value = parser.parse_float();
+    parser.expect("\r\n");
+    parser.expect_end();
+    return value;
+}
+
+static void parse_sweep_output(const std::string &output, unsigned &start, unsigned &stop, unsigned &points)
+{
+    response_parser parser("sweep", output);
+    start = parser.parse_unsigned();
+    parser.expect(' ');
+    stop = parser.parse_unsigned();
+    parser.expect(' ');
+    points = parser.parse_unsigned();
+    parser.expect("\r\n");
+    if (points < 2 || stop < start)
+        throw std::runtime_error("device reported an invalid sweep!");
+}
+
+static void parse_data_output(const std::string &output, unsigned port, std::vector<point> &data)
+{
+    response_parser parser("data", output);
+    for (auto &point : data) {
+        float re = parser.parse_float();
+        parser.expect(' ');
+        float im = parser.parse_float();
+        parser.expect("\r\n");
+
+        if (port == 1)
+            point.s11 = std::complex<float>(re, im);
+        if (port == 2)
+            point.s21 = std::complex<float>(re, im);
+    }
+    parser.expect_end();
+}
+
+// see set_frequencies() and getFrequency() in firmware
+static void fill_frequencies(unsigned start, unsigned stop, std::vector<point> &data)
+{
+    unsigned f_points, f_delta, f_error;
+    f_points = (unsigned)data.size() - 1;
+    f_delta  = (stop - start) / f_points;
+    f_error  = (stop - start) % f_points;
+
+    for (unsigned idx = 0; idx < data.size(); idx++)
+        data[idx].freq = start + f_delta * idx + (f_points / 2 + f_error * idx) / f_points;
+}
+
+void device_impl::detect_board(const std::string &info)
 {   
-    std::string info = run("info");
-    
-    size_t board_pos = info.find("Board: ");
-    if (board_pos == std::string::npos)
-        throw std::runtime_error("cannot parse board from response to info!");
-    size_t board_nl_pos = info.find("\r\n", board_pos);
-    if (board_nl_pos == std::string::npos)
-        throw std::runtime_error("cannot parse board from response to info!");
-    m_board = info.substr(board_pos, board_nl_pos - board_pos).substr(7);
-
-    size_t version_pos = info.find("Version: ", board_nl_pos);
-    if (version_pos == std::string::npos)
-        throw std::runtime_error("cannot parse version from response to info!");
-    size_t version_nl_pos = info.find("\r\n", version_pos);
-    if (version_nl_pos == std::string::npos)
-        throw std::runtime_error("cannot parse version from response to info!");
-    m_version = info.substr(version_pos, version_nl_pos - version_pos).substr(9);
+    response_parser parser("info", info);
+    m_board = parser.field("Board: ");
+    m_version = parser.field("Version: ");
 
     if (m_board != "NanoVNA-H 4")
         throw std::runtime_error("connected board type is not NanoVNA-H 4!");
@@ -125,146 +377,698 @@ std::string device::firmware_info() const
 
 float device::edelay()
 {
-    std::string buf = m_i->run("edelay");
-    size_t pos;
-    float edelay = std::stof(&buf[0], &pos);
-    if (buf.substr(pos) != "\r\n")
-        throw std::runtime_error("failed to parse response to edelay!");
-    return edelay;
+    float value;
+    m_i->capture(0, transfer::text, nullptr, &value, nullptr);
+    return value;
 }
 
 float device::s21offset()
 {
-    std::string buf = m_i->run("s21offset");
-    size_t pos;
-    float s21offset = std::stof(&buf[0], &pos);
-    if (buf.substr(pos) != "\r\n")
-        throw std::runtime_error("failed to parse response to s21offset!");
-    return s21offset;
+    float value;
+    m_i->capture(0, transfer::text, nullptr, nullptr, &value);
+    return value;
 }
 
-std::string device::capture_screenshot(size_t &width, size_t &height)
-{   
-    // only one resolution supported at the moment
-    width = 480;
-    height = 320;
+void device::set_timeout(unsigned timeout_ms)
+{
+    m_i->m_port.timeout = std::chrono::milliseconds(timeout_ms);
+}
 
-    m_i->m_port.write("capture\r\n");
-    m_i->m_port.read_until("capture\r\n");
+void device::cancel()
+{
+    m_i->m_port.cancel();
+}
 
-    std::string display_data(2 * width * height, '\0');
-    m_i->m_port.read(display_data);
+std::string device::run(const std::string &command)
+{
+    return m_i->run(command);
+}
 
-    std::string prompt(4, '\0');
-    m_i->m_port.read(prompt);
-    if (prompt != "ch> ")
-        throw std::runtime_error("device returned screenshot of wrong size!");
-    
-    return display_data;
+void device::run_async(io_loop &loop, const std::string &command, async_handler<std::string> handler)
+{
+    m_i->start(*loop.m_i, { shell_command(command) }, [handler](std::vector<std::string> &outputs) {
+        async_result<std::string> result;
+        result.value = std::move(outputs[0]);
+        handler(result);
+    }, async_failure(handler));
 }
 
-std::vector<std::string> device::capture_header()
+awaitable<std::string> device::run(io_loop &loop, const std::string &command)
+{
+    return awaitable<std::string>([this, &loop, command](async_handler<std::string> handler) {
+        run_async(loop, command, std::move(handler));
+    });
+}
+
+void device::enable_stats(bool enable)
+{
+    if (m_i->m_ring)
+        throw std::logic_error("cannot change statistics while streaming!");
+
+    m_i->m_port.stats = enable ? &m_i->m_stats : nullptr;
+    m_i->m_scan_probes.clear();
+}
+
+std::vector<command_stats> device::stats() const
+{
+    return m_i->m_stats.snapshot();
+}
+
+std::string device::capture_screenshot(size_t &width, size_t &height)
+{   
+    if (m_i->m_ring)
+        throw std::logic_error("cannot capture a screenshot while streaming!");
+
+    screenshot screen;
+    m_i->capture(0, transfer::text, &screen, nullptr, nullptr);
+    width = screen.width;
+    height = screen.height;
+    return screen.data;
+}
+
+static std::vector<std::string> format_header(device &device, float edelay, float s21offset)
 {
     std::vector<std::string> environment;
-    environment.push_back("Board: " + board_name());
-    environment.push_back("Firmware: " + firmware_info());
-    environment.push_back("Timestamp: " + timestamp());
-    float edelay = this->edelay();
+    environment.push_back("Board: " + device.board_name());
+    environment.push_back("Firmware: " + device.firmware_info());
+    environment.push_back("Timestamp: " + device.timestamp());
     if (edelay != 0.0f)
         environment.push_back("E-delay: " + std::to_string(edelay) + " ps");
-    float s21offset = this->s21offset();
     if (s21offset != 0.0f)
         environment.push_back("S21 offset: " + std::to_string(s21offset) + " dB");
     return environment;
 }
 
-std::vector<point> device::capture_data(unsigned ports)
+std::vector<std::string> device::capture_header()
+{
+    float edelay, s21offset;
+    m_i->capture(0, transfer::text, nullptr, &edelay, &s21offset);
+    return format_header(*this, edelay, s21offset);
+}
+
+void device_impl::query_sweep(unsigned &start, unsigned &stop, unsigned &points)
+{
+    std::string output = run("sweep");
+    parse_timer timer(m_port, "sweep");
+    parse_sweep_output(output, start, stop, points);
+}
+
+static uint16_t scan_mask(unsigned ports)
+{
+    uint16_t mask = SCAN_MASK_OUT_FREQ | SCAN_MASK_OUT_DATA0;
+    if (ports == 2)
+        mask |= SCAN_MASK_OUT_DATA1;
+    return mask;
+}
+
+static std::string scan_command(unsigned start, unsigned stop, unsigned points, unsigned ports)
+{
+    return "scan_bin " + std::to_string(start) + " " + std::to_string(stop) + " " + std::to_string(points) + " " +
+        std::to_string(scan_mask(ports));
+}
+
+static size_t scan_record_size(unsigned ports)
+{
+    return sizeof(uint32_t) + 2 * sizeof(float) * ports;
+}
+
+// uint16_t mask, uint16_t points, then for each point: uint32_t freq, float s11[2], float s21[2]
+static bool scan_header_matches(const char *header, unsigned points, unsigned ports)
+{
+    uint32_t reply = load_le32(header);
+    return (reply & 0xffff) == (scan_mask(ports) | SCAN_MASK_BINARY) && (reply >> 16) == points;
+}
+
+static void decode_scan(const char *records, unsigned points, unsigned ports, point *data)
+{
+    size_t record_size = scan_record_size(ports);
+    const char *record = records;
+    for (unsigned idx = 0; idx < points; idx++, record += record_size) {
+        data[idx].freq = load_le32(&record[0]);
+        data[idx].s11 = std::complex<float>(load_le_float(&record[4]), load_le_float(&record[8]));
+        if (ports == 2)
+            data[idx].s21 = std::complex<float>(load_le_float(&record[12]), load_le_float(&record[16]));
+    }
+}
+
+// Writes a `scan_bin` command, whose output is read by receive_scan().
+std::string device_impl::send_scan(unsigned start, unsigned stop, unsigned points, unsigned ports)
+{
+    std::string command = scan_command(start, stop, points, ports);
+    shell_probe probe;
+    shell_send(m_port, command, probe, !m_synchronized);
+    m_synchronized = true;
+    if (m_port.stats != nullptr)
+        m_scan_probes.push_back(probe);
+    return command;
+}
+
+void device_impl::receive_scan(const std::string &command, unsigned points, unsigned ports, point *data)
+{
+    shell_probe probe;
+    if (!m_scan_probes.empty()) {
+        probe = m_scan_probes.front();
+        m_scan_probes.pop_front();
+    }
+    try {
+        probe.reading(m_port);
+        m_port.read_until(command + "\r\n");
+        probe.echoed();
+
+        std::string header(4, '\0');
+        m_port.read(header);
+        if (!scan_header_matches(&header[0], points, ports)) {
+            m_port.read_until("ch> ");
+            probe.finished(m_port);
+            throw std::runtime_error("device does not support binary sweep transfer!");
+        }
+
+        size_t record_size = scan_record_size(ports);
+        m_records.resize(record_size * points + 4);
+        m_port.read(m_records);
+        if (m_records.compare(record_size * points, 4, "ch> ") != 0)
+            throw std::runtime_error("device returned sweep data of wrong size!");
+        probe.finished(m_port);
+    } catch (...) {
+        m_synchronized = false;
+        throw;
+    }
+
+    parse_timer timer(m_port, "scan_bin");
+    decode_scan(&m_records[0], points, ports, data);
+}
+
+void device_impl::scan_binary(unsigned start, unsigned stop, unsigned points, unsigned ports, point *data)
+{
+    m_scan_probes.clear(); // left over if an earlier scan failed
+    receive_scan(send_scan(start, stop, points, ports), points, ports, data);
+}
+
+std::vector<point> device_impl::capture(unsigned ports, transfer mode, screenshot *screen, float *edelay, float *s21offset)
+{
+    if (m_broker.is_open() && !m_port.is_open()) {
+        try {
+            return capture_brokered(ports, mode, screen, edelay, s21offset);
+        } catch (const broker::unavailable &) {
+            bypass_broker();
+        }
+    }
+
+    // Everything except `scan_bin`, which needs the span reported by `sweep`, is written in 
+    // one batch. `scan_bin` is never batched: if the firmware lacks it, the text error must
+    // not be mistaken for binary output.
+    std::vector<shell_command> commands;
+    if (screen != nullptr) {
+        // only one resolution supported at the moment
+        screen->width = 480;
+        screen->height = 320;
+        commands.emplace_back("capture", 2 * screen->width * screen->height);
+    }
+    if (edelay != nullptr)
+        commands.emplace_back("edelay");
+    if (s21offset != nullptr)
+        commands.emplace_back("s21offset");
+    if (ports != 0) {
+        commands.emplace_back("sweep");
+        if (mode == transfer::text) {
+            for (unsigned port = 1; port <= ports; port++)
+                commands.emplace_back("data " + std::to_string(port - 1));
+        }
+    }
+
+    std::vector<std::string> outputs = run_batch(commands);
+    auto output = outputs.begin();
+    if (screen != nullptr)
+        screen->data = std::move(*output++);
+    if (edelay != nullptr) {
+        parse_timer timer(m_port, "edelay");
+        *edelay = parse_float_output("edelay", *output++);
+    }
+    if (s21offset != nullptr) {
+        parse_timer timer(m_port, "s21offset");
+        *s21offset = parse_float_output("s21offset", *output++);
+    }
+    if (ports == 0)
+        return std::vector<point>();
+
+    unsigned start, stop, points;
+    {
+        parse_timer timer(m_port, "sweep");
+        parse_sweep_output(*output++, start, stop, points);
+    }
+
+    std::vector<point> data(points);
+    if (mode == transfer::binary) {
+        scan_binary(start, stop, points, ports, &data[0]);
+        return data;
+    }
+
+    fill_frequencies(start, stop, data);
+    for (unsigned port = 1; port <= ports; port++) {
+        parse_timer timer(m_port, "data");
+        parse_data_output(*output++, port, data);
+    }
+
+    return data;
+}
+
+// The broker answers with the result of the same capture, laid out as broker::nanovna_result.
+std::vector<point> device_impl::capture_brokered(unsigned ports, transfer mode, screenshot *screen, float *edelay,
+    float *s21offset)
+{
+    broker::request request = broker::make_request(broker::NANOVNA_CAPTURE);
+    request.ports = ports;
+    request.mode = (uint32_t)mode;
+    request.parts = (screen != nullptr ? broker::PART_SCREEN : 0) | (edelay != nullptr ? broker::PART_EDELAY : 0) |
+        (s21offset != nullptr ? broker::PART_S21OFFSET : 0);
+    broker::result result = m_broker.call(request, m_port.timeout);
+
+    broker::nanovna_result header;
+    if (result.size < sizeof(header))
+        throw std::runtime_error("broker returned a capture of wrong size!");
+    memcpy(&header, result.data, sizeof(header));
+    size_t screen_size = 2 * (size_t)header.screen_width * header.screen_height;
+    if (header.point_size != sizeof(point) ||
+            result.size != sizeof(header) + header.points * sizeof(point) + screen_size)
+        throw std::runtime_error("broker returned a capture of wrong size!");
+
+    const char *data = result.data + sizeof(header);
+    std::vector<point> points(header.points);
+    if (!points.empty())
+        memcpy(&points[0], data, header.points * sizeof(point));
+    if (screen != nullptr) {
+        screen->width = header.screen_width;
+        screen->height = header.screen_height;
+        screen->data.assign(data + header.points * sizeof(point), screen_size);
+    }
+    if (edelay != nullptr)
+        *edelay = header.edelay;
+    if (s21offset != nullptr)
+        *s21offset = header.s21offset;
+    return points;
+}
+
+std::vector<point> device::capture(unsigned ports, transfer mode, screenshot *screen, float *edelay, float *s21offset)
+{
+    if (ports > 2)
+        throw std::logic_error("can only capture data for up to 2 ports!");
+
+    return m_i->capture(ports, mode, screen, edelay, s21offset);
+}
+
+std::vector<point> device::capture_data(unsigned ports, transfer mode)
 {   
     if (!(ports == 1 || ports == 2))
         throw std::logic_error("can only capture data for 1 or 2 ports!");
- 
-    size_t pos;
-    std::string buf;
-
-    buf = m_i->run("sweep");
-    unsigned start = std::stoi(buf, &pos);
-    if (pos == 0 || buf[pos] != ' ')
-        throw std::runtime_error("unrecognized format of response to sweep!");
-
-    buf = buf.substr(pos);
-    unsigned stop = std::stoi(buf, &pos);
-    if (pos == 0 || buf[pos] != ' ')
-        throw std::runtime_error("failed to parse response to sweep!");
-
-    buf = buf.substr(pos);
-    unsigned points = std::stoi(buf, &pos);
-    if (pos == 0 || buf.substr(pos, 2) != "\r\n")
-        throw std::runtime_error("failed to parse response to sweep!");
-    
-    // see set_frequencies() in firmware
-    unsigned f_points, f_delta, f_error;
-    f_points = points - 1;
-    f_delta  = (stop - start) / f_points;
-    f_error  = (stop - start) % f_points;
 
-    // see getFrequency() in firmware
-    std::vector<point> data(points);
-    for (unsigned idx = 0; idx < points; idx++)
-        data[idx].freq = start + f_delta * idx + (f_points / 2 + f_error * idx) / f_points;
+    return m_i->capture(ports, mode, nullptr, nullptr, nullptr);
+}
 
-    for (unsigned port = 1; port <= ports; port++) {
-        buf = m_i->run("data " + std::to_string(port - 1));
-        for (unsigned idx = 0; idx < points; idx++) {
-            float re = std::stof(buf, &pos);
-            if (pos == 0 || buf[pos] != ' ')
-                throw std::runtime_error("failed to parse response to data!");
-            
-            buf = buf.substr(pos);
-            float im = std::stof(buf, &pos);
-            if (pos == 0 || buf.substr(pos, 2) != "\r\n")
-                throw std::runtime_error("failed to parse response to data!");
-            
-            if (port == 1)
-                data[idx].s11 = std::complex<float>(re, im);
-            if (port == 2)
-                data[idx].s21 = std::complex<float>(re, im);
-            
-            buf = buf.substr(pos);
+// As capture(), but in two exchanges for a binary capture: `sweep`, then `scan_bin`, whose
+// header is checked as soon as it arrives.
+void device::capture_data_async(io_loop &loop, unsigned ports, transfer mode, async_handler<std::vector<point>> handler)
+{
+    if (!(ports == 1 || ports == 2))
+        throw std::logic_error("can only capture data for 1 or 2 ports!");
+
+    std::vector<shell_command> commands;
+    commands.emplace_back("sweep");
+    if (mode == transfer::text) {
+        for (unsigned port = 1; port <= ports; port++)
+            commands.emplace_back("data " + std::to_string(port - 1));
+    }
+
+    device_impl *impl = m_i;
+    io_loop_impl *driver = loop.m_i;
+    auto fail = async_failure(handler);
+    m_i->start(*driver, commands, [=](std::vector<std::string> &outputs) {
+        async_result<std::vector<point>> result;
+        unsigned start, stop, points;
+        try {
+            parse_sweep_output(outputs[0], start, stop, points);
+            if (mode == transfer::binary) {
+                auto scanned = [=](std::vector<std::string> &outputs) {
+                    async_result<std::vector<point>> result;
+                    if (scan_header_matches(&outputs[0][0], points, ports)) {
+                        result.value.resize(points);
+                        decode_scan(&outputs[0][4], points, ports, &result.value[0]);
+                    } else {
+                        result.error = std::make_exception_ptr(
+                            std::runtime_error("device does not support binary sweep transfer!"));
+                    }
+                    handler(result);
+                };
+                auto check = [=](const shell_exchange &exchange) {
+                    const std::string &output = exchange.partial();
+                    if (output.size() >= 4 && !scan_header_matches(&output[0], points, ports))
+                        throw std::runtime_error("device does not support binary sweep transfer!");
+                };
+                shell_command scan(scan_command(start, stop, points, ports), 4 + scan_record_size(ports) * points);
+                impl->start(*driver, { scan }, scanned, fail, check);
+                return;
+            }
+            result.value.resize(points);
+            fill_frequencies(start, stop, result.value);
+            for (unsigned port = 1; port <= ports; port++)
+                parse_data_output(outputs[port], port, result.value);
+        } catch (...) {
+            result.error = std::current_exception();
         }
+        handler(result);
+    }, fail);
+}
+
+awaitable<std::vector<point>> device::capture_data(io_loop &loop, unsigned ports, transfer mode)
+{
+    return awaitable<std::vector<point>>([this, &loop, ports, mode](async_handler<std::vector<point>> handler) {
+        capture_data_async(loop, ports, mode, std::move(handler));
+    });
+}
+
+// A scan of points [scan_begin, end) of a segmented sweep, of which [keep_begin, end) are kept.
+struct segment
+{
+    size_t scan_begin, keep_begin, end;
+    unsigned start, stop; // in Hz
+};
+
+std::vector<point> device::capture_segmented(unsigned start, unsigned stop, size_t points, unsigned ports,
+    unsigned segment_points, unsigned overlap, segment_stats *stats)
+{
+    if (!(ports == 1 || ports == 2))
+        throw std::logic_error("can only capture data for 1 or 2 ports!");
+    if (points < 2 || stop <= start || stop - start < points - 1)
+        throw std::logic_error("segmented sweep needs at least 2 points, at least 1 Hz apart!");
+    if (segment_points < 2 || overlap + 1 >= segment_points)
+        throw std::logic_error("segments must have at least 2 points, and more than the overlap!");
+
+    // the points of the whole sweep are spaced as evenly as whole hertz allow; each segment
+    // is scanned with its own first and last frequencies, so seams land exactly on the grid
+    auto frequency = [&](size_t index) {
+        return start + (unsigned)(((uint64_t)(stop - start) * index + (points - 1) / 2) / (points - 1));
+    };
+    std::vector<segment> segments;
+    for (size_t keep_begin = 0; keep_begin < points; ) {
+        segment part;
+        part.keep_begin = keep_begin;
+        part.scan_begin = keep_begin == 0 ? 0 : keep_begin - std::min<size_t>(overlap, keep_begin);
+        part.end = std::min(points, part.scan_begin + segment_points);
+        if (part.end - part.scan_begin < 2)
+            part.scan_begin = part.end - 2;
+        part.start = frequency(part.scan_begin);
+        part.stop = frequency(part.end - 1);
+        segments.push_back(part);
+        keep_begin = part.end;
     }
 
+    unsigned saved_start, saved_stop, saved_points;
+    m_i->query_sweep(saved_start, saved_stop, saved_points);
+    auto restore = [&] {
+        m_i->run("sweep " + std::to_string(saved_start) + " " + std::to_string(saved_stop) + " " +
+            std::to_string(saved_points));
+    };
+
+    auto clock_start = std::chrono::steady_clock::now();
+    std::vector<point> data(points), scan(segment_points);
+    segment_stats totals = {};
+    totals.segments = segments.size();
+    try {
+        // The first scan is sent alone, as in capture(), in case the firmware lacks `scan_bin`.
+        // After that, the next command is always written before the current output is read.
+        m_i->m_scan_probes.clear();
+        auto send_segment = [&](const segment &part) {
+            return m_i->send_scan(part.start, part.stop, (unsigned)(part.end - part.scan_begin), ports);
+        };
+        std::string command = send_segment(segments[0]);
+        for (size_t idx = 0; idx < segments.size(); idx++) {
+            const segment &part = segments[idx];
+            std::string next_command;
+            if (idx != 0 && idx + 1 < segments.size())
+                next_command = send_segment(segments[idx + 1]);
+            unsigned count = (unsigned)(part.end - part.scan_begin);
+            m_i->receive_scan(command, count, ports, &scan[0]);
+            if (idx == 0 && segments.size() > 1)
+                next_command = send_segment(segments[1]);
+            command = next_command;
+
+            size_t repeated = part.keep_begin - part.scan_begin;
+            for (size_t pt = 0; pt < repeated; pt++) {
+                const point &earlier = data[part.scan_begin + pt];
+                float error = std::abs(scan[pt].s11 - earlier.s11);
+                if (ports == 2)
+                    error = std::max(error, std::abs(scan[pt].s21 - earlier.s21));
+                totals.max_seam_error = std::max(totals.max_seam_error, error);
+            }
+            std::copy(scan.begin() + repeated, scan.begin() + count, data.begin() + part.keep_begin);
+            totals.scanned += count;
+        }
+    } catch (...) {
+        // A `scan_bin` written ahead may still be on its way: run() resynchronizes first,
+        // discarding it, then the span the user had is put back. The original error wins.
+        m_i->m_synchronized = false;
+        m_i->m_scan_probes.clear();
+        try {
+            restore();
+        } catch (const std::runtime_error &) {
+        }
+        throw;
+    }
+    totals.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - clock_start).count();
+
+    restore();
+    if (stats != nullptr)
+        *stats = totals;
     return data;
 }
 
-std::string device::capture_touchstone(unsigned ports)
+void device_impl::start_streaming(unsigned ports, size_t capacity)
 {
-    auto header = capture_header();
-    auto data = capture_data(ports);
+    if (!(ports == 1 || ports == 2))
+        throw std::logic_error("can only capture data for 1 or 2 ports!");
+    if (capacity == 0)
+        throw std::logic_error("stream capacity must not be zero!");
+    if (m_ring)
+        throw std::logic_error("device is already streaming!");
 
-    std::stringstream ss;
-    for (auto &line : header)
-        ss << "! " << line << '\n';
-    ss << "# HZ S RI R 50\n";
-    for (auto &point : data) {
-        std::vector<float> sxy;
-        if (ports == 1 || ports == 2) {
-            sxy.push_back(point.s11.real());
-            sxy.push_back(point.s11.imag());
+    // the span is queried once; the frequency table is then reported by every scan
+    unsigned start, stop, points;
+    query_sweep(start, stop, points);
+
+    sweep prototype = {};
+    prototype.points.resize(points);
+    m_ring.reset(new spsc_ring<sweep>(capacity, prototype));
+    m_stream_stop = false;
+    m_stream_done = false;
+    m_stream_error = nullptr;
+    m_acquired = m_delivered = m_overruns = 0;
+    m_acquire_thread = std::thread(&device_impl::acquire, this, start, stop, points, ports);
+}
+
+void device_impl::acquire(unsigned start, unsigned stop, unsigned points, unsigned ports)
+{
+    std::vector<point> overrun_buffer(points);
+    try {
+        while (!m_stream_stop) {
+            sweep *slot = m_ring->begin_write();
+            point *data = &overrun_buffer[0];
+            if (slot != nullptr) {
+                slot->points.resize(points);
+                data = &slot->points[0];
+            }
+            scan_binary(start, stop, points, ports, data);
+
+            uint64_t sequence = m_acquired++;
+            if (slot == nullptr) {
+                m_overruns++;
+                continue;
+            }
+            slot->sequence = sequence;
+            slot->timestamp = std::chrono::system_clock::now();
+            m_ring->end_write();
+            { std::lock_guard<std::mutex> lock(m_stream_mutex); }
+            m_stream_cv.notify_one();
         }
-        if (ports == 2) {
-            sxy.push_back(point.s21.real());
-            sxy.push_back(point.s21.imag());
-            sxy.push_back(0.0f); // s12.re
-            sxy.push_back(0.0f); // s12.im
-            sxy.push_back(0.0f); // s22.re
-            sxy.push_back(0.0f); // s22.im
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(m_stream_mutex);
+        if (!m_stream_error)
+            m_stream_error = std::current_exception();
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_stream_mutex);
+        m_stream_done = true;
+    }
+    m_stream_cv.notify_all();
+}
+
+bool device_impl::read_sweep(sweep &frame, unsigned timeout_ms)
+{
+    if (!m_ring)
+        throw std::logic_error("device is not streaming!");
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    sweep *slot;
+    while ((slot = m_ring->begin_read()) == nullptr) {
+        if (m_stream_done) {
+            // the ring may have been filled just before acquisition ended
+            if ((slot = m_ring->begin_read()) != nullptr)
+                break;
+            if (m_stream_error)
+                std::rethrow_exception(m_stream_error);
+            return false;
         }
-        ss << std::setw(10) << point.freq;
-        for (auto s : sxy)
-            ss << ' ' << std::fixed << std::setw(12) << std::showpos << std::setprecision(9) << s;
-        ss << '\n';
+        std::unique_lock<std::mutex> lock(m_stream_mutex);
+        if (m_stream_cv.wait_until(lock, deadline, [this] { 
+                return m_ring->begin_read() != nullptr || m_stream_done; }))
+            continue;
+        return false;
     }
-    return ss.str();
+
+    frame.sequence = slot->sequence;
+    frame.timestamp = slot->timestamp;
+    frame.points.swap(slot->points);
+    m_ring->end_read();
+    m_delivered++;
+    return true;
+}
+
+std::exception_ptr device_impl::stop_streaming()
+{
+    if (!m_ring)
+        return nullptr;
+
+    m_stream_stop = true;
+    if (m_acquire_thread.joinable())
+        m_acquire_thread.join();
+    if (m_dispatch_thread.joinable())
+        m_dispatch_thread.join();
+    m_ring.reset();
+
+    std::exception_ptr error = m_stream_error;
+    m_stream_error = nullptr;
+    return error;
+}
+
+void device::start_streaming(unsigned ports, size_t capacity)
+{
+    m_i->start_streaming(ports, capacity);
+}
+
+void device::start_streaming(unsigned ports, size_t capacity, std::function<void(const sweep &)> callback)
+{
+    device_impl *impl = m_i;
+    impl->start_streaming(ports, capacity);
+    impl->m_dispatch_thread = std::thread([impl, callback] {
+        sweep frame;
+        try {
+            while (!impl->m_stream_stop) {
+                if (impl->read_sweep(frame, 100))
+                    callback(frame);
+                else if (impl->m_stream_done)
+                    break;
+            }
+        } catch (...) {
+            // an acquisition error is already recorded; an error from the callback ends the stream
+            std::lock_guard<std::mutex> lock(impl->m_stream_mutex);
+            if (!impl->m_stream_error)
+                impl->m_stream_error = std::current_exception();
+            impl->m_stream_stop = true;
+        }
+    });
+}
+
+bool device::read_sweep(sweep &frame, unsigned timeout_ms)
+{
+    return m_i->read_sweep(frame, timeout_ms);
+}
+
+void device::stop_streaming()
+{
+    std::exception_ptr error = m_i->stop_streaming();
+    if (error)
+        std::rethrow_exception(error);
+}
+
+bool device::is_streaming() const
+{
+    return (bool)m_i->m_ring;
+}
+
+stream_counters device::stream_stats() const
+{
+    stream_counters counters;
+    counters.acquired = m_i->m_acquired;
+    counters.delivered = m_i->m_delivered;
+    counters.overruns = m_i->m_overruns;
+    return counters;
+}
+
+std::string device::capture_touchstone(unsigned ports, transfer mode)
+{
+    std::string result;
+    touchstone::string_sink output(result);
+    capture_touchstone(output, ports, mode);
+    return result;
+}
+
+std::string device::capture_touchstone(unsigned ports, transfer mode, screenshot &screen)
+{
+    std::string result;
+    touchstone::string_sink output(result);
+    capture_touchstone(output, ports, mode, &screen);
+    return result;
+}
+
+void device::capture_touchstone(touchstone::sink &output, unsigned ports, transfer mode, screenshot *screen)
+{
+    if (!(ports == 1 || ports == 2))
+        throw std::logic_error("can only capture data for 1 or 2 ports!");
+
+    float edelay, s21offset;
+    auto data = m_i->capture(ports, mode, screen, &edelay, &s21offset);
+
+    touchstone::writer writer(output, ports);
+    writer.header(format_header(*this, edelay, s21offset));
+    writer.points(data);
+    writer.flush();
+}
+
+void device::start_mirroring()
+{
+    if (m_i->m_ring)
+        throw std::logic_error("cannot mirror the screen while streaming!");
+    if (m_i->m_mirroring)
+        throw std::logic_error("device is already mirroring!");
+
+    if (m_i->m_async)
+        throw std::logic_error("cannot mirror the screen during an asynchronous operation!");
+
+    m_i->lease();
+    if (!m_i->m_synchronized)
+        m_i->synchronize({});
+    remote_desktop_start(m_i->m_port);
+    m_i->m_mirroring = true;
+}
+
+bool device::read_screen_region(screen_region &region, unsigned timeout_ms)
+{
+    if (!m_i->m_mirroring)
+        throw std::logic_error("device is not mirroring!");
+
+    return remote_desktop_read(m_i->m_port, region, timeout_ms);
+}
+
+void device::stop_mirroring()
+{
+    if (!m_i->m_mirroring)
+        return;
+
+    m_i->m_mirroring = false;
+    remote_desktop_stop(m_i->m_port);
+}
+
+bool device::is_mirroring() const
+{
+    return m_i->m_mirroring;
 }
 
 }
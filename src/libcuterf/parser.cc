@@ -0,0 +1,85 @@
+#include <charconv>
+#include <stdexcept>
+#include "parser.h"
+
+namespace cuterf {
+
+response_parser::response_parser(const char *command, std::string_view text) :
+    m_command(command), m_text(text), m_pos(0)
+{}
+
+void response_parser::fail(const char *expected) const
+{
+    throw std::runtime_error(std::string("failed to parse response to ") + m_command +
+        ": expected " + expected + " at offset " + std::to_string(m_pos) + "!");
+}
+
+unsigned response_parser::parse_unsigned()
+{
+    unsigned value;
+    const char *first = m_text.data() + m_pos, *last = m_text.data() + m_text.size();
+    auto result = std::from_chars(first, last, value);
+    if (result.ec != std::errc())
+        fail("unsigned integer");
+    m_pos += result.ptr - first;
+    return value;
+}
+
+uint64_t response_parser::parse_uint64()
+{
+    uint64_t value;
+    const char *first = m_text.data() + m_pos, *last = m_text.data() + m_text.size();
+    auto result = std::from_chars(first, last, value);
+    if (result.ec != std::errc())
+        fail("unsigned integer");
+    m_pos += result.ptr - first;
+    return value;
+}
+
+float response_parser::parse_float()
+{
+    float value;
+    const char *first = m_text.data() + m_pos, *last = m_text.data() + m_text.size();
+    auto result = std::from_chars(first, last, value);
+    if (result.ec != std::errc())
+        fail("number");
+    m_pos += result.ptr - first;
+    return value;
+}
+
+void response_parser::expect(char c)
+{
+    if (m_pos >= m_text.size() || m_text[m_pos] != c)
+        fail(c == ' ' ? "space" : "separator");
+    m_pos++;
+}
+
+void response_parser::expect(std::string_view literal)
+{
+    if (m_text.compare(m_pos, literal.size(), literal) != 0)
+        fail(literal == "\r\n" ? "end of line" : "literal");
+    m_pos += literal.size();
+}
+
+void response_parser::expect_end()
+{
+    if (!at_end())
+        fail("end of response");
+}
+
+std::string_view response_parser::field(std::string_view key)
+{
+    size_t key_pos = m_text.find(key, m_pos);
+    if (key_pos == std::string_view::npos)
+        fail(("'" + std::string(key) + "'").c_str());
+    size_t value_pos = key_pos + key.size();
+    size_t nl_pos = m_text.find("\r\n", value_pos);
+    if (nl_pos == std::string_view::npos) {
+        m_pos = value_pos;
+        fail("end of line");
+    }
+    m_pos = nl_pos + 2;
+    return m_text.substr(value_pos, nl_pos - value_pos);
+}
+
+}
@@ -0,0 +1,43 @@
+#ifndef LIBCUTERF_PARSER_H
+#define LIBCUTERF_PARSER_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace cuterf {
+
+// Cursor over the text response to a shell command. Numbers are parsed in place with
+// std::from_chars, so parsing is linear, allocation-free and independent of the C locale.
+// Errors are reported as std::runtime_error naming the command and the byte offset.
+class response_parser
+{
+public:
+    response_parser(const char *command, std::string_view text);
+
+    size_t position() const { return m_pos; }
+    bool at_end() const { return m_pos == m_text.size(); }
+
+    unsigned parse_unsigned();
+    uint64_t parse_uint64();
+    float parse_float();
+
+    void expect(char c);
+    void expect(std::string_view literal);
+    void expect_end();
+
+    // Returns the rest of the line following the first occurrence of `key` after the cursor,
+    // and moves the cursor past that line.
+    std::string_view field(std::string_view key);
+
+private:
+    const char *m_command;
+    std::string_view m_text;
+    size_t m_pos;
+
+    [[noreturn]] void fail(const char *expected) const;
+};
+
+}
+
+#endif // LIBCUTERF_PARSER_H
@@ -0,0 +1,150 @@
+#include <cstring>
+#include <zlib.h>
+#include "cuterf.h"
+#include "file.h"
+
+namespace cuterf {
+
+static const char PNG_SIGNATURE[] = "\x89PNG\r\n\x1a\n";
+
+static uint32_t load_be32(const char *data)
+{
+    const uint8_t *bytes = (const uint8_t *)data;
+    return ((uint32_t)bytes[0] << 24) | (bytes[1] << 16) | (bytes[2] << 8) | bytes[3];
+}
+
+static bool inflate_text(const char *data, size_t size, std::string &text)
+{
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (inflateInit(&stream) != Z_OK)
+        return false;
+
+    // Touchstone data compresses about 3:1, so this rarely needs to grow
+    text.resize(size * 4 + 256);
+    stream.next_in = (Bytef *)data;
+    stream.avail_in = (uInt)size;
+    int status = Z_OK;
+    size_t done = 0;
+    while (status == Z_OK) {
+        if (done == text.size())
+            text.resize(text.size() * 2);
+        stream.next_out = (Bytef *)&text[done];
+        stream.avail_out = (uInt)(text.size() - done);
+        status = inflate(&stream, Z_NO_FLUSH);
+        done = text.size() - stream.avail_out;
+        if (status == Z_BUF_ERROR && stream.avail_in != 0)
+            status = Z_OK; // the output was full
+    }
+    inflateEnd(&stream);
+    text.resize(done);
+    return status == Z_STREAM_END;
+}
+
+// Extracts the text of a tEXt, zTXt or iTXt chunk whose keyword matched; see the PNG
+// specification, sections 11.3.4.3 to 11.3.4.5.
+static bool decode_text_chunk(const char *type, const char *data, size_t size, size_t keyword_size,
+    std::string &text)
+{
+    const char *body = data + keyword_size + 1, *end = data + size;
+    if (!memcmp(type, "tEXt", 4)) {
+        text.assign(body, end);
+        return true;
+    }
+    if (!memcmp(type, "zTXt", 4)) {
+        if (body >= end || *body != 0)
+            return false;
+        return inflate_text(body + 1, end - body - 1, text);
+    }
+    // iTXt: compression flag and method, then language tag and translated keyword
+    if (end - body < 2)
+        return false;
+    bool compressed = body[0] != 0;
+    body += 2;
+    for (unsigned field = 0; field < 2; field++) {
+        const char *nul = (const char *)memchr(body, 0, end - body);
+        if (nul == nullptr)
+            return false;
+        body = nul + 1;
+    }
+    if (!compressed) {
+        text.assign(body, end);
+        return true;
+    }
+    return inflate_text(body, end - body, text);
+}
+
+static bool is_text_chunk(const char *type)
+{
+    return !memcmp(type, "tEXt", 4) || !memcmp(type, "zTXt", 4) || !memcmp(type, "iTXt", 4);
+}
+
+// Calls `visit(type, data, length)` for each chunk until it returns true; returns false if
+// the file is not a well-formed PNG file or no call returned true.
+template<class Visitor>
+static bool walk_chunks(const mapped_file &file, Visitor visit)
+{
+    if (file.size < 8 || memcmp(file.data, PNG_SIGNATURE, 8))
+        return false;
+
+    // each chunk is length, type, data and CRC; the CRC is not checked
+    size_t offset = 8;
+    while (file.size - offset >= 12) {
+        size_t length = load_be32(&file.data[offset]);
+        const char *type = &file.data[offset + 4], *data = &file.data[offset + 8];
+        if (length > file.size - offset - 12 || !memcmp(type, "IEND", 4))
+            return false;
+        if (visit(type, data, length))
+            return true;
+        offset += 12 + length;
+    }
+    return false;
+}
+
+bool read_png_text(const std::wstring &path, const std::string &keyword, std::string &text)
+{
+    mapped_file file;
+    if (!file.open(path))
+        return false;
+
+    bool found = false, result = false;
+    walk_chunks(file, [&](const char *type, const char *data, size_t length) {
+        if (!is_text_chunk(type) || length <= keyword.size() || data[keyword.size()] != '\0' ||
+                memcmp(data, keyword.data(), keyword.size()))
+            return false;
+        found = true;
+        result = decode_text_chunk(type, data, length, keyword.size(), text);
+        return true;
+    });
+    return found && result;
+}
+
+bool read_png_texts(const std::wstring &path, std::vector<std::pair<std::string, std::string>> &texts)
+{
+    mapped_file file;
+    if (!file.open(path))
+        return false;
+
+    // text may also follow the image data, so every chunk is visited
+    texts.clear();
+    bool valid = file.size >= 8 && !memcmp(file.data, PNG_SIGNATURE, 8);
+    walk_chunks(file, [&](const char *type, const char *data, size_t length) {
+        if (!is_text_chunk(type))
+            return false;
+        const char *nul = (const char *)memchr(data, 0, length);
+        if (nul == nullptr) {
+            valid = false;
+            return true;
+        }
+        std::string text;
+        if (!decode_text_chunk(type, data, length, nul - data, text)) {
+            valid = false;
+            return true;
+        }
+        texts.emplace_back(std::string(data, nul), text);
+        return false;
+    });
+    return valid;
+}
+
+}
@@ -0,0 +1,70 @@
+#include "pool.h"
+
+namespace cuterf {
+
+worker_pool::worker_pool(unsigned threads) : 
+    m_generation(0), m_stop(false), m_job(nullptr), m_count(0), m_next(0), m_busy(0)
+{
+    if (threads == 0)
+        threads = 1;
+    for (unsigned idx = 0; idx < threads; idx++)
+        m_threads.emplace_back(&worker_pool::work, this);
+}
+
+worker_pool::~worker_pool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_start_cv.notify_all();
+    for (auto &thread : m_threads)
+        thread.join();
+}
+
+void worker_pool::run(size_t count, const std::function<void(size_t)> &job)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_job = &job;
+    m_count = count;
+    m_next = 0;
+    m_busy = (unsigned)m_threads.size();
+    m_error = nullptr;
+    m_generation++;
+    m_start_cv.notify_all();
+    m_done_cv.wait(lock, [this] { return m_busy == 0; });
+
+    m_job = nullptr;
+    if (m_error)
+        std::rethrow_exception(m_error);
+}
+
+void worker_pool::work()
+{
+    uint64_t generation = 0;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+        m_start_cv.wait(lock, [&] { return m_stop || m_generation != generation; });
+        if (m_stop)
+            return;
+        generation = m_generation;
+
+        lock.unlock();
+        size_t index;
+        while ((index = m_next++) < m_count) {
+            try {
+                (*m_job)(index);
+            } catch (...) {
+                std::lock_guard<std::mutex> error_lock(m_mutex);
+                if (!m_error)
+                    m_error = std::current_exception();
+            }
+        }
+        lock.lock();
+
+        if (--m_busy == 0)
+            m_done_cv.notify_one();
+    }
+}
+
+}
@@ -0,0 +1,45 @@
+#ifndef LIBCUTERF_POOL_H
+#define LIBCUTERF_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace cuterf {
+
+// Fixed set of worker threads that run batches of indexed jobs.
+class worker_pool
+{
+public:
+    explicit worker_pool(unsigned threads);
+    ~worker_pool();
+
+    unsigned size() const { return (unsigned)m_threads.size(); }
+
+    // Calls job(0) ... job(count - 1) across the workers and waits for all of them. If any
+    // call throws, the first exception is rethrown once the batch has finished.
+    void run(size_t count, const std::function<void(size_t)> &job);
+
+private:
+    std::vector<std::thread> m_threads;
+    std::mutex m_mutex;
+    std::condition_variable m_start_cv, m_done_cv;
+    uint64_t m_generation;
+    bool m_stop;
+
+    const std::function<void(size_t)> *m_job;
+    size_t m_count;
+    std::atomic<size_t> m_next;
+    unsigned m_busy;
+    std::exception_ptr m_error;
+
+    void work();
+};
+
+}
+
+#endif // LIBCUTERF_POOL_H
@@ -0,0 +1,121 @@
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include "reader.h"
+
+namespace cuterf {
+
+buffered_reader::buffered_reader() : m_head(0), m_tail(0), m_consumed(0)
+{}
+
+buffered_reader::~buffered_reader()
+{}
+
+void buffered_reader::discard_buffered()
+{
+    m_head = m_tail = 0;
+}
+
+size_t buffered_reader::take_buffered(char *data, size_t size)
+{
+    size_t done = 0;
+    while (done < size && m_tail != m_head) {
+        size_t offset = m_tail & (CAPACITY - 1);
+        size_t span = std::min(std::min(m_head - m_tail, CAPACITY - offset), size - done);
+        memcpy(&data[done], &m_ring[offset], span);
+        m_tail += span;
+        done += span;
+    }
+    m_consumed += done;
+    return done;
+}
+
+void buffered_reader::fill()
+{
+    if (m_head == m_tail)
+        m_head = m_tail = 0;
+
+    // read into the largest contiguous free span of the ring
+    size_t offset = m_head & (CAPACITY - 1);
+    size_t free = CAPACITY - (m_head - m_tail);
+    size_t span = std::min(free, CAPACITY - offset);
+    size_t count = read_some(&m_ring[offset], span);
+    if (count == 0 || count > span)
+        throw std::runtime_error("read from serial port failed!");
+    m_head += count;
+}
+
+void buffered_reader::read(std::string &data)
+{
+    size_t done = data.empty() ? 0 : take_buffered(&data[0], data.size());
+    // large reads (e.g. screenshots) go straight into the destination
+    while (done < data.size()) {
+        size_t count = read_some(&data[done], data.size() - done);
+        if (count == 0 || count > data.size() - done)
+            throw std::runtime_error("read from serial port failed!");
+        done += count;
+        m_consumed += count;
+    }
+}
+
+void buffered_reader::read_until(const std::string &expected, std::string *data)
+{
+    if (expected.empty())
+        throw std::logic_error("cannot read until an empty delimiter!");
+
+    // KMP failure function; the vector only grows, so this rarely allocates
+    size_t length = expected.size();
+    if (m_failure.size() < length)
+        m_failure.resize(length);
+    m_failure[0] = 0;
+    for (size_t idx = 1, k = 0; idx < length; idx++) {
+        while (k > 0 && expected[idx] != expected[k])
+            k = m_failure[k - 1];
+        if (expected[idx] == expected[k])
+            k++;
+        m_failure[idx] = k;
+    }
+
+    if (data != nullptr)
+        data->clear();
+
+    size_t matched = 0;
+    while (true) {
+        if (m_tail == m_head)
+            fill();
+
+        size_t offset = m_tail & (CAPACITY - 1);
+        size_t span = std::min(m_head - m_tail, CAPACITY - offset);
+        const char *chunk = &m_ring[offset];
+        size_t idx = 0;
+        while (idx < span && matched < length) {
+            if (matched == 0) {
+                // skip ahead to the next possible start of the delimiter
+                const void *next = memchr(&chunk[idx], expected[0], span - idx);
+                if (next == nullptr) {
+                    idx = span;
+                    break;
+                }
+                idx = (const char *)next - chunk;
+            }
+            char c = chunk[idx++];
+            while (matched > 0 && c != expected[matched])
+                matched = m_failure[matched - 1];
+            if (c == expected[matched])
+                matched++;
+        }
+
+        if (data != nullptr)
+            data->append(chunk, idx);
+        m_tail += idx;
+        m_consumed += idx;
+
+        if (matched == length) {
+            if (data != nullptr)
+                data->resize(data->size() - length);
+            return;
+        }
+    }
+}
+
+}
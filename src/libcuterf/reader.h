@@ -0,0 +1,47 @@
+#ifndef LIBCUTERF_READER_H
+#define LIBCUTERF_READER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace cuterf {
+
+// Reads from a byte stream through a fixed ring buffer. The stream is read in bulk, and
+// delimiters are matched incrementally (KMP), so nothing is allocated or copied per byte.
+class buffered_reader
+{
+public:
+    buffered_reader();
+    virtual ~buffered_reader();
+
+    void read(std::string &data);
+    void read_until(const std::string &expected, std::string *data = nullptr);
+
+    // Drops any bytes that were read ahead but not consumed yet.
+    void discard_buffered();
+    bool has_buffered() const { return m_head != m_tail; }
+    // Moves up to `size` bytes that were read ahead into `data`; returns how many.
+    size_t take_buffered(char *data, size_t size);
+    // Bytes handed out by read() and read_until() so far.
+    uint64_t consumed() const { return m_consumed; }
+
+protected:
+    // Blocks until at least one byte is available, then reads at most `size` bytes.
+    virtual size_t read_some(char *data, size_t size) = 0;
+
+private:
+    static const size_t CAPACITY = 4096; // must be a power of two
+
+    char m_ring[CAPACITY];
+    size_t m_head, m_tail; // free-running; m_head - m_tail bytes are buffered
+    uint64_t m_consumed;
+    std::vector<size_t> m_failure;
+
+    void fill();
+};
+
+}
+
+#endif // LIBCUTERF_READER_H
@@ -0,0 +1,68 @@
+#include <algorithm>
+#include "cuterf.h"
+#include "registry.h"
+
+namespace cuterf {
+
+device_registry::device_registry() : m_watcher(nanovna::VID, nanovna::PID), m_found(false)
+{
+    static_assert(nanovna::VID == tinysa::VID && nanovna::PID == tinysa::PID, 
+        "the registry assumes that NanoVNA and TinySA share a VID/PID");
+}
+
+device_registry &device_registry::instance()
+{
+    static device_registry registry;
+    return registry;
+}
+
+std::vector<usb_serial_port> device_registry::ports()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_found = true;
+    return m_watcher.update();
+}
+
+// Brings the ports up to date, and returns the one at `path` if an identity can be
+// remembered for it. Identities of devices that are gone are forgotten on the way.
+const usb_serial_port *device_registry::find(const std::wstring &path)
+{
+    if (!m_found)
+        return nullptr;
+    const std::vector<usb_serial_port> &ports = m_watcher.update();
+    for (auto it = m_identities.begin(); it != m_identities.end(); ) {
+        bool connected = std::any_of(ports.begin(), ports.end(), [&](const usb_serial_port &port) {
+            return port.arrival == it->second.arrival;
+        });
+        it = connected ? std::next(it) : m_identities.erase(it);
+    }
+
+    for (auto &port : ports) {
+        if (port.path == path)
+            return port.serial_number.empty() || port.arrival == 0 ? nullptr : &port;
+    }
+    return nullptr;
+}
+
+bool device_registry::recall(const std::wstring &path, device_identity &identity)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const usb_serial_port *port = find(path);
+    if (port == nullptr)
+        return false;
+    auto it = m_identities.find(port->serial_number);
+    if (it == m_identities.end() || it->second.arrival != port->arrival)
+        return false;
+    identity = it->second.identity;
+    return true;
+}
+
+void device_registry::remember(const std::wstring &path, const device_identity &identity)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const usb_serial_port *port = find(path);
+    if (port != nullptr)
+        m_identities[port->serial_number] = entry{ port->arrival, identity };
+}
+
+}
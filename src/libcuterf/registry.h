@@ -0,0 +1,53 @@
+#ifndef LIBCUTERF_REGISTRY_H
+#define LIBCUTERF_REGISTRY_H
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "serial.h"
+
+namespace cuterf {
+
+// What identifying a device found out.
+struct device_identity
+{
+    std::string board;            // as device_info::board
+    std::string version;          // firmware version
+    std::string hardware_version; // TinySA only
+};
+
+// The ports that NanoVNA and TinySA can be connected to, found once per process and then
+// kept up to date by a port_watcher, and the identities of the devices behind them. An
+// identity is remembered by USB serial number until its device is disconnected; ports that
+// have no serial number, or whose connections are not observed, are identified every time
+// they are opened. Nothing is remembered until the ports are first asked for, so a device
+// opened by path alone costs no enumeration. Used from any thread.
+class device_registry
+{
+public:
+    static device_registry &instance();
+
+    std::vector<usb_serial_port> ports();
+    bool recall(const std::wstring &path, device_identity &identity);
+    void remember(const std::wstring &path, const device_identity &identity);
+
+private:
+    struct entry
+    {
+        uint64_t arrival; // of the port the device was identified on
+        device_identity identity;
+    };
+
+    std::mutex m_mutex;
+    port_watcher m_watcher;
+    bool m_found; // ports() has been called
+    std::map<std::string, entry> m_identities; // by serial number
+
+    device_registry();
+    const usb_serial_port *find(const std::wstring &path);
+};
+
+}
+
+#endif // LIBCUTERF_REGISTRY_H
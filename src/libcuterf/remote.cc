@@ -0,0 +1,75 @@
+#include <cstring>
+#include <stdexcept>
+#include "remote.h"
+#include "shell.h"
+
+namespace cuterf {
+
+static const char REFRESH_ON[] = "refresh on";
+static const char REFRESH_OFF[] = "refresh off";
+
+static bool ends_with(const std::string &line, const char *suffix)
+{
+    size_t length = strlen(suffix);
+    return line.size() >= length && line.compare(line.size() - length, length, suffix) == 0;
+}
+
+static int load_le16(const char *data)
+{
+    const uint8_t *bytes = (const uint8_t *)data;
+    return (int16_t)(bytes[0] | (bytes[1] << 8));
+}
+
+// Reads a line, and if it is a region header, the region after it; returns false if the
+// line was something else.
+static bool read_region_or_line(serial_port &port, screen_region &region, std::string &line)
+{
+    port.read_until("\r\n", &line);
+    bool bulk = ends_with(line, "bulk");
+    if (!bulk && !ends_with(line, "fill"))
+        return false;
+
+    std::string header(8, '\0');
+    port.read(header);
+    int x = load_le16(&header[0]), y = load_le16(&header[2]);
+    int width = load_le16(&header[4]), height = load_le16(&header[6]);
+    if (x < 0 || y < 0 || width <= 0 || height <= 0)
+        throw std::runtime_error("device sent a malformed screen region!");
+    region.x = x;
+    region.y = y;
+    region.width = width;
+    region.height = height;
+    region.fill = !bulk;
+    region.data.resize(bulk ? 2 * (size_t)width * height : 2);
+    port.read(region.data);
+    return true;
+}
+
+void remote_desktop_start(serial_port &port)
+{
+    shell_run(port, REFRESH_ON);
+}
+
+bool remote_desktop_read(serial_port &port, screen_region &region, unsigned timeout_ms)
+{
+    std::string line;
+    do {
+        if (!port.wait_readable(timeout_ms))
+            return false;
+        port.arm();
+    } while (!read_region_or_line(port, region, line));
+    return true;
+}
+
+void remote_desktop_stop(serial_port &port)
+{
+    port.arm();
+    port.write(std::string(REFRESH_OFF) + "\r\n");
+    screen_region discarded;
+    std::string line;
+    while (read_region_or_line(port, discarded, line) || !ends_with(line, REFRESH_OFF))
+        ;
+    port.read_until("ch> ");
+}
+
+}
@@ -0,0 +1,22 @@
+#ifndef LIBCUTERF_REMOTE_H
+#define LIBCUTERF_REMOTE_H
+
+#include "cuterf.h"
+#include "serial.h"
+
+namespace cuterf {
+
+// After `refresh on`, NanoVNA and TinySA firmware send every region of the screen they
+// redraw: a `bulk` or `fill` line, then x, y, width and height as little-endian int16, then
+// either width * height pixels or a single pixel to fill the region with, then a prompt.
+// Shell output may appear between regions and is skipped.
+
+void remote_desktop_start(serial_port &port);
+// Waits up to `timeout_ms` for the next region; returns false on timeout.
+bool remote_desktop_read(serial_port &port, screen_region &region, unsigned timeout_ms);
+// Regions that were already on the way are discarded.
+void remote_desktop_stop(serial_port &port);
+
+}
+
+#endif // LIBCUTERF_REMOTE_H
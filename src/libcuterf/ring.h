@@ -0,0 +1,59 @@
+#ifndef LIBCUTERF_RING_H
+#define LIBCUTERF_RING_H
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+namespace cuterf {
+
+// Fixed-capacity lock-free ring for exactly one producer and one consumer thread. Slots are
+// constructed up front and reused; the producer fills a slot in place between begin_write()
+// and end_write(), and the consumer drains it between begin_read() and end_read().
+template<class T>
+class spsc_ring
+{
+public:
+    spsc_ring(size_t capacity, const T &prototype) : 
+        m_slots(capacity, prototype), m_head(0), m_tail(0)
+    {}
+
+    size_t capacity() const { return m_slots.size(); }
+
+    // Returns the next free slot, or nullptr if the consumer has fallen behind.
+    T *begin_write()
+    {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        if (head - m_tail.load(std::memory_order_acquire) == m_slots.size())
+            return nullptr;
+        return &m_slots[head % m_slots.size()];
+    }
+
+    void end_write()
+    {
+        m_head.store(m_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // Returns the oldest filled slot, or nullptr if there is none.
+    T *begin_read()
+    {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail == m_head.load(std::memory_order_acquire))
+            return nullptr;
+        return &m_slots[tail % m_slots.size()];
+    }
+
+    void end_read()
+    {
+        m_tail.store(m_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+private:
+    std::vector<T> m_slots;
+    alignas(64) std::atomic<size_t> m_head; // advanced by the producer
+    alignas(64) std::atomic<size_t> m_tail; // advanced by the consumer
+};
+
+}
+
+#endif // LIBCUTERF_RING_H
@@ -1,17 +1,91 @@
 #ifndef LIBCUTERF_SERIAL_H
 #define LIBCUTERF_SERIAL_H
 
+#ifdef _WIN32
 #include <windows.h>
+#include <cfgmgr32.h>
+#endif
+#include <chrono>
 #include <cstdint>
 #include <string>
+#include <vector>
+#include "reader.h"
 
 namespace cuterf {
 
+struct usb_serial_port
+{
+    std::wstring path;
+    std::string serial_number; // empty if the device has none
+    uint64_t arrival;          // numbered by port_watcher; 0 if connections are not observed
+
+    usb_serial_port() : arrival(0) {}
+};
+
 bool FindUSBSerialPortByVIDPID(uint16_t VID, uint16_t PID, std::wstring &port_unc_path);
+// Finds every matching port, ordered by path.
+void FindUSBSerialPortsByVIDPID(uint16_t VID, uint16_t PID, std::vector<usb_serial_port> &ports);
 
-struct serial_port 
+// Keeps the list of matching ports up to date without enumerating them again: once they are
+// found, ports connected and disconnected are observed as they come and go (through inotify on
+// /dev/serial/by-id on Linux, or device notifications on Windows). Every connection observed
+// gets a new arrival number, so a device that was unplugged and plugged in again, perhaps
+// with new firmware, is told apart from one that stayed connected. Where connections cannot
+// be observed, every update enumerates the ports again and numbers them 0.
+class port_watcher
 {
+public:
+    port_watcher(uint16_t VID, uint16_t PID);
+    ~port_watcher();
+    port_watcher(const port_watcher &) = delete;
+    port_watcher &operator=(const port_watcher &) = delete;
+
+    // Returns the ports connected now, ordered by path.
+    const std::vector<usb_serial_port> &update();
+
+private:
+    uint16_t m_VID, m_PID;
+    uint64_t m_arrivals;
+    std::vector<usb_serial_port> m_ports;
+#ifdef _WIN32
+    HCMNOTIFICATION hNotification;
+    volatile LONG64 m_changes; // bumped by the notification callback
+    LONG64 m_seen_changes;
+#else
+    int m_inotify;
+    std::string m_overrides;                     // CUTERF_PORTS when the ports were last found
+    std::vector<std::pair<std::string, std::wstring>> m_links; // names in by-id, and their ports
+#endif
+
+    void rescan(bool observed);
+#ifdef _WIN32
+    static DWORD CALLBACK notify(HCMNOTIFICATION, PVOID context, CM_NOTIFY_ACTION, PCM_NOTIFY_EVENT_DATA, DWORD);
+#else
+    bool watch();
+    void link_added(const std::string &name);
+    void link_removed(const std::string &name);
+#endif
+};
+
+class shell_stats;
+
+constexpr unsigned DEFAULT_TIMEOUT_MS = 60000;
+
+struct serial_port : buffered_reader
+{
+    typedef std::chrono::steady_clock clock;
+
+#ifdef _WIN32
     HANDLE hPort;
+    volatile LONG cancelled;
+#else
+    int fd;
+    int cancel_fds[2]; // a pipe, written to by cancel()
+#endif
+    uint64_t syscalls;  // reads and writes made so far
+    shell_stats *stats; // if non-null, commands run on the port are measured into it
+    clock::duration timeout; // given to each command by arm(); zero for none
+    clock::time_point deadline; // waiting for the device past it throws timeout_error
 
     serial_port();
     ~serial_port();
@@ -20,11 +94,26 @@ struct serial_port
     bool open(std::wstring path);
     void close();
 
-    void write(std::string data);
-    void read(std::string &data);
-    void read_until(std::string expected, std::string *data = nullptr);
+    void write(const std::string &data);
+    // Waits up to `timeout_ms` for data to read; returns false on timeout.
+    bool wait_readable(unsigned timeout_ms);
+    // Reads what has arrived, without waiting; returns 0 if nothing has.
+    size_t read_available(char *data, size_t size);
+
+    // Starts the time the device has to answer the command just written.
+    void arm()
+    {
+        deadline = timeout == clock::duration::zero() ? (clock::time_point::max)() : clock::now() + timeout;
+    }
+    // Makes the wait in progress, or the next one, throw cancelled_error. Thread-safe.
+    void cancel();
+    // Returns true, once, if cancel() has been called.
+    bool take_cancellation();
+
+protected:
+    size_t read_some(char *data, size_t size) override;
 };
 
 }
 
-#endif // LIBCUTERF_SERIAL_H
\ No newline at end of file
+#endif // LIBCUTERF_SERIAL_H
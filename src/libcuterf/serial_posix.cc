@@ -0,0 +1,457 @@
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+#include <termios.h>
+#include <unistd.h>
+#include "cuterf.h"
+#include "file.h"
+#include "serial.h"
+
+namespace cuterf {
+
+static std::wstring widen(const std::string &narrow)
+{
+    return std::wstring(narrow.begin(), narrow.end());
+}
+
+static std::vector<std::string> list_directory(const std::string &path)
+{
+    std::vector<std::string> names;
+    DIR *dir = opendir(path.c_str());
+    if (dir == NULL)
+        return names;
+    while (struct dirent *entry = readdir(dir)) {
+        if (entry->d_name[0] != '.')
+            names.push_back(entry->d_name);
+    }
+    closedir(dir);
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+static bool read_hex_attribute(const std::string &path, unsigned &value)
+{
+    std::ifstream file(path);
+    return (bool)(file >> std::hex >> value);
+}
+
+static std::string read_text_attribute(const std::string &path)
+{
+    std::string value;
+    std::ifstream file(path);
+    std::getline(file, value);
+    return value;
+}
+
+void FindUSBSerialPortsByVIDPID(uint16_t VID, uint16_t PID, std::vector<usb_serial_port> &ports)
+{
+    // CUTERF_PORTS, a list of paths separated by `:`, replaces discovery; it points the tools
+    // at stand-ins such as cuterf_simulator, which have no USB device behind them. A path may
+    // be followed by `=` and the serial number the stand-in should be known by.
+    ports.clear();
+    if (const char *override_paths = getenv("CUTERF_PORTS")) {
+        std::string paths = override_paths;
+        for (size_t begin = 0, end; begin <= paths.size(); begin = end + 1) {
+            end = std::min(paths.find(':', begin), paths.size());
+            if (end > begin) {
+                std::string entry = paths.substr(begin, end - begin);
+                size_t equals = entry.find('=');
+                usb_serial_port port;
+                port.path = widen(entry.substr(0, equals));
+                if (equals != std::string::npos)
+                    port.serial_number = entry.substr(equals + 1);
+                ports.push_back(port);
+            }
+        }
+        return;
+    }
+
+    // USB devices are named like `1-1.2`, and their interfaces like `1-1.2:1.0`; an ACM
+    // interface bound to a tty driver has the tty name under `tty/`.
+    static const std::string usb_devices = "/sys/bus/usb/devices/";
+    std::vector<std::string> entries = list_directory(usb_devices);
+    for (auto &device : entries) {
+        if (device.find(':') != std::string::npos)
+            continue;
+
+        unsigned vendor, product;
+        if (!read_hex_attribute(usb_devices + device + "/idVendor", vendor) || vendor != VID)
+            continue;
+        if (!read_hex_attribute(usb_devices + device + "/idProduct", product) || product != PID)
+            continue;
+
+        for (auto &interface : entries) {
+            if (interface.compare(0, device.size() + 1, device + ":"))
+                continue;
+            std::vector<std::string> ttys = list_directory(usb_devices + interface + "/tty");
+            if (ttys.empty())
+                continue;
+            usb_serial_port port;
+            port.path = widen("/dev/" + ttys[0]);
+            port.serial_number = read_text_attribute(usb_devices + device + "/serial");
+            ports.push_back(port);
+            break;
+        }
+    }
+    std::sort(ports.begin(), ports.end(), [](const usb_serial_port &a, const usb_serial_port &b) {
+        return a.path < b.path;
+    });
+}
+
+bool FindUSBSerialPortByVIDPID(uint16_t VID, uint16_t PID, std::wstring &port_unc_path)
+{
+    std::vector<usb_serial_port> ports;
+    FindUSBSerialPortsByVIDPID(VID, PID, ports);
+    if (ports.empty())
+        return false;
+    port_unc_path = ports[0].path;
+    return true;
+}
+
+static const std::string serial_by_id = "/dev/serial/by-id/";
+
+port_watcher::port_watcher(uint16_t VID, uint16_t PID) : m_VID(VID), m_PID(PID), m_arrivals(0), m_inotify(-1)
+{}
+
+port_watcher::~port_watcher()
+{
+    if (m_inotify != -1)
+        ::close(m_inotify);
+}
+
+// Finds the ports again; if `observed`, connections are observed from now on, and the ports
+// found are numbered as new arrivals.
+void port_watcher::rescan(bool observed)
+{
+    FindUSBSerialPortsByVIDPID(m_VID, m_PID, m_ports);
+    for (auto &port : m_ports)
+        port.arrival = observed ? ++m_arrivals : 0;
+}
+
+const std::vector<usb_serial_port> &port_watcher::update()
+{
+    // stand-ins are fixed for as long as CUTERF_PORTS is
+    if (const char *overrides = getenv("CUTERF_PORTS")) {
+        if (m_inotify != -1)
+            ::close(m_inotify);
+        m_inotify = -1;
+        if (m_ports.empty() || m_overrides != overrides) {
+            m_overrides = overrides;
+            rescan(true);
+        }
+        return m_ports;
+    }
+    if (!m_overrides.empty()) {
+        m_overrides.clear();
+        m_ports.clear();
+    }
+
+    if (m_inotify == -1) {
+        // the watch is set before the ports are found, so that none are missed in between
+        rescan(watch());
+        return m_ports;
+    }
+
+#ifdef __linux__
+    alignas(struct inotify_event) char events[4096];
+    while (true) {
+        ssize_t size = read(m_inotify, events, sizeof(events));
+        if (size == -1 && errno == EINTR)
+            continue;
+        if (size <= 0)
+            break;
+        for (ssize_t offset = 0; offset < size; ) {
+            const struct inotify_event *event = (const struct inotify_event *)&events[offset];
+            offset += sizeof(struct inotify_event) + event->len;
+            if (event->mask & (IN_Q_OVERFLOW | IN_IGNORED)) {
+                // events were lost, or udev removed the directory with the last port in it
+                ::close(m_inotify);
+                m_inotify = -1;
+                rescan(watch());
+                return m_ports;
+            }
+            if (event->len == 0)
+                continue;
+            if (event->mask & (IN_CREATE | IN_MOVED_TO))
+                link_added(event->name);
+            else if (event->mask & (IN_DELETE | IN_MOVED_FROM))
+                link_removed(event->name);
+        }
+    }
+#endif
+    return m_ports;
+}
+
+// udev links every serial port with a USB device behind it from /dev/serial/by-id, which
+// only exists while there is such a port; until it does, ports are found on every update.
+bool port_watcher::watch()
+{
+    m_links.clear();
+#ifdef __linux__
+    m_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_inotify == -1)
+        return false;
+    if (inotify_add_watch(m_inotify, serial_by_id.c_str(), 
+            IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF) == -1) {
+        ::close(m_inotify);
+        m_inotify = -1;
+        return false;
+    }
+    for (auto &name : list_directory(serial_by_id)) {
+        if (char *target = realpath((serial_by_id + name).c_str(), NULL)) {
+            m_links.emplace_back(name, widen(target));
+            free(target);
+        }
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+void port_watcher::link_added(const std::string &name)
+{
+    char *target = realpath((serial_by_id + name).c_str(), NULL);
+    if (target == NULL)
+        return; // removed already
+    std::string path = target;
+    free(target);
+    link_removed(name);
+    m_links.emplace_back(name, widen(path));
+
+    // the tty is a child of an interface of the USB device, which has the IDs
+    std::string tty = path.substr(path.rfind('/') + 1);
+    char *device = realpath(("/sys/class/tty/" + tty + "/device/..").c_str(), NULL);
+    if (device == NULL)
+        return;
+    std::string usb_device = device;
+    free(device);
+    unsigned vendor, product;
+    if (!read_hex_attribute(usb_device + "/idVendor", vendor) || vendor != m_VID)
+        return;
+    if (!read_hex_attribute(usb_device + "/idProduct", product) || product != m_PID)
+        return;
+
+    usb_serial_port port;
+    port.path = widen(path);
+    port.serial_number = read_text_attribute(usb_device + "/serial");
+    port.arrival = ++m_arrivals;
+    auto position = std::lower_bound(m_ports.begin(), m_ports.end(), port, 
+        [](const usb_serial_port &a, const usb_serial_port &b) { return a.path < b.path; });
+    if (position != m_ports.end() && position->path == port.path)
+        *position = port;
+    else
+        m_ports.insert(position, port);
+}
+
+void port_watcher::link_removed(const std::string &name)
+{
+    auto link = std::find_if(m_links.begin(), m_links.end(), 
+        [&](const std::pair<std::string, std::wstring> &entry) { return entry.first == name; });
+    if (link == m_links.end())
+        return;
+    std::wstring path = link->second;
+    m_links.erase(link);
+    m_ports.erase(std::remove_if(m_ports.begin(), m_ports.end(), 
+        [&](const usb_serial_port &port) { return port.path == path; }), m_ports.end());
+}
+
+serial_port::serial_port() : 
+    fd(-1), syscalls(0), stats(nullptr), timeout(std::chrono::milliseconds(DEFAULT_TIMEOUT_MS)),
+    deadline(clock::time_point::max())
+{
+    if (pipe(cancel_fds) == -1)
+        throw std::runtime_error("pipe() failed");
+    for (int cancel_fd : cancel_fds) {
+        fcntl(cancel_fd, F_SETFL, O_NONBLOCK);
+        fcntl(cancel_fd, F_SETFD, FD_CLOEXEC);
+    }
+}
+
+serial_port::~serial_port()
+{
+    close();
+    ::close(cancel_fds[0]);
+    ::close(cancel_fds[1]);
+}
+
+bool serial_port::is_open() const
+{
+    return fd != -1;
+}
+
+bool serial_port::open(std::wstring path)
+{
+    fd = ::open(narrow_path(path).c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (fd == -1) {
+        // another process set TIOCEXCL on the port
+        if (errno == EBUSY)
+            throw std::runtime_error("serial port is in use!");
+        return false;
+    }
+
+    // as share mode 0 does on Win32, this keeps other processes from interleaving their
+    // commands with ours: TIOCEXCL refuses later opens except by root, and the lock covers
+    // those as well
+    ioctl(fd, TIOCEXCL);
+    if (flock(fd, LOCK_EX | LOCK_NB) == -1) {
+        int error = errno;
+        ::close(fd);
+        fd = -1;
+        if (error == EWOULDBLOCK)
+            throw std::runtime_error("serial port is in use!");
+        return false;
+    }
+
+    struct termios tio;
+    if (tcgetattr(fd, &tio) == 0) {
+        cfmakeraw(&tio);
+        tio.c_cflag |= CLOCAL | CREAD;
+        tio.c_cc[VMIN] = 0;
+        tio.c_cc[VTIME] = 0;
+        cfsetispeed(&tio, B115200);
+        cfsetospeed(&tio, B115200);
+        tcsetattr(fd, TCSANOW, &tio);
+        tcflush(fd, TCIFLUSH);
+    }
+
+    discard_buffered();
+    take_cancellation();
+    deadline = clock::time_point::max();
+    return true;
+}
+
+void serial_port::close()
+{
+    if (fd != -1) {
+        ioctl(fd, TIOCNXCL);
+        ::close(fd);
+    }
+    fd = -1;
+    discard_buffered();
+}
+
+void serial_port::cancel()
+{
+    char signal = 1;
+    while (::write(cancel_fds[1], &signal, 1) == -1 && errno == EINTR)
+        ;
+}
+
+bool serial_port::take_cancellation()
+{
+    char signals[64];
+    bool cancelled = false;
+    ssize_t count;
+    while ((count = ::read(cancel_fds[0], signals, sizeof(signals))) > 0 || (count == -1 && errno == EINTR))
+        cancelled |= count > 0;
+    return cancelled;
+}
+
+// Waits for `events` on the port until the deadline, or until cancelled.
+static void wait_for(serial_port &port, short events)
+{
+    struct pollfd pfds[2] = { { port.fd, events, 0 }, { port.cancel_fds[0], POLLIN, 0 } };
+    while (true) {
+        int timeout_ms = -1;
+        if (port.deadline != serial_port::clock::time_point::max()) {
+            auto left = port.deadline - serial_port::clock::now();
+            if (left <= serial_port::clock::duration::zero())
+                throw timeout_error("device did not answer in time!");
+            timeout_ms = (int)std::min<int64_t>(std::chrono::ceil<std::chrono::milliseconds>(left).count(), INT_MAX);
+        }
+        int count = poll(pfds, 2, timeout_ms);
+        if (count == -1 && errno == EINTR)
+            continue;
+        if (count == -1)
+            throw std::runtime_error("poll() failed");
+        if ((pfds[1].revents & POLLIN) && port.take_cancellation())
+            throw cancelled_error("operation was cancelled!");
+        if (count == 0 || pfds[0].revents == 0)
+            continue;
+        if (!(pfds[0].revents & events))
+            throw std::runtime_error("serial port was disconnected");
+        return;
+    }
+}
+
+void serial_port::write(const std::string &data)
+{
+    size_t done = 0;
+    while (done < data.size()) {
+        ssize_t count = ::write(fd, &data[done], data.size() - done);
+        syscalls++;
+        if (count > 0) {
+            done += count;
+        } else if (count == -1 && errno == EAGAIN) {
+            wait_for(*this, POLLOUT);
+        } else if (!(count == -1 && errno == EINTR)) {
+            throw std::runtime_error("write() failed");
+        }
+    }
+}
+
+bool serial_port::wait_readable(unsigned timeout_ms)
+{
+    if (has_buffered())
+        return true;
+    struct pollfd pfds[2] = { { fd, POLLIN, 0 }, { cancel_fds[0], POLLIN, 0 } };
+    int count;
+    while ((count = poll(pfds, 2, (int)timeout_ms)) == -1) {
+        if (errno != EINTR)
+            throw std::runtime_error("poll() failed");
+    }
+    if ((pfds[1].revents & POLLIN) && take_cancellation())
+        throw cancelled_error("operation was cancelled!");
+    if (pfds[0].revents == 0)
+        return false;
+    if (!(pfds[0].revents & POLLIN))
+        throw std::runtime_error("serial port was disconnected");
+    return true;
+}
+
+size_t serial_port::read_available(char *data, size_t size)
+{
+    size_t done = take_buffered(data, size);
+    if (done != 0)
+        return done;
+    while (true) {
+        ssize_t count = ::read(fd, data, size);
+        syscalls++;
+        if (count >= 0)
+            return count;
+        if (errno == EAGAIN)
+            return 0;
+        if (errno != EINTR)
+            throw std::runtime_error("read() failed");
+    }
+}
+
+size_t serial_port::read_some(char *data, size_t size)
+{
+    while (true) {
+        ssize_t count = ::read(fd, data, size);
+        syscalls++;
+        if (count > 0)
+            return count;
+        if (count == -1 && errno == EINTR)
+            continue;
+        if (count == -1 && errno != EAGAIN)
+            throw std::runtime_error("read() failed");
+        wait_for(*this, POLLIN);
+    }
+}
+
+}
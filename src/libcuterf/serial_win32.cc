@@ -0,0 +1,247 @@
+#include <algorithm>
+#include <stdexcept>
+#include <initguid.h>
+#include <windows.h>
+#include <strsafe.h>
+#include <Setupapi.h>
+#include <cfgmgr32.h>
+#include <usbiodef.h>
+#include "cuterf.h"
+#include "serial.h"
+
+namespace cuterf {
+
+void FindUSBSerialPortsByVIDPID(uint16_t VID, uint16_t PID, std::vector<usb_serial_port> &ports) 
+{
+    WCHAR szExpectedHardwareId[128];
+    StringCchPrintf(szExpectedHardwareId, sizeof(szExpectedHardwareId) / sizeof(WCHAR),
+        L"USB\\VID_%04x&PID_%04x", VID, PID);
+
+    ports.clear();
+    HDEVINFO hDeviceInfoSet = SetupDiGetClassDevs(NULL, L"USB", NULL, DIGCF_ALLCLASSES | DIGCF_PRESENT);
+    if (hDeviceInfoSet == INVALID_HANDLE_VALUE)
+        return;
+
+    SP_DEVINFO_DATA DeviceInfoData = {};
+    DWORD dwDeviceIndex = 0;
+    DeviceInfoData.cbSize = sizeof(DeviceInfoData);
+    while (SetupDiEnumDeviceInfo(hDeviceInfoSet, dwDeviceIndex++, &DeviceInfoData)) {
+        WCHAR szHardwareId[128];
+        DWORD dwHardwareIdSize = 0;
+        if (SetupDiGetDeviceRegistryProperty(hDeviceInfoSet, &DeviceInfoData, SPDRP_HARDWAREID, NULL, (LPBYTE)szHardwareId, (DWORD)sizeof(szHardwareId) * sizeof(WCHAR), &dwHardwareIdSize)) {
+            if (wcsncmp(szHardwareId, szExpectedHardwareId, wcslen(szExpectedHardwareId)))
+                continue;
+
+            HKEY hDeviceRegistryKey = SetupDiOpenDevRegKey(hDeviceInfoSet, &DeviceInfoData, DICS_FLAG_GLOBAL, 0, DIREG_DEV, KEY_READ);
+            if (hDeviceRegistryKey == INVALID_HANDLE_VALUE)
+                continue;
+
+            DWORD dwRegValueType = 0;
+            WCHAR szPortName[16];
+            DWORD dwPortNameSize = sizeof(szPortName) * sizeof(WCHAR);
+            LSTATUS result = RegQueryValueEx(hDeviceRegistryKey, L"PortName", NULL, &dwRegValueType, (LPBYTE) szPortName, &dwPortNameSize);
+                RegCloseKey(hDeviceRegistryKey);
+
+            if (result != ERROR_SUCCESS || dwRegValueType != REG_SZ)
+                continue;
+            if (wcsncmp(szPortName, L"COM", 3))
+                continue;
+
+            usb_serial_port port;
+            port.path = std::wstring(L"\\\\.\\") + szPortName;
+
+            // the instance ID is USB\VID_xxxx&PID_xxxx\<serial>; Windows substitutes an ID
+            // containing '&' for devices without a serial number
+            WCHAR szInstanceId[MAX_DEVICE_ID_LEN];
+            if (SetupDiGetDeviceInstanceId(hDeviceInfoSet, &DeviceInfoData, szInstanceId, MAX_DEVICE_ID_LEN, NULL)) {
+                const WCHAR *szSerial = wcsrchr(szInstanceId, L'\\');
+                if (szSerial != NULL && wcschr(szSerial, L'&') == NULL)
+                    for (szSerial++; *szSerial; szSerial++)
+                        port.serial_number += (char)*szSerial;
+            }
+            ports.push_back(port);
+        }
+    }
+
+    SetupDiDestroyDeviceInfoList(hDeviceInfoSet);
+    std::sort(ports.begin(), ports.end(), [](const usb_serial_port &a, const usb_serial_port &b) {
+        return a.path < b.path;
+    });
+}
+
+bool FindUSBSerialPortByVIDPID(uint16_t VID, uint16_t PID, std::wstring &port_unc_path) 
+{
+    std::vector<usb_serial_port> ports;
+    FindUSBSerialPortsByVIDPID(VID, PID, ports);
+    if (ports.empty())
+        return false;
+    port_unc_path = ports[0].path;
+    return true;
+}
+
+port_watcher::port_watcher(uint16_t VID, uint16_t PID) : 
+    m_VID(VID), m_PID(PID), m_arrivals(0), hNotification(NULL), m_changes(0), m_seen_changes(0)
+{}
+
+port_watcher::~port_watcher()
+{
+    if (hNotification != NULL)
+        CM_Unregister_Notification(hNotification);
+}
+
+DWORD CALLBACK port_watcher::notify(HCMNOTIFICATION, PVOID context, CM_NOTIFY_ACTION, PCM_NOTIFY_EVENT_DATA, DWORD)
+{
+    InterlockedIncrement64(&((port_watcher *)context)->m_changes);
+    return ERROR_SUCCESS;
+}
+
+void port_watcher::rescan(bool observed)
+{
+    FindUSBSerialPortsByVIDPID(m_VID, m_PID, m_ports);
+    for (auto &port : m_ports)
+        port.arrival = observed ? ++m_arrivals : 0;
+}
+
+// Windows tells that some USB device came or went, but not which one, so every port is
+// found again and numbered as a new arrival.
+const std::vector<usb_serial_port> &port_watcher::update()
+{
+    if (hNotification == NULL) {
+        CM_NOTIFY_FILTER filter = {};
+        filter.cbSize = sizeof(filter);
+        filter.FilterType = CM_NOTIFY_FILTER_TYPE_DEVICEINTERFACE;
+        filter.u.DeviceInterface.ClassGuid = GUID_DEVINTERFACE_USB_DEVICE;
+        if (CM_Register_Notification(&filter, this, notify, &hNotification) != CR_SUCCESS) {
+            hNotification = NULL;
+            rescan(false);
+            return m_ports;
+        }
+        m_seen_changes = InterlockedCompareExchange64(&m_changes, 0, 0);
+        rescan(true);
+        return m_ports;
+    }
+
+    LONG64 changes = InterlockedCompareExchange64(&m_changes, 0, 0);
+    if (changes != m_seen_changes) {
+        m_seen_changes = changes;
+        rescan(true);
+    }
+    return m_ports;
+}
+
+serial_port::serial_port() : 
+    hPort(INVALID_HANDLE_VALUE), cancelled(0), syscalls(0), stats(nullptr), 
+    timeout(std::chrono::milliseconds(DEFAULT_TIMEOUT_MS)), deadline((clock::time_point::max)())
+{}
+
+serial_port::~serial_port() 
+{
+    close();
+}
+
+bool serial_port::is_open() const
+{
+    return hPort != INVALID_HANDLE_VALUE;
+}
+
+bool serial_port::open(std::wstring path) 
+{
+    hPort = CreateFile(path.c_str(), GENERIC_READ|GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+    if (hPort == INVALID_HANDLE_VALUE)
+        return false;
+    
+    // ReadFile() returns as soon as any bytes are available, or after 50 ms with none, so
+    // that waits notice deadlines and cancellation
+    COMMTIMEOUTS CommTimeouts = {};
+    CommTimeouts.ReadIntervalTimeout = MAXDWORD;
+    CommTimeouts.ReadTotalTimeoutMultiplier = MAXDWORD;
+    CommTimeouts.ReadTotalTimeoutConstant = 50;
+    CommTimeouts.WriteTotalTimeoutMultiplier = 0;
+    CommTimeouts.WriteTotalTimeoutConstant = 0;
+    SetCommTimeouts(hPort, &CommTimeouts);
+
+    discard_buffered();
+    take_cancellation();
+    deadline = (clock::time_point::max)();
+    return true;
+}
+
+void serial_port::close()
+{
+    CloseHandle(hPort);
+    hPort = INVALID_HANDLE_VALUE;
+    discard_buffered();
+}
+
+void serial_port::write(const std::string &data)
+{
+    DWORD dwWritten = 0;
+    syscalls++;
+    if (!WriteFile(hPort, data.data(), (DWORD)data.size(), &dwWritten, NULL) || dwWritten != data.size())
+        throw std::runtime_error("WriteFile() failed");
+}
+
+void serial_port::cancel()
+{
+    InterlockedExchange(&cancelled, 1);
+}
+
+bool serial_port::take_cancellation()
+{
+    return InterlockedExchange(&cancelled, 0) != 0;
+}
+
+bool serial_port::wait_readable(unsigned timeout_ms)
+{
+    DWORD dwStart = GetTickCount();
+    while (!has_buffered()) {
+        if (take_cancellation())
+            throw cancelled_error("operation was cancelled!");
+        DWORD dwErrors;
+        COMSTAT ComStat;
+        if (!ClearCommError(hPort, &dwErrors, &ComStat))
+            throw std::runtime_error("ClearCommError() failed");
+        if (ComStat.cbInQue != 0)
+            break;
+        if (GetTickCount() - dwStart >= timeout_ms)
+            return false;
+        Sleep(1);
+    }
+    return true;
+}
+
+size_t serial_port::read_available(char *data, size_t size)
+{
+    size_t done = take_buffered(data, size);
+    if (done != 0)
+        return done;
+
+    DWORD dwErrors;
+    COMSTAT ComStat;
+    if (!ClearCommError(hPort, &dwErrors, &ComStat))
+        throw std::runtime_error("ClearCommError() failed");
+    if (ComStat.cbInQue == 0)
+        return 0;
+    DWORD dwRead = 0;
+    syscalls++;
+    if (!ReadFile(hPort, data, (DWORD)(size < ComStat.cbInQue ? size : ComStat.cbInQue), &dwRead, NULL))
+        throw std::runtime_error("ReadFile() failed");
+    return dwRead;
+}
+
+size_t serial_port::read_some(char *data, size_t size)
+{
+    DWORD dwRead = 0;
+    while (dwRead == 0) {
+        if (take_cancellation())
+            throw cancelled_error("operation was cancelled!");
+        if (clock::now() >= deadline)
+            throw timeout_error("device did not answer in time!");
+        syscalls++;
+        if (!ReadFile(hPort, data, (DWORD)size, &dwRead, NULL))
+            throw std::runtime_error("ReadFile() failed");
+    }
+    return dwRead;
+}
+
+}
\ No newline at end of file
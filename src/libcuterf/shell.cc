@@ -0,0 +1,173 @@
+#include <algorithm>
+#include <stdexcept>
+#include "shell.h"
+#include "stats.h"
+
+namespace cuterf {
+
+static const char SYNC_COMMAND[] = "#sync#\r\n";
+static const char SYNC_REPLY[] = "#sync#\r\n#sync#?\r\nch> ";
+static const char PROMPT[] = "ch> ";
+
+std::vector<std::string> shell_run_batch(serial_port &port, const std::vector<shell_command> &commands,
+    bool synchronize)
+{
+    std::string lines;
+    if (synchronize)
+        lines += SYNC_COMMAND;
+    for (auto &command : commands)
+        lines += command.line + "\r\n";
+
+    // measured as if each command were written on its own, with the write charged to the first
+    std::vector<shell_probe> probes(port.stats != nullptr ? commands.size() : 0);
+    shell_probe unmeasured;
+    shell_stats::clock::time_point sent;
+    uint64_t syscalls = port.syscalls;
+    if (port.stats != nullptr)
+        sent = shell_stats::clock::now();
+    port.arm();
+    port.write(lines);
+    for (size_t idx = 0; idx < probes.size(); idx++) {
+        size_t written = commands[idx].line.size() + 2 + (idx == 0 && synchronize ? sizeof(SYNC_COMMAND) - 1 : 0);
+        probes[idx].sent(port, commands[idx].line, written, sent, idx == 0 ? syscalls : port.syscalls);
+    }
+
+    if (synchronize)
+        port.read_until(SYNC_REPLY);
+
+    std::vector<std::string> outputs(commands.size());
+    std::string prompt(4, '\0');
+    for (size_t idx = 0; idx < commands.size(); idx++) {
+        shell_probe &probe = probes.empty() ? unmeasured : probes[idx];
+        probe.reading(port);
+        port.read_until(commands[idx].line + "\r\n");
+        probe.echoed();
+        if (commands[idx].binary_size == 0) {
+            port.read_until(PROMPT, &outputs[idx]);
+        } else {
+            outputs[idx].resize(commands[idx].binary_size);
+            port.read(outputs[idx]);
+            port.read(prompt);
+            if (prompt != PROMPT)
+                throw std::runtime_error("device returned " + commands[idx].line + " output of wrong size!");
+        }
+        probe.finished(port);
+        port.arm();
+    }
+    return outputs;
+}
+
+shell_exchange::shell_exchange(const std::vector<shell_command> &commands, bool synchronize) :
+    m_commands(commands), m_outputs(commands.size()), m_stage(READING_SYNC), m_index(0), m_searched(0)
+{
+    if (synchronize)
+        m_request += SYNC_COMMAND;
+    for (auto &command : commands)
+        m_request += command.line + "\r\n";
+    if (!synchronize)
+        begin_command();
+}
+
+const std::string &shell_exchange::partial() const
+{
+    static const std::string none;
+    return m_index < m_outputs.size() ? m_outputs[m_index] : none;
+}
+
+void shell_exchange::begin_command()
+{
+    m_searched = 0;
+    m_stage = m_index < m_commands.size() ? READING_ECHO : DONE;
+}
+
+// Drops pending bytes up to and including `expected`; returns false, keeping what may be the
+// start of it, if it has not arrived yet.
+bool shell_exchange::skip_past(const std::string &expected)
+{
+    size_t found = m_pending.find(expected);
+    if (found == std::string::npos) {
+        if (m_pending.size() >= expected.size())
+            m_pending.erase(0, m_pending.size() - expected.size() + 1);
+        return false;
+    }
+    m_pending.erase(0, found + expected.size());
+    return true;
+}
+
+void shell_exchange::feed(const char *data, size_t size)
+{
+    m_pending.append(data, size);
+    while (m_stage != DONE) {
+        if (m_stage == READING_SYNC) {
+            if (!skip_past(SYNC_REPLY))
+                return;
+            begin_command();
+        } else if (m_stage == READING_ECHO) {
+            if (!skip_past(m_commands[m_index].line + "\r\n"))
+                return;
+            m_stage = m_commands[m_index].binary_size != 0 ? READING_BINARY : READING_TEXT;
+        } else if (m_stage == READING_TEXT) {
+            std::string &output = m_outputs[m_index];
+            output += m_pending;
+            m_pending.clear();
+            size_t found = output.find(PROMPT, m_searched);
+            if (found == std::string::npos) {
+                m_searched = output.size() >= sizeof(PROMPT) - 1 ? output.size() - (sizeof(PROMPT) - 2) : 0;
+                return;
+            }
+            m_pending = output.substr(found + sizeof(PROMPT) - 1);
+            output.resize(found);
+            m_index++;
+            begin_command();
+        } else if (m_stage == READING_BINARY) {
+            std::string &output = m_outputs[m_index];
+            size_t count = std::min(m_pending.size(), m_commands[m_index].binary_size - output.size());
+            output.append(m_pending, 0, count);
+            m_pending.erase(0, count);
+            if (output.size() < m_commands[m_index].binary_size)
+                return;
+            m_stage = READING_PROMPT;
+        } else if (m_stage == READING_PROMPT) {
+            if (m_pending.size() < sizeof(PROMPT) - 1)
+                return;
+            if (m_pending.compare(0, sizeof(PROMPT) - 1, PROMPT) != 0)
+                throw std::runtime_error("device returned " + m_commands[m_index].line + " output of wrong size!");
+            m_pending.erase(0, sizeof(PROMPT) - 1);
+            m_index++;
+            begin_command();
+        }
+    }
+}
+
+void shell_send(serial_port &port, const std::string &line, shell_probe &probe, bool synchronize)
+{
+    std::string lines;
+    if (synchronize)
+        lines += SYNC_COMMAND;
+    lines += line + "\r\n";
+
+    shell_stats::clock::time_point sent;
+    uint64_t syscalls = port.syscalls;
+    if (port.stats != nullptr)
+        sent = shell_stats::clock::now();
+    port.arm();
+    port.write(lines);
+    probe.sent(port, line, lines.size(), sent, syscalls);
+    if (synchronize)
+        port.read_until(SYNC_REPLY);
+}
+
+std::string shell_run(serial_port &port, const std::string &command)
+{
+    std::string result;
+    shell_probe probe;
+    shell_send(port, command, probe);
+    probe.reading(port);
+    port.read_until(command + "\r\n");
+    probe.echoed();
+    port.read_until(PROMPT, &result);
+    probe.finished(port);
+    return result;
+}
+
+}
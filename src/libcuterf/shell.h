@@ -0,0 +1,73 @@
+#ifndef LIBCUTERF_SHELL_H
+#define LIBCUTERF_SHELL_H
+
+#include <string>
+#include <vector>
+#include "serial.h"
+
+namespace cuterf {
+
+// The ChibiOS shell used by NanoVNA and TinySA firmware echoes each command line, then
+// prints its output, then the `ch> ` prompt. It reads the next line only once the previous
+// command has finished, so several commands can be written at once and their outputs
+// demultiplexed by echo and prompt afterwards.
+
+struct shell_command
+{
+    std::string line;
+    size_t binary_size; // if non-zero, the output is exactly this many bytes of binary data
+
+    shell_command(const std::string &line, size_t binary_size = 0) :
+        line(line), binary_size(binary_size)
+    {}
+};
+
+// Writes all commands in a single transfer, then returns their outputs in order. With
+// `synchronize`, the batch is preceded by `#sync#`, and anything the device sent before the
+// reply to it is discarded.
+std::vector<std::string> shell_run_batch(serial_port &port, const std::vector<shell_command> &commands,
+    bool synchronize = false);
+
+std::string shell_run(serial_port &port, const std::string &command);
+
+// A batch as shell_run_batch() writes it, whose outputs are assembled from bytes as they
+// arrive, for an io_loop, which cannot wait for them in read_until().
+class shell_exchange
+{
+public:
+    shell_exchange(const std::vector<shell_command> &commands, bool synchronize);
+
+    const std::string &request() const { return m_request; }
+    // Takes bytes read from the device; throws if they do not fit the batch.
+    void feed(const char *data, size_t size);
+    bool done() const { return m_stage == DONE; }
+    size_t completed() const { return m_index; } // commands whose output is complete
+    // The output of the command being received, as far as it has arrived.
+    const std::string &partial() const;
+    std::vector<std::string> &outputs() { return m_outputs; }
+
+private:
+    enum stage { READING_SYNC, READING_ECHO, READING_TEXT, READING_BINARY, READING_PROMPT, DONE };
+
+    std::vector<shell_command> m_commands;
+    std::string m_request;
+    std::vector<std::string> m_outputs;
+    stage m_stage;
+    size_t m_index;
+    std::string m_pending; // bytes not assigned to a stage yet
+    size_t m_searched;     // bytes of the text output searched for the prompt so far
+
+    void begin_command();
+    bool skip_past(const std::string &expected);
+};
+
+class shell_probe;
+
+// Writes `line` and its line ending, measuring it as a command into `probe`, for the caller
+// to read its output. With `synchronize`, `#sync#` is written in the same transfer, and
+// everything up to the reply to it is discarded.
+void shell_send(serial_port &port, const std::string &line, shell_probe &probe, bool synchronize = false);
+
+}
+
+#endif // LIBCUTERF_SHELL_H
@@ -0,0 +1,172 @@
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#include <algorithm>
+#include <cmath>
+#include "stats.h"
+
+namespace cuterf {
+
+// --- histogram -------------------------------------------------------------
+
+// Values below 2 * SUB_BUCKETS have a bucket each; above that, each power of two has
+// SUB_BUCKETS buckets, so a bucket is at most 1/32 of its values wide.
+static const unsigned SUB_BUCKET_BITS = 5;
+static const uint64_t SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+
+static unsigned highest_bit(uint64_t value)
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanReverse64(&index, value);
+    return (unsigned)index;
+#else
+    return 63 - __builtin_clzll(value);
+#endif
+}
+
+static size_t bucket_index(uint64_t value)
+{
+    if (value < 2 * SUB_BUCKETS)
+        return (size_t)value;
+    unsigned shift = highest_bit(value) - SUB_BUCKET_BITS;
+    return (size_t)(shift * SUB_BUCKETS + (value >> shift));
+}
+
+// The largest value that falls into a bucket.
+static uint64_t bucket_limit(size_t index)
+{
+    if (index < 2 * SUB_BUCKETS)
+        return index;
+    unsigned shift = (unsigned)(index / SUB_BUCKETS - 1);
+    uint64_t sub_bucket = index % SUB_BUCKETS + SUB_BUCKETS;
+    return ((sub_bucket + 1) << shift) - 1;
+}
+
+histogram::histogram() : m_count(0), m_min(UINT64_MAX), m_max(0), m_sum(0)
+{}
+
+void histogram::record(uint64_t value)
+{
+    size_t index = bucket_index(value);
+    if (index >= m_counts.size())
+        m_counts.resize(index + 1);
+    m_counts[index]++;
+    m_count++;
+    m_min = std::min(m_min, value);
+    m_max = std::max(m_max, value);
+    m_sum += (double)value;
+}
+
+void histogram::merge(const histogram &other)
+{
+    if (other.m_counts.size() > m_counts.size())
+        m_counts.resize(other.m_counts.size());
+    for (size_t index = 0; index < other.m_counts.size(); index++)
+        m_counts[index] += other.m_counts[index];
+    m_count += other.m_count;
+    m_min = std::min(m_min, other.m_min);
+    m_max = std::max(m_max, other.m_max);
+    m_sum += other.m_sum;
+}
+
+uint64_t histogram::percentile(double percent) const
+{
+    if (m_count == 0)
+        return 0;
+    uint64_t rank = (uint64_t)std::ceil(std::min(std::max(percent, 0.0), 100.0) / 100.0 * m_count);
+    rank = std::max<uint64_t>(rank, 1);
+    uint64_t seen = 0;
+    for (size_t index = 0; index < m_counts.size(); index++) {
+        seen += m_counts[index];
+        if (seen >= rank)
+            return std::min(bucket_limit(index), m_max);
+    }
+    return m_max;
+}
+
+// --- shell_stats -----------------------------------------------------------
+
+static std::string_view command_name(std::string_view line)
+{
+    return line.substr(0, line.find(' '));
+}
+
+command_stats &shell_stats::find(std::string_view command)
+{
+    for (auto &entry : m_commands) {
+        if (entry.command == command)
+            return entry;
+    }
+    m_commands.emplace_back();
+    m_commands.back().command = std::string(command);
+    return m_commands.back();
+}
+
+static uint64_t nanoseconds(shell_stats::clock::duration duration)
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+}
+
+void shell_stats::record(std::string_view line, uint64_t written, uint64_t read, uint64_t syscalls,
+    clock::duration echo, clock::duration prompt)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    command_stats &entry = find(command_name(line));
+    entry.calls++;
+    entry.bytes_written += written;
+    entry.bytes_read += read;
+    entry.syscalls += syscalls;
+    entry.echo.record(nanoseconds(echo));
+    entry.prompt.record(nanoseconds(prompt));
+}
+
+void shell_stats::record_parse(std::string_view command, clock::duration elapsed)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    find(command).parse.record(nanoseconds(elapsed));
+}
+
+std::vector<command_stats> shell_stats::snapshot() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_commands;
+}
+
+// --- shell_probe -----------------------------------------------------------
+
+void shell_probe::sent(const serial_port &port, const std::string &line, size_t written,
+    shell_stats::clock::time_point sent, uint64_t syscalls_before)
+{
+    m_stats = port.stats;
+    if (m_stats == nullptr)
+        return;
+    m_line = line;
+    m_sent = sent;
+    m_written = written;
+    m_syscalls = port.syscalls - syscalls_before;
+}
+
+void shell_probe::reading(const serial_port &port)
+{
+    if (m_stats == nullptr)
+        return;
+    m_read_from = port.consumed();
+    m_syscalls_from = port.syscalls;
+}
+
+void shell_probe::echoed()
+{
+    if (m_stats != nullptr)
+        m_echoed = shell_stats::clock::now();
+}
+
+void shell_probe::finished(const serial_port &port)
+{
+    if (m_stats == nullptr)
+        return;
+    m_stats->record(m_line, m_written, port.consumed() - m_read_from, m_syscalls + (port.syscalls - m_syscalls_from),
+        m_echoed - m_sent, shell_stats::clock::now() - m_sent);
+}
+
+}
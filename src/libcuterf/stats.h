@@ -0,0 +1,80 @@
+#ifndef LIBCUTERF_STATS_H
+#define LIBCUTERF_STATS_H
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "cuterf.h"
+#include "serial.h"
+
+namespace cuterf {
+
+// Statistics of the commands run on a port, attached through serial_port::stats. Recording
+// takes a lock, as a streaming thread may record while another thread reads them.
+class shell_stats
+{
+public:
+    typedef std::chrono::steady_clock clock;
+
+    void record(std::string_view line, uint64_t written, uint64_t read, uint64_t syscalls,
+        clock::duration echo, clock::duration prompt);
+    void record_parse(std::string_view command, clock::duration elapsed);
+    std::vector<command_stats> snapshot() const;
+
+private:
+    mutable std::mutex m_mutex;
+    std::vector<command_stats> m_commands; // in order of first use; a device knows only a few
+
+    command_stats &find(std::string_view command);
+};
+
+// Measures one command from the moment it is written until its prompt is read. Every method
+// returns at once unless the port had statistics attached when the command was sent.
+class shell_probe
+{
+public:
+    shell_probe() : m_stats(nullptr), m_written(0), m_syscalls(0), m_read_from(0), m_syscalls_from(0) {}
+
+    // Call after writing the command; `sent` and `syscalls_before` are taken before writing.
+    void sent(const serial_port &port, const std::string &line, size_t written, shell_stats::clock::time_point sent,
+        uint64_t syscalls_before);
+    // Call before reading the echo, and after it.
+    void reading(const serial_port &port);
+    void echoed();
+    // Call after reading the prompt.
+    void finished(const serial_port &port);
+
+private:
+    shell_stats *m_stats;
+    std::string m_line;
+    shell_stats::clock::time_point m_sent, m_echoed;
+    uint64_t m_written, m_syscalls, m_read_from, m_syscalls_from;
+};
+
+// Times the decoding of a command's output, if the port has statistics attached.
+class parse_timer
+{
+public:
+    parse_timer(const serial_port &port, const char *command) : m_stats(port.stats), m_command(command)
+    {
+        if (m_stats != nullptr)
+            m_start = shell_stats::clock::now();
+    }
+
+    ~parse_timer()
+    {
+        if (m_stats != nullptr)
+            m_stats->record_parse(m_command, shell_stats::clock::now() - m_start);
+    }
+
+private:
+    shell_stats *m_stats;
+    const char *m_command;
+    shell_stats::clock::time_point m_start;
+};
+
+}
+
+#endif // LIBCUTERF_STATS_H
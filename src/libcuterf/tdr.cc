@@ -0,0 +1,315 @@
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <cuterf.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define TDR_AVX2
+#define TDR_SSE2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TDR_SSE2
+#endif
+
+namespace cuterf {
+
+namespace tdr {
+
+static const double PI = 3.14159265358979323846;
+static const double SPEED_OF_LIGHT = 299792458.0;
+
+options::options() : mode(mode::lowpass_step), window(window::kaiser), kaiser_beta(6), oversampling(4)
+{}
+
+// Modified Bessel function of the first kind, order 0, by its power series.
+static double bessel_i0(double x)
+{
+    double sum = 1, term = 1;
+    for (unsigned k = 1; term > 1e-12 * sum; k++) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+// Window value at `offset` from the center of the spectrum, from -1 to 1.
+static double window_value(const options &opts, double offset)
+{
+    switch (opts.window) {
+    case window::hann:
+        return 0.5 * (1 + std::cos(PI * offset));
+    case window::kaiser:
+        return bessel_i0(opts.kaiser_beta * std::sqrt(std::max(0.0, 1 - offset * offset))) / bessel_i0(opts.kaiser_beta);
+    default:
+        return 1;
+    }
+}
+
+static size_t next_power_of_two(size_t value)
+{
+    size_t result = 1;
+    while (result < value)
+        result *= 2;
+    return result;
+}
+
+// Computes `count` radix-2 butterflies a' = a + w b, b' = a - w b over interleaved complex
+// floats. Each twiddle w is stored twice in `tw_re` as (re, re) and in `tw_im` as (-im, im), so
+// that the complex product is two multiplies and an add after swapping the halves of b.
+static void butterflies(float *a, float *b, const float *tw_re, const float *tw_im, size_t count)
+{
+    size_t idx = 0;
+#if defined(TDR_AVX2)
+    for (; idx + 4 <= count; idx += 4) {
+        __m256 vb = _mm256_loadu_ps(&b[2 * idx]);
+        __m256 t = _mm256_add_ps(_mm256_mul_ps(vb, _mm256_loadu_ps(&tw_re[2 * idx])),
+            _mm256_mul_ps(_mm256_permute_ps(vb, 0xb1), _mm256_loadu_ps(&tw_im[2 * idx])));
+        __m256 va = _mm256_loadu_ps(&a[2 * idx]);
+        _mm256_storeu_ps(&a[2 * idx], _mm256_add_ps(va, t));
+        _mm256_storeu_ps(&b[2 * idx], _mm256_sub_ps(va, t));
+    }
+#endif
+#if defined(TDR_SSE2)
+    for (; idx + 2 <= count; idx += 2) {
+        __m128 vb = _mm_loadu_ps(&b[2 * idx]);
+        __m128 t = _mm_add_ps(_mm_mul_ps(vb, _mm_loadu_ps(&tw_re[2 * idx])),
+            _mm_mul_ps(_mm_shuffle_ps(vb, vb, _MM_SHUFFLE(2, 3, 0, 1)), _mm_loadu_ps(&tw_im[2 * idx])));
+        __m128 va = _mm_loadu_ps(&a[2 * idx]);
+        _mm_storeu_ps(&a[2 * idx], _mm_add_ps(va, t));
+        _mm_storeu_ps(&b[2 * idx], _mm_sub_ps(va, t));
+    }
+#endif
+    for (; idx < count; idx++) {
+        float b_re = b[2 * idx], b_im = b[2 * idx + 1];
+        float w_re = tw_re[2 * idx], w_im = tw_im[2 * idx + 1];
+        float t_re = b_re * w_re - b_im * w_im, t_im = b_re * w_im + b_im * w_re;
+        float a_re = a[2 * idx], a_im = a[2 * idx + 1];
+        a[2 * idx] = a_re + t_re;
+        a[2 * idx + 1] = a_im + t_im;
+        b[2 * idx] = a_re - t_re;
+        b[2 * idx + 1] = a_im - t_im;
+    }
+}
+
+class plan_impl
+{
+public:
+    size_t m_points;
+    options m_opts;
+    size_t m_length; // of the time-domain signal; a power of two
+
+    // complex FFT of m_work.size() points, which is m_length, or half of it for lowpass
+    std::vector<uint32_t> m_reversed;
+    std::vector<float> m_twiddle_re, m_twiddle_im; // for the stage of half-size h, at 2h
+    std::vector<std::complex<float>> m_work;
+
+    std::vector<float> m_window; // lowpass: from DC outwards; bandpass: across the sweep
+    double m_window_sum;         // over the whole two-sided or bandpass spectrum
+
+    // lowpass only: the one-sided spectrum, and the twiddles that split the real inverse
+    // transform into a complex one of half the size
+    std::vector<std::complex<float>> m_spectrum;
+    std::vector<std::complex<float>> m_split;
+
+    plan_impl(size_t points, const options &opts);
+
+    void inverse_fft();
+    template<class Sweep>
+    void transform(const Sweep &sweep, response &result);
+};
+
+plan_impl::plan_impl(size_t points, const options &opts) : m_points(points), m_opts(opts)
+{
+    if (points < 2)
+        throw std::logic_error("a time-domain transform needs at least 2 points!");
+    size_t oversampling = std::max(1u, opts.oversampling);
+    bool lowpass = opts.mode != mode::bandpass;
+
+    // the lowpass spectrum is made two-sided, with DC, so that the response is real
+    m_length = next_power_of_two(lowpass ? oversampling * (2 * points + 1) : oversampling * points);
+    size_t size = lowpass ? m_length / 2 : m_length;
+
+    unsigned bits = 0;
+    while (((size_t)1 << bits) < size)
+        bits++;
+    m_reversed.resize(size);
+    for (size_t idx = 0; idx < size; idx++) {
+        uint32_t reversed = 0;
+        for (unsigned bit = 0; bit < bits; bit++)
+            reversed |= ((idx >> bit) & 1) << (bits - 1 - bit);
+        m_reversed[idx] = reversed;
+    }
+    m_twiddle_re.resize(2 * size);
+    m_twiddle_im.resize(2 * size);
+    for (size_t half = 1; half < size; half *= 2) {
+        for (size_t idx = 0; idx < half; idx++) {
+            double angle = PI * idx / half; // positive, for the inverse transform
+            m_twiddle_re[2 * (half + idx)] = m_twiddle_re[2 * (half + idx) + 1] = (float)std::cos(angle);
+            m_twiddle_im[2 * (half + idx)] = (float)-std::sin(angle);
+            m_twiddle_im[2 * (half + idx) + 1] = (float)std::sin(angle);
+        }
+    }
+    m_work.resize(size);
+
+    if (lowpass) {
+        m_window.resize(points + 1);
+        m_window_sum = -1;
+        for (size_t idx = 0; idx <= points; idx++) {
+            m_window[idx] = (float)window_value(opts, (double)idx / (points + 1));
+            m_window_sum += 2 * m_window[idx];
+        }
+        m_spectrum.resize(size + 1);
+        m_split.resize(size);
+        for (size_t idx = 0; idx < size; idx++)
+            m_split[idx] = std::polar(1.0f, (float)(2 * PI * idx / m_length));
+    } else {
+        m_window.resize(points);
+        m_window_sum = 0;
+        for (size_t idx = 0; idx < points; idx++) {
+            m_window[idx] = (float)window_value(opts, (2.0 * idx - (points - 1)) / (points + 1));
+            m_window_sum += m_window[idx];
+        }
+    }
+}
+
+// Inverse transform of m_work, which holds its input in bit-reversed order; not normalized.
+void plan_impl::inverse_fft()
+{
+    float *data = (float *)m_work.data();
+    size_t size = m_work.size();
+    // the first stage has only the twiddle 1
+    for (size_t idx = 0; idx < 2 * size; idx += 4) {
+        float a_re = data[idx], a_im = data[idx + 1];
+        data[idx] = a_re + data[idx + 2];
+        data[idx + 1] = a_im + data[idx + 3];
+        data[idx + 2] = a_re - data[idx + 2];
+        data[idx + 3] = a_im - data[idx + 3];
+    }
+    for (size_t half = 2; half < size; half *= 2) {
+        const float *tw_re = &m_twiddle_re[2 * half], *tw_im = &m_twiddle_im[2 * half];
+        for (size_t base = 0; base < size; base += 2 * half)
+            butterflies(&data[2 * base], &data[2 * (base + half)], tw_re, tw_im, half);
+    }
+}
+
+template<class Sweep>
+void plan_impl::transform(const Sweep &sweep, response &result)
+{
+    size_t size = m_work.size();
+    double freq_step = ((double)sweep.freq(m_points - 1) - sweep.freq(0)) / (m_points - 1);
+    if (!(freq_step > 0))
+        throw std::runtime_error("sweep frequencies are not increasing!");
+    result.time_step = 1 / (m_length * freq_step);
+
+    if (m_opts.mode == mode::bandpass) {
+        memset((void *)m_work.data(), 0, size * sizeof(m_work[0]));
+        for (size_t idx = 0; idx < m_points; idx++)
+            m_work[m_reversed[idx]] = m_window[idx] * sweep.value(idx);
+        inverse_fft();
+        result.values.resize(size / 2);
+        float scale = (float)(1 / m_window_sum);
+        for (size_t idx = 0; idx < size / 2; idx++)
+            result.values[idx] = std::abs(m_work[idx]) * scale;
+        return;
+    }
+
+    // DC is extrapolated from the first two points; only its real part is meaningful
+    std::complex<float> first = sweep.value(0), second = sweep.value(1);
+    float dc = (first - (second - first) * (float)(sweep.freq(0) / freq_step)).real();
+    m_spectrum[0] = dc;
+    for (size_t idx = 0; idx < m_points; idx++)
+        m_spectrum[idx + 1] = m_window[idx + 1] * sweep.value(idx);
+
+    // the even and odd samples of the real response are the real and imaginary parts of a
+    // complex inverse transform of half the length; X[k + size] = conj(X[size - k])
+    for (size_t idx = 0; idx < size; idx++) {
+        std::complex<float> low = m_spectrum[idx], high = std::conj(m_spectrum[size - idx]);
+        std::complex<float> even = low + high, odd = (low - high) * m_split[idx];
+        m_work[m_reversed[idx]] = even + std::complex<float>(-odd.imag(), odd.real());
+    }
+    inverse_fft();
+
+    const float *samples = (const float *)m_work.data();
+    result.values.resize(size);
+    if (m_opts.mode == mode::lowpass_impulse) {
+        float scale = (float)(1 / m_window_sum);
+        for (size_t idx = 0; idx < size; idx++)
+            result.values[idx] = samples[idx] * scale;
+    } else {
+        // integrated from half a period before time 0, where the response is negligible
+        double sum = 0;
+        for (size_t idx = size; idx < 2 * size; idx++)
+            sum += samples[idx];
+        for (size_t idx = 0; idx < size; idx++) {
+            sum += samples[idx];
+            result.values[idx] = (float)(sum / m_length);
+        }
+    }
+}
+
+// Reads one parameter of a sweep from either layout.
+struct points_sweep
+{
+    const std::vector<nanovna::point> &points;
+    parameter which;
+
+    double freq(size_t index) const { return points[index].freq; }
+    std::complex<float> value(size_t index) const
+    {
+        return which == parameter::s11 ? points[index].s11 : points[index].s21;
+    }
+};
+
+struct view_sweep
+{
+    const uint32_t *freqs;
+    const std::complex<float> *values;
+
+    double freq(size_t index) const { return freqs[index]; }
+    std::complex<float> value(size_t index) const { return values[index]; }
+};
+
+plan::plan(size_t points, const options &opts) : m_i(new plan_impl(points, opts))
+{}
+
+plan::~plan()
+{
+    delete m_i;
+}
+
+size_t plan::points() const
+{
+    return m_i->m_points;
+}
+
+size_t plan::size() const
+{
+    return m_i->m_opts.mode == mode::bandpass ? m_i->m_work.size() / 2 : m_i->m_work.size();
+}
+
+void plan::transform(const std::vector<nanovna::point> &sweep, parameter which, response &result)
+{
+    if (sweep.size() != m_i->m_points)
+        throw std::logic_error("sweep has a different number of points than the plan!");
+    m_i->transform(points_sweep { sweep, which }, result);
+}
+
+void plan::transform(const archive::sweep_view &sweep, parameter which, response &result)
+{
+    if (sweep.points != m_i->m_points)
+        throw std::logic_error("sweep has a different number of points than the plan!");
+    if (which == parameter::s21 && sweep.s21 == nullptr)
+        throw std::logic_error("sweep has no S21 data!");
+    m_i->transform(view_sweep { sweep.freq, which == parameter::s11 ? sweep.s11 : sweep.s21 }, result);
+}
+
+double distance(double time, double velocity_factor, parameter which)
+{
+    double length = SPEED_OF_LIGHT * velocity_factor * time;
+    return which == parameter::s11 ? length / 2 : length;
+}
+
+}
+
+}
@@ -1,7 +1,16 @@
+#include <cstring>
 #include <iostream>
 #include <iomanip>
+#include <stdexcept>
+#include "broker.h"
 #include "cuterf.h"
+#include "io.h"
+#include "parser.h"
+#include "registry.h"
+#include "remote.h"
 #include "serial.h"
+#include "shell.h"
+#include "stats.h"
 
 namespace cuterf {
 
@@ -14,11 +23,30 @@ public:
     serial_port m_port;
     bool m_is_ultra;
     std::string m_firmware_version, m_hardware_version;
+    bool m_mirroring;
+    bool m_synchronized;   // as nanovna::device_impl
+    bool m_async;          // as nanovna::device_impl
+    bool m_lacks_scanraw;  // set once the firmware has rejected `scanraw`
+    std::string m_records; // reused for binary trace transfers
+    shell_stats m_stats;
+    broker::connection m_broker; // as nanovna::device_impl
+
+    device_impl() : m_is_ultra(false), m_mirroring(false), m_synchronized(false), m_async(false),
+        m_lacks_scanraw(false) {}
 
-    void synchronize();
     std::string run(const std::string &command);
+    std::vector<std::string> run_batch(const std::vector<shell_command> &commands);
+    std::vector<std::string> synchronize(const std::vector<shell_command> &commands);
+    void lease();
+    void bypass_broker();
+    void start(io_loop_impl &loop, const std::vector<shell_command> &commands,
+        std::function<void(std::vector<std::string> &outputs)> next, std::function<void(std::exception_ptr)> fail);
+    trace capture_brokered(const broker::request &request, std::string *screen, size_t *width, size_t *height);
+
+    void detect_board(const std::string &version);
 
-    void detect_board();
+    bool scan_raw(uint64_t start, uint64_t stop, unsigned points, trace &data);
+    void read_text_trace(trace &data);
 };
 
 device::device() : m_i(new device_impl) 
@@ -46,7 +74,7 @@ std::string device::firmware_version() const
 
 bool device::is_open() const
 {
-    return m_i->m_port.is_open();
+    return m_i->m_port.is_open() || m_i->m_broker.is_open();
 }
 
 std::wstring device::path() const
@@ -54,47 +82,223 @@ std::wstring device::path() const
     return m_i->m_path;
 }
 
+void device::set_timeout(unsigned timeout_ms)
+{
+    m_i->m_port.timeout = std::chrono::milliseconds(timeout_ms);
+}
+
+void device::cancel()
+{
+    m_i->m_port.cancel();
+}
+
+std::string device::run(const std::string &command)
+{
+    return m_i->run(command);
+}
+
+void device::run_async(io_loop &loop, const std::string &command, async_handler<std::string> handler)
+{
+    m_i->start(*loop.m_i, { shell_command(command) }, [handler](std::vector<std::string> &outputs) {
+        async_result<std::string> result;
+        result.value = std::move(outputs[0]);
+        handler(result);
+    }, async_failure(handler));
+}
+
+awaitable<std::string> device::run(io_loop &loop, const std::string &command)
+{
+    return awaitable<std::string>([this, &loop, command](async_handler<std::string> handler) {
+        run_async(loop, command, std::move(handler));
+    });
+}
+
+void device::enable_stats(bool enable)
+{
+    m_i->m_port.stats = enable ? &m_i->m_stats : nullptr;
+}
+
+std::vector<command_stats> device::stats() const
+{
+    return m_i->m_stats.snapshot();
+}
+
 bool device::open(const std::wstring &path)
 {
     m_i->m_path = path;
-    if (m_i->m_path.empty())
-        if (!FindUSBSerialPortByVIDPID(VID, PID, m_i->m_path))
+    if (m_i->m_path.empty()) {
+        // a broker that holds the device has identified it already
+        std::vector<std::string> identity;
+        if (m_i->m_broker.open("tinysa", identity) && identity.size() == 4) {
+            m_i->m_path.assign(identity[0].begin(), identity[0].end());
+            m_i->m_is_ultra = identity[1] == "1";
+            m_i->m_hardware_version = identity[2];
+            m_i->m_firmware_version = identity[3];
+            return true;
+        }
+        m_i->m_broker.close();
+        std::vector<usb_serial_port> ports = device_registry::instance().ports();
+        if (ports.empty())
             return false;
+        m_i->m_path = ports[0].path;
+    }
     if (!m_i->m_port.open(m_i->m_path))
         return false;
 
-    m_i->synchronize();
-    m_i->detect_board();
+    // as in nanovna::device::open()
+    device_identity identity;
+    if (device_registry::instance().recall(m_i->m_path, identity) && identity.board.compare(0, 6, "tinySA") == 0) {
+        m_i->m_is_ultra = identity.board == "tinySA Ultra";
+        m_i->m_firmware_version = identity.version;
+        m_i->m_hardware_version = identity.hardware_version;
+        m_i->m_synchronized = false;
+        return true;
+    }
+
+    // `version` is pipelined behind `#sync#`, saving a round trip
+    std::vector<std::string> outputs = m_i->synchronize({ shell_command("version") });
+    {
+        parse_timer timer(m_i->m_port, "version");
+        m_i->detect_board(outputs[0]);
+    }
+    device_registry::instance().remember(m_i->m_path, 
+        { m_i->m_is_ultra ? "tinySA Ultra" : "tinySA", m_i->m_firmware_version, m_i->m_hardware_version });
     return true;
 }
 
 void device::close()
 {
     m_i->m_port.close();
+    m_i->m_broker.close();
+    m_i->m_mirroring = false;
+    m_i->m_lacks_scanraw = false;
     m_i->m_is_ultra = false;
     m_i->m_firmware_version.clear();
     m_i->m_hardware_version.clear();
 }
 
-void device_impl::synchronize()
+std::string device_impl::run(const std::string &command)
 {
-    m_port.write("#sync#\r\n");
-    m_port.read_until("#sync#\r\n#sync#?\r\nch> ");
+    if (m_mirroring)
+        throw std::logic_error("cannot run commands while mirroring!");
+    if (m_async)
+        throw std::logic_error("cannot run commands during an asynchronous operation!");
+
+    lease();
+    if (!m_synchronized)
+        return synchronize({ shell_command(command) })[0];
+    try {
+        return shell_run(m_port, command);
+    } catch (...) {
+        m_synchronized = false;
+        throw;
+    }
 }
 
-std::string device_impl::run(const std::string &command)
+std::vector<std::string> device_impl::run_batch(const std::vector<shell_command> &commands)
 {
-    std::string result;
-    m_port.write(command + "\r\n");
-    m_port.read_until(command + "\r\n");
-    m_port.read_until("ch> ", &result);
-    return result;
+    if (m_mirroring)
+        throw std::logic_error("cannot run commands while mirroring!");
+    if (m_async)
+        throw std::logic_error("cannot run commands during an asynchronous operation!");
+
+    lease();
+    if (!m_synchronized)
+        return synchronize(commands);
+    try {
+        return shell_run_batch(m_port, commands);
+    } catch (...) {
+        m_synchronized = false;
+        throw;
+    }
 }
 
-void device_impl::detect_board()
-{   
-    std::string version = run("version");
+std::vector<std::string> device_impl::synchronize(const std::vector<shell_command> &commands)
+{
+    std::vector<std::string> outputs = shell_run_batch(m_port, commands, true);
+    m_synchronized = true;
+    return outputs;
+}
+
+// As nanovna::device_impl::lease().
+void device_impl::lease()
+{
+    if (!m_broker.is_open() || m_port.is_open())
+        return;
+    std::wstring path;
+    try {
+        path = m_broker.lease(m_port.timeout);
+    } catch (const broker::unavailable &) {
+        bypass_broker();
+        return;
+    }
+    if (!m_port.open(path))
+        throw std::runtime_error("cannot open serial port leased from broker!");
+    m_synchronized = false;
+}
+
+// As nanovna::device_impl::bypass_broker().
+void device_impl::bypass_broker()
+{
+    if (!m_port.open(m_path))
+        throw std::runtime_error("broker is unavailable and the device cannot be opened!");
+    m_synchronized = false;
+}
+
+// As nanovna::device_impl::start().
+void device_impl::start(io_loop_impl &loop, const std::vector<shell_command> &commands,
+    std::function<void(std::vector<std::string> &outputs)> next, std::function<void(std::exception_ptr)> fail)
+{
+    if (m_mirroring)
+        throw std::logic_error("cannot run commands while mirroring!");
+    if (m_async)
+        throw std::logic_error("device already has an asynchronous operation in progress!");
+
+    lease();
+    std::unique_ptr<io_operation> operation(new io_operation(m_port, shell_exchange(commands, !m_synchronized)));
+    operation->finish = [this, next, fail](shell_exchange &exchange, std::exception_ptr error) {
+        m_async = false;
+        m_synchronized = !error;
+        if (error)
+            fail(error);
+        else
+            next(exchange.outputs());
+    };
+    m_async = true;
+    loop.submit(std::move(operation));
+}
+
+// The broker answers with the result of the same capture, laid out as broker::tinysa_result.
+trace device_impl::capture_brokered(const broker::request &request, std::string *screen, size_t *width,
+    size_t *height)
+{
+    broker::result result = m_broker.call(request, m_port.timeout);
+    broker::tinysa_result header;
+    if (result.size < sizeof(header))
+        throw std::runtime_error("broker returned a capture of wrong size!");
+    memcpy(&header, result.data, sizeof(header));
+    size_t screen_size = 2 * (size_t)header.screen_width * header.screen_height;
+    if (result.size != sizeof(header) + header.points * (sizeof(uint64_t) + sizeof(float)) + screen_size)
+        throw std::runtime_error("broker returned a capture of wrong size!");
 
+    const char *data = result.data + sizeof(header);
+    trace captured;
+    captured.freq.resize(header.points);
+    captured.level.resize(header.points);
+    if (header.points != 0) {
+        memcpy(&captured.freq[0], data, header.points * sizeof(uint64_t));
+        memcpy(&captured.level[0], data + header.points * sizeof(uint64_t), header.points * sizeof(float));
+    }
+    if (screen != nullptr) {
+        *width = header.screen_width;
+        *height = header.screen_height;
+        screen->assign(data + header.points * (sizeof(uint64_t) + sizeof(float)), screen_size);
+    }
+    return captured;
+}
+
+void device_impl::detect_board(const std::string &version)
+{   
     size_t firmware_ver_nl_pos = version.find("\r\n");
     if (version.substr(0, 8) == "tinySA4_") {
         m_is_ultra = true;
@@ -116,6 +320,18 @@ void device_impl::detect_board()
 
 std::string device::capture_screenshot(size_t &width, size_t &height)
 {   
+    if (m_i->m_mirroring)
+        throw std::logic_error("cannot capture a screenshot while mirroring!");
+    if (m_i->m_broker.is_open() && !m_i->m_port.is_open()) {
+        try {
+            std::string screen;
+            m_i->capture_brokered(broker::make_request(broker::TINYSA_SCREENSHOT), &screen, &width, &height);
+            return screen;
+        } catch (const broker::unavailable &) {
+            m_i->bypass_broker();
+        }
+    }
+
     if (is_ultra()) {
         width = 480;
         height = 320;
@@ -124,18 +340,285 @@ std::string device::capture_screenshot(size_t &width, size_t &height)
         height = 240;
     }
 
-    m_i->m_port.write("capture\r\n");
-    m_i->m_port.read_until("capture\r\n");
+    std::vector<std::string> outputs = m_i->run_batch({ shell_command("capture", 2 * width * height) });
+    return outputs[0];
+}
+
+// Levels are reported in 1/32 dB above a zero level; see config.ext_zero_level in firmware.
+static const float ZERO_LEVEL = 128.0f;
+static const float ZERO_LEVEL_ULTRA = 174.0f;
+
+static uint64_t grid_frequency(uint64_t start, uint64_t stop, unsigned points, unsigned index)
+{
+    // see set_frequencies() in firmware
+    uint64_t steps = points - 1, span = stop - start;
+    return start + span / steps * index + (steps / 2 + span % steps * index) / steps;
+}
 
-    std::string display_data(2 * width * height, '\0');
-    m_i->m_port.read(display_data);
+static std::string scanraw_command(uint64_t start, uint64_t stop, unsigned points)
+{
+    return "scanraw " + std::to_string(start) + " " + std::to_string(stop) + " " + std::to_string(points);
+}
 
-    std::string prompt(4, '\0');
-    m_i->m_port.read(prompt);
-    if (prompt != "ch> ")
-        throw std::runtime_error("device returned screenshot of wrong size!");
-    
-    return display_data;
+// `records` follow the opening '{': for each point, 'x' and uint16_t level, then '}'.
+static void decode_raw_trace(const char *records, uint64_t start, uint64_t stop, unsigned points, float zero_level,
+    trace &data)
+{
+    data.freq.resize(points);
+    data.level.resize(points);
+    const uint8_t *record = (const uint8_t *)records;
+    for (unsigned idx = 0; idx < points; idx++, record += 3) {
+        if (record[0] != 'x')
+            throw std::runtime_error("device returned malformed trace data!");
+        data.freq[idx] = grid_frequency(start, stop, points, idx);
+        data.level[idx] = (record[1] | (record[2] << 8)) / 32.0f - zero_level;
+    }
+}
+
+// Returns false, leaving `data` untouched, if the firmware does not know `scanraw`.
+bool device_impl::scan_raw(uint64_t start, uint64_t stop, unsigned points, trace &data)
+{
+    if (m_mirroring)
+        throw std::logic_error("cannot run commands while mirroring!");
+    if (m_async)
+        throw std::logic_error("cannot run commands during an asynchronous operation!");
+
+    std::string command = scanraw_command(start, stop, points);
+    shell_probe probe;
+    try {
+        shell_send(m_port, command, probe, !m_synchronized);
+        m_synchronized = true;
+        probe.reading(m_port);
+        m_port.read_until(command + "\r\n");
+        probe.echoed();
+
+        std::string opening(1, '\0');
+        m_port.read(opening);
+        if (opening[0] != '{') {
+            m_port.read_until("ch> ");
+            probe.finished(m_port);
+            return false;
+        }
+        m_records.resize(3 * (size_t)points + 1);
+        m_port.read(m_records);
+        if (m_records.back() != '}')
+            throw std::runtime_error("device returned trace data of wrong size!");
+        m_port.read_until("ch> ");
+        probe.finished(m_port);
+    } catch (...) {
+        m_synchronized = false;
+        throw;
+    }
+
+    parse_timer timer(m_port, "scanraw");
+    decode_raw_trace(m_records.data(), start, stop, points, m_is_ultra ? ZERO_LEVEL_ULTRA : ZERO_LEVEL, data);
+    return true;
+}
+
+static void parse_frequencies_output(const std::string &output, trace &data)
+{
+    data.freq.clear();
+    response_parser parser("frequencies", output);
+    while (!parser.at_end()) {
+        data.freq.push_back(parser.parse_uint64());
+        parser.expect("\r\n");
+    }
+}
+
+static void parse_levels_output(const std::string &output, trace &data)
+{
+    data.level.resize(data.freq.size());
+    response_parser parser("data", output);
+    for (auto &level : data.level) {
+        level = parser.parse_float();
+        parser.expect("\r\n");
+    }
+    parser.expect_end();
+}
+
+static const std::vector<shell_command> TEXT_TRACE_COMMANDS = { shell_command("frequencies"), shell_command("data 2") };
+
+void device_impl::read_text_trace(trace &data)
+{
+    std::vector<std::string> outputs = run_batch(TEXT_TRACE_COMMANDS);
+    {
+        parse_timer timer(m_port, "frequencies");
+        parse_frequencies_output(outputs[0], data);
+    }
+    parse_timer timer(m_port, "data");
+    parse_levels_output(outputs[1], data);
+}
+
+static void parse_sweep_output(const std::string &output, uint64_t &start, uint64_t &stop, unsigned &points)
+{
+    response_parser parser("sweep", output);
+    start = parser.parse_uint64();
+    parser.expect(' ');
+    stop = parser.parse_uint64();
+    parser.expect(' ');
+    points = parser.parse_unsigned();
+    parser.expect("\r\n");
+    if (points < 2 || stop < start)
+        throw std::runtime_error("device reported an invalid sweep!");
+}
+
+trace device::capture_trace(transfer mode)
+{
+    if (m_i->m_broker.is_open() && !m_i->m_port.is_open()) {
+        broker::request request = broker::make_request(broker::TINYSA_TRACE);
+        request.mode = (uint32_t)mode;
+        try {
+            return m_i->capture_brokered(request, nullptr, nullptr, nullptr);
+        } catch (const broker::unavailable &) {
+            m_i->bypass_broker();
+        }
+    }
+
+    trace data;
+    if (mode == transfer::text || m_i->m_lacks_scanraw) {
+        m_i->read_text_trace(data);
+        return data;
+    }
+
+    std::string output = m_i->run("sweep");
+    uint64_t start, stop;
+    unsigned points;
+    {
+        parse_timer timer(m_i->m_port, "sweep");
+        parse_sweep_output(output, start, stop, points);
+    }
+
+    if (!m_i->scan_raw(start, stop, points, data)) {
+        m_i->m_lacks_scanraw = true;
+        m_i->read_text_trace(data);
+    }
+    return data;
+}
+
+// As capture_trace(), in two exchanges for a binary capture: `sweep`, then `scanraw`, whose
+// records cannot contain the prompt, so it is received as text.
+void device::capture_trace_async(io_loop &loop, transfer mode, async_handler<trace> handler)
+{
+    device_impl *impl = m_i;
+    io_loop_impl *driver = loop.m_i;
+    auto fail = async_failure(handler);
+    auto parsed = [handler](std::vector<std::string> &outputs) {
+        async_result<trace> result;
+        try {
+            parse_frequencies_output(outputs[0], result.value);
+            parse_levels_output(outputs[1], result.value);
+        } catch (...) {
+            result.error = std::current_exception();
+        }
+        handler(result);
+    };
+    if (mode == transfer::text || m_i->m_lacks_scanraw) {
+        m_i->start(*driver, TEXT_TRACE_COMMANDS, parsed, fail);
+        return;
+    }
+
+    m_i->start(*driver, { shell_command("sweep") }, [=](std::vector<std::string> &outputs) {
+        async_result<trace> result;
+        try {
+            uint64_t start, stop;
+            unsigned points;
+            parse_sweep_output(outputs[0], start, stop, points);
+            auto scanned = [=](std::vector<std::string> &outputs) {
+                const std::string &output = outputs[0];
+                if (output.empty() || output[0] != '{') {
+                    impl->m_lacks_scanraw = true;
+                    try {
+                        impl->start(*driver, TEXT_TRACE_COMMANDS, parsed, fail);
+                    } catch (...) {
+                        fail(std::current_exception());
+                    }
+                    return;
+                }
+                async_result<trace> result;
+                try {
+                    if (output.size() < 3 * (size_t)points + 2 || output[3 * (size_t)points + 1] != '}')
+                        throw std::runtime_error("device returned trace data of wrong size!");
+                    decode_raw_trace(&output[1], start, stop, points, impl->m_is_ultra ? ZERO_LEVEL_ULTRA : ZERO_LEVEL,
+                        result.value);
+                } catch (...) {
+                    result.error = std::current_exception();
+                }
+                handler(result);
+            };
+            impl->start(*driver, { shell_command(scanraw_command(start, stop, points)) }, scanned, fail);
+            return;
+        } catch (...) {
+            result.error = std::current_exception();
+        }
+        handler(result);
+    }, fail);
+}
+
+awaitable<trace> device::capture_trace(io_loop &loop, transfer mode)
+{
+    return awaitable<trace>([this, &loop, mode](async_handler<trace> handler) {
+        capture_trace_async(loop, mode, std::move(handler));
+    });
+}
+
+trace device::capture_trace(uint64_t start, uint64_t stop, unsigned points)
+{
+    if (points < 2 || stop < start)
+        throw std::logic_error("a trace needs at least 2 points and an increasing span!");
+    if (m_i->m_broker.is_open() && !m_i->m_port.is_open()) {
+        broker::request request = broker::make_request(broker::TINYSA_SCAN);
+        request.start = start;
+        request.stop = stop;
+        request.points = points;
+        try {
+            return m_i->capture_brokered(request, nullptr, nullptr, nullptr);
+        } catch (const broker::unavailable &) {
+            m_i->bypass_broker();
+        }
+    }
+
+    trace data;
+    if (!m_i->scan_raw(start, stop, points, data)) {
+        m_i->m_lacks_scanraw = true;
+        throw std::runtime_error("device does not support binary trace transfer!");
+    }
+    return data;
+}
+
+void device::start_mirroring()
+{
+    if (m_i->m_mirroring)
+        throw std::logic_error("device is already mirroring!");
+    if (m_i->m_async)
+        throw std::logic_error("cannot mirror the screen during an asynchronous operation!");
+
+    m_i->lease();
+    if (!m_i->m_synchronized)
+        m_i->synchronize({});
+    remote_desktop_start(m_i->m_port);
+    m_i->m_mirroring = true;
+}
+
+bool device::read_screen_region(screen_region &region, unsigned timeout_ms)
+{
+    if (!m_i->m_mirroring)
+        throw std::logic_error("device is not mirroring!");
+
+    return remote_desktop_read(m_i->m_port, region, timeout_ms);
+}
+
+void device::stop_mirroring()
+{
+    if (!m_i->m_mirroring)
+        return;
+
+    m_i->m_mirroring = false;
+    remote_desktop_stop(m_i->m_port);
+}
+
+bool device::is_mirroring() const
+{
+    return m_i->m_mirroring;
 }
 
 }
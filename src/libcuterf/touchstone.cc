@@ -0,0 +1,297 @@
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <cuterf.h>
+
+namespace cuterf {
+
+namespace touchstone {
+
+// Longest formatted point: a 10-digit frequency and eight values, each of which may take
+// up to 39 integer digits for huge floats.
+static const size_t MAX_LINE = 10 + 8 * (1 + 1 + 39 + 1 + 9) + 1;
+
+static const char OPTION_LINE[] = "# HZ S RI R 50\n";
+static const char ZERO_VALUE[] = " +0.000000000";
+
+void string_sink::write(const char *data, size_t size)
+{
+    m_target.append(data, size);
+}
+
+void file_sink::write(const char *data, size_t size)
+{
+    fwrite(data, 1, size, m_file);
+}
+
+static char *pad_to(char *out, const char *digits, size_t length, size_t width)
+{
+    if (length < width) {
+        memset(out, ' ', width - length);
+        out += width - length;
+    }
+    memcpy(out, digits, length);
+    return out + length;
+}
+
+// `%10u`
+static char *format_freq(char *out, unsigned freq)
+{
+    char digits[16];
+    size_t length = std::to_chars(digits, digits + sizeof(digits), freq).ptr - digits;
+    return pad_to(out, digits, length, 10);
+}
+
+// ` %+12.9f`; the float is printed exactly as the double it promotes to, so this matches
+// what printf and iostreams produce, including `+nan` and `-inf`.
+static char *format_value(char *out, float value)
+{
+    char digits[64];
+    char *end = digits;
+    if (!std::signbit(value))
+        *end++ = '+';
+    end = std::to_chars(end, digits + sizeof(digits), value, std::chars_format::fixed, 9).ptr;
+    *out++ = ' ';
+    return pad_to(out, digits, end - digits, 12);
+}
+
+writer::writer(sink &output, unsigned ports) : m_output(output), m_ports(ports), m_used(0)
+{
+    if (!(ports == 1 || ports == 2))
+        throw std::logic_error("can only write Touchstone data for 1 or 2 ports!");
+}
+
+void writer::append(const char *data, size_t size)
+{
+    if (m_used + size > CAPACITY)
+        flush();
+    if (size > CAPACITY) {
+        m_output.write(data, size);
+        return;
+    }
+    memcpy(&m_buffer[m_used], data, size);
+    m_used += size;
+}
+
+void writer::comment(const std::string &line)
+{
+    append("! ", 2);
+    append(line.data(), line.size());
+    append("\n", 1);
+}
+
+void writer::header(const std::vector<std::string> &comments)
+{
+    for (auto &line : comments)
+        comment(line);
+    append(OPTION_LINE, sizeof(OPTION_LINE) - 1);
+}
+
+void writer::point(const nanovna::point &point)
+{
+    if (m_used + MAX_LINE > CAPACITY)
+        flush();
+
+    char *out = &m_buffer[m_used];
+    out = format_freq(out, point.freq);
+    out = format_value(out, point.s11.real());
+    out = format_value(out, point.s11.imag());
+    if (m_ports == 2) {
+        out = format_value(out, point.s21.real());
+        out = format_value(out, point.s21.imag());
+        for (unsigned idx = 0; idx < 4; idx++) { // s12, s22
+            memcpy(out, ZERO_VALUE, sizeof(ZERO_VALUE) - 1);
+            out += sizeof(ZERO_VALUE) - 1;
+        }
+    }
+    *out++ = '\n';
+    m_used = out - m_buffer;
+}
+
+void writer::points(const std::vector<nanovna::point> &points)
+{
+    for (auto &point : points)
+        this->point(point);
+}
+
+void writer::flush()
+{
+    if (m_used != 0)
+        m_output.write(m_buffer, m_used);
+    m_used = 0;
+}
+
+// Splits Touchstone text into lines, comments and whitespace-separated tokens.
+class document_scanner
+{
+public:
+    explicit document_scanner(std::string_view text) : m_text(text), m_pos(0), m_line(0)
+    {}
+
+    size_t line_number() const { return m_line; }
+
+    // Returns the next line with any CR removed; false at the end of the text.
+    bool next_line(std::string_view &line)
+    {
+        if (m_pos >= m_text.size())
+            return false;
+        size_t end = m_text.find('\n', m_pos);
+        if (end == std::string_view::npos)
+            end = m_text.size();
+        line = m_text.substr(m_pos, end - m_pos);
+        if (!line.empty() && line.back() == '\r')
+            line.remove_suffix(1);
+        m_pos = end + 1;
+        m_line++;
+        return true;
+    }
+
+    [[noreturn]] void fail(const char *expected) const
+    {
+        throw std::runtime_error(std::string("failed to parse Touchstone data: expected ") + expected + 
+            " at line " + std::to_string(m_line) + "!");
+    }
+
+private:
+    std::string_view m_text;
+    size_t m_pos, m_line;
+};
+
+static bool next_token(std::string_view &line, std::string_view &token)
+{
+    size_t start = line.find_first_not_of(" \t");
+    if (start == std::string_view::npos) {
+        line = std::string_view();
+        return false;
+    }
+    size_t end = line.find_first_of(" \t", start);
+    if (end == std::string_view::npos)
+        end = line.size();
+    token = line.substr(start, end - start);
+    line.remove_prefix(end);
+    return true;
+}
+
+static bool equals_ignoring_case(std::string_view a, const char *b)
+{
+    size_t idx = 0;
+    for (; idx < a.size() && b[idx] != '\0'; idx++) {
+        if (toupper((unsigned char)a[idx]) != b[idx])
+            return false;
+    }
+    return idx == a.size() && b[idx] == '\0';
+}
+
+enum class value_format { ri, ma, db };
+
+static std::complex<float> to_complex(double a, double b, value_format format)
+{
+    static const double DEGREE = 3.14159265358979323846 / 180.0;
+    switch (format) {
+    case value_format::ri:
+        return std::complex<float>((float)a, (float)b);
+    case value_format::ma:
+        return std::complex<float>(std::polar(a, b * DEGREE));
+    case value_format::db:
+        return std::complex<float>(std::polar(std::pow(10.0, a / 20.0), b * DEGREE));
+    }
+    return std::complex<float>();
+}
+
+document parse(std::string_view text)
+{
+    document result;
+    result.ports = 0;
+
+    // defaults from the Touchstone specification
+    double multiplier = 1e9;
+    value_format format = value_format::ma;
+
+    document_scanner scanner(text);
+    std::string_view line, token;
+    bool seen_options = false;
+    double values[9];
+    while (scanner.next_line(line)) {
+        size_t comment = line.find('!');
+        if (comment != std::string_view::npos) {
+            std::string_view body = line.substr(comment + 1);
+            if (!body.empty() && body[0] == ' ')
+                body.remove_prefix(1);
+            if (line.find_first_not_of(" \t") == comment)
+                result.comments.emplace_back(body);
+            line = line.substr(0, comment);
+        }
+
+        if (!next_token(line, token))
+            continue;
+
+        if (token[0] == '#') {
+            if (seen_options)
+                scanner.fail("a single option line");
+            seen_options = true;
+            token.remove_prefix(1);
+            do {
+                if (token.empty())
+                    continue;
+                if (equals_ignoring_case(token, "HZ"))
+                    multiplier = 1.0;
+                else if (equals_ignoring_case(token, "KHZ"))
+                    multiplier = 1e3;
+                else if (equals_ignoring_case(token, "MHZ"))
+                    multiplier = 1e6;
+                else if (equals_ignoring_case(token, "GHZ"))
+                    multiplier = 1e9;
+                else if (equals_ignoring_case(token, "RI"))
+                    format = value_format::ri;
+                else if (equals_ignoring_case(token, "MA"))
+                    format = value_format::ma;
+                else if (equals_ignoring_case(token, "DB"))
+                    format = value_format::db;
+                else if (equals_ignoring_case(token, "R")) {
+                    if (!next_token(line, token))
+                        scanner.fail("reference resistance");
+                } else if (!equals_ignoring_case(token, "S"))
+                    scanner.fail("S-parameters in RI, MA or DB format");
+            } while (next_token(line, token));
+            continue;
+        }
+
+        size_t count = 0;
+        do {
+            if (count == 9)
+                scanner.fail("1-port or 2-port data");
+            // from_chars does not accept the explicit plus sign that our own files have
+            const char *first = token.data(), *last = token.data() + token.size();
+            if (first != last && *first == '+')
+                first++;
+            auto parsed = std::from_chars(first, last, values[count]);
+            if (parsed.ec != std::errc() || parsed.ptr != last)
+                scanner.fail("number");
+            count++;
+        } while (next_token(line, token));
+
+        // the first data line determines the number of ports
+        if (result.ports == 0 && (count == 3 || count == 9))
+            result.ports = count == 3 ? 1 : 2;
+        if (count != (result.ports == 1 ? 3u : 9u))
+            scanner.fail("1-port or 2-port data");
+
+        nanovna::point point;
+        double freq = values[0] * multiplier;
+        if (!(freq >= 0 && freq < 4294967296.0))
+            scanner.fail("frequency below 4.3 GHz");
+        point.freq = (unsigned)(freq + 0.5);
+        point.s11 = to_complex(values[1], values[2], format);
+        if (result.ports == 2)
+            point.s21 = to_complex(values[3], values[4], format);
+        result.points.push_back(point);
+    }
+    return result;
+}
+
+}
+
+}
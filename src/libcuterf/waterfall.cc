@@ -0,0 +1,427 @@
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <cuterf.h>
+#include "file.h"
+
+namespace cuterf {
+
+namespace waterfall {
+
+// On-disk layout. Every field is little-endian, and rows are 8-byte aligned, so that a
+// mapped waterfall can be used in place:
+//
+//   file_header
+//   row_header, trace                  (rows times, tier 0)
+//   row_header, min, max, mean         (rows times, each further tier)
+//
+// Each tier is a ring. The row at `completed % rows` is the one being folded; it is reset
+// when the previous row completes, so it never holds a stale complete row.
+
+static const char FILE_MAGIC[8] = { 'C', 'U', 'T', 'E', 'R', 'F', 'W', 'F' };
+static const uint32_t FILE_VERSION = 1;
+static const unsigned MAX_TIERS = 8;
+
+struct file_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t points;
+    uint64_t start, stop;
+    uint32_t rows;
+    uint32_t tiers;
+    uint32_t factor;
+    uint32_t reserved;
+    uint64_t completed[MAX_TIERS]; // rows ever completed in each tier
+};
+
+struct row_header
+{
+    int64_t first, last; // microseconds since the epoch
+    uint32_t traces;
+    uint32_t reserved;
+};
+
+static_assert(sizeof(file_header) == 112 && sizeof(row_header) == 24, "waterfall headers must be packed");
+
+static uint64_t align8(uint64_t offset)
+{
+    return (offset + 7) & ~(uint64_t)7;
+}
+
+static uint64_t row_size(const layout &shape, unsigned tier)
+{
+    return align8(sizeof(row_header) + sizeof(float) * (uint64_t)shape.points * (tier == 0 ? 1 : 3));
+}
+
+static uint64_t tier_offset(const layout &shape, unsigned tier)
+{
+    uint64_t offset = sizeof(file_header);
+    for (unsigned idx = 0; idx < tier; idx++)
+        offset += row_size(shape, idx) * shape.rows;
+    return offset;
+}
+
+static int64_t to_micros(std::chrono::system_clock::time_point time)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(time.time_since_epoch()).count();
+}
+
+static std::chrono::system_clock::time_point from_micros(int64_t micros)
+{
+    return std::chrono::system_clock::time_point(std::chrono::duration_cast<std::chrono::system_clock::duration>(
+        std::chrono::microseconds(micros)));
+}
+
+layout::layout() : points(450), start(0), stop(0), rows(4096), tiers(4), factor(8)
+{}
+
+size_t layout::file_size() const
+{
+    return (size_t)tier_offset(*this, tiers);
+}
+
+static void check_layout(const layout &shape)
+{
+    if (shape.points < 2 || shape.stop < shape.start)
+        throw std::logic_error("a waterfall needs at least 2 points and an increasing span!");
+    if (shape.rows < 2 || shape.tiers < 1 || shape.tiers > MAX_TIERS || shape.factor < 2)
+        throw std::logic_error("a waterfall needs at least 2 rows, 1 to 8 tiers and a factor of at least 2!");
+}
+
+// Reads the layout of a mapped waterfall, checking that the file is large enough for it.
+static layout load_layout(const char *data, size_t size)
+{
+    if (size < sizeof(file_header) || memcmp(data, FILE_MAGIC, sizeof(FILE_MAGIC)))
+        throw std::runtime_error("file is not a waterfall!");
+    const file_header *header = (const file_header *)data;
+    if (header->version != FILE_VERSION)
+        throw std::runtime_error("unsupported waterfall version!");
+
+    layout shape;
+    shape.points = header->points;
+    shape.start = header->start;
+    shape.stop = header->stop;
+    shape.rows = header->rows;
+    shape.tiers = header->tiers;
+    shape.factor = header->factor;
+    if (shape.points < 2 || shape.rows < 2 || shape.tiers < 1 || shape.tiers > MAX_TIERS || shape.factor < 2 ||
+            shape.file_size() > size)
+        throw std::runtime_error("waterfall header is corrupt!");
+    return shape;
+}
+
+static size_t complete_rows(const layout &shape, const file_header *header, unsigned tier)
+{
+    return (size_t)std::min<uint64_t>(header->completed[tier], shape.rows - 1);
+}
+
+// Position in the ring of the `index`th oldest complete row.
+static uint64_t ring_slot(const layout &shape, const file_header *header, unsigned tier, size_t index)
+{
+    uint64_t completed = header->completed[tier];
+    uint64_t oldest = completed - complete_rows(shape, header, tier);
+    return (oldest + index) % shape.rows;
+}
+
+static row_view make_row_view(const layout &shape, const char *data, unsigned tier, uint64_t slot)
+{
+    const char *base = &data[tier_offset(shape, tier) + row_size(shape, tier) * slot];
+    const row_header *row = (const row_header *)base;
+    const float *columns = (const float *)&base[sizeof(row_header)];
+    row_view view;
+    view.first = from_micros(row->first);
+    view.last = from_micros(row->last);
+    view.traces = row->traces;
+    view.min = columns;
+    view.max = tier == 0 ? columns : columns + shape.points;
+    view.mean = tier == 0 ? columns : columns + 2 * (size_t)shape.points;
+    return view;
+}
+
+// --- recorder --------------------------------------------------------------
+
+class recorder_impl
+{
+public:
+    mapped_file m_file;
+    layout m_layout;
+    std::vector<uint64_t> m_traces_per_row; // factor ** tier
+
+    file_header *header() const { return (file_header *)m_file.writable_data(); }
+    char *row(unsigned tier, uint64_t slot) const;
+};
+
+char *recorder_impl::row(unsigned tier, uint64_t slot) const
+{
+    return &m_file.writable_data()[tier_offset(m_layout, tier) + row_size(m_layout, tier) * slot];
+}
+
+recorder::recorder() : m_i(new recorder_impl)
+{}
+
+recorder::~recorder()
+{
+    delete m_i;
+}
+
+bool recorder::open(const std::wstring &path, const waterfall::layout &layout)
+{
+    close();
+    check_layout(layout);
+    if (!m_i->m_file.open_writable(path, layout.file_size()))
+        return false;
+
+    try {
+        file_header *header = m_i->header();
+        const char empty[sizeof(FILE_MAGIC)] = {};
+        if (m_i->m_file.size == layout.file_size() && !memcmp(header->magic, empty, sizeof(empty))) {
+            // just created, and zero-filled by the OS
+            header->version = FILE_VERSION;
+            header->points = layout.points;
+            header->start = layout.start;
+            header->stop = layout.stop;
+            header->rows = layout.rows;
+            header->tiers = layout.tiers;
+            header->factor = layout.factor;
+            memcpy(header->magic, FILE_MAGIC, sizeof(FILE_MAGIC));
+        }
+
+        waterfall::layout existing = load_layout(m_i->m_file.data, m_i->m_file.size);
+        if (existing.points != layout.points || existing.start != layout.start || existing.stop != layout.stop ||
+                existing.rows != layout.rows || existing.tiers != layout.tiers || existing.factor != layout.factor)
+            throw std::runtime_error("waterfall was recorded with a different layout!");
+    } catch (...) {
+        close();
+        throw;
+    }
+
+    m_i->m_layout = layout;
+    m_i->m_traces_per_row.assign(1, 1);
+    for (unsigned tier = 1; tier < layout.tiers; tier++)
+        m_i->m_traces_per_row.push_back(m_i->m_traces_per_row.back() * layout.factor);
+    return true;
+}
+
+void recorder::close()
+{
+    m_i->m_file.close();
+}
+
+const layout &recorder::layout() const
+{
+    return m_i->m_layout;
+}
+
+size_t recorder::rows(unsigned tier) const
+{
+    if (!m_i->m_file.is_open() || tier >= m_i->m_layout.tiers)
+        return 0;
+    return complete_rows(m_i->m_layout, m_i->header(), tier);
+}
+
+// Folds a trace into the minimum, maximum and running mean of a row.
+static void fold(const float *level, float *min, float *max, float *mean, size_t points, uint32_t traces)
+{
+    if (traces == 0) {
+        memcpy(min, level, sizeof(float) * points);
+        memcpy(max, level, sizeof(float) * points);
+        memcpy(mean, level, sizeof(float) * points);
+        return;
+    }
+    float weight = 1.0f / (float)(traces + 1);
+    for (size_t idx = 0; idx < points; idx++) {
+        float value = level[idx];
+        min[idx] = value < min[idx] ? value : min[idx];
+        max[idx] = value > max[idx] ? value : max[idx];
+        mean[idx] += (value - mean[idx]) * weight;
+    }
+}
+
+void recorder::append(std::chrono::system_clock::time_point timestamp, const tinysa::trace &data)
+{
+    if (!m_i->m_file.is_open())
+        throw std::logic_error("cannot append to a waterfall that is not open!");
+
+    const waterfall::layout &shape = m_i->m_layout;
+    if (data.level.size() != shape.points || data.freq.size() != shape.points ||
+            data.freq.front() != shape.start || data.freq.back() != shape.stop)
+        throw std::runtime_error("trace does not match the span and points of the waterfall!");
+
+    file_header *header = m_i->header();
+    int64_t micros = to_micros(timestamp);
+    for (unsigned tier = 0; tier < shape.tiers; tier++) {
+        uint64_t slot = header->completed[tier] % shape.rows;
+        char *base = m_i->row(tier, slot);
+        row_header *row = (row_header *)base;
+        float *columns = (float *)&base[sizeof(row_header)];
+        if (tier == 0)
+            memcpy(columns, data.level.data(), sizeof(float) * shape.points);
+        else
+            fold(data.level.data(), columns, columns + shape.points, columns + 2 * (size_t)shape.points,
+                shape.points, row->traces);
+        if (row->traces == 0)
+            row->first = micros;
+        row->last = micros;
+        row->traces++;
+
+        if (row->traces == m_i->m_traces_per_row[tier]) {
+            // the row to be folded next is the oldest complete one, which is dropped
+            ((row_header *)m_i->row(tier, (slot + 1) % shape.rows))->traces = 0;
+            header->completed[tier]++;
+        }
+    }
+}
+
+// --- reader ----------------------------------------------------------------
+
+class reader_impl
+{
+public:
+    mapped_file m_file;
+    layout m_layout;
+
+    const file_header *header() const { return (const file_header *)m_file.data; }
+};
+
+reader::reader() : m_i(new reader_impl)
+{}
+
+reader::~reader()
+{
+    delete m_i;
+}
+
+bool reader::open(const std::wstring &path)
+{
+    close();
+    if (!m_i->m_file.open(path))
+        return false;
+
+    try {
+        m_i->m_layout = load_layout(m_i->m_file.data, m_i->m_file.size);
+    } catch (...) {
+        close();
+        throw;
+    }
+    return true;
+}
+
+void reader::close()
+{
+    m_i->m_file.close();
+}
+
+const layout &reader::layout() const
+{
+    return m_i->m_layout;
+}
+
+size_t reader::rows(unsigned tier) const
+{
+    if (!m_i->m_file.is_open() || tier >= m_i->m_layout.tiers)
+        return 0;
+    return complete_rows(m_i->m_layout, m_i->header(), tier);
+}
+
+row_view reader::row(unsigned tier, size_t index) const
+{
+    if (index >= rows(tier))
+        throw std::logic_error("waterfall row index is out of range!");
+    return make_row_view(m_i->m_layout, m_i->m_file.data, tier, ring_slot(m_i->m_layout, m_i->header(), tier, index));
+}
+
+size_t reader::find(unsigned tier, std::chrono::system_clock::time_point time) const
+{
+    // rows are in order of time, so only the rows on the path of the search are paged in
+    size_t low = 0, high = rows(tier);
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (row(tier, middle).last < time)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low;
+}
+
+// --- rendering -------------------------------------------------------------
+
+selection select(const reader &source, std::chrono::system_clock::time_point from,
+    std::chrono::system_clock::time_point to, size_t max_rows)
+{
+    const waterfall::layout &shape = source.layout();
+
+    // a window that starts before the recording is held by any tier that kept its first row
+    std::chrono::system_clock::time_point history_start = from;
+    for (unsigned tier = 0; tier < shape.tiers; tier++) {
+        if (source.rows(tier) != 0)
+            history_start = std::min(history_start, source.row(tier, 0).first);
+    }
+    std::chrono::system_clock::time_point start = std::max(from, history_start);
+
+    selection result = {};
+    for (unsigned tier = 0; tier < shape.tiers; tier++) {
+        size_t rows = source.rows(tier);
+        if (rows == 0)
+            continue;
+        result.tier = tier;
+        result.first = source.find(tier, from);
+        size_t end = source.find(tier, to);
+        if (end < rows && source.row(tier, end).first <= to)
+            end++;
+        result.count = end - result.first;
+        if (source.row(tier, 0).first <= start && result.count <= max_rows)
+            return result;
+    }
+    if (result.count > max_rows) {
+        result.first += result.count - max_rows;
+        result.count = max_rows;
+    }
+    return result;
+}
+
+// Colormap stops, evenly spaced from floor to ceiling.
+static const uint8_t COLORMAP[][3] = {
+    { 0, 0, 0 },
+    { 0, 0, 192 },
+    { 0, 192, 255 },
+    { 255, 255, 0 },
+    { 255, 0, 0 },
+    { 255, 255, 255 },
+};
+
+struct palette
+{
+    uint8_t rgb[256][3];
+
+    palette()
+    {
+        const size_t segments = sizeof(COLORMAP) / sizeof(COLORMAP[0]) - 1;
+        for (unsigned idx = 0; idx < 256; idx++) {
+            float position = idx * segments / 255.0f;
+            size_t segment = std::min((size_t)position, segments - 1);
+            float fraction = position - segment;
+            for (unsigned channel = 0; channel < 3; channel++)
+                rgb[idx][channel] = (uint8_t)(COLORMAP[segment][channel] +
+                    fraction * (COLORMAP[segment + 1][channel] - COLORMAP[segment][channel]) + 0.5f);
+        }
+    }
+};
+
+void render_row(const row_view &row, size_t points, statistic which, float floor, float ceiling, uint8_t *rgb24)
+{
+    static const palette colors;
+
+    const float *levels = which == statistic::min ? row.min : which == statistic::max ? row.max : row.mean;
+    float scale = 255.0f / (ceiling - floor);
+    for (size_t idx = 0; idx < points; idx++) {
+        float position = (levels[idx] - floor) * scale;
+        unsigned index = position <= 0 ? 0 : position >= 255 ? 255 : (unsigned)position;
+        memcpy(&rgb24[3 * idx], colors.rgb[index], 3);
+    }
+}
+
+}
+
+}
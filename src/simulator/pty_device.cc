@@ -0,0 +1,248 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include "pty_device.h"
+
+const pty_device::link USB_FULL_SPEED = { std::chrono::microseconds(1000), 1e6 };
+
+pty_device::pty_device(handler respond, link timing, script behaviour) : 
+    m_respond(respond), m_link(timing), m_script(behaviour), m_stop(false), m_commands(0), m_round_trips(0),
+    m_truncated(0)
+{
+    m_master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (m_master == -1 || grantpt(m_master) != 0 || unlockpt(m_master) != 0)
+        throw std::runtime_error("cannot allocate a pseudo-terminal");
+    m_slave_path = ptsname(m_master);
+
+    // keep the slave open so that the master never sees a hangup between clients
+    m_slave = open(m_slave_path.c_str(), O_RDWR | O_NOCTTY);
+    if (m_slave == -1)
+        throw std::runtime_error("cannot open pseudo-terminal slave");
+    struct termios tio;
+    tcgetattr(m_slave, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(m_slave, TCSANOW, &tio);
+
+    m_thread = std::thread(&pty_device::serve, this);
+}
+
+pty_device::~pty_device()
+{
+    m_stop = true;
+    m_thread.join();
+    close(m_slave);
+    close(m_master);
+}
+
+std::wstring pty_device::path() const
+{
+    return std::wstring(m_slave_path.begin(), m_slave_path.end());
+}
+
+void pty_device::send(const std::string &data, bool turnaround)
+{
+    typedef std::chrono::steady_clock clock;
+    clock::time_point start = clock::now();
+    if (turnaround)
+        start += m_link.latency;
+    std::this_thread::sleep_until(start);
+
+    size_t done = 0;
+    while (done < data.size()) {
+        size_t chunk = data.size() - done;
+        if (m_link.bytes_per_second > 0) {
+            // a chunk is available once its last byte would have crossed the link
+            chunk = std::min<size_t>(chunk, 4096);
+            std::this_thread::sleep_until(start + std::chrono::duration_cast<clock::duration>(
+                std::chrono::duration<double>((done + chunk) / m_link.bytes_per_second)));
+        }
+        ssize_t count = write(m_master, &data[done], chunk);
+        if (count > 0) {
+            done += count;
+        } else if (!(count == -1 && (errno == EINTR || errno == EAGAIN))) {
+            return;
+        }
+    }
+}
+
+void pty_device::answer(const std::string &line, bool turnaround)
+{
+    std::string echo = line + "\r\n", response = m_respond(line) + "ch> ";
+    // the cut always falls before the prompt; a command without output has nothing to cut
+    // into but the prompt, and is left whole
+    if (m_script.truncate_every != 0 && m_commands % m_script.truncate_every == 0 && response.size() > 4) {
+        response.resize(std::uniform_int_distribution<size_t>(0, response.size() - 5)(m_random));
+        m_truncated++;
+    }
+    auto delay = m_script.delays.find(line.substr(0, line.find(' ')));
+    if (delay == m_script.delays.end()) {
+        send(echo + response, turnaround);
+    } else {
+        send(echo, turnaround);
+        std::this_thread::sleep_for(delay->second);
+        send(response, false);
+    }
+}
+
+void pty_device::serve()
+{
+    std::string line;
+    char buffer[4096];
+    while (!m_stop) {
+        struct pollfd pfd = { m_master, POLLIN, 0 };
+        if (poll(&pfd, 1, 50) <= 0)
+            continue;
+        ssize_t count = read(m_master, buffer, sizeof(buffer));
+        if (count <= 0)
+            continue;
+        bool turnaround = true;
+        for (ssize_t idx = 0; idx < count; idx++) {
+            if (buffer[idx] == '\r')
+                continue;
+            if (buffer[idx] != '\n') {
+                line += buffer[idx];
+                continue;
+            }
+            m_commands++;
+            if (turnaround)
+                m_round_trips++;
+            answer(line, turnaround);
+            turnaround = false;
+            line.clear();
+        }
+    }
+}
+
+float fake_nanovna_value(unsigned port, unsigned idx, bool imag)
+{
+    float phase = 0.01f * idx + port;
+    return imag ? -0.25f * phase : 0.5f * phase;
+}
+
+static void append_le(std::string &data, const void *value, size_t size)
+{
+    // the firmware runs on a little-endian Cortex-M, as does every host we benchmark on
+    data.append((const char *)value, size);
+}
+
+std::string fake_nanovna(const std::string &command, unsigned points)
+{
+    const unsigned start = 50000, stop = 900000000;
+    char line[64];
+    if (command == "info")
+        return "NanoVNA-H 4\r\nBoard: NanoVNA-H 4\r\nVersion: 1.2.20\r\n";
+    if (command == "edelay")
+        return "0.000000\r\n";
+    if (command == "s21offset")
+        return "0.000\r\n";
+    unsigned span_start, span_stop, span_points;
+    if (sscanf(command.c_str(), "sweep %u %u %u", &span_start, &span_stop, &span_points) == 3)
+        return "";
+    if (command == "sweep") {
+        snprintf(line, sizeof(line), "%u %u %u\r\n", start, stop, points);
+        return line;
+    }
+    if (command == "data 0" || command == "data 1") {
+        unsigned port = command[5] - '0';
+        std::string response;
+        for (unsigned idx = 0; idx < points; idx++) {
+            snprintf(line, sizeof(line), "%.9f %.9f\r\n", 
+                fake_nanovna_value(port, idx, false), fake_nanovna_value(port, idx, true));
+            response += line;
+        }
+        return response;
+    }
+    unsigned scan_start, scan_stop, scan_points, mask;
+    if (sscanf(command.c_str(), "scan_bin %u %u %u %u", &scan_start, &scan_stop, &scan_points, &mask) == 4) {
+        // see cmd_scan() in firmware
+        uint16_t reply_mask = (uint16_t)(mask | 0x80), reply_points = (uint16_t)scan_points;
+        std::string response;
+        append_le(response, &reply_mask, sizeof(reply_mask));
+        append_le(response, &reply_points, sizeof(reply_points));
+        unsigned f_points = scan_points - 1;
+        unsigned f_delta = (scan_stop - scan_start) / f_points;
+        unsigned f_error = (scan_stop - scan_start) % f_points;
+        for (unsigned idx = 0; idx < scan_points; idx++) {
+            uint32_t freq = scan_start + f_delta * idx + (f_points / 2 + f_error * idx) / f_points;
+            if (mask & 1)
+                append_le(response, &freq, sizeof(freq));
+            for (unsigned port = 0; port < 2; port++) {
+                if (!(mask & (2 << port)))
+                    continue;
+                float re = fake_nanovna_value(port, idx, false), im = fake_nanovna_value(port, idx, true);
+                append_le(response, &re, sizeof(re));
+                append_le(response, &im, sizeof(im));
+            }
+        }
+        return response;
+    }
+    if (command == "capture")
+        return std::string(2 * 480 * 320, '\x5a');
+    if (command == "refresh on" || command == "refresh off")
+        return "";
+    // including `#sync#`, which the library expects to be rejected
+    return command + "?\r\n";
+}
+
+std::string fake_screen_region(const cuterf::screen_region &region)
+{
+    // see send_region() in firmware
+    int16_t rect[4] = { (int16_t)region.x, (int16_t)region.y, (int16_t)region.width, (int16_t)region.height };
+    std::string data = region.fill ? "fill\r\n" : "bulk\r\n";
+    append_le(data, rect, sizeof(rect));
+    data += region.data;
+    data += "ch> \r\n";
+    return data;
+}
+
+uint16_t fake_tinysa_level(unsigned idx)
+{
+    return (uint16_t)(74 * 32 + (idx * 37) % 640); // -100 dBm to -80 dBm
+}
+
+std::string fake_tinysa(const std::string &command, unsigned points, bool has_scanraw)
+{
+    const uint64_t start = 100000, stop = 5300000000;
+    char line[64];
+    if (command == "version")
+        return "tinySA4_v1.4-143-g864bb27\r\nHW Version:V0.4.5.1\r\n";
+    if (command == "sweep") {
+        snprintf(line, sizeof(line), "%llu %llu %u\r\n", (unsigned long long)start, (unsigned long long)stop, points);
+        return line;
+    }
+    if (command == "frequencies" || command == "data 2") {
+        std::string response;
+        for (unsigned idx = 0; idx < points; idx++) {
+            if (command == "frequencies")
+                snprintf(line, sizeof(line), "%llu\r\n", (unsigned long long)(start + (stop - start) * idx / (points - 1)));
+            else
+                snprintf(line, sizeof(line), "%e\r\n", fake_tinysa_level(idx) / 32.0 - 174);
+            response += line;
+        }
+        return response;
+    }
+    unsigned long long scan_start, scan_stop;
+    unsigned scan_points;
+    if (has_scanraw && sscanf(command.c_str(), "scanraw %llu %llu %u", &scan_start, &scan_stop, &scan_points) == 3) {
+        // see cmd_scanraw() in firmware
+        std::string response = "{";
+        for (unsigned idx = 0; idx < scan_points; idx++) {
+            uint16_t level = fake_tinysa_level(idx);
+            response += 'x';
+            append_le(response, &level, sizeof(level));
+        }
+        return response + "}";
+    }
+    if (command == "capture")
+        return std::string(2 * 480 * 320, '\x5a');
+    if (command == "refresh on" || command == "refresh off")
+        return "";
+    return command + "?\r\n";
+}
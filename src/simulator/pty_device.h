@@ -0,0 +1,89 @@
+#ifndef CUTERF_SIMULATOR_PTY_DEVICE_H
+#define CUTERF_SIMULATOR_PTY_DEVICE_H
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <cuterf.h>
+
+// Stand-in for an instrument on the far side of a pseudo-terminal. It implements the shell
+// framing (echo, response, `ch> ` prompt) and delegates each command line to a handler.
+class pty_device
+{
+public:
+    typedef std::function<std::string(const std::string &command)> handler;
+
+    // Simulated USB link: a fixed turnaround per exchange, then a byte rate (0 = unlimited).
+    // Commands that arrive together (pipelined) share one turnaround.
+    struct link
+    {
+        std::chrono::microseconds latency;
+        double bytes_per_second;
+    };
+
+    // How the firmware behaves beyond what it answers.
+    struct script
+    {
+        // Time spent on a command between echoing it and answering, as when `scan` waits for
+        // a sweep to complete; keyed by the first word of the command.
+        std::map<std::string, std::chrono::microseconds> delays;
+        // Cut every Nth response (0 = none) short at a random point before its prompt, as
+        // when the link drops data. Responses that are only a prompt are left whole.
+        unsigned truncate_every;
+
+        script() : truncate_every(0) {}
+    };
+
+    explicit pty_device(handler respond, link timing = { std::chrono::microseconds(0), 0 },
+        script behaviour = script());
+    ~pty_device();
+
+    std::wstring path() const;
+    size_t commands() const { return m_commands; }
+    size_t round_trips() const { return m_round_trips; }
+    size_t truncated() const { return m_truncated; }
+
+    // Sends `data` without being asked, as firmware does in remote desktop mode.
+    void push(const std::string &data) { send(data, false); }
+
+private:
+    handler m_respond;
+    link m_link;
+    script m_script;
+    std::minstd_rand m_random;
+    int m_master, m_slave;
+    std::string m_slave_path;
+    std::atomic<bool> m_stop;
+    std::atomic<size_t> m_commands, m_round_trips, m_truncated;
+    std::thread m_thread;
+
+    void serve();
+    void answer(const std::string &line, bool turnaround);
+    void send(const std::string &data, bool turnaround);
+};
+
+// Full-speed USB CDC as seen by the host: ~1 ms per transaction, ~1 MB/s sustained.
+extern const pty_device::link USB_FULL_SPEED;
+
+// Responds like NanoVNA-H 4 firmware with a `points`-point sweep, including the binary
+// `scan_bin` command.
+std::string fake_nanovna(const std::string &command, unsigned points);
+
+// The S11/S21 values fake_nanovna() reports for a point.
+float fake_nanovna_value(unsigned port, unsigned idx, bool imag);
+
+// Encodes a region as firmware sends it in remote desktop mode, prompt included.
+std::string fake_screen_region(const cuterf::screen_region &region);
+
+// Responds like tinySA Ultra firmware with a `points`-point trace from 100 kHz to 5.3 GHz,
+// including the binary `scanraw` command unless `has_scanraw` is false.
+std::string fake_tinysa(const std::string &command, unsigned points = 450, bool has_scanraw = true);
+
+// The level fake_tinysa() reports for a point, in 1/32 dB above the zero level of -174 dBm.
+uint16_t fake_tinysa_level(unsigned idx);
+
+#endif // CUTERF_SIMULATOR_PTY_DEVICE_H
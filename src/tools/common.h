@@ -2,12 +2,48 @@
 #define UTILS_H
 
 #include <time.h>
+#include <chrono>
+#include <clocale>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cwchar>
 #include <string>
 #include <iostream>
 #include <iomanip>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
 #include <png.h>
+#include <cuterf.h>
+#include "compat.h"
+#include "pixmap.h"
 
-static const std::string SOFTWARE_NAME = "https://github.com/VioletEternity/cuterf-tools";
+#ifndef _WIN32
+// The tools are written against the wide-character Windows CRT entry point; on POSIX
+// systems arguments are converted using the current locale.
+
+int wmain(int argc, wchar_t **argv);
+
+int main(int argc, char **argv)
+{
+    setlocale(LC_ALL, "");
+    std::vector<std::wstring> wide_args;
+    std::vector<wchar_t *> wide_argv;
+    for (int argn = 0; argn < argc; argn++) {
+        std::wstring wide(mbstowcs(NULL, argv[argn], 0), L'\0');
+        mbstowcs(&wide[0], argv[argn], wide.size());
+        wide_args.push_back(wide);
+    }
+    for (auto &arg : wide_args)
+        wide_argv.push_back(&arg[0]);
+    wide_argv.push_back(NULL);
+    return wmain(argc, &wide_argv[0]);
+}
+#endif
 
 std::wstring current_date_time_for_filename()
 {
@@ -45,122 +81,87 @@ std::string current_date_time_for_metadata()
     return ss.str();
 }
 
-struct rgb565_pixmap
+// Formats a local time as "YYYY-MM-DD HH:MM:SS", with milliseconds appended when `millis` is set.
+std::string format_date_time(std::chrono::system_clock::time_point timestamp, bool millis = false)
 {
-    typedef uint16_t pixel;
-
-    const size_t width, height;
-    std::unique_ptr<pixel[]> data;
-
-    rgb565_pixmap(size_t width, size_t height) :
-        width(width), height(height), data(new pixel[width * height])
-    {}
-
-    std::vector<uint8_t> to_rgb24(unsigned scale) const 
-    {
-        static const uint8_t lut6to8[] = {
-            0,   4,   8,   12,  16,  20,  24,  28,  32,  36,  40,  45,  49,  53,  57,  61,
-            65,  69,  73,  77,  81,  85,  89,  93,  97,  101, 105, 109, 113, 117, 121, 125,
-            130, 134, 138, 142, 146, 150, 154, 158, 162, 166, 170, 174, 178, 182, 186, 190,
-            194, 198, 202, 206, 210, 215, 219, 223, 227, 231, 235, 239, 243, 247, 251, 255
-        };
-        std::vector<uint8_t> rgb24_data;
-        for (size_t row = 0; row < height; row++) {
-            for (unsigned yrepeat = 0; yrepeat < scale; yrepeat++) {
-                for (size_t column = 0; column < width; column++) {
-                    pixel pixel = data[column + width * row];
-                    for (unsigned xrepeat = 0; xrepeat < scale; xrepeat++) {
-                        rgb24_data.push_back(lut6to8[(pixel & 0xf800) >> 10]);
-                        rgb24_data.push_back(lut6to8[(pixel & 0x07e0) >> 5]);
-                        rgb24_data.push_back(lut6to8[(pixel & 0x001f) << 1]);
-                    }
-                }
-            }
-        }
-        return rgb24_data;
+    time_t seconds = std::chrono::system_clock::to_time_t(timestamp);
+    struct tm *timeinfo = localtime(&seconds);
+
+    // room for any int year, not just four digits
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "%04d-%02d-%02d %02d:%02d:%02d",
+        1900 + timeinfo->tm_year, timeinfo->tm_mon + 1, timeinfo->tm_mday,
+        timeinfo->tm_hour, timeinfo->tm_min, timeinfo->tm_sec);
+    std::string text = buffer;
+    if (millis) {
+        unsigned fraction = (unsigned)(std::chrono::duration_cast<std::chrono::milliseconds>(
+            timestamp.time_since_epoch()).count() % 1000);
+        snprintf(buffer, sizeof(buffer), ".%03u", fraction);
+        text += buffer;
     }
+    return text;
+}
 
-    void read_from_capture(const std::string &raw_data)
-    {
-        if (raw_data.size() != width * height * sizeof(pixel))
-            throw std::runtime_error("raw capture data has wrong size!");
-        for (size_t i = 0; i < raw_data.length(); i += 2)
-            data[i / 2] = (raw_data[i] << 8) | (raw_data[i + 1] & 0xff);
+// Parses a frequency in Hz, with an optional k, M or G suffix, stopping at `end`.
+template<typename T>
+bool parse_frequency(const wchar_t *text, const wchar_t **end, T &freq)
+{
+    wchar_t *number_end;
+    double value = wcstod(text, &number_end);
+    if (number_end == text)
+        return false;
+    switch (*number_end) {
+    case L'k': value *= 1e3; number_end++; break;
+    case L'M': value *= 1e6; number_end++; break;
+    case L'G': value *= 1e9; number_end++; break;
     }
+    if (!(value >= 0 && value < (double)std::numeric_limits<T>::max()))
+        return false;
+    freq = (T)(value + 0.5);
+    *end = number_end;
+    return true;
+}
 
-    bool save_to_png_file(const std::wstring &path, unsigned scale, const std::string &source, const std::string &creation_time, const std::string &extra_name = "", const std::string &extra_value = "")
-    {
-        FILE *file = NULL;
-        png_structp png = NULL;
-        png_infop info = NULL;
-        std::vector<uint8_t> rgb24_data;
-        std::vector<png_bytep> rows;
-        bool result = false;
-        
-        file = _wfopen(path.c_str(), L"wb");
-        if (file == NULL) 
-            goto done;
-
-        png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-        if (png == NULL)
-            goto done;
-
-        info = png_create_info_struct(png);
-        if (info == NULL)
-            goto done;
-
-        if (setjmp(png_jmpbuf(png)))
-            goto done;
-
-        png_set_IHDR(png, info,
-            width * scale,
-            height * scale,
-            8, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE,
-            PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
-
-        rgb24_data = to_rgb24(scale);
-        for (size_t row = 0; row < height * scale; row++)
-            rows.push_back(&rgb24_data[3 * width * scale * row]);
-        png_set_rows(png, info, &rows[0]);
-
-        png_text texts[4];
-        size_t text_count = 0;
-        texts[text_count].key = "Software";
-        texts[text_count].compression = PNG_TEXT_COMPRESSION_NONE;
-        texts[text_count].text = const_cast<png_charp>(SOFTWARE_NAME.c_str());
-        texts[text_count++].text_length = SOFTWARE_NAME.length();
-        if (!source.empty()) {
-            texts[text_count].key = "Source";
-            texts[text_count].compression = PNG_TEXT_COMPRESSION_NONE;
-            texts[text_count].text = const_cast<png_charp>(source.c_str());
-            texts[text_count++].text_length = source.length();
-        }
-        if (!creation_time.empty()) {
-            texts[text_count].key = "Creation Time";
-            texts[text_count].compression = PNG_TEXT_COMPRESSION_NONE;
-            texts[text_count].text = const_cast<png_charp>(creation_time.c_str());
-            texts[text_count++].text_length = creation_time.length();
-        }
-        if (!extra_name.empty()) {
-            texts[text_count].key = const_cast<png_charp>(extra_name.c_str());
-            texts[text_count].compression = PNG_TEXT_COMPRESSION_zTXt;
-            texts[text_count].text = const_cast<png_charp>(extra_value.c_str());
-            texts[text_count++].text_length = extra_value.length();
-        }
-        png_set_text(png, info, texts, text_count);
-
-        png_init_io(png, file);
-        png_write_png(png, info, PNG_TRANSFORM_IDENTITY, 0);
-        result = true;
-
-    done:
-        if (png != NULL)
-            png_destroy_write_struct(&png, &info);
-        if (file != NULL)
-            fclose(file);
-        return result;
+// Parses a frequency range, LOW-HIGH, each as parse_frequency() accepts.
+template<typename T>
+bool parse_frequency_range(const wchar_t *text, T &low, T &high)
+{
+    const wchar_t *end;
+    return parse_frequency(text, &end, low) && *end == L'-' && parse_frequency(end + 1, &end, high) &&
+        *end == L'\0' && low <= high;
+}
+
+// Prints the statistics collected with /stats: per command, the bytes and system calls of
+// an execution, and the median and 99th percentile of its latencies, in microseconds.
+inline void print_command_stats(const std::vector<cuterf::command_stats> &stats)
+{
+    auto percentiles = [](const cuterf::histogram &latency) {
+        std::wostringstream text;
+        text << std::fixed << std::setprecision(1) << latency.percentile(50) / 1e3 << L"/"
+            << latency.percentile(99) / 1e3;
+        return text.str();
+    };
+    std::wcerr << std::left << std::setw(14) << L"Command" << std::right << std::setw(7) << L"Calls"
+        << std::setw(11) << L"Bytes out" << std::setw(11) << L"Bytes in" << std::setw(10) << L"Syscalls"
+        << std::setw(17) << L"Echo p50/p99" << std::setw(19) << L"Prompt p50/p99" << std::setw(17) << L"Parse p50/p99"
+        << std::endl;
+    for (auto &command : stats) {
+        double calls = command.calls != 0 ? (double)command.calls : 1;
+        std::wcerr << std::left << std::setw(14) << std::wstring(command.command.begin(), command.command.end())
+            << std::right << std::setw(7) << command.calls << std::fixed << std::setprecision(0)
+            << std::setw(11) << command.bytes_written / calls << std::setw(11) << command.bytes_read / calls
+            << std::setprecision(1) << std::setw(10) << command.syscalls / calls
+            << std::setw(17) << percentiles(command.echo) << std::setw(19) << percentiles(command.prompt)
+            << std::setw(17) << percentiles(command.parse) << std::endl;
     }
-};
+    std::wcerr << L"Bytes and system calls are per call; latencies are in microseconds." << std::endl;
+}
+
+// Reads the Touchstone data that nanovna_screenshot embeds in a PNG file.
+inline bool extract_touchstone_from_png_file(const std::wstring &path, std::string &touchstone)
+{
+    return cuterf::read_png_text(path, "Touchstone", touchstone);
+}
 
 
 #endif // UTILS_H
\ No newline at end of file
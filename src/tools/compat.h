@@ -0,0 +1,25 @@
+#ifndef TOOLS_COMPAT_H
+#define TOOLS_COMPAT_H
+
+#ifndef _WIN32
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+// The tools are written against the wide-character Windows CRT file API; on POSIX systems
+// paths are converted using the current locale.
+
+inline std::string narrow_path(const wchar_t *wide)
+{
+    std::string narrow(wcstombs(NULL, wide, 0), '\0');
+    wcstombs(&narrow[0], wide, narrow.size());
+    return narrow;
+}
+
+inline FILE *_wfopen(const wchar_t *path, const wchar_t *mode)
+{
+    return fopen(narrow_path(path).c_str(), narrow_path(mode).c_str());
+}
+#endif
+
+#endif // TOOLS_COMPAT_H
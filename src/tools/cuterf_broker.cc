@@ -0,0 +1,77 @@
+#include <csignal>
+#include <cuterf.h>
+#include "common.h"
+
+using namespace cuterf;
+
+static broker::server *serving = nullptr;
+
+static void handle_interrupt(int)
+{
+    if (serving != nullptr)
+        serving->stop();
+}
+
+int wmain(int argc, wchar_t** argv)
+{
+    bool show_usage = false;
+    int usage_status = EXIT_SUCCESS;
+    std::wstring device_path, socket_path;
+    for (size_t argn = 1; argn < (size_t)argc; argn++) {
+        if (!wcscmp(argv[argn], L"/?")) {
+            show_usage = true;
+            break;
+        } else if (!wcsncmp(argv[argn], L"/socket:", 8) && argv[argn][8] != L'\0') {
+            socket_path = &argv[argn][8];
+        } else if (wcscmp(argv[argn], L"/") && device_path.empty()) {
+            device_path = argv[argn];
+        } else {
+            std::wcerr << L"Unrecognized argument '" << argv[argn] << "'!" << std::endl;
+            show_usage = true;
+            usage_status = EXIT_FAILURE;
+        }
+    }
+    if (show_usage) {
+        std::wcerr << L"Usage: cuterf_broker [options] [device]" << std::endl;
+        std::wcerr << std::endl;
+        std::wcerr << L"Keeps a NanoVNA or TinySA open until interrupted with Ctrl+C, and makes captures" << std::endl;
+        std::wcerr << L"for the other tools, which use the broker instead of opening the device. Identical" << std::endl;
+        std::wcerr << L"captures requested at the same time are made once." << std::endl;
+        std::wcerr << std::endl;
+        std::wcerr << L"Options:" << std::endl;
+        std::wcerr << "\t/?\t\tShow program usage." << std::endl;
+        std::wcerr << "\t/socket:PATH\tListen on PATH instead of the socket the tools look for." << std::endl;
+        return usage_status;
+    }
+    if (socket_path.empty())
+        socket_path = broker::default_path();
+    if (socket_path.empty()) {
+        std::wcerr << L"The socket directory in /tmp belongs to another user or is not private; set" << std::endl;
+        std::wcerr << L"XDG_RUNTIME_DIR or use /socket:PATH!" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    broker::server server;
+    try {
+        if (!server.open(device_path, socket_path)) {
+            std::wcerr << L"Cannot find a connected NanoVNA or TinySA!" << std::endl;
+            return EXIT_FAILURE;
+        }
+        const device_info &info = server.device();
+        std::wcerr << L"Serving " << std::wstring(info.board.begin(), info.board.end()) << L" at '" << info.path
+            << L"' on '" << socket_path << L"' until interrupted" << std::endl;
+        serving = &server;
+        signal(SIGINT, handle_interrupt);
+        signal(SIGTERM, handle_interrupt);
+        server.serve();
+        serving = nullptr;
+    } catch (const std::exception &e) {
+        std::wcerr << L"Failed to serve device: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    broker::server_counters counters = server.counters();
+    std::wcerr << L"Made " << counters.transactions << L" captures for " << counters.requests << L" requests, and leased "
+        << L"the device " << counters.leases << L" times" << std::endl;
+    return EXIT_SUCCESS;
+}
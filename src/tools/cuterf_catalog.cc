@@ -0,0 +1,147 @@
+#include <filesystem>
+#include <cuterf.h>
+#include "common.h"
+
+using namespace cuterf;
+
+// Parses "YYYY-MM-DD" or "YYYY-MM-DDTHH:MM:SS" in local time. A date alone means the start
+// of the day, or with `end_of_day`, its last second.
+static bool parse_time_option(const wchar_t *text, bool end_of_day, std::chrono::system_clock::time_point &timestamp)
+{
+    struct tm timeinfo = {};
+    wchar_t separator = L'\0';
+    int fields = swscanf(text, L"%d-%d-%d%lc%d:%d:%d", &timeinfo.tm_year, &timeinfo.tm_mon, &timeinfo.tm_mday,
+        &separator, &timeinfo.tm_hour, &timeinfo.tm_min, &timeinfo.tm_sec);
+    if (fields == 3 && end_of_day) {
+        timeinfo.tm_hour = 23;
+        timeinfo.tm_min = 59;
+        timeinfo.tm_sec = 59;
+    } else if (fields != 3 && !(fields == 7 && separator == L'T')) {
+        return false;
+    }
+    timeinfo.tm_year -= 1900;
+    timeinfo.tm_mon -= 1;
+    timeinfo.tm_isdst = -1;
+    time_t seconds = mktime(&timeinfo);
+    if (seconds == (time_t)-1)
+        return false;
+    timestamp = std::chrono::system_clock::from_time_t(seconds);
+    return true;
+}
+
+int wmain(int argc, wchar_t** argv)
+{
+    bool show_usage = false;
+    int usage_status = EXIT_SUCCESS;
+    bool list = false, search = false;
+    unsigned long threads = 0;
+    catalog::query criteria;
+    std::wstring catalog_path;
+    std::vector<std::wstring> inputs;
+    for (size_t argn = 1; argn < (size_t)argc; argn++) {
+        if (!wcscmp(argv[argn], L"/?")) {
+            show_usage = true;
+            break;
+        } else if (!wcscmp(argv[argn], L"/list")) {
+            list = true;
+        } else if (!wcsncmp(argv[argn], L"/from:", 6) || !wcsncmp(argv[argn], L"/to:", 4)) {
+            bool from = argv[argn][1] == L'f';
+            if (!parse_time_option(&argv[argn][from ? 6 : 4], !from, from ? criteria.from : criteria.to)) {
+                std::wcerr << L"Time should be YYYY-MM-DD or YYYY-MM-DDTHH:MM:SS!" << std::endl;
+                show_usage = true;
+                usage_status = EXIT_FAILURE;
+                break;
+            }
+            search = true;
+        } else if (!wcsncmp(argv[argn], L"/freq:", 6)) {
+            if (!parse_frequency_range(&argv[argn][6], criteria.min_freq, criteria.max_freq)) {
+                std::wcerr << L"Frequency range should be LOW-HIGH, in Hz, kHz (k), MHz (M) or GHz (G)!" << std::endl;
+                show_usage = true;
+                usage_status = EXIT_FAILURE;
+                break;
+            }
+            search = true;
+        } else if (!wcsncmp(argv[argn], L"/device:", 8)) {
+            std::wstring device = &argv[argn][8];
+            criteria.device = std::string(device.begin(), device.end());
+            search = true;
+        } else if (!wcsncmp(argv[argn], L"/path:", 6)) {
+            criteria.path = &argv[argn][6];
+            search = true;
+        } else if (!wcsncmp(argv[argn], L"/threads:", 9)) {
+            wchar_t *szThreadsEnd;
+            threads = wcstoul(&argv[argn][9], &szThreadsEnd, 10);
+            if (*szThreadsEnd != L'\0' || threads == 0) {
+                std::wcerr << L"Thread count should be a positive number!" << std::endl;
+                show_usage = true;
+                usage_status = EXIT_FAILURE;
+                break;
+            }
+        } else if (wcscmp(argv[argn], L"/") && catalog_path.empty()) {
+            catalog_path = argv[argn];
+        } else if (wcscmp(argv[argn], L"/")) {
+            inputs.push_back(argv[argn]);
+        } else {
+            std::wcerr << L"Unrecognized argument '" << argv[argn] << "'!" << std::endl;
+            show_usage = true;
+            usage_status = EXIT_FAILURE;
+        }
+    }
+    if (!show_usage && (catalog_path.empty() || (inputs.empty() && !list && !search))) {
+        show_usage = true;
+        usage_status = EXIT_FAILURE;
+    }
+    if (show_usage) {
+        std::wcerr << L"Usage: cuterf_catalog.exe [options] filename.cat [file or directory...]" << std::endl;
+        std::wcerr << std::endl;
+        std::wcerr << L"Indexes screenshots (.png) and Touchstone files (.s1p, .s2p) in a catalog, creating" << std::endl;
+        std::wcerr << L"it if it does not exist, and searches the catalog. Directories are searched" << std::endl;
+        std::wcerr << L"recursively, and only new or changed files are read again." << std::endl;
+        std::wcerr << std::endl;
+        std::wcerr << L"Options:" << std::endl;
+        std::wcerr << "\t/?\t\tShow program usage." << std::endl;
+        std::wcerr << "\t/list\t\tList every capture in the catalog." << std::endl;
+        std::wcerr << "\t/from:TIME\tList captures made at or after TIME (YYYY-MM-DD[THH:MM:SS])." << std::endl;
+        std::wcerr << "\t/to:TIME\tList captures made at or before TIME." << std::endl;
+        std::wcerr << "\t/freq:LOW-HIGH\tList sweeps that overlap LOW to HIGH Hz (suffixes k, M, G)." << std::endl;
+        std::wcerr << "\t/device:TEXT\tList captures from a device whose name or firmware contains TEXT." << std::endl;
+        std::wcerr << "\t/path:TEXT\tList captures whose path contains TEXT." << std::endl;
+        std::wcerr << "\t/threads:N\tRead N files at a time (default: one per CPU)." << std::endl;
+        return usage_status;
+    }
+
+    int status = EXIT_SUCCESS;
+    catalog::database database;
+    try {
+        database.load(catalog_path);
+    } catch (const std::runtime_error &e) {
+        std::wcerr << L"Failed to read catalog '" << catalog_path << L"': " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (!inputs.empty()) {
+        catalog::update_stats stats = database.update(inputs, (unsigned)threads);
+        if (!database.save(catalog_path)) {
+            std::wcerr << L"Failed to write catalog '" << catalog_path << L"'!" << std::endl;
+            return EXIT_FAILURE;
+        }
+        std::wcerr << L"Found " << stats.files << L" files, indexed " << stats.indexed << L", removed "
+            << stats.removed << L"; catalog has " << database.size() << L" captures" << std::endl;
+        if (stats.failed != 0) {
+            std::wcerr << L"Failed to read " << stats.failed << L" files!" << std::endl;
+            status = EXIT_FAILURE;
+        }
+    }
+
+    if (list || search) {
+        for (const catalog::entry *capture : database.find(criteria)) {
+            printf("%s  %-14s", format_date_time(capture->created).c_str(), capture->device.c_str());
+            if (capture->ports != 0)
+                printf("  %u-port %5u points  %10u - %10u Hz", capture->ports, capture->points, capture->start, capture->stop);
+            else
+                printf("  %-45s", "");
+            printf("  %s\n", (const char *)std::filesystem::path(capture->path).u8string().c_str());
+        }
+    }
+    return status;
+}
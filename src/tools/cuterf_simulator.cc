@@ -0,0 +1,136 @@
+#include <csignal>
+#include <thread>
+#include <cuterf.h>
+#include "common.h"
+#include "pty_device.h"
+
+using namespace cuterf;
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void handle_interrupt(int)
+{
+    interrupted = 1;
+}
+
+int wmain(int argc, wchar_t** argv)
+{
+    bool show_usage = false;
+    int usage_status = EXIT_SUCCESS;
+    bool tinysa = false, has_scanraw = true;
+    unsigned long points = 0;
+    pty_device::link timing = { std::chrono::microseconds(0), 0 };
+    pty_device::script behaviour;
+    for (size_t argn = 1; argn < (size_t)argc; argn++) {
+        if (!wcscmp(argv[argn], L"/?")) {
+            show_usage = true;
+            break;
+        } else if (!wcscmp(argv[argn], L"/nanovna")) {
+            tinysa = false;
+        } else if (!wcscmp(argv[argn], L"/tinysa")) {
+            tinysa = true;
+        } else if (!wcscmp(argv[argn], L"/noscanraw")) {
+            has_scanraw = false;
+        } else if (!wcsncmp(argv[argn], L"/points:", 8)) {
+            wchar_t *szPointsEnd;
+            points = wcstoul(&argv[argn][8], &szPointsEnd, 10);
+            if (*szPointsEnd != L'\0' || !(points >= 2 && points <= 65535)) {
+                std::wcerr << L"Points should be 2 to 65535 inclusive!" << std::endl;
+                show_usage = true;
+                usage_status = EXIT_FAILURE;
+                break;
+            }
+        } else if (!wcsncmp(argv[argn], L"/latency:", 9)) {
+            wchar_t *szLatencyEnd;
+            unsigned long latency = wcstoul(&argv[argn][9], &szLatencyEnd, 10);
+            if (argv[argn][9] == L'\0' || *szLatencyEnd != L'\0') {
+                std::wcerr << L"Latency should be a number of microseconds!" << std::endl;
+                show_usage = true;
+                usage_status = EXIT_FAILURE;
+                break;
+            }
+            timing.latency = std::chrono::microseconds(latency);
+        } else if (!wcsncmp(argv[argn], L"/rate:", 6)) {
+            wchar_t *szRateEnd;
+            timing.bytes_per_second = wcstod(&argv[argn][6], &szRateEnd);
+            if (argv[argn][6] == L'\0' || *szRateEnd != L'\0' || !(timing.bytes_per_second >= 0)) {
+                std::wcerr << L"Rate should be a number of bytes per second!" << std::endl;
+                show_usage = true;
+                usage_status = EXIT_FAILURE;
+                break;
+            }
+        } else if (!wcsncmp(argv[argn], L"/delay:", 7)) {
+            const wchar_t *szCommand = &argv[argn][7], *szEquals = wcschr(szCommand, L'=');
+            wchar_t *szDelayEnd = nullptr;
+            unsigned long delay = 0;
+            if (szEquals != nullptr)
+                delay = wcstoul(szEquals + 1, &szDelayEnd, 10);
+            if (szEquals == nullptr || szEquals == szCommand || szEquals[1] == L'\0' || *szDelayEnd != L'\0') {
+                std::wcerr << L"Delay should be COMMAND=N, in milliseconds!" << std::endl;
+                show_usage = true;
+                usage_status = EXIT_FAILURE;
+                break;
+            }
+            behaviour.delays[std::string(szCommand, szEquals)] = std::chrono::milliseconds(delay);
+        } else if (!wcsncmp(argv[argn], L"/truncate:", 10)) {
+            wchar_t *szTruncateEnd;
+            behaviour.truncate_every = (unsigned)wcstoul(&argv[argn][10], &szTruncateEnd, 10);
+            if (argv[argn][10] == L'\0' || *szTruncateEnd != L'\0') {
+                std::wcerr << L"Truncation interval should be a number!" << std::endl;
+                show_usage = true;
+                usage_status = EXIT_FAILURE;
+                break;
+            }
+        } else {
+            std::wcerr << L"Unrecognized argument '" << argv[argn] << "'!" << std::endl;
+            show_usage = true;
+            usage_status = EXIT_FAILURE;
+        }
+    }
+    if (show_usage) {
+        std::wcerr << L"Usage: cuterf_simulator [options]" << std::endl;
+        std::wcerr << std::endl;
+        std::wcerr << L"Simulates NanoVNA-H 4 or tinySA Ultra firmware on a pseudo-terminal until" << std::endl;
+        std::wcerr << L"interrupted with Ctrl+C. The tools use it instead of connected devices when" << std::endl;
+        std::wcerr << L"its path is in the CUTERF_PORTS environment variable." << std::endl;
+        std::wcerr << std::endl;
+        std::wcerr << L"Options:" << std::endl;
+        std::wcerr << "\t/?\t\tShow program usage." << std::endl;
+        std::wcerr << "\t/nanovna\tSimulate a NanoVNA. Default." << std::endl;
+        std::wcerr << "\t/tinysa\t\tSimulate a TinySA." << std::endl;
+        std::wcerr << "\t/noscanraw\tSimulate TinySA firmware without the scanraw command." << std::endl;
+        std::wcerr << "\t/points:N\tSweep N points (default 101 for NanoVNA, 450 for TinySA)." << std::endl;
+        std::wcerr << "\t/latency:N\tDelay each exchange by N microseconds (full-speed USB: 1000)." << std::endl;
+        std::wcerr << "\t/rate:N\t\tSend at most N bytes per second (full-speed USB: 1000000)." << std::endl;
+        std::wcerr << "\t/delay:CMD=N\tSpend N milliseconds on command CMD before answering it." << std::endl;
+        std::wcerr << "\t/truncate:N\tCut every Nth response short before its prompt." << std::endl;
+        return usage_status;
+    }
+    if (points == 0)
+        points = tinysa ? 450 : 101;
+
+    signal(SIGINT, handle_interrupt);
+    try {
+        pty_device::handler respond;
+        if (tinysa)
+            respond = [=](const std::string &command) { return fake_tinysa(command, (unsigned)points, has_scanraw); };
+        else
+            respond = [=](const std::string &command) { return fake_nanovna(command, (unsigned)points); };
+        pty_device device(respond, timing, behaviour);
+        std::wcerr << L"Simulating " << (tinysa ? L"TinySA" : L"NanoVNA") << L" at '" << device.path() << L"'"
+            << std::endl;
+        std::wcerr << L"Run the tools with CUTERF_PORTS=" << device.path() << std::endl;
+        while (!interrupted)
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+        std::wcerr << L"Answered " << device.commands() << L" commands in " << device.round_trips()
+            << L" round trips";
+        if (behaviour.truncate_every != 0)
+            std::wcerr << L", cutting " << device.truncated() << L" short";
+        std::wcerr << std::endl;
+    } catch (const std::runtime_error &e) {
+        std::wcerr << L"Failed to start simulator: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
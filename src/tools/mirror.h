@@ -0,0 +1,102 @@
+#ifndef TOOLS_MIRROR_H
+#define TOOLS_MIRROR_H
+
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <cuterf.h>
+#include "pixmap.h"
+
+struct mirror_options
+{
+    unsigned scale;
+    unsigned interval_ms;  // shortest time between frames
+    unsigned long count;   // frames to record, or 0 to record until interrupted
+};
+
+struct mirror_counters
+{
+    unsigned long frames;  // frames written
+    unsigned long regions; // regions received
+    size_t bytes;          // bytes received, not counting the first screenshot
+    double seconds;
+};
+
+// Writes one frame of the sequence as `prefix`_NNNNN.png.
+inline bool save_mirror_frame(const rgb565_pixmap &pixmap, const std::wstring &prefix, unsigned long index,
+    unsigned scale, const std::string &source)
+{
+    wchar_t suffix[32];
+    swprintf(suffix, sizeof(suffix) / sizeof(suffix[0]), L"_%05lu.png", index);
+    std::wstring path = prefix + suffix;
+    if (!pixmap.save_to_png_file(path, scale, source, "", NULL, png_speed::fast)) {
+        std::wcerr << L"Failed to write frame to '" << path << L"'!" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Mirrors the screen of a NanoVNA or TinySA into a PNG sequence, starting from a screenshot
+// and then applying the regions the device redraws. A frame is written only if the screen
+// has changed, and at most once per `interval_ms`. Runs until `interrupted` is set or
+// `count` frames have been written.
+template<class Device>
+inline bool mirror_screen(Device &device, const std::wstring &prefix, const std::string &source,
+    const mirror_options &options, volatile sig_atomic_t &interrupted, mirror_counters &counters)
+{
+    typedef std::chrono::steady_clock clock;
+    // a region header is "bulk\r\n" or "fill\r\n" and four int16; a prompt line follows it
+    const size_t REGION_OVERHEAD = 6 + 8 + 6;
+
+    counters = mirror_counters();
+    clock::time_point start = clock::now();
+
+    size_t width, height;
+    std::string screen_data = device.capture_screenshot(width, height);
+    rgb565_pixmap pixmap(width, height);
+    pixmap.read_from_capture(screen_data);
+    if (!save_mirror_frame(pixmap, prefix, counters.frames++, options.scale, source))
+        return false;
+
+    const std::chrono::milliseconds interval(options.interval_ms);
+    clock::time_point last_frame = clock::now();
+    cuterf::screen_region region;
+    bool changed = false;
+    bool result = true;
+    device.start_mirroring();
+    while (!interrupted && (options.count == 0 || counters.frames < options.count)) {
+        if (device.read_screen_region(region, options.interval_ms < 50 ? options.interval_ms : 50)) {
+            counters.regions++;
+            counters.bytes += REGION_OVERHEAD + region.data.size();
+            if (pixmap.apply_region(region))
+                changed = true;
+        }
+        clock::time_point now = clock::now();
+        if (changed && now - last_frame >= interval) {
+            if (!save_mirror_frame(pixmap, prefix, counters.frames++, options.scale, source)) {
+                result = false;
+                break;
+            }
+            changed = false;
+            last_frame = now;
+        }
+    }
+    device.stop_mirroring();
+    counters.seconds = std::chrono::duration<double>(clock::now() - start).count();
+    return result;
+}
+
+inline void print_mirror_counters(const std::wstring &prefix, const mirror_counters &counters)
+{
+    std::wcerr << L"Wrote " << counters.frames << L" frames to '" << prefix << L"_*.png' in "
+        << std::fixed << std::setprecision(1) << counters.seconds << L" s ("
+        << counters.frames / counters.seconds << L" frames/s)" << std::endl;
+    if (counters.frames > 1)
+        std::wcerr << L"Received " << counters.regions << L" regions, "
+            << counters.bytes / 1024.0 / (counters.frames - 1) << L" KiB per frame" << std::endl;
+}
+
+#endif // TOOLS_MIRROR_H
@@ -0,0 +1,228 @@
+#include <algorithm>
+#include <filesystem>
+#include <cuterf.h>
+#include "common.h"
+
+using namespace cuterf;
+
+static bool read_file(const std::wstring &path, std::string &data)
+{
+    FILE *f = _wfopen(path.c_str(), L"rb");
+    if (!f)
+        return false;
+    data.clear();
+    char buffer[65536];
+    size_t count;
+    while ((count = fread(buffer, 1, sizeof(buffer), f)) != 0)
+        data.append(buffer, count);
+    bool result = !ferror(f);
+    fclose(f);
+    return result;
+}
+
+static std::wstring lowercase_extension(const std::filesystem::path &path)
+{
+    std::wstring extension = path.extension().wstring();
+    for (auto &c : extension)
+        c = towlower(c);
+    return extension;
+}
+
+// Sweeps are stamped with the time in their "Timestamp:" header line, which is what
+// nanovna_data and nanovna_screenshot write, and otherwise with the file modification time.
+static std::chrono::system_clock::time_point sweep_time(const std::vector<std::string> &comments,
+    const std::filesystem::path &path)
+{
+    for (auto &line : comments) {
+        struct tm timeinfo = {};
+        if (sscanf(line.c_str(), "Timestamp: %d-%d-%d %d:%d:%d", &timeinfo.tm_year, &timeinfo.tm_mon,
+                &timeinfo.tm_mday, &timeinfo.tm_hour, &timeinfo.tm_min, &timeinfo.tm_sec) == 6) {
+            timeinfo.tm_year -= 1900;
+            timeinfo.tm_mon -= 1;
+            timeinfo.tm_isdst = -1;
+            return std::chrono::system_clock::from_time_t(mktime(&timeinfo));
+        }
+    }
+    auto modified = std::filesystem::last_write_time(path);
+    return std::chrono::system_clock::now() + std::chrono::duration_cast<std::chrono::system_clock::duration>(
+        modified - std::filesystem::file_time_type::clock::now());
+}
+
+// Adds one Touchstone or PNG file to the archive; returns false and reports why if it cannot.
+static bool add_file(archive::writer &archive, const std::filesystem::path &path)
+{
+    std::wstring extension = lowercase_extension(path);
+    std::string text;
+    if (extension == L".png") {
+        if (!extract_touchstone_from_png_file(path.wstring(), text)) {
+            std::wcerr << L"Failed to extract Touchstone data from PNG image '" << path.wstring() << L"'!" << std::endl;
+            return false;
+        }
+    } else if (!read_file(path.wstring(), text)) {
+        std::wcerr << L"Failed to read '" << path.wstring() << L"'!" << std::endl;
+        return false;
+    }
+
+    try {
+        touchstone::document document = touchstone::parse(text);
+        archive.append(sweep_time(document.comments, path), document.comments, document.ports, document.points);
+    } catch (const std::runtime_error &e) {
+        std::wcerr << L"Failed to add '" << path.wstring() << L"': " << e.what() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Collects the files to add, searching directories recursively for Touchstone and PNG files
+// and sorting what is found, so that sweeps are archived in a predictable order.
+static void collect_files(const std::wstring &input, std::vector<std::filesystem::path> &files)
+{
+    std::filesystem::path path(input);
+    if (!std::filesystem::is_directory(path)) {
+        files.push_back(path);
+        return;
+    }
+    std::vector<std::filesystem::path> found;
+    for (auto &entry : std::filesystem::recursive_directory_iterator(path)) {
+        std::wstring extension = lowercase_extension(entry.path());
+        if (entry.is_regular_file() && (extension == L".s1p" || extension == L".s2p" || extension == L".png"))
+            found.push_back(entry.path());
+    }
+    std::sort(found.begin(), found.end());
+    files.insert(files.end(), found.begin(), found.end());
+}
+
+static int list_archive(const std::wstring &archive_path)
+{
+    archive::reader archive;
+    if (!archive.open(archive_path)) {
+        std::wcerr << L"Failed to open '" << archive_path << L"'!" << std::endl;
+        return EXIT_FAILURE;
+    }
+    for (size_t index = 0; index < archive.size(); index++) {
+        archive::sweep_view sweep = archive.sweep(index);
+        printf("%8zu  %s  %u-port %6zu points", index, format_date_time(sweep.timestamp).c_str(),
+            sweep.ports, sweep.points);
+        if (sweep.points != 0)
+            printf("  %10u - %10u Hz", sweep.freq[0], sweep.freq[sweep.points - 1]);
+        printf("\n");
+    }
+    return EXIT_SUCCESS;
+}
+
+static int extract_sweep(const std::wstring &archive_path, size_t index)
+{
+    archive::reader archive;
+    if (!archive.open(archive_path)) {
+        std::wcerr << L"Failed to open '" << archive_path << L"'!" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (index >= archive.size()) {
+        std::wcerr << L"Archive has only " << archive.size() << L" sweeps!" << std::endl;
+        return EXIT_FAILURE;
+    }
+    archive::sweep_view sweep = archive.sweep(index);
+    touchstone::file_sink output(stdout);
+    touchstone::writer writer(output, sweep.ports);
+    writer.header(sweep.header_lines());
+    for (size_t point = 0; point < sweep.points; point++)
+        writer.point(sweep.point(point));
+    writer.flush();
+    return fflush(stdout) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int wmain(int argc, wchar_t** argv)
+{
+    bool show_usage = false;
+    int usage_status = EXIT_SUCCESS;
+    bool list = false, extract = false;
+    unsigned long extract_index = 0;
+    std::wstring archive_path;
+    std::vector<std::wstring> inputs;
+    for (size_t argn = 1; argn < (size_t)argc; argn++) {
+        if (!wcscmp(argv[argn], L"/?")) {
+            show_usage = true;
+            break;
+        } else if (!wcscmp(argv[argn], L"/list")) {
+            list = true;
+        } else if (!wcsncmp(argv[argn], L"/extract:", 9)) {
+            wchar_t *szIndexEnd;
+            extract = true;
+            extract_index = wcstoul(&argv[argn][9], &szIndexEnd, 10);
+            if (argv[argn][9] == L'\0' || *szIndexEnd != L'\0') {
+                std::wcerr << L"Sweep index should be a number!" << std::endl;
+                show_usage = true;
+                usage_status = EXIT_FAILURE;
+                break;
+            }
+        } else if (wcscmp(argv[argn], L"/") && archive_path.empty()) {
+            archive_path = argv[argn];
+        } else if (wcscmp(argv[argn], L"/")) {
+            inputs.push_back(argv[argn]);
+        } else {
+            std::wcerr << L"Unrecognized argument '" << argv[argn] << "'!" << std::endl;
+            show_usage = true;
+            usage_status = EXIT_FAILURE;
+        }
+    }
+    if (!show_usage && (archive_path.empty() || (inputs.empty() && !list && !extract))) {
+        show_usage = true;
+        usage_status = EXIT_FAILURE;
+    }
+    if (show_usage) {
+        std::wcerr << L"Usage: nanovna_archive.exe [options] filename.cra [file or directory...]" << std::endl;
+        std::wcerr << std::endl;
+        std::wcerr << L"Adds Touchstone files (.s1p, .s2p) and screenshots with embedded Touchstone data" << std::endl;
+        std::wcerr << L"(.png) to a sweep archive, creating it if it does not exist. Directories are" << std::endl;
+        std::wcerr << L"searched recursively." << std::endl;
+        std::wcerr << std::endl;
+        std::wcerr << L"Options:" << std::endl;
+        std::wcerr << "\t/?\t\tShow program usage." << std::endl;
+        std::wcerr << "\t/list\t\tList the sweeps in the archive." << std::endl;
+        std::wcerr << "\t/extract:N\tWrite sweep N of the archive to standard output as Touchstone." << std::endl;
+        return usage_status;
+    }
+
+    int status = EXIT_SUCCESS;
+    if (!inputs.empty()) {
+        std::vector<std::filesystem::path> files;
+        try {
+            for (auto &input : inputs)
+                collect_files(input, files);
+        } catch (const std::filesystem::filesystem_error &e) {
+            std::wcerr << L"Failed to search for files: " << e.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        size_t added = 0;
+        try {
+            archive::writer archive;
+            if (!archive.open(archive_path)) {
+                std::wcerr << L"Failed to open '" << archive_path << L"' for writing!" << std::endl;
+                return EXIT_FAILURE;
+            }
+            for (auto &file : files) {
+                if (add_file(archive, file))
+                    added++;
+                else
+                    status = EXIT_FAILURE;
+            }
+            archive.close();
+        } catch (const std::runtime_error &e) {
+            std::wcerr << L"Failed to write archive '" << archive_path << L"': " << e.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+        std::wcerr << L"Added " << added << L" of " << files.size() << L" files to '" << archive_path << L"'" << std::endl;
+    }
+
+    try {
+        if (list && list_archive(archive_path) != EXIT_SUCCESS)
+            status = EXIT_FAILURE;
+        if (extract && extract_sweep(archive_path, extract_index) != EXIT_SUCCESS)
+            status = EXIT_FAILURE;
+    } catch (const std::runtime_error &e) {
+        std::wcerr << L"Failed to read archive '" << archive_path << L"': " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    return status;
+}
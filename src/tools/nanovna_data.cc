@@ -13,22 +13,170 @@ bool save_touchstone_to_file(const std::wstring &path, const std::string &touchs
     return true;
 }
 
+// Creates the file on the first write, so that a failed capture leaves no empty file behind.
+class lazy_file_sink : public touchstone::sink
+{
+private:
+    std::wstring m_path;
+    FILE *m_file;
+    bool m_failed;
+
+public:
+    explicit lazy_file_sink(const std::wstring &path) : m_path(path), m_file(NULL), m_failed(false)
+    {}
+
+    ~lazy_file_sink()
+    {
+        close();
+    }
+
+    void write(const char *data, size_t size) override
+    {
+        if (m_file == NULL && !m_failed)
+            m_file = _wfopen(m_path.c_str(), L"wt");
+        if (m_file == NULL || fwrite(data, 1, size, m_file) != size)
+            m_failed = true;
+    }
+
+    bool close()
+    {
+        if (m_file != NULL && fclose(m_file) != 0)
+            m_failed = true;
+        m_file = NULL;
+        return !m_failed;
+    }
+};
+
+// Captures from every connected NanoVNA in parallel, saving to `output_path` with the
+// 1-based device index (in order of port path) inserted before the extension.
+int capture_all(const std::wstring &output_path, unsigned ports, nanovna::transfer mode)
+{
+    std::vector<device_info> nanovnas;
+    for (auto &info : enumerate_devices()) {
+        if (info.is_nanovna())
+            nanovnas.push_back(info);
+    }
+    if (nanovnas.empty()) {
+        std::wcerr << L"Cannot find a connected NanoVNA!" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    fleet devices(nanovnas);
+    devices.open();
+    auto results = devices.capture_touchstone(ports, mode);
+
+    size_t ext_pos = output_path.rfind(L'.');
+    int status = EXIT_SUCCESS;
+    for (size_t index = 0; index < results.size(); index++) {
+        const device_info &info = devices.devices()[index];
+        std::wstring path = output_path.substr(0, ext_pos) + L"_" + std::to_wstring(index + 1) + 
+            (ext_pos == std::wstring::npos ? L"" : output_path.substr(ext_pos));
+        if (!info.error.empty() || !results[index].ok()) {
+            std::wcerr << L"Failed to read data from NanoVNA at '" << info.path << L"': " 
+                << (info.error.empty() ? results[index].error : info.error).c_str() << std::endl;
+            status = EXIT_FAILURE;
+        } else if (!save_touchstone_to_file(path, results[index].value)) {
+            std::wcerr << L"Failed to write Touchstone data to '" << path << L"'!" << std::endl;
+            status = EXIT_FAILURE;
+        } else {
+            std::wcerr << L"Saved Touchstone data from '" << info.path << L"' to '" << path << L"'" << std::endl;
+        }
+    }
+    return status;
+}
+
+// Sweeps `points` points from `start` to `stop` Hz in segments and writes them as Touchstone.
+int capture_segmented(const std::wstring &output_path, unsigned ports, uint32_t start, uint32_t stop,
+    unsigned long points, unsigned long segment_points, unsigned long overlap, bool show_stats)
+{
+    lazy_file_sink output(output_path);
+    nanovna::segment_stats stats;
+    try {
+        nanovna::device device;
+        device.enable_stats(show_stats);
+        if (!device.open()) {
+            std::wcerr << L"Cannot find a connected NanoVNA!" << std::endl;
+            return EXIT_FAILURE;
+        }
+        std::wcerr << "Found NanoVNA at '" << device.path() << L"'" << std::endl;
+        std::vector<std::string> header = device.capture_header();
+        std::vector<nanovna::point> data = device.capture_segmented(start, stop, points, ports,
+            segment_points, overlap, &stats);
+
+        touchstone::writer writer(output, ports);
+        writer.header(header);
+        writer.points(data);
+        writer.flush();
+        if (show_stats)
+            print_command_stats(device.stats());
+    } catch (const std::exception &e) {
+        std::wcerr << L"Failed to read data from NanoVNA: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (!output.close()) {
+        std::wcerr << L"Failed to write Touchstone data to '" << output_path << L"'!" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::wcerr << L"Saved " << points << L" points to '" << output_path << L"'" << std::endl;
+    std::wcerr << L"Swept " << stats.segments << L" segments in " << std::fixed << std::setprecision(2)
+        << stats.seconds << L" s (" << std::setprecision(0) << points / stats.seconds << L" points/s, "
+        << std::setprecision(1) << stats.seconds * 1e3 / stats.segments << L" ms per segment)" << std::endl;
+    if (overlap != 0)
+        std::wcerr << L"Largest difference between overlapping points: " << std::setprecision(4)
+            << stats.max_seam_error << std::endl;
+    return EXIT_SUCCESS;
+}
+
 int wmain(int argc, wchar_t** argv) 
 {
     bool show_usage = false;
     int usage_status = EXIT_SUCCESS;
     std::wstring output_path;
     unsigned ports = 0;
+    nanovna::transfer mode = nanovna::transfer::binary;
+    bool all = false;
+    bool stats = false;
+    uint32_t span_start = 0, span_stop = 0;
+    unsigned long points = 0, segment_points = 401, overlap = 0;
     for (size_t argn = 1; argn < (size_t)argc; argn++) {
         if (!wcscmp(argv[argn], L"/?")) {
             show_usage = true;
             break;
         } else if (!wcscmp(argv[argn], L"/s1p")) {
             ports = 1;
-            break;
         } else if (!wcscmp(argv[argn], L"/s2p")) {
             ports = 2;
-            break;
+        } else if (!wcscmp(argv[argn], L"/text")) {
+            mode = nanovna::transfer::text;
+        } else if (!wcscmp(argv[argn], L"/all")) {
+            all = true;
+        } else if (!wcsncmp(argv[argn], L"/span:", 6)) {
+            if (!parse_frequency_range(&argv[argn][6], span_start, span_stop) || span_start == span_stop) {
+                std::wcerr << L"Span should be START-STOP, in Hz, kHz (k), MHz (M) or GHz (G)!" << std::endl;
+                show_usage = true;
+                usage_status = EXIT_FAILURE;
+                break;
+            }
+        } else if (!wcsncmp(argv[argn], L"/points:", 8) || !wcsncmp(argv[argn], L"/segment:", 9) ||
+                !wcsncmp(argv[argn], L"/overlap:", 9)) {
+            wchar_t *szValue = wcschr(argv[argn], L':') + 1, *szValueEnd;
+            unsigned long value = wcstoul(szValue, &szValueEnd, 10);
+            if (*szValueEnd != L'\0' || *szValue == L'\0') {
+                std::wcerr << L"Point counts should be numbers!" << std::endl;
+                show_usage = true;
+                usage_status = EXIT_FAILURE;
+                break;
+            }
+            if (argv[argn][1] == L'p')
+                points = value;
+            else if (argv[argn][1] == L's')
+                segment_points = value;
+            else
+                overlap = value;
+        } else if (!wcscmp(argv[argn], L"/stats")) {
+            stats = true;
         } else if (wcscmp(argv[argn], L"/") && output_path.empty()) {
             output_path = argv[argn];
         } else {
@@ -40,15 +188,37 @@ int wmain(int argc, wchar_t** argv)
     if (show_usage) {
         std::wcerr << L"Usage: nanovna_data.exe [options] [filename.s1p,s2p]" << std::endl;
         std::wcerr << std::endl;
-        std::wcerr << L"Writes a capture of the data displayed on screen to a Touchstone format file," << std::endl;
-        std::wcerr << L"without initiating a sweep." << std::endl;
+        std::wcerr << L"Sweeps the span displayed on screen and writes the captured data to a Touchstone" << std::endl;
+        std::wcerr << L"format file." << std::endl;
         std::wcerr << std::endl;
         std::wcerr << L"Options:" << std::endl;
         std::wcerr << "\t/?\t\tShow program usage." << std::endl;
         std::wcerr << "\t/s1p\t\tSave measurements of 1-port network." << std::endl;
         std::wcerr << "\t/s2p\t\tSave measurements of 2-port network. Default if no filename given." << std::endl;
+        std::wcerr << "\t/text\t\tRead the data displayed on screen as text, without initiating a sweep." << std::endl;
+        std::wcerr << "\t/all\t\tCapture from every connected NanoVNA in parallel, appending _1, _2, ..." << std::endl;
+        std::wcerr << "\t\t\tto the file name in order of port name." << std::endl;
+        std::wcerr << "\t/span:START-STOP\tSweep from START to STOP Hz (suffixes k, M, G) instead of the" << std::endl;
+        std::wcerr << "\t\t\tspan on screen. Requires /points." << std::endl;
+        std::wcerr << "\t/points:N\tSweep N points, in as many segments as needed. Requires /span." << std::endl;
+        std::wcerr << "\t/segment:N\tSweep at most N points per segment (default 401)." << std::endl;
+        std::wcerr << "\t/overlap:N\tRepeat N points of the previous segment at the start of each" << std::endl;
+        std::wcerr << "\t\t\tsegment, and discard them (default 0)." << std::endl;
+        std::wcerr << "\t/stats\t\tPrint the latency and transfer statistics of each command." << std::endl;
         return usage_status;
     }
+    if ((points == 0) != (span_stop == 0)) {
+        std::wcerr << L"Specify both /span and /points for a segmented sweep!" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (points != 0 && (all || mode == nanovna::transfer::text)) {
+        std::wcerr << L"A segmented sweep cannot be combined with /all or /text!" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (stats && all) {
+        std::wcerr << L"Statistics cannot be collected with /all!" << std::endl;
+        return EXIT_FAILURE;
+    }
     if (output_path.empty()) {
         output_path = L"NanoVNA_Data_" + current_date_time_for_filename();
         if (ports == 1)
@@ -68,21 +238,36 @@ int wmain(int argc, wchar_t** argv)
         }
     }
 
-    std::string touchstone;
+    if (points != 0)
+        return capture_segmented(output_path, ports, span_start, span_stop, points, segment_points, overlap, stats);
+
+    if (all) {
+        try {
+            return capture_all(output_path, ports, mode);
+        } catch (const std::runtime_error &e) {
+            std::wcerr << L"Failed to read data from NanoVNA: " << e.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    lazy_file_sink touchstone(output_path);
     try {
         nanovna::device device;
+        device.enable_stats(stats);
         if (!device.open()) {
             std::wcerr << L"Cannot find a connected NanoVNA!" << std::endl;
             return EXIT_FAILURE;
         }
         std::wcerr << "Found NanoVNA at '" << device.path() << L"'" << std::endl;
-        touchstone = device.capture_touchstone(ports);
+        device.capture_touchstone(touchstone, ports, mode);
+        if (stats)
+            print_command_stats(device.stats());
     } catch (const std::runtime_error &e) {
         std::wcerr << L"Failed to read data from NanoVNA: " << e.what() << std::endl;
         return EXIT_FAILURE;
     }
 
-    if (!save_touchstone_to_file(output_path, touchstone)) {
+    if (!touchstone.close()) {
         std::wcerr << L"Failed to write Touchstone data to '" << output_path << L"'!" << std::endl;
         return EXIT_FAILURE;
     }
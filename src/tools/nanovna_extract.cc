@@ -1,71 +1,112 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstdint>
+#include <filesystem>
 #include <iostream>
-#include <png.h>
+#include <thread>
+#include "common.h"
 
-bool extract_touchstone_from_png_file(const std::wstring &path, std::string &touchstone)
+bool save_touchstone_to_file(const std::wstring &path, const std::string &touchstone)
 {
-    FILE *file = NULL;
-    png_structp png = NULL;
-    png_infop info = NULL;
-    bool result = false;
-    
-    file = _wfopen(path.c_str(), L"rb");
-    if (!file) 
-        goto done;
-
-    png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-    if (png == NULL)
-        goto done;
-
-    info = png_create_info_struct(png);
-    if (info == NULL)
-        goto done;
+    FILE *f = _wfopen(path.c_str(), L"wt");
+    if (!f)
+        return false;
+    bool written = fwrite(touchstone.data(), 1, touchstone.length(), f) == touchstone.length();
+    return fclose(f) == 0 && written;
+}
 
-    if (setjmp(png_jmpbuf(png)))
-        goto done;
-    
-    png_init_io(png, file);
-    png_read_png(png, info, PNG_TRANSFORM_IDENTITY, 0);
+static std::wstring touchstone_path_for(const std::wstring &image_path)
+{
+    size_t pos = image_path.rfind(L'.');
+    if (pos == std::string::npos)
+        return image_path + L".s2p";
+    return image_path.substr(0, pos) + L".s2p";
+}
 
-    png_textp texts;
-    size_t text_count = png_get_text(png, info, &texts, NULL);
-    for (size_t idx = 0; idx < text_count; idx++) {
-        if (!strcmp(texts[idx].key, "Touchstone")) {
-            touchstone = std::string(texts[idx].text, texts[idx].text_length);
-            result = true;
-            break;
+// Extracts every PNG file under `input_dir` on `threads` threads, writing each Touchstone file
+// to the same relative path under `output_dir`.
+static int extract_directory(const std::filesystem::path &input_dir, const std::filesystem::path &output_dir,
+    unsigned threads)
+{
+    std::vector<std::filesystem::path> images;
+    try {
+        for (auto &entry : std::filesystem::recursive_directory_iterator(input_dir)) {
+            std::wstring extension = entry.path().extension().wstring();
+            for (auto &c : extension)
+                c = towlower(c);
+            if (entry.is_regular_file() && extension == L".png")
+                images.push_back(entry.path());
         }
+        std::sort(images.begin(), images.end());
+        for (auto &image : images)
+            std::filesystem::create_directories((output_dir / image.lexically_relative(input_dir)).parent_path());
+    } catch (const std::filesystem::filesystem_error &e) {
+        std::wcerr << L"Failed to search for files: " << e.what() << std::endl;
+        return EXIT_FAILURE;
     }
 
-done:
-    if (png != NULL)
-        png_destroy_read_struct(&png, &info, NULL);
-    if (file != NULL)
-        fclose(file);
-    return result;
-}
+    // errors are reported afterwards, in order, rather than interleaved
+    std::vector<std::wstring> errors(images.size());
+    std::atomic<size_t> next(0);
+    auto work = [&] {
+        std::string touchstone;
+        size_t index;
+        while ((index = next++) < images.size()) {
+            std::wstring image_path = images[index].wstring();
+            std::wstring touchstone_path = touchstone_path_for(
+                (output_dir / images[index].lexically_relative(input_dir)).wstring());
+            if (!extract_touchstone_from_png_file(image_path, touchstone))
+                errors[index] = L"Failed to extract Touchstone data from PNG image '" + image_path + L"'!";
+            else if (!save_touchstone_to_file(touchstone_path, touchstone))
+                errors[index] = L"Failed to write Touchstone data to '" + touchstone_path + L"'!";
+        }
+    };
 
-bool save_touchstone_to_file(const std::wstring &path, const std::string &touchstone)
-{
-    FILE *f = _wfopen(path.c_str(), L"wt");
-    if (!f)
-        return false;
-    fwrite(touchstone.c_str(), 1, touchstone.length(), f);
-    fclose(f);
-    return true;
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (unsigned idx = 1; idx < threads; idx++)
+        workers.emplace_back(work);
+    work();
+    for (auto &worker : workers)
+        worker.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    size_t extracted = 0;
+    for (auto &error : errors) {
+        if (error.empty())
+            extracted++;
+        else
+            std::wcerr << error << std::endl;
+    }
+    std::wcerr << L"Extracted Touchstone data from " << extracted << L" of " << images.size()
+        << L" PNG images in " << std::fixed << std::setprecision(2) << seconds << L" s" << std::endl;
+    return extracted == images.size() ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
-int wmain(int argc, wchar_t** argv) 
+int wmain(int argc, wchar_t** argv)
 {
     bool show_usage = false;
     int usage_status = EXIT_SUCCESS;
     std::wstring image_path, touchstone_path;
+    unsigned long threads = std::max(1u, std::thread::hardware_concurrency());
     for (size_t argn = 1; argn < (size_t)argc; argn++) {
         if (!wcscmp(argv[argn], L"/?")) {
             show_usage = true;
             break;
+        } else if (!wcsncmp(argv[argn], L"/threads:", 9)) {
+            wchar_t *szThreadsEnd;
+            threads = wcstoul(&argv[argn][9], &szThreadsEnd, 10);
+            if (*szThreadsEnd != L'\0' || threads == 0) {
+                std::wcerr << L"Thread count should be a positive number!" << std::endl;
+                show_usage = true;
+                usage_status = EXIT_FAILURE;
+                break;
+            }
         } else if (wcscmp(argv[argn], L"/") && image_path.empty()) {
             image_path = argv[argn];
+        } else if (wcscmp(argv[argn], L"/") && touchstone_path.empty()) {
+            touchstone_path = argv[argn];
         } else {
             std::wcerr << L"Unrecognized argument '" << argv[argn] << "'!" << std::endl;
             show_usage = true;
@@ -78,21 +119,26 @@ int wmain(int argc, wchar_t** argv)
     }
     if (show_usage) {
         std::wcerr << L"Usage: nanovna_extract.exe [options] [filename.png] [filename.s2p]" << std::endl;
+        std::wcerr << L"       nanovna_extract.exe [options] [directory] [output directory]" << std::endl;
         std::wcerr << std::endl;
         std::wcerr << L"Extracts Touchstone data from a PNG file. The Touchstone file name may be" << std::endl;
         std::wcerr << L"omitted." << std::endl;
         std::wcerr << std::endl;
+        std::wcerr << L"Given a directory, extracts Touchstone data from every PNG file in it and its" << std::endl;
+        std::wcerr << L"subdirectories, writing each to the same relative path in the output directory," << std::endl;
+        std::wcerr << L"or next to the PNG file if it is omitted." << std::endl;
+        std::wcerr << std::endl;
         std::wcerr << L"Options:" << std::endl;
         std::wcerr << "\t/?\t\tShow program usage." << std::endl;
+        std::wcerr << "\t/threads:N\tExtract N files at a time from a directory (default: one per CPU)." << std::endl;
         return usage_status;
     }
-    if (touchstone_path.empty()) {
-        size_t pos = image_path.rfind(L'.');
-        if (pos == std::string::npos)
-            touchstone_path = image_path + L".s2p";
-        else
-            touchstone_path = image_path.substr(0, pos) + L".s2p";
-    }
+
+    if (std::filesystem::is_directory(image_path))
+        return extract_directory(image_path, touchstone_path.empty() ? image_path : touchstone_path, (unsigned)threads);
+
+    if (touchstone_path.empty())
+        touchstone_path = touchstone_path_for(image_path);
 
     std::string touchstone;
     if (!extract_touchstone_from_png_file(image_path, touchstone)) {
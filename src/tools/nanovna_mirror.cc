@@ -0,0 +1,108 @@
+#include <csignal>
+#include <cuterf.h>
+#include "common.h"
+#include "mirror.h"
+
+using namespace cuterf;
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void handle_interrupt(int)
+{
+    interrupted = 1;
+}
+
+int wmain(int argc, wchar_t** argv)
+{
+    bool show_usage = false;
+    bool stats = false;
+    int usage_status = EXIT_SUCCESS;
+    std::wstring prefix;
+    mirror_options options = { 1, 100, 0 };
+    for (size_t argn = 1; argn < (size_t)argc; argn++) {
+        if (!wcscmp(argv[argn], L"/?")) {
+            show_usage = true;
+            break;
+        } else if (!wcsncmp(argv[argn], L"/scale:", 7) || !wcsncmp(argv[argn], L"/x", 2)) {
+            wchar_t *szScale, *szScaleEnd;
+            if (argv[argn][2] == 's')
+                szScale = &argv[argn][7];
+            else
+                szScale = &argv[argn][2];
+            long scale = wcstol(szScale, &szScaleEnd, 10);
+            if (*szScaleEnd != L'\0' || !(scale >= 1 && scale <= 4)) {
+                std::wcerr << L"Scale should be 1 to 4 inclusive!" << std::endl;
+                show_usage = true;
+                usage_status = EXIT_FAILURE;
+                break;
+            }
+            options.scale = (unsigned)scale;
+        } else if (!wcsncmp(argv[argn], L"/interval:", 10)) {
+            wchar_t *szIntervalEnd;
+            options.interval_ms = (unsigned)wcstoul(&argv[argn][10], &szIntervalEnd, 10);
+            if (argv[argn][10] == L'\0' || *szIntervalEnd != L'\0') {
+                std::wcerr << L"Frame interval should be a number!" << std::endl;
+                show_usage = true;
+                usage_status = EXIT_FAILURE;
+                break;
+            }
+        } else if (!wcsncmp(argv[argn], L"/count:", 7)) {
+            wchar_t *szCountEnd;
+            options.count = wcstoul(&argv[argn][7], &szCountEnd, 10);
+            if (*szCountEnd != L'\0') {
+                std::wcerr << L"Frame count should be a number!" << std::endl;
+                show_usage = true;
+                usage_status = EXIT_FAILURE;
+                break;
+            }
+        } else if (!wcscmp(argv[argn], L"/stats")) {
+            stats = true;
+        } else if (wcscmp(argv[argn], L"/") && prefix.empty()) {
+            prefix = argv[argn];
+        } else {
+            std::wcerr << L"Unrecognized argument '" << argv[argn] << "'!" << std::endl;
+            show_usage = true;
+            usage_status = EXIT_FAILURE;
+        }
+    }
+    if (show_usage) {
+        std::wcerr << L"Usage: nanovna_mirror.exe [options] [prefix]" << std::endl;
+        std::wcerr << std::endl;
+        std::wcerr << L"Mirrors the screen until interrupted with Ctrl+C, writing each frame in which" << std::endl;
+        std::wcerr << L"the screen changed to prefix_00000.png, prefix_00001.png, ..." << std::endl;
+        std::wcerr << std::endl;
+        std::wcerr << L"Options:" << std::endl;
+        std::wcerr << "\t/?\t\tShow program usage." << std::endl;
+        std::wcerr << "\t/scale:N, /xN\tEnlarge frames by factor of N (1 <= N <= 4)." << std::endl;
+        std::wcerr << "\t/interval:N\tWrite a frame at most every N milliseconds (default 100)." << std::endl;
+        std::wcerr << "\t/count:N\tStop after N frames." << std::endl;
+        std::wcerr << "\t/stats\t\tPrint the latency and transfer statistics of each command." << std::endl;
+        return usage_status;
+    }
+    if (prefix.empty())
+        prefix = L"NanoVNA_Mirror_" + current_date_time_for_filename();
+
+    signal(SIGINT, handle_interrupt);
+
+    mirror_counters counters = {};
+    bool written;
+    try {
+        nanovna::device device;
+        device.enable_stats(stats);
+        if (!device.open()) {
+            std::wcerr << L"Cannot find a connected NanoVNA!" << std::endl;
+            return EXIT_FAILURE;
+        }
+        std::wcerr << "Found NanoVNA at '" << device.path() << L"'" << std::endl;
+        std::string source = device.board_name() + " (firmware " + device.firmware_info() + ")";
+        written = mirror_screen(device, prefix, source, options, interrupted, counters);
+        if (stats)
+            print_command_stats(device.stats());
+    } catch (const std::runtime_error &e) {
+        std::wcerr << L"Failed to mirror screen of NanoVNA: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    print_mirror_counters(prefix, counters);
+    return written ? EXIT_SUCCESS : EXIT_FAILURE;
+}
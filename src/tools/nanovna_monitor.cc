@@ -0,0 +1,141 @@
+#include <csignal>
+#include <cuterf.h>
+#include "common.h"
+
+using namespace cuterf;
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void handle_interrupt(int)
+{
+    interrupted = 1;
+}
+
+static bool write_sweep(FILE *f, touchstone::writer &writer, const nanovna::sweep &frame)
+{
+    writer.comment("Sweep " + std::to_string(frame.sequence) + " at " + format_date_time(frame.timestamp, true));
+    writer.points(frame.points);
+    writer.flush();
+    return !ferror(f);
+}
+
+int wmain(int argc, wchar_t** argv)
+{
+    bool show_usage = false;
+    bool stats = false;
+    int usage_status = EXIT_SUCCESS;
+    std::wstring output_path;
+    unsigned ports = 2;
+    unsigned long count = 0, capacity = 64;
+    for (size_t argn = 1; argn < (size_t)argc; argn++) {
+        if (!wcscmp(argv[argn], L"/?")) {
+            show_usage = true;
+            break;
+        } else if (!wcscmp(argv[argn], L"/s1p")) {
+            ports = 1;
+        } else if (!wcscmp(argv[argn], L"/s2p")) {
+            ports = 2;
+        } else if (!wcsncmp(argv[argn], L"/count:", 7)) {
+            wchar_t *szCountEnd;
+            count = wcstoul(&argv[argn][7], &szCountEnd, 10);
+            if (*szCountEnd != L'\0') {
+                std::wcerr << L"Sweep count should be a number!" << std::endl;
+                show_usage = true;
+                usage_status = EXIT_FAILURE;
+                break;
+            }
+        } else if (!wcsncmp(argv[argn], L"/buffer:", 8)) {
+            wchar_t *szCapacityEnd;
+            capacity = wcstoul(&argv[argn][8], &szCapacityEnd, 10);
+            if (*szCapacityEnd != L'\0' || capacity == 0) {
+                std::wcerr << L"Buffer size should be a positive number!" << std::endl;
+                show_usage = true;
+                usage_status = EXIT_FAILURE;
+                break;
+            }
+        } else if (!wcscmp(argv[argn], L"/stats")) {
+            stats = true;
+        } else if (wcscmp(argv[argn], L"/") && output_path.empty()) {
+            output_path = argv[argn];
+        } else {
+            std::wcerr << L"Unrecognized argument '" << argv[argn] << "'!" << std::endl;
+            show_usage = true;
+            usage_status = EXIT_FAILURE;
+        }
+    }
+    if (show_usage) {
+        std::wcerr << L"Usage: nanovna_monitor.exe [options] [filename.log]" << std::endl;
+        std::wcerr << std::endl;
+        std::wcerr << L"Sweeps the span displayed on screen continuously and logs every sweep to a file" << std::endl;
+        std::wcerr << L"until interrupted with Ctrl+C. Each sweep is written as a \"! Sweep\" comment" << std::endl;
+        std::wcerr << L"line followed by Touchstone data lines." << std::endl;
+        std::wcerr << std::endl;
+        std::wcerr << L"Options:" << std::endl;
+        std::wcerr << "\t/?\t\tShow program usage." << std::endl;
+        std::wcerr << "\t/s1p\t\tLog measurements of 1-port network." << std::endl;
+        std::wcerr << "\t/s2p\t\tLog measurements of 2-port network. Default." << std::endl;
+        std::wcerr << "\t/count:N\tStop after N sweeps." << std::endl;
+        std::wcerr << "\t/buffer:N\tQueue up to N sweeps in memory while writing (default 64)." << std::endl;
+        std::wcerr << "\t/stats\t\tPrint the latency and transfer statistics of each command." << std::endl;
+        return usage_status;
+    }
+    if (output_path.empty())
+        output_path = L"NanoVNA_Monitor_" + current_date_time_for_filename() + L".log";
+
+    FILE *f = _wfopen(output_path.c_str(), L"wb");
+    if (!f) {
+        std::wcerr << L"Failed to open '" << output_path << L"' for writing!" << std::endl;
+        return EXIT_FAILURE;
+    }
+    setvbuf(f, NULL, _IOFBF, 1 << 20);
+
+    signal(SIGINT, handle_interrupt);
+
+    nanovna::stream_counters counters = {};
+    uint64_t written = 0;
+    bool write_failed = false;
+    try {
+        nanovna::device device;
+        device.enable_stats(stats);
+        if (!device.open()) {
+            std::wcerr << L"Cannot find a connected NanoVNA!" << std::endl;
+            fclose(f);
+            return EXIT_FAILURE;
+        }
+        std::wcerr << "Found NanoVNA at '" << device.path() << L"'" << std::endl;
+        touchstone::file_sink output(f);
+        touchstone::writer writer(output, ports);
+        writer.header(device.capture_header());
+        writer.flush();
+
+        device.start_streaming(ports, capacity);
+        nanovna::sweep frame;
+        while (!interrupted && (count == 0 || written < count)) {
+            if (!device.read_sweep(frame, 500))
+                continue;
+            if (!write_sweep(f, writer, frame)) {
+                write_failed = true;
+                break;
+            }
+            written++;
+        }
+        counters = device.stream_stats();
+        device.stop_streaming();
+        if (stats)
+            print_command_stats(device.stats());
+    } catch (const std::runtime_error &e) {
+        std::wcerr << L"Failed to read data from NanoVNA: " << e.what() << std::endl;
+        fclose(f);
+        return EXIT_FAILURE;
+    }
+
+    if (fclose(f) != 0 || write_failed) {
+        std::wcerr << L"Failed to write sweeps to '" << output_path << L"'!" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::wcerr << L"Logged " << written << L" sweeps to '" << output_path << L"'" << std::endl;
+    if (counters.overruns != 0)
+        std::wcerr << L"Dropped " << counters.overruns << L" of " << counters.acquired << L" sweeps; try a larger /buffer:N." << std::endl;
+    return EXIT_SUCCESS;
+}
@@ -7,9 +7,12 @@ using namespace cuterf;
 int wmain(int argc, wchar_t** argv) 
 {
     bool show_usage = false;
+    bool stats = false;
     int usage_status = EXIT_SUCCESS;
     std::wstring screenshot_path;
     int scale = 1;
+    png_speed speed = png_speed::balanced;
+    nanovna::transfer mode = nanovna::transfer::text;
     for (size_t argn = 1; argn < (size_t)argc; argn++) {
         if (!wcscmp(argv[argn], L"/?")) {
             show_usage = true;
@@ -27,6 +30,14 @@ int wmain(int argc, wchar_t** argv)
                 usage_status = EXIT_FAILURE;
                 break;
             }
+        } else if (!wcscmp(argv[argn], L"/sweep")) {
+            mode = nanovna::transfer::binary;
+        } else if (!wcscmp(argv[argn], L"/fast")) {
+            speed = png_speed::fast;
+        } else if (!wcscmp(argv[argn], L"/small")) {
+            speed = png_speed::small;
+        } else if (!wcscmp(argv[argn], L"/stats")) {
+            stats = true;
         } else if (wcscmp(argv[argn], L"/") && screenshot_path.empty()) {
             screenshot_path = argv[argn];
         } else {
@@ -44,34 +55,43 @@ int wmain(int argc, wchar_t** argv)
         std::wcerr << L"Options:" << std::endl;
         std::wcerr << "\t/?\t\tShow program usage." << std::endl;
         std::wcerr << "\t/scale:N, /xN\tEnlarge image by factor of N (1 <= N <= 4)." << std::endl;
+        std::wcerr << "\t/sweep\t\tEmbed data from a new sweep read with a binary transfer, instead" << std::endl;
+        std::wcerr << "\t\t\tof the trace displayed on screen. The image shows the screen" << std::endl;
+        std::wcerr << "\t\t\tbefore that sweep, so the data may not match it." << std::endl;
+        std::wcerr << "\t/fast\t\tCompress the image quickly rather than well." << std::endl;
+        std::wcerr << "\t/small\t\tCompress the image as well as possible, taking longer." << std::endl;
+        std::wcerr << "\t/stats\t\tPrint the latency and transfer statistics of each command." << std::endl;
         return usage_status;
     }
     if (screenshot_path.empty())
         screenshot_path = L"NanoVNA_Screenshot_" + current_date_time_for_filename() + L".png";
 
-    std::string screen_raw_data, source, creation_time, touchstone;
-    size_t screen_width, screen_height;
+    std::string source, creation_time;
+    png_ztxt_sink touchstone("Touchstone");
+    screenshot screen;
     try {
         nanovna::device device;
+        device.enable_stats(stats);
         if (!device.open()) {
             std::wcerr << L"Cannot find a connected NanoVNA!" << std::endl;
             return EXIT_FAILURE;
         }
         std::wcerr << "Found NanoVNA at '" << device.path() << L"'" << std::endl;
-        screen_raw_data = device.capture_screenshot(screen_width, screen_height);
         source = device.board_name() + " (firmware " + device.firmware_info() + ")";
         creation_time = device.timestamp();
-        touchstone = device.capture_touchstone(2);
+        device.capture_touchstone(touchstone, 2, mode, &screen);
+        if (stats)
+            print_command_stats(device.stats());
     } catch (const std::runtime_error &e) {
         std::wcerr << L"Failed to read screenshot from NanoVNA: " << e.what() << std::endl;
         return EXIT_FAILURE;
     }
 
-    rgb565_pixmap pixmap(screen_width, screen_height);
-    pixmap.read_from_capture(screen_raw_data);
+    rgb565_pixmap pixmap(screen.width, screen.height);
+    pixmap.read_from_capture(screen.data);
     creation_time[4] = ':'; // PNG uses YYYY:mm:dd HH:MM
     creation_time[7] = ':';
-    if (!pixmap.save_to_png_file(screenshot_path, (unsigned)scale, source, creation_time, "Touchstone", touchstone)) {
+    if (!pixmap.save_to_png_file(screenshot_path, (unsigned)scale, source, creation_time, &touchstone, speed)) {
         std::wcerr << L"Failed to write screenshot to '" << screenshot_path << L"'!" << std::endl;
         return EXIT_FAILURE;
     }
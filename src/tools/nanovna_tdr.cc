@@ -0,0 +1,144 @@
+#include <cmath>
+#include <cuterf.h>
+#include "common.h"
+
+using namespace cuterf;
+
+static bool read_file(const std::wstring &path, std::string &data)
+{
+    FILE *f = _wfopen(path.c_str(), L"rb");
+    if (!f)
+        return false;
+    data.clear();
+    char buffer[65536];
+    size_t count;
+    while ((count = fread(buffer, 1, sizeof(buffer), f)) != 0)
+        data.append(buffer, count);
+    bool result = !ferror(f);
+    fclose(f);
+    return result;
+}
+
+int wmain(int argc, wchar_t** argv)
+{
+    bool show_usage = false;
+    bool stats = false;
+    int usage_status = EXIT_SUCCESS;
+    std::wstring input_path;
+    tdr::options opts;
+    tdr::parameter which = tdr::parameter::s11;
+    double velocity_factor = 0.66;
+    for (size_t argn = 1; argn < (size_t)argc; argn++) {
+        if (!wcscmp(argv[argn], L"/?")) {
+            show_usage = true;
+            break;
+        } else if (!wcscmp(argv[argn], L"/s21")) {
+            which = tdr::parameter::s21;
+        } else if (!wcscmp(argv[argn], L"/impulse")) {
+            opts.mode = tdr::mode::lowpass_impulse;
+        } else if (!wcscmp(argv[argn], L"/step")) {
+            opts.mode = tdr::mode::lowpass_step;
+        } else if (!wcscmp(argv[argn], L"/bandpass")) {
+            opts.mode = tdr::mode::bandpass;
+        } else if (!wcscmp(argv[argn], L"/rectangular")) {
+            opts.window = tdr::window::rectangular;
+        } else if (!wcscmp(argv[argn], L"/hann")) {
+            opts.window = tdr::window::hann;
+        } else if (!wcsncmp(argv[argn], L"/kaiser:", 8)) {
+            wchar_t *szBetaEnd;
+            opts.window = tdr::window::kaiser;
+            opts.kaiser_beta = (float)wcstod(&argv[argn][8], &szBetaEnd);
+            if (*szBetaEnd != L'\0' || !(opts.kaiser_beta >= 0 && opts.kaiser_beta <= 50)) {
+                std::wcerr << L"Kaiser window beta should be between 0 and 50!" << std::endl;
+                show_usage = true;
+                usage_status = EXIT_FAILURE;
+                break;
+            }
+        } else if (!wcsncmp(argv[argn], L"/vf:", 4)) {
+            wchar_t *szFactorEnd;
+            velocity_factor = wcstod(&argv[argn][4], &szFactorEnd);
+            if (*szFactorEnd != L'\0' || !(velocity_factor > 0 && velocity_factor <= 1)) {
+                std::wcerr << L"Velocity factor should be greater than 0 and at most 1!" << std::endl;
+                show_usage = true;
+                usage_status = EXIT_FAILURE;
+                break;
+            }
+        } else if (!wcscmp(argv[argn], L"/stats")) {
+            stats = true;
+        } else if (wcscmp(argv[argn], L"/") && input_path.empty()) {
+            input_path = argv[argn];
+        } else {
+            std::wcerr << L"Unrecognized argument '" << argv[argn] << "'!" << std::endl;
+            show_usage = true;
+            usage_status = EXIT_FAILURE;
+        }
+    }
+    if (show_usage) {
+        std::wcerr << L"Usage: nanovna_tdr.exe [options] [filename.s1p,s2p]" << std::endl;
+        std::wcerr << std::endl;
+        std::wcerr << L"Transforms a sweep to the time domain and writes the response to standard output" << std::endl;
+        std::wcerr << L"as CSV, with the time in ns and the distance in m. Reads a Touchstone file, or" << std::endl;
+        std::wcerr << L"sweeps the span displayed on screen if no filename is given. Lowpass modes need a" << std::endl;
+        std::wcerr << L"sweep that starts at its frequency step, e.g. 101 points from 1 MHz to 101 MHz." << std::endl;
+        std::wcerr << std::endl;
+        std::wcerr << L"Options:" << std::endl;
+        std::wcerr << "\t/?\t\tShow program usage." << std::endl;
+        std::wcerr << "\t/s21\t\tTransform S21 (transmission) instead of S11 (reflection)." << std::endl;
+        std::wcerr << "\t/step\t\tWrite the lowpass step response. Default." << std::endl;
+        std::wcerr << "\t/impulse\tWrite the lowpass impulse response." << std::endl;
+        std::wcerr << "\t/bandpass\tWrite the magnitude of the bandpass impulse response." << std::endl;
+        std::wcerr << "\t/rectangular\tDo not window the sweep." << std::endl;
+        std::wcerr << "\t/hann\t\tUse a Hann window." << std::endl;
+        std::wcerr << "\t/kaiser:N\tUse a Kaiser window with beta N (default 6)." << std::endl;
+        std::wcerr << "\t/vf:N\t\tVelocity factor of the line (default 0.66)." << std::endl;
+        std::wcerr << "\t/stats\t\tPrint the latency and transfer statistics of each command when sweeping." << std::endl;
+        return usage_status;
+    }
+
+    std::vector<nanovna::point> points;
+    if (!input_path.empty()) {
+        std::string text;
+        if (!read_file(input_path, text)) {
+            std::wcerr << L"Failed to read '" << input_path << L"'!" << std::endl;
+            return EXIT_FAILURE;
+        }
+        touchstone::document document = touchstone::parse(text);
+        if (which == tdr::parameter::s21 && document.ports != 2) {
+            std::wcerr << L"'" << input_path << L"' has no S21 data!" << std::endl;
+            return EXIT_FAILURE;
+        }
+        points = std::move(document.points);
+    } else {
+        try {
+            nanovna::device device;
+            device.enable_stats(stats);
+            if (!device.open()) {
+                std::wcerr << L"Cannot find a connected NanoVNA!" << std::endl;
+                return EXIT_FAILURE;
+            }
+            std::wcerr << "Found NanoVNA at '" << device.path() << L"'" << std::endl;
+            points = device.capture_data(which == tdr::parameter::s21 ? 2 : 1);
+            if (stats)
+                print_command_stats(device.stats());
+        } catch (const std::runtime_error &e) {
+            std::wcerr << L"Failed to read data from NanoVNA: " << e.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    tdr::response response;
+    try {
+        tdr::plan plan(points.size(), opts);
+        plan.transform(points, which, response);
+    } catch (const std::exception &e) {
+        std::wcerr << L"Failed to transform sweep: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    printf("time_ns,distance_m,value\n");
+    for (size_t idx = 0; idx < response.values.size(); idx++) {
+        double time = idx * response.time_step;
+        printf("%.4f,%.4f,%+.6f\n", time * 1e9, tdr::distance(time, velocity_factor, which), response.values[idx]);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,423 @@
+#ifndef TOOLS_PIXMAP_H
+#define TOOLS_PIXMAP_H
+
+#include <csetjmp>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <png.h>
+#include <zlib.h>
+#include <cuterf.h>
+#include "compat.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define PIXMAP_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define PIXMAP_SSE2
+#endif
+
+static const std::string SOFTWARE_NAME = "https://github.com/VioletEternity/cuterf-tools";
+
+// Compresses text for a PNG zTXt chunk as it is written, so that the uncompressed text
+// never has to be held in memory.
+class png_ztxt_sink : public cuterf::touchstone::sink
+{
+private:
+    z_stream m_stream;
+    std::string m_chunk; // keyword, NUL, compression method, zlib stream
+    bool m_finished;
+
+    void deflate_into_chunk(const char *data, size_t size, int flush)
+    {
+        m_stream.next_in = (Bytef *)data;
+        m_stream.avail_in = (uInt)size;
+        do {
+            char output[16384];
+            m_stream.next_out = (Bytef *)output;
+            m_stream.avail_out = sizeof(output);
+            if (deflate(&m_stream, flush) == Z_STREAM_ERROR)
+                throw std::runtime_error("failed to compress PNG text!");
+            m_chunk.append(output, sizeof(output) - m_stream.avail_out);
+        } while (m_stream.avail_out == 0);
+    }
+
+public:
+    explicit png_ztxt_sink(const std::string &keyword) : m_finished(false)
+    {
+        memset(&m_stream, 0, sizeof(m_stream));
+        if (deflateInit(&m_stream, Z_DEFAULT_COMPRESSION) != Z_OK)
+            throw std::runtime_error("failed to initialize zlib!");
+        m_chunk = keyword;
+        m_chunk.push_back('\0');
+        m_chunk.push_back(PNG_COMPRESSION_TYPE_BASE);
+    }
+
+    ~png_ztxt_sink()
+    {
+        deflateEnd(&m_stream);
+    }
+
+    void write(const char *data, size_t size) override
+    {
+        deflate_into_chunk(data, size, Z_NO_FLUSH);
+    }
+
+    // Returns the chunk data, ready to be passed to png_write_chunk().
+    const std::string &finish()
+    {
+        if (!m_finished)
+            deflate_into_chunk(NULL, 0, Z_FINISH);
+        m_finished = true;
+        return m_chunk;
+    }
+};
+
+// The conversion kernels below expand each 5- or 6-bit channel to 8 bits as
+// (x6 * 259 + 33) >> 6, where a 5-bit channel is first doubled to 6 bits. This equals
+// round(x6 * 255 / 63) for every input, i.e. the lookup table the tools have always used,
+// and it fits in 16-bit lanes.
+
+// Bytes that the kernels may store past the end of an RGB24 row.
+static const size_t RGB24_ROW_SLACK = 4;
+
+// Converts big-endian RGB565 bytes to native pixels.
+inline void rgb565_from_big_endian(const uint8_t *src, uint16_t *dst, size_t count)
+{
+    size_t idx = 0;
+#if defined(PIXMAP_AVX2)
+    for (; idx + 16 <= count; idx += 16) {
+        __m256i p = _mm256_loadu_si256((const __m256i *)&src[2 * idx]);
+        _mm256_storeu_si256((__m256i *)&dst[idx], _mm256_or_si256(_mm256_slli_epi16(p, 8), _mm256_srli_epi16(p, 8)));
+    }
+#elif defined(PIXMAP_SSE2)
+    for (; idx + 8 <= count; idx += 8) {
+        __m128i p = _mm_loadu_si128((const __m128i *)&src[2 * idx]);
+        _mm_storeu_si128((__m128i *)&dst[idx], _mm_or_si128(_mm_slli_epi16(p, 8), _mm_srli_epi16(p, 8)));
+    }
+#endif
+    for (; idx < count; idx++)
+        dst[idx] = (uint16_t)((src[2 * idx] << 8) | src[2 * idx + 1]);
+}
+
+// Converts native RGB565 pixels to RGB24; `dst` must have RGB24_ROW_SLACK spare bytes.
+inline void rgb565_to_rgb24(const uint16_t *src, uint8_t *dst, size_t count)
+{
+    size_t idx = 0;
+#if defined(PIXMAP_AVX2)
+    const __m256i mask6 = _mm256_set1_epi32(0x3f), mask5 = _mm256_set1_epi32(0x3e);
+    const __m256i mul = _mm256_set1_epi32(259), bias = _mm256_set1_epi32(33);
+    // packs the low three bytes of each 32-bit lane into the first 12 bytes of each half
+    const __m256i pack = _mm256_setr_epi8(
+        0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+        0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    for (; idx + 8 <= count; idx += 8) {
+        __m256i p = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)&src[idx]));
+        __m256i r = _mm256_and_si256(_mm256_srli_epi32(p, 10), mask5);
+        __m256i g = _mm256_and_si256(_mm256_srli_epi32(p, 5), mask6);
+        __m256i b = _mm256_and_si256(_mm256_slli_epi32(p, 1), mask5);
+        r = _mm256_srli_epi32(_mm256_add_epi32(_mm256_mullo_epi16(r, mul), bias), 6);
+        g = _mm256_srli_epi32(_mm256_add_epi32(_mm256_mullo_epi16(g, mul), bias), 6);
+        b = _mm256_srli_epi32(_mm256_add_epi32(_mm256_mullo_epi16(b, mul), bias), 6);
+        __m256i rgb = _mm256_or_si256(r, _mm256_or_si256(_mm256_slli_epi32(g, 8), _mm256_slli_epi32(b, 16)));
+        rgb = _mm256_shuffle_epi8(rgb, pack);
+        _mm_storeu_si128((__m128i *)&dst[3 * idx], _mm256_castsi256_si128(rgb));
+        _mm_storeu_si128((__m128i *)&dst[3 * idx + 12], _mm256_extracti128_si256(rgb, 1));
+    }
+#elif defined(PIXMAP_SSE2)
+    const __m128i mask6 = _mm_set1_epi16(0x3f), mask5 = _mm_set1_epi16(0x3e);
+    const __m128i mul = _mm_set1_epi16(259), bias = _mm_set1_epi16(33);
+    const __m128i low_pixel = _mm_set_epi32(0, 0xffffff, 0, 0xffffff);
+    const __m128i high_pixel = _mm_set_epi32(0xffffff, 0, 0xffffff, 0);
+    for (; idx + 8 <= count; idx += 8) {
+        __m128i p = _mm_loadu_si128((const __m128i *)&src[idx]);
+        __m128i r = _mm_and_si128(_mm_srli_epi16(p, 10), mask5);
+        __m128i g = _mm_and_si128(_mm_srli_epi16(p, 5), mask6);
+        __m128i b = _mm_and_si128(_mm_slli_epi16(p, 1), mask5);
+        r = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(r, mul), bias), 6);
+        g = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(g, mul), bias), 6);
+        b = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(b, mul), bias), 6);
+        __m128i rg = _mm_or_si128(r, _mm_slli_epi16(g, 8));
+        __m128i halves[2] = { _mm_unpacklo_epi16(rg, b), _mm_unpackhi_epi16(rg, b) };
+        for (unsigned half = 0; half < 2; half++) {
+            // without a byte shuffle, close the gap between the two pixels of each 64-bit
+            // lane, then store the lanes 6 bytes apart
+            __m128i x = halves[half];
+            x = _mm_or_si128(_mm_and_si128(x, low_pixel), _mm_srli_epi64(_mm_and_si128(x, high_pixel), 8));
+            uint8_t *out = &dst[3 * idx + 12 * half];
+            _mm_storel_epi64((__m128i *)out, x);
+            _mm_storel_epi64((__m128i *)(out + 6), _mm_unpackhi_epi64(x, x));
+        }
+    }
+#endif
+    for (; idx < count; idx++) {
+        unsigned p = src[idx];
+        dst[3 * idx + 0] = (uint8_t)((((p >> 10) & 0x3e) * 259 + 33) >> 6);
+        dst[3 * idx + 1] = (uint8_t)((((p >> 5) & 0x3f) * 259 + 33) >> 6);
+        dst[3 * idx + 2] = (uint8_t)((((p << 1) & 0x3e) * 259 + 33) >> 6);
+    }
+}
+
+// Trades PNG encoding time against file size.
+enum class png_speed
+{
+    fast,     // zlib level 1, run-length matching only
+    balanced, // zlib level 6
+    small,    // zlib level 9
+};
+
+struct rgb565_pixmap
+{
+    typedef uint16_t pixel;
+
+    const size_t width, height;
+    std::unique_ptr<pixel[]> data;
+
+    rgb565_pixmap(size_t width, size_t height) :
+        width(width), height(height), data(new pixel[width * height])
+    {}
+
+    // Bytes needed to hold a row converted by convert_row().
+    size_t row_buffer_size(unsigned scale) const
+    {
+        return 3 * width * scale + RGB24_ROW_SLACK;
+    }
+
+    // Converts a row to RGB24, enlarged horizontally by `scale`; `scratch` holds width * scale
+    // pixels, and is unused when `scale` is 1. Vertical scaling is left to the caller, which
+    // can just repeat the row.
+    void convert_row(size_t row, unsigned scale, pixel *scratch, uint8_t *rgb24) const
+    {
+        const pixel *src = &data[width * row];
+        if (scale > 1) {
+            for (size_t column = 0; column < width; column++) {
+                for (unsigned xrepeat = 0; xrepeat < scale; xrepeat++)
+                    scratch[column * scale + xrepeat] = src[column];
+            }
+            src = scratch;
+        }
+        rgb565_to_rgb24(src, rgb24, width * scale);
+    }
+
+    // Finds the distinct colors of the image, if there are at most 256 of them, and maps each
+    // pixel value to its palette index in `indices`, which has 65536 entries.
+    bool find_palette(std::vector<pixel> &palette, std::vector<uint8_t> &indices) const
+    {
+        std::vector<bool> seen(65536);
+        palette.clear();
+        indices.assign(65536, 0);
+        pixel previous = data[0];
+        seen[previous] = true;
+        palette.push_back(previous);
+        for (size_t idx = 1; idx < width * height; idx++) {
+            // screens are mostly runs of the same color
+            pixel current = data[idx];
+            if (current == previous)
+                continue;
+            previous = current;
+            if (seen[current])
+                continue;
+            if (palette.size() == 256)
+                return false;
+            seen[current] = true;
+            indices[current] = (uint8_t)palette.size();
+            palette.push_back(current);
+        }
+        return true;
+    }
+
+    // Converts a row to palette indices of `bit_depth` (4 or 8) bits, enlarged horizontally
+    // by `scale`.
+    void convert_indexed_row(size_t row, unsigned scale, const std::vector<uint8_t> &indices, int bit_depth, uint8_t *out) const
+    {
+        const pixel *src = &data[width * row];
+        if (bit_depth == 8) {
+            for (size_t column = 0; column < width; column++) {
+                uint8_t index = indices[src[column]];
+                for (unsigned xrepeat = 0; xrepeat < scale; xrepeat++)
+                    *out++ = index;
+            }
+            return;
+        }
+        size_t count = 0;
+        for (size_t column = 0; column < width; column++) {
+            uint8_t index = indices[src[column]];
+            for (unsigned xrepeat = 0; xrepeat < scale; xrepeat++, count++) {
+                if (count % 2 == 0)
+                    out[count / 2] = (uint8_t)(index << 4);
+                else
+                    out[count / 2] |= index;
+            }
+        }
+    }
+
+    std::vector<uint8_t> to_rgb24(unsigned scale) const
+    {
+        size_t row_size = 3 * width * scale;
+        std::vector<pixel> scratch(width * scale);
+        std::vector<uint8_t> rgb24_data(row_size * height * scale + RGB24_ROW_SLACK);
+        for (size_t row = 0; row < height; row++) {
+            uint8_t *first = &rgb24_data[row_size * scale * row];
+            convert_row(row, scale, &scratch[0], first);
+            for (unsigned yrepeat = 1; yrepeat < scale; yrepeat++)
+                memcpy(first + row_size * yrepeat, first, row_size);
+        }
+        rgb24_data.resize(row_size * height * scale);
+        return rgb24_data;
+    }
+
+    void read_from_capture(const std::string &raw_data)
+    {
+        if (raw_data.size() != width * height * sizeof(pixel))
+            throw std::runtime_error("raw capture data has wrong size!");
+        rgb565_from_big_endian((const uint8_t *)raw_data.data(), &data[0], width * height);
+    }
+
+    // Draws a region received while mirroring; returns whether any pixel changed.
+    bool apply_region(const cuterf::screen_region &region)
+    {
+        if (region.x + region.width > width || region.y + region.height > height)
+            throw std::runtime_error("screen region is out of bounds!");
+        if (region.data.size() != (region.fill ? 2 : 2 * region.width * region.height))
+            throw std::runtime_error("screen region data has wrong size!");
+
+        bool changed = false;
+        pixel fill_pixel = 0;
+        std::vector<pixel> row_pixels(region.width);
+        if (region.fill) {
+            rgb565_from_big_endian((const uint8_t *)region.data.data(), &fill_pixel, 1);
+            row_pixels.assign(region.width, fill_pixel);
+        }
+        for (size_t row = 0; row < region.height; row++) {
+            if (!region.fill)
+                rgb565_from_big_endian((const uint8_t *)&region.data[2 * region.width * row], &row_pixels[0], region.width);
+            pixel *target = &data[width * (region.y + row) + region.x];
+            if (memcmp(target, &row_pixels[0], region.width * sizeof(pixel))) {
+                memcpy(target, &row_pixels[0], region.width * sizeof(pixel));
+                changed = true;
+            }
+        }
+        return changed;
+    }
+
+    // Rows are converted and handed to libpng one at a time, so only a single scaled row is
+    // ever held in memory. Images with at most 256 colors, which screenshots always are, are
+    // written with an exact palette, at 4 bits per pixel if 16 colors suffice.
+    bool save_to_png_file(const std::wstring &path, unsigned scale, const std::string &source, const std::string &creation_time, png_ztxt_sink *extra = NULL, png_speed speed = png_speed::balanced) const
+    {
+        FILE *file = NULL;
+        png_structp png = NULL;
+        png_infop info = NULL;
+        std::vector<pixel> scratch(width * scale);
+        std::vector<uint8_t> row_data(row_buffer_size(scale));
+        std::vector<pixel> palette;
+        std::vector<uint8_t> indices;
+        bool indexed = find_palette(palette, indices);
+        int bit_depth = !indexed ? 8 : palette.size() <= 16 ? 4 : 8;
+        uint8_t palette_rgb24[3 * 256 + RGB24_ROW_SLACK];
+        png_color colors[256];
+        png_text texts[3];
+        size_t text_count = 0;
+        bool result = false;
+
+        file = _wfopen(path.c_str(), L"wb");
+        if (file == NULL)
+            goto done;
+
+        png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+        if (png == NULL)
+            goto done;
+
+        info = png_create_info_struct(png);
+        if (info == NULL)
+            goto done;
+
+        if (setjmp(png_jmpbuf(png)))
+            goto done;
+
+        png_set_IHDR(png, info,
+            width * scale,
+            height * scale,
+            bit_depth, indexed ? PNG_COLOR_TYPE_PALETTE : PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE,
+            PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+        if (indexed) {
+            rgb565_to_rgb24(&palette[0], palette_rgb24, palette.size());
+            for (size_t idx = 0; idx < palette.size(); idx++) {
+                colors[idx].red = palette_rgb24[3 * idx + 0];
+                colors[idx].green = palette_rgb24[3 * idx + 1];
+                colors[idx].blue = palette_rgb24[3 * idx + 2];
+            }
+            png_set_PLTE(png, info, colors, (int)palette.size());
+        }
+
+        // Filters do not help indexed images, and trying every filter on each row is most of
+        // the cost of fast compression of RGB images, which are mostly flat areas where the
+        // Sub filter does well.
+        switch (speed) {
+        case png_speed::fast:
+            png_set_compression_level(png, 1);
+            png_set_compression_strategy(png, Z_RLE);
+            png_set_filter(png, PNG_FILTER_TYPE_BASE, indexed ? PNG_FILTER_NONE : PNG_FILTER_SUB);
+            break;
+        case png_speed::balanced:
+            png_set_compression_level(png, 6);
+            if (indexed)
+                png_set_filter(png, PNG_FILTER_TYPE_BASE, PNG_FILTER_NONE);
+            break;
+        case png_speed::small:
+            png_set_compression_level(png, 9);
+            png_set_filter(png, PNG_FILTER_TYPE_BASE, indexed ? PNG_FILTER_NONE : PNG_ALL_FILTERS);
+            break;
+        }
+
+        texts[text_count].key = const_cast<png_charp>("Software");
+        texts[text_count].compression = PNG_TEXT_COMPRESSION_NONE;
+        texts[text_count].text = const_cast<png_charp>(SOFTWARE_NAME.c_str());
+        texts[text_count++].text_length = SOFTWARE_NAME.length();
+        if (!source.empty()) {
+            texts[text_count].key = const_cast<png_charp>("Source");
+            texts[text_count].compression = PNG_TEXT_COMPRESSION_NONE;
+            texts[text_count].text = const_cast<png_charp>(source.c_str());
+            texts[text_count++].text_length = source.length();
+        }
+        if (!creation_time.empty()) {
+            texts[text_count].key = const_cast<png_charp>("Creation Time");
+            texts[text_count].compression = PNG_TEXT_COMPRESSION_NONE;
+            texts[text_count].text = const_cast<png_charp>(creation_time.c_str());
+            texts[text_count++].text_length = creation_time.length();
+        }
+        png_set_text(png, info, texts, text_count);
+
+        png_init_io(png, file);
+        png_write_info(png, info);
+        if (extra != NULL) {
+            // already compressed; goes before IDAT, like the text chunks above
+            const std::string &chunk = extra->finish();
+            png_write_chunk(png, (png_const_bytep)"zTXt", (png_const_bytep)chunk.data(), chunk.size());
+        }
+        for (size_t row = 0; row < height; row++) {
+            if (indexed)
+                convert_indexed_row(row, scale, indices, bit_depth, &row_data[0]);
+            else
+                convert_row(row, scale, &scratch[0], &row_data[0]);
+            for (unsigned yrepeat = 0; yrepeat < scale; yrepeat++)
+                png_write_row(png, &row_data[0]);
+        }
+        png_write_end(png, info);
+        result = true;
+
+    done:
+        if (png != NULL)
+            png_destroy_write_struct(&png, &info);
+        if (file != NULL)
+            fclose(file);
+        return result;
+    }
+};
+
+#endif // TOOLS_PIXMAP_H
@@ -0,0 +1,111 @@
+#include <cuterf.h>
+#include "common.h"
+
+using namespace cuterf;
+
+bool save_trace_to_file(const std::wstring &path, const tinysa::trace &data)
+{
+    FILE *f = _wfopen(path.c_str(), L"wt");
+    if (!f)
+        return false;
+    fprintf(f, "freq_hz,level_dbm\n");
+    for (size_t idx = 0; idx < data.freq.size(); idx++)
+        fprintf(f, "%llu,%.2f\n", (unsigned long long)data.freq[idx], data.level[idx]);
+    return fclose(f) == 0;
+}
+
+int wmain(int argc, wchar_t** argv)
+{
+    bool show_usage = false;
+    bool stats = false;
+    int usage_status = EXIT_SUCCESS;
+    std::wstring output_path;
+    tinysa::transfer mode = tinysa::transfer::binary;
+    uint64_t span_start = 0, span_stop = 0;
+    unsigned long points = 0;
+    for (size_t argn = 1; argn < (size_t)argc; argn++) {
+        if (!wcscmp(argv[argn], L"/?")) {
+            show_usage = true;
+            break;
+        } else if (!wcscmp(argv[argn], L"/text")) {
+            mode = tinysa::transfer::text;
+        } else if (!wcsncmp(argv[argn], L"/span:", 6)) {
+            if (!parse_frequency_range(&argv[argn][6], span_start, span_stop) || span_start == span_stop) {
+                std::wcerr << L"Span should be START-STOP, in Hz, kHz (k), MHz (M) or GHz (G)!" << std::endl;
+                show_usage = true;
+                usage_status = EXIT_FAILURE;
+                break;
+            }
+        } else if (!wcsncmp(argv[argn], L"/points:", 8)) {
+            wchar_t *szPointsEnd;
+            points = wcstoul(&argv[argn][8], &szPointsEnd, 10);
+            if (*szPointsEnd != L'\0' || points < 2 || points > 65535) {
+                std::wcerr << L"Point count should be a number between 2 and 65535!" << std::endl;
+                show_usage = true;
+                usage_status = EXIT_FAILURE;
+                break;
+            }
+        } else if (!wcscmp(argv[argn], L"/stats")) {
+            stats = true;
+        } else if (wcscmp(argv[argn], L"/") && output_path.empty()) {
+            output_path = argv[argn];
+        } else {
+            std::wcerr << L"Unrecognized argument '" << argv[argn] << "'!" << std::endl;
+            show_usage = true;
+            usage_status = EXIT_FAILURE;
+        }
+    }
+    if (show_usage) {
+        std::wcerr << L"Usage: tinysa_data.exe [options] [filename.csv]" << std::endl;
+        std::wcerr << std::endl;
+        std::wcerr << L"Captures the trace of the span displayed on screen and writes the frequency in Hz" << std::endl;
+        std::wcerr << L"and level in dBm of each point to a CSV file." << std::endl;
+        std::wcerr << std::endl;
+        std::wcerr << L"Options:" << std::endl;
+        std::wcerr << "\t/?\t\tShow program usage." << std::endl;
+        std::wcerr << "\t/text\t\tRead the trace displayed on screen as text, without initiating a scan." << std::endl;
+        std::wcerr << "\t/span:START-STOP\tScan from START to STOP Hz (suffixes k, M, G) instead of the" << std::endl;
+        std::wcerr << "\t\t\tspan on screen. Requires /points." << std::endl;
+        std::wcerr << "\t/points:N\tScan N points. Requires /span." << std::endl;
+        std::wcerr << "\t/stats\t\tPrint the latency and transfer statistics of each command." << std::endl;
+        return usage_status;
+    }
+    if ((points == 0) != (span_stop == 0)) {
+        std::wcerr << L"Specify both /span and /points for a custom scan!" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (points != 0 && mode == tinysa::transfer::text) {
+        std::wcerr << L"A custom scan cannot be combined with /text!" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (output_path.empty())
+        output_path = L"TinySA_Data_" + current_date_time_for_filename() + L".csv";
+
+    tinysa::trace data;
+    try {
+        tinysa::device device;
+        device.enable_stats(stats);
+        if (!device.open()) {
+            std::wcerr << L"Cannot find a connected TinySA!" << std::endl;
+            return EXIT_FAILURE;
+        }
+        std::wcerr << "Found TinySA at '" << device.path() << L"'" << std::endl;
+        if (points != 0)
+            data = device.capture_trace(span_start, span_stop, (unsigned)points);
+        else
+            data = device.capture_trace(mode);
+        if (stats)
+            print_command_stats(device.stats());
+    } catch (const std::runtime_error &e) {
+        std::wcerr << L"Failed to read data from TinySA: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (!save_trace_to_file(output_path, data)) {
+        std::wcerr << L"Failed to write trace data to '" << output_path << L"'!" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::wcerr << L"Saved " << data.freq.size() << L" points to '" << output_path << L"'" << std::endl;
+    return EXIT_SUCCESS;
+}
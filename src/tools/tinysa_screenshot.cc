@@ -6,9 +6,11 @@ using namespace cuterf;
 int wmain(int argc, wchar_t** argv) 
 {
     bool show_usage = false;
+    bool stats = false;
     int usage_status = EXIT_SUCCESS;
     std::wstring screenshot_path;
     int scale = 1;
+    png_speed speed = png_speed::balanced;
     for (size_t argn = 1; argn < (size_t)argc; argn++) {
         if (!wcscmp(argv[argn], L"/?")) {
             show_usage = true;
@@ -26,6 +28,12 @@ int wmain(int argc, wchar_t** argv)
                 usage_status = EXIT_FAILURE;
                 break;
             }
+        } else if (!wcscmp(argv[argn], L"/fast")) {
+            speed = png_speed::fast;
+        } else if (!wcscmp(argv[argn], L"/small")) {
+            speed = png_speed::small;
+        } else if (!wcscmp(argv[argn], L"/stats")) {
+            stats = true;
         } else if (wcscmp(argv[argn], L"/") && screenshot_path.empty()) {
             screenshot_path = argv[argn];
         } else {
@@ -42,6 +50,9 @@ int wmain(int argc, wchar_t** argv)
         std::wcerr << L"Options:" << std::endl;
         std::wcerr << "\t/?\t\tShow program usage." << std::endl;
         std::wcerr << "\t/scale:N, /xN\tEnlarge image by factor of N (1 <= N <= 4)." << std::endl;
+        std::wcerr << "\t/fast\t\tCompress the image quickly rather than well." << std::endl;
+        std::wcerr << "\t/small\t\tCompress the image as well as possible, taking longer." << std::endl;
+        std::wcerr << "\t/stats\t\tPrint the latency and transfer statistics of each command." << std::endl;
         return usage_status;
     }
     if (screenshot_path.empty())
@@ -51,6 +62,7 @@ int wmain(int argc, wchar_t** argv)
     size_t screen_width, screen_height;
     try {
         tinysa::device device;
+        device.enable_stats(stats);
         if (!device.open()) {
             std::wcerr << L"Cannot find a connected TinySA!" << std::endl;
             return EXIT_FAILURE;
@@ -59,6 +71,8 @@ int wmain(int argc, wchar_t** argv)
         screen_raw_data = device.capture_screenshot(screen_width, screen_height);
         source = std::string("tinySA ") + (device.is_ultra() ? "Ultra " : "");
         source += "(hardware " + device.hardware_version() + ", firmware " + device.firmware_version() + ")";
+        if (stats)
+            print_command_stats(device.stats());
     } catch (const std::runtime_error &e) {
         std::wcerr << L"Failed to read screenshot from TinySA: " << e.what() << std::endl;
         return EXIT_FAILURE;
@@ -66,7 +80,7 @@ int wmain(int argc, wchar_t** argv)
 
     rgb565_pixmap pixmap(screen_width, screen_height);
     pixmap.read_from_capture(screen_raw_data);
-    if (!pixmap.save_to_png_file(screenshot_path, (unsigned)scale, source, current_date_time_for_metadata())) {
+    if (!pixmap.save_to_png_file(screenshot_path, (unsigned)scale, source, current_date_time_for_metadata(), NULL, speed)) {
         std::wcerr << L"Failed to write screenshot to '" << screenshot_path << L"'!" << std::endl;
         return EXIT_FAILURE;
     }
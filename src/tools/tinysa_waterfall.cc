@@ -0,0 +1,286 @@
+#include <csignal>
+#include <cuterf.h>
+#include "common.h"
+
+using namespace cuterf;
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void handle_interrupt(int)
+{
+    interrupted = 1;
+}
+
+// Parses a duration in seconds, with an optional m, h or d suffix.
+static bool parse_duration(const wchar_t *text, std::chrono::seconds &duration)
+{
+    wchar_t *number_end;
+    unsigned long value = wcstoul(text, &number_end, 10);
+    if (number_end == text)
+        return false;
+    switch (*number_end) {
+    case L'm': value *= 60; number_end++; break;
+    case L'h': value *= 3600; number_end++; break;
+    case L'd': value *= 86400; number_end++; break;
+    case L's': number_end++; break;
+    }
+    if (*number_end != L'\0')
+        return false;
+    duration = std::chrono::seconds(value);
+    return true;
+}
+
+struct render_options
+{
+    std::chrono::seconds last, before; // window length (0 for all) and its distance from the newest row
+    size_t max_rows;
+    waterfall::statistic which;
+    float floor, ceiling;
+};
+
+// Writes the rows of the window to a PNG file, newest at the top. Rows are read from the
+// mapping and converted one at a time, so rendering touches only the rows that are drawn.
+static bool render_to_png_file(const waterfall::reader &source, const waterfall::selection &rows,
+    const render_options &options, const std::wstring &path)
+{
+    const size_t points = source.layout().points;
+    FILE *file = NULL;
+    png_structp png = NULL;
+    png_infop info = NULL;
+    std::vector<uint8_t> row_data(3 * points);
+    bool result = false;
+
+    file = _wfopen(path.c_str(), L"wb");
+    if (file == NULL)
+        goto done;
+
+    png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    if (png == NULL)
+        goto done;
+
+    info = png_create_info_struct(png);
+    if (info == NULL)
+        goto done;
+
+    if (setjmp(png_jmpbuf(png)))
+        goto done;
+
+    png_set_IHDR(png, info, points, rows.count, 8, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE,
+        PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+    png_text text;
+    text.key = const_cast<png_charp>("Software");
+    text.compression = PNG_TEXT_COMPRESSION_NONE;
+    text.text = const_cast<png_charp>(SOFTWARE_NAME.c_str());
+    text.text_length = SOFTWARE_NAME.length();
+    png_set_text(png, info, &text, 1);
+
+    png_init_io(png, file);
+    png_write_info(png, info);
+    for (size_t row = rows.first + rows.count; row-- > rows.first; ) {
+        waterfall::render_row(source.row(rows.tier, row), points, options.which, options.floor, options.ceiling,
+            &row_data[0]);
+        png_write_row(png, &row_data[0]);
+    }
+    png_write_end(png, NULL);
+
+    result = true;
+
+done:
+    if (png != NULL)
+        png_destroy_write_struct(&png, &info);
+    if (file != NULL && fclose(file) != 0)
+        result = false;
+    return result;
+}
+
+int render(const std::wstring &input_path, const std::wstring &output_path, const render_options &options)
+{
+    waterfall::reader source;
+    waterfall::selection rows;
+    try {
+        if (!source.open(input_path)) {
+            std::wcerr << L"Failed to open '" << input_path << L"'!" << std::endl;
+            return EXIT_FAILURE;
+        }
+        if (source.rows(0) == 0) {
+            std::wcerr << L"'" << input_path << L"' has no traces yet!" << std::endl;
+            return EXIT_FAILURE;
+        }
+        std::chrono::system_clock::time_point to = source.row(0, source.rows(0) - 1).last - options.before;
+        std::chrono::system_clock::time_point from = options.last.count() != 0 ? to - options.last :
+            std::chrono::system_clock::time_point::min();
+        rows = waterfall::select(source, from, to, options.max_rows);
+        if (rows.count == 0) {
+            std::wcerr << L"No traces were recorded in that time window!" << std::endl;
+            return EXIT_FAILURE;
+        }
+    } catch (const std::exception &e) {
+        std::wcerr << L"Failed to read '" << input_path << L"': " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (!render_to_png_file(source, rows, options, output_path)) {
+        std::wcerr << L"Failed to write waterfall to '" << output_path << L"'!" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    const waterfall::layout &shape = source.layout();
+    waterfall::row_view oldest = source.row(rows.tier, rows.first);
+    waterfall::row_view newest = source.row(rows.tier, rows.first + rows.count - 1);
+    std::wcerr << L"Saved " << rows.count << L" rows of tier " << rows.tier << L" (" << oldest.traces << L" traces each)"
+        << L" to '" << output_path << L"'" << std::endl;
+    std::wcerr << L"Time from " << format_date_time(oldest.first).c_str() << L" to " << format_date_time(newest.last).c_str()
+        << L", frequency from " << shape.start << L" to " << shape.stop << L" Hz" << std::endl;
+    return EXIT_SUCCESS;
+}
+
+int record(const std::wstring &path, waterfall::layout shape, unsigned long count, bool show_stats)
+{
+    signal(SIGINT, handle_interrupt);
+
+    unsigned long traces = 0;
+    std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+    try {
+        tinysa::device device;
+        device.enable_stats(show_stats);
+        if (!device.open()) {
+            std::wcerr << L"Cannot find a connected TinySA!" << std::endl;
+            return EXIT_FAILURE;
+        }
+        std::wcerr << "Found TinySA at '" << device.path() << L"'" << std::endl;
+
+        // the span on screen, at the time recording starts, sets the layout
+        tinysa::trace data = device.capture_trace();
+        shape.points = (unsigned)data.freq.size();
+        shape.start = data.freq.front();
+        shape.stop = data.freq.back();
+        waterfall::recorder recorder;
+        if (!recorder.open(path, shape)) {
+            std::wcerr << L"Failed to open '" << path << L"'!" << std::endl;
+            return EXIT_FAILURE;
+        }
+        std::wcerr << L"Recording " << shape.points << L" points from " << shape.start << L" to " << shape.stop
+            << L" Hz to '" << path << L"' (" << shape.file_size() / 1048576 << L" MiB) until interrupted" << std::endl;
+        while (!interrupted && (count == 0 || traces < count)) {
+            recorder.append(std::chrono::system_clock::now(), data);
+            traces++;
+            if (!interrupted && (count == 0 || traces < count))
+                data = device.capture_trace();
+        }
+        if (show_stats)
+            print_command_stats(device.stats());
+    } catch (const std::runtime_error &e) {
+        std::wcerr << L"Failed to record waterfall from TinySA: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    std::wcerr << L"Recorded " << traces << L" traces in " << std::fixed << std::setprecision(1) << seconds
+        << L" s (" << traces / seconds << L" traces/s)" << std::endl;
+    return EXIT_SUCCESS;
+}
+
+int wmain(int argc, wchar_t** argv)
+{
+    bool show_usage = false;
+    bool stats = false;
+    int usage_status = EXIT_SUCCESS;
+    std::wstring path, render_path;
+    waterfall::layout shape;
+    unsigned long count = 0;
+    render_options options = { std::chrono::seconds(0), std::chrono::seconds(0), 1024, waterfall::statistic::max,
+        -110.0f, -20.0f };
+    for (size_t argn = 1; argn < (size_t)argc; argn++) {
+        if (!wcscmp(argv[argn], L"/?")) {
+            show_usage = true;
+            break;
+        } else if (!wcsncmp(argv[argn], L"/rows:", 6) || !wcsncmp(argv[argn], L"/tiers:", 7) ||
+                !wcsncmp(argv[argn], L"/factor:", 8) || !wcsncmp(argv[argn], L"/count:", 7) ||
+                !wcsncmp(argv[argn], L"/height:", 8)) {
+            wchar_t *szValue = wcschr(argv[argn], L':') + 1, *szValueEnd;
+            unsigned long value = wcstoul(szValue, &szValueEnd, 10);
+            if (*szValueEnd != L'\0' || *szValue == L'\0') {
+                std::wcerr << L"Row, tier and trace counts should be numbers!" << std::endl;
+                show_usage = true;
+                usage_status = EXIT_FAILURE;
+                break;
+            }
+            switch (argv[argn][1]) {
+            case L'r': shape.rows = (unsigned)value; break;
+            case L't': shape.tiers = (unsigned)value; break;
+            case L'f': shape.factor = (unsigned)value; break;
+            case L'c': count = value; break;
+            case L'h': options.max_rows = value; break;
+            }
+        } else if (!wcsncmp(argv[argn], L"/render:", 8)) {
+            render_path = &argv[argn][8];
+        } else if (!wcsncmp(argv[argn], L"/last:", 6) || !wcsncmp(argv[argn], L"/before:", 8)) {
+            if (!parse_duration(wcschr(argv[argn], L':') + 1, argv[argn][1] == L'l' ? options.last : options.before)) {
+                std::wcerr << L"Durations should be numbers of seconds, or of minutes (m), hours (h) or days (d)!" << std::endl;
+                show_usage = true;
+                usage_status = EXIT_FAILURE;
+                break;
+            }
+        } else if (!wcscmp(argv[argn], L"/min")) {
+            options.which = waterfall::statistic::min;
+        } else if (!wcscmp(argv[argn], L"/mean")) {
+            options.which = waterfall::statistic::mean;
+        } else if (!wcsncmp(argv[argn], L"/range:", 7)) {
+            wchar_t *szFloorEnd, *szCeilingEnd;
+            options.floor = (float)wcstod(&argv[argn][7], &szFloorEnd);
+            options.ceiling = *szFloorEnd == L',' ? (float)wcstod(szFloorEnd + 1, &szCeilingEnd) : 0;
+            if (*szFloorEnd != L',' || *szCeilingEnd != L'\0' || !(options.floor < options.ceiling)) {
+                std::wcerr << L"Level range should be FLOOR,CEILING in dBm!" << std::endl;
+                show_usage = true;
+                usage_status = EXIT_FAILURE;
+                break;
+            }
+        } else if (!wcscmp(argv[argn], L"/stats")) {
+            stats = true;
+        } else if (wcscmp(argv[argn], L"/") && path.empty()) {
+            path = argv[argn];
+        } else {
+            std::wcerr << L"Unrecognized argument '" << argv[argn] << "'!" << std::endl;
+            show_usage = true;
+            usage_status = EXIT_FAILURE;
+        }
+    }
+    if (show_usage) {
+        std::wcerr << L"Usage: tinysa_waterfall.exe [options] [filename.wf]" << std::endl;
+        std::wcerr << std::endl;
+        std::wcerr << L"Records traces of the span displayed on screen into a waterfall file until" << std::endl;
+        std::wcerr << L"interrupted with Ctrl+C, or renders a waterfall file to a PNG image. The file" << std::endl;
+        std::wcerr << L"has a fixed size: it keeps the latest traces, and older ones folded into rows" << std::endl;
+        std::wcerr << L"of their minimum, maximum and mean, each tier folding more traces per row." << std::endl;
+        std::wcerr << std::endl;
+        std::wcerr << L"Options:" << std::endl;
+        std::wcerr << "\t/?\t\tShow program usage." << std::endl;
+        std::wcerr << "\t/rows:N\t\tKeep N rows in each tier (default 4096)." << std::endl;
+        std::wcerr << "\t/tiers:N\tKeep N tiers, from 1 to 8 (default 4)." << std::endl;
+        std::wcerr << "\t/factor:N\tFold N rows of each tier into a row of the next (default 8)." << std::endl;
+        std::wcerr << "\t/count:N\tStop after N traces." << std::endl;
+        std::wcerr << "\t/render:FILE\tRender the waterfall to FILE.png, newest row at the top." << std::endl;
+        std::wcerr << "\t/last:D\t\tRender the last D seconds, or minutes (m), hours (h) or days (d)." << std::endl;
+        std::wcerr << "\t/before:D\tRender the window ending D before the newest trace." << std::endl;
+        std::wcerr << "\t/height:N\tRender at most N rows, from the finest tier that fits (default 1024)." << std::endl;
+        std::wcerr << "\t/min, /mean\tRender the minimum or mean of each row instead of the maximum." << std::endl;
+        std::wcerr << "\t/range:A,B\tRender levels from A dBm (black) to B dBm (white) (default -110,-20)." << std::endl;
+        std::wcerr << "\t/stats\t\tPrint the latency and transfer statistics of each command when recording." << std::endl;
+        return usage_status;
+    }
+    if (path.empty() && !render_path.empty()) {
+        std::wcerr << L"Specify the waterfall file to render!" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (path.empty())
+        path = L"TinySA_Waterfall_" + current_date_time_for_filename() + L".wf";
+
+    if (!render_path.empty())
+        return render(path, render_path, options);
+
+    if (shape.rows < 2 || shape.tiers < 1 || shape.tiers > 8 || shape.factor < 2) {
+        std::wcerr << L"A waterfall needs at least 2 rows, 1 to 8 tiers and a factor of at least 2!" << std::endl;
+        return EXIT_FAILURE;
+    }
+    return record(path, shape, count, stats);
+}